@@ -0,0 +1,156 @@
+#ifndef __AIRTIME_H__
+#define __AIRTIME_H__
+
+/// airtime.hpp
+/// Time on air of a LoRa packet, from the SX127x datasheet: the preamble, then the header and the
+/// payload in symbols of 2^SF / BW seconds, the payload rounded up to whole blocks of the coding rate.
+/// And a token bucket over it, to keep a transmitter within a duty cycle, e.g. the 1% or 10% that
+/// regulations allow in some bands, or whatever share of the channel the car should leave to others.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// RadioHead puts to, from, id and flags in front of every payload it sends
+#define RADIO_HEADER_SIZE 4
+#define DEFAULT_AIRTIME_WINDOW 60000 // the window a duty cycle is averaged over, in ms
+
+namespace wircom
+{
+    struct LoRaModulation
+    {
+        int spreadingFactor = 7;
+        long bandwidth = 125000; // in Hz
+        int codingRate = 5;      // the denominator of the coding rate, 4/5 to 4/8
+        int preambleLength = 8;  // in symbols
+        bool explicitHeader = true;
+        bool crc = true;
+    };
+
+    /// @brief How long a packet of length bytes is on air, in µs, radio header included if the radio adds one.
+    inline std::uint32_t timeOnAir(const LoRaModulation &modulation, std::size_t length)
+    {
+        int sf = modulation.spreadingFactor;
+
+        // symbols of more than 16 ms need the low data rate optimization, which spends two bits a symbol less
+        bool lowDataRate = ((std::uint64_t)1000 << sf) > 16 * (std::uint64_t)modulation.bandwidth;
+        int bitsPerBlock = 4 * (sf - (lowDataRate ? 2 : 0));
+        int payloadBits = 8 * (int)length - 4 * sf + 28 + (modulation.crc ? 16 : 0) - (modulation.explicitHeader ? 0 : 20);
+        int blocks = payloadBits > 0 ? (payloadBits + bitsPerBlock - 1) / bitsPerBlock : 0;
+
+        // in quarter symbols, the preamble ends with 4.25 symbols of sync word
+        std::uint64_t quarterSymbols = 4 * (std::uint64_t)modulation.preambleLength + 17 + 4 * (8 + (std::uint64_t)blocks * modulation.codingRate);
+        return (std::uint32_t)((quarterSymbols * 1000000 << sf) / (4 * (std::uint64_t)modulation.bandwidth));
+    }
+
+    /// AirtimeBudget
+    /// A token bucket of time on air, in µs. It fills at the duty cycle, e.g. 10 ms a second at 1%, and holds
+    /// at most the duty cycle of a window, so a transmitter can burst that much after a quiet spell, but never
+    /// averages more than the duty cycle. Only one thread at a time configures or spends, any thread may look
+    /// at what is available: the level and the time it was taken at are published together, under a sequence
+    /// number, so a reader never pairs the level of one spend() with the time of another.
+    class AirtimeBudget
+    {
+    public:
+        /// @param dutyCycle The share of time on air, 0 or 1 and up for no limit.
+        /// @param window In ms, the bucket holds dutyCycle * window of time on air, and starts out full.
+        void configure(float dutyCycle, std::uint32_t window, std::uint32_t now)
+        {
+            bool enabled = dutyCycle > 0.0f && dutyCycle < 1.0f;
+            float capacity = dutyCycle * window * 1000.0f;
+            this->_enabled = false;
+            this->_dutyCycle = enabled ? dutyCycle : 1.0f;
+            this->_capacity = capacity < INT32_MAX / 2 ? (std::int32_t)capacity : INT32_MAX / 2;
+            this->_publish(this->_capacity, now);
+            this->_enabled = enabled;
+        }
+
+        bool enabled() const { return this->_enabled; }
+        float dutyCycle() const { return this->_dutyCycle; }
+        std::int32_t capacity() const { return this->_capacity; }
+
+        /// @brief The time on air left in the bucket, in µs, negative while in debt.
+        std::int32_t available(std::uint32_t now) const
+        {
+            if (!this->_enabled)
+            {
+                return INT32_MAX;
+            }
+
+            std::int32_t tokens;
+            std::uint32_t updated;
+            this->_snapshot(tokens, updated);
+
+            // a reader that took the time just before the last spend() sees it in the past, which is no refill yet,
+            // rather than a wrapped around, full bucket
+            std::int32_t elapsed = (std::int32_t)(now - updated);
+            std::int64_t level = tokens + (elapsed > 0 ? (std::int64_t)(elapsed * this->_dutyCycle * 1000.0f) : 0);
+            std::int32_t capacity = this->_capacity;
+            return level < capacity ? (std::int32_t)level : capacity;
+        }
+
+        /// @brief Whether a packet of airtime µs fits now. One longer than the whole bucket fits once it is full,
+        /// and leaves it in debt, otherwise it would never go out.
+        bool allows(std::uint32_t airtime, std::uint32_t now) const
+        {
+            std::int32_t capacity = this->_capacity;
+            std::int32_t needed = airtime < (std::uint32_t)capacity ? (std::int32_t)airtime : capacity;
+            return this->available(now) >= needed;
+        }
+
+        /// @brief How long until a packet of airtime µs fits, in ms.
+        std::uint32_t wait(std::uint32_t airtime, std::uint32_t now) const
+        {
+            std::int32_t capacity = this->_capacity;
+            std::int32_t needed = airtime < (std::uint32_t)capacity ? (std::int32_t)airtime : capacity;
+            std::int64_t missing = (std::int64_t)needed - this->available(now);
+            return missing > 0 ? (std::uint32_t)(missing / (this->_dutyCycle * 1000.0f)) + 1 : 0;
+        }
+
+        /// @brief Takes a packet's time on air out of the bucket, whether it fits or not, e.g. for a packet that had to go.
+        void spend(std::uint32_t airtime, std::uint32_t now)
+        {
+            if (!this->_enabled)
+            {
+                return;
+            }
+
+            std::int64_t tokens = (std::int64_t)this->available(now) - airtime;
+            this->_publish(tokens > INT32_MIN / 2 ? (std::int32_t)tokens : INT32_MIN / 2, now);
+        }
+
+    private:
+        std::atomic<bool> _enabled{false};
+        std::atomic<float> _dutyCycle{1.0f};
+        std::atomic<std::int32_t> _capacity{0};
+
+        // odd while _tokens and _updated are being written
+        std::atomic<std::uint32_t> _sequence{0};
+        std::atomic<std::int32_t> _tokens{0};
+        std::atomic<std::uint32_t> _updated{0};
+
+        void _publish(std::int32_t tokens, std::uint32_t updated)
+        {
+            std::uint32_t sequence = this->_sequence.load(std::memory_order_relaxed);
+            this->_sequence.store(sequence + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            this->_tokens.store(tokens, std::memory_order_relaxed);
+            this->_updated.store(updated, std::memory_order_relaxed);
+            this->_sequence.store(sequence + 2, std::memory_order_release);
+        }
+
+        void _snapshot(std::int32_t &tokens, std::uint32_t &updated) const
+        {
+            std::uint32_t sequence;
+            do
+            {
+                sequence = this->_sequence.load(std::memory_order_acquire);
+                tokens = this->_tokens.load(std::memory_order_relaxed);
+                updated = this->_updated.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+            } while ((sequence & 1) != 0 || sequence != this->_sequence.load(std::memory_order_relaxed));
+        }
+    };
+} // namespace wircom
+
+#endif // __AIRTIME_H__
@@ -4,24 +4,127 @@
 #include <string>
 #include "message.hpp"
 #include "com_interface.hpp"
+#include "content_layout.hpp"
+#include "content_registry.hpp"
+#include "delta_codec.hpp"
+#include "lz_codec.hpp"
 
 namespace wircom
 {
+    /// The first payload byte of a data transfer request that controls a stream, see createDataStreamRequest().
+    enum DataStreamCommand
+    {
+        STREAM_SUBSCRIBE = 1,  // subscribe, or renew the subscription
+        STREAM_STOP = 2,       // stop pushing frames
+        STREAM_KEYFRAME = 3,   // send the next frame of a delta encoded stream as a keyframe
+    };
+
+    /// Options of a stream subscription, the last payload byte of a subscribe request.
+    enum DataStreamOption
+    {
+        STREAM_OPTION_DELTA = BIT_FLAG(0), // delta encode the frames, see delta_codec.hpp
+    };
+
+    /// The first payload byte of a switch data rate request negotiated by the link adaptation,
+    /// see ComInterface::enableLinkAdaptation().
+    enum DataRateSwitchPhase
+    {
+        SWITCH_PROPOSE = 1, // switch to this rate, answered at the old one
+        SWITCH_COMMIT = 2,  // sent at the new rate, completes the switch, or checks that both sides are still on it
+    };
+
+// MESSAGE CONTENT STRUCTS
+#pragma region MessageContentStructs
+
+struct MetaContent
+{
+    std::string schemaName;
+    int major;
+    int minor;
+    int patch;
+};
+
+struct DriveContent
+{
+    std::string driveContent;
+};
+
+struct SwitchDataRateContent
+{
+    int bandwidth;
+    int frequency;
+};
+
+struct DataRateSwitchContent
+{
+    DataRateSwitchPhase phase;
+    int spreadingFactor;
+    long bandwidth;
+};
+
+struct DataTransferContent
+{
+    std::vector<std::uint8_t> data;
+};
+
+struct DataStreamContent
+{
+    DataStreamCommand command;
+    std::uint16_t interval;
+    std::uint32_t lease;
+    bool delta;
+};
+
+#pragma endregion
+
+// MESSAGE CONTENT CODECS, the wire format of each struct, see content_layout.hpp
+#pragma region MessageContentCodecs
+
+    // 0: Schema Name Length, 1-: Schema Name, then Major, Minor and Patch, a byte each
+    template <>
+    struct ContentCodec<MetaContent> : LayoutCodec<MetaContent, MSG_CON_META, PrefixedField<&MetaContent::schemaName>,
+                                                   IntField<&MetaContent::major, 1>, IntField<&MetaContent::minor, 1>, IntField<&MetaContent::patch, 1>>
+    {
+    };
+
+    template <>
+    struct ContentCodec<DriveContent> : LayoutCodec<DriveContent, MSG_CON_DRIVE, RemainderField<&DriveContent::driveContent>>
+    {
+    };
+
+    template <>
+    struct ContentCodec<SwitchDataRateContent> : LayoutCodec<SwitchDataRateContent, MSG_CON_SWITCH_DATA_RATE,
+                                                             IntField<&SwitchDataRateContent::bandwidth, 1>, IntField<&SwitchDataRateContent::frequency, 1>>
+    {
+    };
+
+    // 0: Phase, 1: Spreading Factor, 2-5: Bandwidth in Hz, big-endian
+    template <>
+    struct ContentCodec<DataRateSwitchContent> : LayoutCodec<DataRateSwitchContent, MSG_CON_SWITCH_DATA_RATE, IntField<&DataRateSwitchContent::phase, 1>,
+                                                             IntField<&DataRateSwitchContent::spreadingFactor, 1>, IntField<&DataRateSwitchContent::bandwidth, 4>>
+    {
+        static ContentResult<DataRateSwitchContent> decode(const PayloadView &payload)
+        {
+            // the two byte request of createSwitchDataRateMessageRequest() is not a negotiated switch
+            ContentResult<DataRateSwitchContent> result = LayoutCodec::decode(payload);
+            result.success = result.success && (result.content.phase == SWITCH_PROPOSE || result.content.phase == SWITCH_COMMIT);
+            return result;
+        }
+    };
+
+    template <>
+    struct ContentCodec<DataTransferContent> : LayoutCodec<DataTransferContent, MSG_CON_DATA_TRANSFER, RemainderField<&DataTransferContent::data>>
+    {
+    };
+
+#pragma endregion
+
     class MessageBuilder
     {
     public:
         static Message createMetaMessageResponse(std::uint16_t id, std::string schemaName, int major, int minor, int patch)
         {
-            std::vector<std::uint8_t> data;
-            data.push_back(schemaName.size());
-            for (char c : schemaName)
-            {
-                data.push_back(c);
-            }
-            data.push_back(major);
-            data.push_back(minor);
-            data.push_back(patch);
-            return Message(id, MSG_RESPONSE, MSG_CON_META, data);
+            return createContentMessage(id, MSG_RESPONSE, MetaContent{std::move(schemaName), major, minor, patch});
         }
 
         static Message createMetaMessageRequest()
@@ -29,14 +132,34 @@ namespace wircom
             return Message(MSG_REQUEST, MSG_CON_META, std::vector<std::uint8_t>());
         }
 
-        static Message createDriveMessageResponse(std::uint16_t id, const std::string driveContent)
+        /// @param compress Whether to LZ compress the drive file. Receivers using ComInterface decompress it
+        /// before dispatch. It is sent as is if it does not get any smaller.
+        static Message createDriveMessageResponse(std::uint16_t id, const std::string driveContent, bool compress = false)
         {
-            std::vector<std::uint8_t> data;
-            for (char c : driveContent)
+            // the layout of DriveContent is the file as is, so it is copied once, without a DriveContent in between
+            std::vector<std::uint8_t> data(driveContent.begin(), driveContent.end());
+            if (compress)
             {
-                data.push_back(c);
+                std::vector<std::uint8_t> compressed(LzCodec::maxCompressedSize(data.size()));
+                std::size_t size = LzCodec::compress(data.data(), data.size(), compressed.data(), compressed.size());
+                if (size != 0 && size < data.size())
+                {
+                    compressed.resize(size);
+                    Message msg(id, MSG_RESPONSE, MSG_CON_DRIVE, std::move(compressed));
+                    msg.flag.markAsCompressed();
+                    return msg;
+                }
             }
-            return Message(id, MSG_RESPONSE, MSG_CON_DRIVE, data);
+
+            return Message(id, MSG_RESPONSE, MSG_CON_DRIVE, std::move(data));
+        }
+
+        /// @brief A drive file read from source as it is sent, e.g. straight off the SD card, so that it never
+        /// has to fit in memory. It is not compressed.
+        /// @param size The size of the file, in bytes.
+        static Message createDriveMessageResponse(std::uint16_t id, std::size_t size, MessageSource source)
+        {
+            return Message(id, MSG_RESPONSE, MSG_CON_DRIVE, size, std::move(source));
         }
 
         static Message createDriveMessageRequest()
@@ -46,17 +169,19 @@ namespace wircom
 
         static Message createSwitchDataRateMessageRequest(int bandwidth, int frequency)
         {
-            std::vector<std::uint8_t> payload;
-            payload.push_back(bandwidth);
-            payload.push_back(frequency);
-            return Message(MSG_REQUEST, MSG_CON_SWITCH_DATA_RATE, payload);
+            return createContentMessage(MSG_REQUEST, SwitchDataRateContent{bandwidth, frequency});
         }
 
         static Message createSwitchDataRateMessageResponse(std::uint16_t id, bool okay)
         {
-            std::vector<std::uint8_t> data;
-            data.push_back(okay);
-            return Message(id, MSG_RESPONSE, MSG_CON_SWITCH_DATA_RATE, data);
+            return Message(id, MSG_RESPONSE, MSG_CON_SWITCH_DATA_RATE, std::vector<std::uint8_t>{okay});
+        }
+
+        /// @brief A step of a negotiated data rate switch. Unlike createSwitchDataRateMessageRequest(), it carries the
+        /// spreading factor and the whole bandwidth, and is answered with createSwitchDataRateMessageResponse().
+        static Message createDataRateSwitchRequest(DataRateSwitchPhase phase, int spreadingFactor, long bandwidth)
+        {
+            return createContentMessage(MSG_REQUEST, DataRateSwitchContent{phase, spreadingFactor, bandwidth});
         }
 
         static Message createDataTransferMessage(const std::vector<std::uint8_t> &data)
@@ -68,100 +193,146 @@ namespace wircom
         {
             return Message(MSG_REQUEST, MSG_CON_DATA_TRANSFER, std::vector<std::uint8_t>());
         }
-    };
 
-// MESSAGE CONTENT STRUCTS
-#pragma region MessageContentStructs
+        /// @brief Subscribes to data transfer frames pushed by the server, instead of requesting each one.
+        /// Sending it again renews the subscription.
+        /// @param interval The time between frames, in ms. 0 pushes frames as fast as the link allows.
+        /// @param lease How long the server keeps pushing without a renewal, in ms.
+        /// @param delta Whether the frames should be delta encoded, see DeltaEncoder.
+        static Message createDataStreamRequest(std::uint16_t interval, std::uint32_t lease, bool delta = false)
+        {
+            std::vector<std::uint8_t> payload;
+            payload.push_back(STREAM_SUBSCRIBE);
+            payload.push_back((interval >> 8) & 0xFF);
+            payload.push_back(interval & 0xFF);
+            payload.push_back((lease >> 24) & 0xFF);
+            payload.push_back((lease >> 16) & 0xFF);
+            payload.push_back((lease >> 8) & 0xFF);
+            payload.push_back(lease & 0xFF);
+            payload.push_back(delta ? STREAM_OPTION_DELTA : 0);
+            return Message(MSG_REQUEST, MSG_CON_DATA_TRANSFER, payload);
+        }
 
-struct MetaContent
-{
-    std::string schemaName;
-    int major;
-    int minor;
-    int patch;
-};
+        static Message createDataStreamStop()
+        {
+            std::vector<std::uint8_t> payload;
+            payload.push_back(STREAM_STOP);
+            return Message(MSG_REQUEST, MSG_CON_DATA_TRANSFER, payload);
+        }
 
-struct DriveContent
-{
-    std::string driveContent;
-};
+        /// @brief Asks for a keyframe, after a delta encoded stream lost its reference.
+        static Message createKeyframeRequest()
+        {
+            std::vector<std::uint8_t> payload;
+            payload.push_back(STREAM_KEYFRAME);
+            return Message(MSG_REQUEST, MSG_CON_DATA_TRANSFER, payload);
+        }
 
-struct SwitchDataRateContent
-{
-    int bandwidth;
-    int frequency;
-};
+        /// @brief Subscribes to the link statistics of the other side, see ComInterface::subscribeLinkStats().
+        /// Every snapshot answers the latest request, so it carries its ID.
+        /// @param interval The time between snapshots, in ms. 0 asks for a single one.
+        /// @param lease How long the other side keeps pushing without a renewal, in ms. 0 stops the snapshots.
+        static Message createLinkStatsRequest(std::uint16_t interval, std::uint32_t lease)
+        {
+            LinkStatsRequest request;
+            request.interval = interval;
+            request.lease = lease;
+            return createContentMessage(MSG_REQUEST, request);
+        }
 
-struct DataTransferContent
-{
-    std::vector<std::uint8_t> data;
-};
+        static Message createLinkStatsResponse(std::uint16_t id, const LinkStats &stats)
+        {
+            return createContentMessage(id, MSG_RESPONSE, stats);
+        }
 
-#pragma endregion
+        /// @brief A message carrying a struct registered with a ContentCodec, of the content type the codec gives it.
+        template <typename T>
+        static Message createContentMessage(MessageType type, const T &content)
+        {
+            return Message(type, contentTypeOf<T>(), ContentCodec<T>::encode(content));
+        }
 
-    template <typename T>
-    class ContentResult
-    {
-    public:
-        bool success;
-        T content;
+        template <typename T>
+        static Message createContentMessage(std::uint16_t id, MessageType type, const T &content)
+        {
+            return Message(id, type, contentTypeOf<T>(), ContentCodec<T>::encode(content));
+        }
     };
 
+
     class MessageParser
     {
     public:
         static ContentResult<MetaContent> parseMetaContent(const std::vector<std::uint8_t> &data)
         {
-            if (data.size() < 4)
-            {
-                return {false, MetaContent()};
-            }
+            return parseContent<MetaContent>(data);
+        }
 
-            std::string schemaName;
-            int major;
-            int minor;
-            int patch;
+        static ContentResult<DriveContent> parseDriveContent(const std::vector<std::uint8_t> &data)
+        {
+            return parseContent<DriveContent>(data);
+        }
 
-            int schemaNameLength = data[0];
-            for (int i = 1; i <= schemaNameLength; i++)
-            {
-                schemaName.push_back(data[i]);
-            }
+        static ContentResult<SwitchDataRateContent> parseSwitchDataRateContent(const std::vector<std::uint8_t> &data)
+        {
+            return parseContent<SwitchDataRateContent>(data);
+        }
 
-            major = data[schemaNameLength + 1];
-            minor = data[schemaNameLength + 2];
-            patch = data[schemaNameLength + 3];
+        static ContentResult<DataRateSwitchContent> parseDataRateSwitchContent(const std::vector<std::uint8_t> &data)
+        {
+            return parseContent<DataRateSwitchContent>(data);
+        }
 
-            return {true, MetaContent{schemaName, major, minor, patch}};
+        static ContentResult<DataTransferContent> parseDataTransferContent(const std::vector<std::uint8_t> &data)
+        {
+            return parseContent<DataTransferContent>(data);
         }
 
-        static ContentResult<DriveContent> parseDriveContent(const std::vector<std::uint8_t> &data)
+        /// @brief Stream commands differ in length by command, so they are parsed by hand rather than from a layout.
+        static ContentResult<DataStreamContent> parseDataStreamContent(const std::vector<std::uint8_t> &data)
         {
-            std::string driveContent;
-            for (char c : data)
+            if (data.empty())
             {
-                driveContent.push_back(c);
+                // a plain data transfer request, for a single frame
+                return {false, DataStreamContent()};
             }
 
-            return {true, DriveContent{driveContent}};
-        }
+            if (data[0] == STREAM_STOP || data[0] == STREAM_KEYFRAME)
+            {
+                return {true, DataStreamContent{(DataStreamCommand)data[0], 0, 0, false}};
+            }
 
-        static ContentResult<SwitchDataRateContent> parseSwitchDataRateContent(const std::vector<std::uint8_t> &data)
-        {
-            if (data.size() < 2)
+            if (data[0] != STREAM_SUBSCRIBE || data.size() < 7)
             {
-                return {false, SwitchDataRateContent()};
+                return {false, DataStreamContent()};
             }
 
-            int bandwidth = data[0];
-            int frequency = data[1];
+            std::uint16_t interval = (data[1] << 8) | data[2];
+            std::uint32_t lease = ((std::uint32_t)data[3] << 24) | ((std::uint32_t)data[4] << 16) | (data[5] << 8) | data[6];
+            bool delta = data.size() > 7 && (data[7] & STREAM_OPTION_DELTA) != 0;
+            return {true, DataStreamContent{(DataStreamCommand)data[0], interval, lease, delta}};
+        }
 
-            return {true, SwitchDataRateContent{bandwidth, frequency}};
+        static ContentResult<LinkStats> parseLinkStatsContent(const std::vector<std::uint8_t> &data)
+        {
+            return parseContent<LinkStats>(data);
         }
 
-        static ContentResult<DataTransferContent> parseDataTransferContent(const std::vector<std::uint8_t> &data)
+        /// @brief Decodes a struct registered with a ContentCodec, from a vector or straight from a received view.
+        template <typename T>
+        static ContentResult<T> parseContent(const PayloadView &payload)
+        {
+            return ContentCodec<T>::decode(payload);
+        }
+
+        /// @brief Rebuilds a full frame from a frame of a delta encoded stream.
+        /// @param decoder The decoder for the stream, which keeps the last keyframe.
+        /// @return success is false if the stream needs a keyframe, see createKeyframeRequest().
+        static ContentResult<DataTransferContent> parseDataFrame(const std::vector<std::uint8_t> &data, DeltaDecoder &decoder)
         {
-            return {true, DataTransferContent{data}};
+            DataTransferContent content;
+            bool success = decoder.decode(PayloadView(data), content.data);
+            return {success, content};
         }
     };
 }
@@ -169,7 +340,10 @@ struct DataTransferContent
 template class wircom::ContentResult<wircom::MetaContent>;
 template class wircom::ContentResult<wircom::DriveContent>;
 template class wircom::ContentResult<wircom::SwitchDataRateContent>;
+template class wircom::ContentResult<wircom::DataRateSwitchContent>;
 template class wircom::ContentResult<wircom::DataTransferContent>;
+template class wircom::ContentResult<wircom::DataStreamContent>;
+template class wircom::ContentResult<wircom::LinkStats>;
 
 
 #endif // __BUILDER_H__
\ No newline at end of file
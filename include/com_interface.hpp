@@ -1,17 +1,36 @@
-#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
 #ifndef __COM_INTERFACE_H__
 #define __COM_INTERFACE_H__
 
 /// com_interface.hpp
 /// This file contains the interface for communicating using the LoRa module.
-/// It handles basic setup and communication with the LoRa module, and provides
+/// It handles basic setup and communication with the radio, through a Transport, and provides
 /// callback functions for handling received messages.
 
-#include <SPI.h>
-#include <RH_RF95.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <random>
 #include <unordered_map>
 
+#include "airtime.hpp"
+#include "content_registry.hpp"
+#include "delta_codec.hpp"
+#include "dispatch_table.hpp"
+#include "fragment_bitmap.hpp"
+#include "link_adaptation.hpp"
+#include "link_stats.hpp"
 #include "message.hpp"
+#include "mpsc_queue.hpp"
+#include "reassembly.hpp"
+#include "rtt_estimator.hpp"
+#include "spsc_ring.hpp"
+#include "transport.hpp"
+
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+#include <SPI.h>
+#include <RH_RF95.h>
+#include "rf95_transport.hpp"
+#endif
 
 namespace wircom
 {
@@ -19,33 +38,163 @@ namespace wircom
 #define DEFAULT_RFM95_CS 10 // Chip Select pin
 #define DEFAULT_RFM95_RST 2 // Reset pin
 #define DEFAULT_RFM95_INT 3 // Interrupt pin
-#define SEND_TIMEOUT 1000
+#define SEND_TIMEOUT 1000 // initial retransmission timeout, until a round trip has been measured
 #define MAX_RETRIES 20
+#define DEFAULT_SEND_WINDOW 8       // fragments of a long message in flight before waiting for a selective ack
+#define COMPLETED_MESSAGE_HISTORY 8 // reassembled messages remembered, to re-ack their late retransmissions
+#define RX_QUEUE_SIZE 8             // received packets the interrupt can queue up between poll() calls, a power of two
+#define TX_QUEUE_SIZE 16            // packets queued for the radio in event mode before sendMessage() blocks, a power of two
+#define COMMAND_QUEUE_SIZE 32       // messages other threads can queue for the radio owner, a power of two
+#define COMMAND_QUEUE_TIMEOUT 1000  // how long sendMessage() waits for room in a full queue before dropping the message, in ms
+#define DEFAULT_STREAM_LEASE 5000   // how long a data stream subscription lasts without a renewal, in ms
+#define DEFAULT_LINK_STATS_INTERVAL 1000 // time between link statistics pushed to a subscriber, in ms
+#define DEFAULT_BATCH_DEADLINE 20   // how long a short message may wait for others to share its packet, in ms
+#define TX_CONTROL_QUEUE_SIZE 16    // control packets waiting for the radio before queueing one sends the oldest, a power of two
+#ifndef BULK_QUEUE_SIZE
+#define BULK_QUEUE_SIZE 4           // long messages on their way before sendMessage() refuses more
+#endif
+#define RANGE_ACK_HEADER_SIZE 5     // the selective ack of a message with the extended header, see _sendAck()
+#define RANGE_ACK_BITMAP_SIZE (MAX_SHORT_MSG_PAYLOAD_SIZE - CONTENT_TYPE_EXTENSION_SIZE - RANGE_ACK_HEADER_SIZE - PACKET_CRC_SIZE) // so the ack stays short when checked and typed
+#ifndef MAX_DECOMPRESSED_SIZE
+#define MAX_DECOMPRESSED_SIZE 65536 // largest compressed message that is decompressed, in bytes
+#endif
+
+    struct SentMessage
+    {
+        Message message;
+        std::uint32_t timeSent;
+        std::uint8_t retries;
+        std::uint32_t firstSent = 0;
+        std::uint32_t timeout = SEND_TIMEOUT; // retransmission timeout for the next retry, with backoff
+        bool rttSampled = false;
+    };
 
-    enum RadioState
+    /// CompletedMessage
+    /// A long message that was reassembled and dispatched, remembered to re-ack its retransmissions. The peer
+    /// numbers its messages on its own, so the ID alone may be reused by a new message, and only a message
+    /// that also matches in size, type and content type, and comes back within the reassembly timeout, is taken
+    /// for a retransmission.
+    struct CompletedMessage
     {
-        RADIO_STATE_IDLE,
-        RADIO_STATE_RECEIVING,
-        RADIO_STATE_TRANSMITTING
+        std::uint16_t messageID;
+        std::uint16_t packetCount;
+        MessageType messageType;
+        MessageContentType contentType;
+        std::uint32_t lastSeen; // when it completed, or was last retransmitted
     };
 
-    struct SentMessage
+    /// OutgoingTransfer
+    /// A long message being sent with selective-repeat ARQ. Fragments are sent a window at a time,
+    /// the last fragment of each window asks for a selective ack, and only the fragments the receiver
+    /// reports as missing are sent again.
+    struct OutgoingTransfer
     {
         Message message;
+        FragmentBitmap acked;   // fragments the receiver has confirmed
+        std::size_t nextToSend; // the first fragment that has never been sent
         std::uint32_t timeSent;
         std::uint8_t retries;
+        std::uint32_t firstSent = 0;
+        std::uint32_t timeout = SEND_TIMEOUT;
+        std::vector<std::size_t> window; // the fragments of the current window, in the order they go on air
+        std::size_t windowSent = 0;      // how many of them have
+    };
+
+    /// UnackedTransfer
+    /// A long message sent once, without acks, e.g. with FEC over a link with no way back.
+    struct UnackedTransfer
+    {
+        Message message;
+        std::size_t nextToSend;
+    };
+
+    /// TrafficClass
+    /// What the TX scheduler sends first. Control packets, i.e. acks and every short message sent with
+    /// sendMessage(), go out first, in order. Then live telemetry, the frames of a data stream (see
+    /// setDataStreamSource()), of which only the latest waiting frame is kept. Long messages are bulk,
+    /// and go out one fragment at a time whenever nothing else is waiting, so a drive file never holds up
+    /// telemetry for longer than a fragment.
+    enum TrafficClass
+    {
+        TRAFFIC_CONTROL,
+        TRAFFIC_TELEMETRY,
+        TRAFFIC_BULK,
+        TRAFFIC_CLASS_COUNT
+    };
+
+    /// AirtimePolicy
+    /// What happens to messages while the airtime budget is spent, see ComInterface::setAirtimeBudget().
+    enum AirtimePolicy
+    {
+        AIRTIME_DEFER,  // queue them, they go out as the budget refills
+        AIRTIME_REFUSE, // sendMessage() refuses what does not fit the budget right now, what was queued still waits
+    };
+
+    struct TxStats
+    {
+        std::uint32_t sent[TRAFFIC_CLASS_COUNT] = {}; // packets handed to the radio, by class
+        std::uint32_t staleDropped = 0;               // telemetry frames replaced by a newer one before they went out
+    };
+
+    /// DataStream
+    /// The server side of a data stream subscription: which frames to push, and until when.
+    struct DataStream
+    {
+        std::atomic<bool> active{false};
+        std::uint16_t interval = 0;
+        std::uint32_t leaseExpires = 0;
+        std::uint32_t nextFrame = 0;
+        bool answerPending = false; // the next frame answers a subscribe request, so it carries the request's ID
+        bool answerQueued = false;  // the last frame queued for the radio answered one
+        std::uint16_t requestID = 0;
+        bool delta = false;
+        DeltaEncoder encoder;
+    };
+
+    /// RadioCommand
+    /// Work queued for the thread that owns the radio: a message to send, or a data rate switch.
+    struct RadioCommand
+    {
+        Message message;
+        bool ackRequired = true;
+        bool bulk = false; // a long message, counted in _bulkQueued
+        bool switchDataRate = false;
+        int spreadingFactor = 0;
+        long bandwidth = 0;
     };
 
     /// ComInterface
     /// This class provides an interface for communicating with the LoRa module.
+    ///
+    /// sendMessage() and switchDataRate() can be called from any thread. They queue the work on a
+    /// lock-free queue, and whichever thread owns the radio at that moment, i.e. is inside listen(),
+    /// poll() or tick(), does it. Packets go on air by TrafficClass, so the fragments of long messages
+    /// interleave with control and telemetry packets. If no thread owns the radio, the caller takes
+    /// ownership and does the work itself. listen(), poll() and tick() take turns owning the radio. Callbacks run on the owning
+    /// thread. Registering callbacks and changing settings is not thread-safe, do it during setup.
     class ComInterface
     {
     public:
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
         RH_RF95 rf95;
+#endif
         bool ready = false;
 
-        ComInterface() : rf95(DEFAULT_RFM95_CS, DEFAULT_RFM95_INT), _csPin(DEFAULT_RFM95_CS), _resetPin(DEFAULT_RFM95_RST), _interruptPin(DEFAULT_RFM95_INT), _frequency(1575.42), _power(23) {}
-        ComInterface(int csPin, int resetPin, int interruptPin, float frequency, int power) : rf95(csPin, interruptPin), _csPin(csPin), _resetPin(resetPin), _interruptPin(interruptPin), _frequency(frequency), _power(power) {}
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+        ComInterface() : rf95(DEFAULT_RFM95_CS, DEFAULT_RFM95_INT), _rf95Transport(rf95, DEFAULT_RFM95_RST, DEFAULT_RFM95_INT, 1575.42, 23), _transport(&_rf95Transport), _csPin(DEFAULT_RFM95_CS), _interruptPin(DEFAULT_RFM95_INT) {}
+        ComInterface(int csPin, int resetPin, int interruptPin, float frequency, int power) : rf95(csPin, interruptPin), _rf95Transport(rf95, resetPin, interruptPin, frequency, power), _transport(&_rf95Transport), _csPin(csPin), _interruptPin(interruptPin) {}
+#endif
+
+        /// @brief Creates an interface that talks through an arbitrary transport, e.g. a SimulatedTransport.
+        /// @param transport The transport to use, which must outlive this interface.
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+        explicit ComInterface(Transport &transport) : rf95(DEFAULT_RFM95_CS, DEFAULT_RFM95_INT), _rf95Transport(rf95, DEFAULT_RFM95_RST, DEFAULT_RFM95_INT, 1575.42, 23), _transport(&transport) {}
+#else
+        explicit ComInterface(Transport &transport) : _transport(&transport) {}
+#endif
+
+        ComInterface(const ComInterface &) = delete;
+        ComInterface &operator=(const ComInterface &) = delete;
 
         void initialize();
 
@@ -53,34 +202,331 @@ namespace wircom
         /// @param type The message type to add the callback for.
         /// @param callback The callback function to add.
         /// @return this, allowing for chaining of function calls.
-        ComInterface addRXCallback(MessageType messageType, MessageContentType contentType, std::function<void(Message)> callback);
-        ComInterface addRXCallback(MessageType messageType, std::vector<MessageContentType> contentTypes, std::function<void(Message)> callback);
-        ComInterface addRXCallbackToAny(MessageType messageType, std::function<void(Message)> callback);
+        ComInterface &addRXCallback(MessageType messageType, MessageContentType contentType, MessageCallback callback);
+        ComInterface &addRXCallback(MessageType messageType, const std::vector<MessageContentType> &contentTypes, MessageCallback callback);
+        ComInterface &addRXCallbackToAny(MessageType messageType, MessageCallback callback);
+
+        /// @brief Adds a callback that receives a non-owning view of the message, instead of a copy.
+        /// For single packet messages the payload points straight into the radio buffer, so the view
+        /// must not be kept after the callback returns.
+        /// @param messageType The message type to add the callback for.
+        /// @param contentType The content type to add the callback for.
+        /// @param callback The callback function to add.
+        /// @return this, allowing for chaining of function calls.
+        ComInterface &addRXViewCallback(MessageType messageType, MessageContentType contentType, MessageViewCallback callback);
 
+        /// @brief Adds a callback that gets the content of messages decoded as a T, a struct registered with a
+        /// ContentCodec, along with the message ID. The content type and the codec are picked at compile time.
+        /// Messages that do not decode are dropped.
+        /// @return this, allowing for chaining of function calls.
+        template <typename T>
+        ComInterface &addContentCallback(MessageType messageType, std::function<void(std::uint16_t, const T &)> callback)
+        {
+            MessageViewCallback decode = [callback](const MessageView &view)
+            {
+                ContentResult<T> result = ContentCodec<T>::decode(view.payload);
+                if (result.success)
+                {
+                    callback(view.messageID, result.content);
+                }
+            };
+            return this->addRXViewCallback(messageType, contentTypeOf<T>(), std::move(decode));
+        }
+
+        /// @brief Switches the radio to a different data rate, after any messages queued before the call have been sent.
         void switchDataRate(int spreadingFactor, int bandwidth);
 
+        /// @brief Lets the data rate follow the link, see LinkAdaptation. Both sides call it with the same rates, and one
+        /// of them as the initiator. The initiator proposes a switch at the old rate, and once the other side agrees,
+        /// both move to the new rate, where the initiator confirms it. If they do not hear each other there within
+        /// switchTimeout, both go back. If the link goes quiet for silenceTimeout, both fall back to the first rate.
+        /// Do not call switchDataRate() as well. Call after initialize().
+        void enableLinkAdaptation(const LinkAdaptationConfig &config = LinkAdaptationConfig());
+
+        const LinkAdaptation &linkAdaptation() const { return _linkAdaptation; }
+
+        /// @brief Keeps the time on air within a duty cycle, with a token bucket that holds dutyCycle * window of it, see
+        /// AirtimeBudget. While the budget is spent, packets wait in the TX scheduler, in order of their TrafficClass,
+        /// telemetry frames are replaced by newer ones, and retries wait as well. Packets queued before a data rate
+        /// switch, and control packets that overflow their queue, go out regardless and put the budget in debt.
+        /// @param dutyCycle The share of time on air, e.g. 0.01 for 1%. 0 turns the budget off, the default.
+        /// @param policy Whether sendMessage() queues messages past the budget, or refuses them.
+        void setAirtimeBudget(float dutyCycle, std::uint32_t window = DEFAULT_AIRTIME_WINDOW, AirtimePolicy policy = AIRTIME_DEFER);
+
+        const AirtimeBudget &airtimeBudget() const { return _airtimeBudget; }
+
+        /// @brief The modulation packets go out with right now.
+        LoRaModulation modulation() const;
+
+        /// @brief The time on air, in µs, of a data transfer message of payloadSize bytes sent now, all its packets,
+        /// with the integrity check and FEC as they are set.
+        std::uint32_t messageAirtime(std::size_t payloadSize) const;
+
+        /// @brief How many data transfer messages of payloadSize bytes a second fit the airtime budget, or the
+        /// channel if there is none, e.g. to size the frames of a data stream for the update rate it needs. Acks,
+        /// retries and the other side's packets are not counted.
+        float maxFrameRate(std::size_t payloadSize) const;
+
+        /// @brief Messages sendMessage() refused because they did not fit the airtime budget, see AIRTIME_REFUSE.
+        std::uint32_t airtimeRefusals() const { return _airtimeRefusals; }
+
+        /// @brief Sets how many fragments of a long message may be in flight before waiting for a selective ack.
+        void setSendWindow(std::size_t window) { _sendWindow = window > 0 ? window : 1; }
+
+        /// @brief Sends long messages of a content type with forward error correction, see Message::enableFEC().
+        /// While FEC is on, windows of the selective-repeat ARQ are rounded up to whole blocks.
+        /// @param dataFragments The data fragments per block.
+        /// @param parityFragments The parity fragments per block, at most dataFragments. 0 turns FEC off.
+        void setFEC(MessageContentType contentType, std::uint8_t dataFragments, std::uint8_t parityFragments)
+        {
+            _fecData[contentType] = dataFragments;
+            _fecParity[contentType] = parityFragments;
+        }
+
+        /// @brief Sets when to give up on an unacknowledged message.
+        /// @param maxRetries How many times to retransmit, if timeBudget is 0.
+        /// @param timeBudget If non-zero, keep retransmitting until this many ms have passed since the first send instead.
+        void setRetryPolicy(std::uint8_t maxRetries, std::uint32_t timeBudget = 0)
+        {
+            _maxRetries = maxRetries;
+            _retryBudget = timeBudget;
+        }
+
+        /// @brief Switches between the adaptive, RTT based retransmission timeout (the default)
+        /// and a fixed SEND_TIMEOUT without backoff.
+        void setAdaptiveTimeout(bool enabled) { _adaptiveTimeout = enabled; }
+
+        const RttEstimator &rttEstimator() const { return _rtt; }
+        /// @brief Sets how long, in ms, a partially received long message is kept without a new fragment,
+        /// and how many bytes all partially received messages may claim together. See ReassemblyBuffer.
+        void setReassemblyLimits(std::uint32_t timeout, std::size_t byteBudget)
+        {
+            _reassembly.setTimeout(timeout);
+            _reassembly.setByteBudget(byteBudget);
+        }
+
+        /// @brief Resizes the pool long messages are reassembled in, see ReassemblyBuffer::resize(). A slot of
+        /// slotFragments fragments takes slotFragments * MAX_LONG_MSG_PAYLOAD_SIZE bytes, e.g. 4400 fragments
+        /// for a 1 MB session log. Call during setup.
+        void setReassemblyPool(std::size_t slots, std::size_t slotFragments) { _reassembly.resize(slots, slotFragments); }
+
+        const ReassemblyBuffer &reassemblyBuffer() const { return _reassembly; }
+
+        /// @brief Switches to event mode: the radio interrupt queues received packets, sendMessage() queues
+        /// packets for the radio instead of waiting for each one to go out, and poll() does the rest.
+        /// Call after initialize().
+        /// @return false if the transport can only be polled, in which case nothing changes.
+        bool enableEventMode();
+
+        /// @brief Dispatches the packets the interrupt has queued and hands queued packets to the radio.
+        /// Never waits for the radio. Without event mode, it handles whatever packets are available.
+        void poll();
+
+        /// @brief Serves data stream subscriptions, e.g. on the car. While a client is subscribed, source is
+        /// called every subscribed interval from tick(), and each non-empty frame it returns is pushed to
+        /// the client as a data transfer response. Plain data transfer requests still go to the callbacks.
+        void setDataStreamSource(std::function<std::vector<std::uint8_t>()> source) { _streamSource = source; }
+
+        /// @brief Whether a client is currently subscribed to the data stream.
+        bool streaming() const { return _stream.active; }
+
+        /// @brief Subscribes to the data stream of the other side, e.g. from the pit. Frames arrive through the
+        /// data transfer response callbacks, and tick() renews the subscription until unsubscribe() is called.
+        /// @param interval The time between frames, in ms. 0 asks for frames as fast as the link allows.
+        /// @param lease How long the server keeps pushing frames if renewals stop arriving, in ms.
+        /// @param delta Whether the server should delta encode the frames. They are decoded before they reach
+        /// the callbacks, and a keyframe is requested whenever a frame cannot be rebuilt.
+        bool subscribe(std::uint16_t interval, std::uint32_t lease = DEFAULT_STREAM_LEASE, bool delta = false);
+        bool unsubscribe();
+
+        /// @brief Packs short messages, e.g. acks and meta requests, that are sent close together into one packet,
+        /// which saves a preamble and most of a header on air per message. Receivers unpack batches
+        /// transparently, but ones running an older version of this library drop them, so batching is off by default.
+        /// @param flushDeadline How long, in ms, the first message of a batch waits for more to join it.
+        /// 0 turns batching off and sends whatever is waiting.
+        void setBatching(std::uint32_t flushDeadline);
+
+        /// @brief Protects every message sent from here on with CRCs, see Message::enableChecksum(). A corrupt
+        /// packet is dropped before reassembly and recovered like a lost one, and a long message whose CRC-32 does
+        /// not match is dropped before dispatch. Checked messages are always verified, whatever this is set to,
+        /// but receivers running an older version of this library drop them, so the check is off by default.
+        void setIntegrityCheck(bool enabled) { _integrityCheck = enabled; }
+
+        /// @brief Received packets dropped because poll() was not called often enough.
+        std::uint32_t rxOverflows() const { return _rxQueue.overflows(); }
+
+        /// @brief Received packets and reassembled messages dropped because their CRC did not match.
+        std::uint32_t checksumFailures() const { return _linkStats.checksumFailures; }
+
+        /// @brief A copy of the counters and histograms of this side of the link, see LinkStats. Like txStats(),
+        /// read it from the thread that owns the radio, or while none does.
+        LinkStats linkStats() const;
+
+        /// @brief Starts the counters and histograms over, e.g. after tuning a setting, to see its effect alone.
+        void resetLinkStats() { _linkStats = LinkStats(); }
+
+        /// @brief Subscribes to the link statistics of the other side, e.g. from the pit, to see how the link
+        /// looks from the car. Every side serves its statistics, there is nothing to set up on the other end.
+        /// Each snapshot is decoded and handed to callback, then goes on to the callbacks for MSG_CON_LINK_STATS,
+        /// e.g. those of addContentCallback<LinkStats>(). tick() renews the subscription until unsubscribeLinkStats() is called.
+        /// @param interval The time between snapshots, in ms. 0 asks for a single one.
+        /// @param lease How long the other side keeps pushing if renewals stop arriving, in ms.
+        bool subscribeLinkStats(std::function<void(const LinkStats &)> callback, std::uint16_t interval = DEFAULT_LINK_STATS_INTERVAL,
+                                std::uint32_t lease = DEFAULT_STREAM_LEASE);
+        bool unsubscribeLinkStats();
+
+        /// @brief Whether the other side is subscribed to our link statistics.
+        bool streamingLinkStats() const { return _statsStream.active; }
+
         void listen(std::uint16_t timeout = 1000);
-        void sendMessage(Message msg, bool ackRequired = true);
+
+        /// @brief Sends a message, or queues it for the thread that currently owns the radio.
+        /// @return false if the queue stayed full for COMMAND_QUEUE_TIMEOUT ms and the message was dropped,
+        /// or if it is a long message and BULK_QUEUE_SIZE long messages are already on their way. Nothing is
+        /// sent then, try again once one of them is through.
+        bool sendMessage(Message msg, bool ackRequired = true);
+
+        /// @brief Packets sent by TrafficClass, and telemetry frames dropped as stale.
+        const TxStats &txStats() const { return _txStats; }
+
+        /// @brief Long messages sendMessage() refused because BULK_QUEUE_SIZE were already on their way.
+        std::uint32_t bulkRefusals() const { return _bulkRefusals; }
         void tick(); // called in the main loop to handle resending unacked messages
 
     private:
-        std::unordered_map<std::uint16_t, std::vector<MessageParsingResult>> _messageBuffer; // map of message IDs to message packets
-        std::unordered_map<MessageContentType, std::vector<std::function<void(Message)>>> _responseMessageCallbacks;
-        std::unordered_map<MessageContentType, std::vector<std::function<void(Message)>>> _requestMessageCallbacks;
-        volatile RadioState _radioState = RADIO_STATE_IDLE;
+        ReassemblyBuffer _reassembly; // long messages being received
+        DispatchTable _dispatchTable;
+        std::atomic<bool> _radioOwned{false};                          // held by the thread doing radio and protocol work
+        MpscQueue<RadioCommand, COMMAND_QUEUE_SIZE> _commandQueue; // filled by any thread, drained by the radio owner
 
         std::unordered_map<std::uint16_t, SentMessage> _acksRequired;
+        std::unordered_map<std::uint16_t, OutgoingTransfer> _outgoingTransfers;
+        std::deque<UnackedTransfer> _unackedTransfers;
+        std::atomic<std::size_t> _bulkQueued{0}; // long messages accepted by sendMessage() and still in the command queue
+        std::atomic<std::size_t> _bulkActive{0}; // long messages being sent, see _updateBulkActive()
+        std::atomic<std::uint32_t> _bulkRefusals{0};
+        std::size_t _sendWindow = DEFAULT_SEND_WINDOW;
+        std::uint8_t _fecData[MESSAGE_CONTENT_TYPE_COUNT] = {};
+        std::uint8_t _fecParity[MESSAGE_CONTENT_TYPE_COUNT] = {};
+        bool _integrityCheck = false;
+        LinkStats _linkStats;
+        std::uint16_t _lastFragmentID = 0; // the message the last fragment received belongs to, for the interarrival times
+        std::uint32_t _lastFragmentAt = 0;
+        bool _fragmentReceived = false;
+
+        // there are no peer addresses on the link, so the one estimator covers the peer we talk to
+        RttEstimator _rtt{SEND_TIMEOUT};
+        bool _adaptiveTimeout = true;
+        std::uint8_t _maxRetries = MAX_RETRIES;
+        std::uint32_t _retryBudget = 0;
+        std::minstd_rand _jitter;
+        std::atomic<int> _spreadingFactor{7}; // read by sendMessage() to check the airtime budget
+        std::atomic<long> _bandwidth{125000};
+        AirtimeBudget _airtimeBudget;
+        std::atomic<AirtimePolicy> _airtimePolicy{AIRTIME_DEFER};
+        std::atomic<std::uint32_t> _airtimeRefusals{0};
+        LinkAdaptation _linkAdaptation;
+
+        CompletedMessage _completedMessages[COMPLETED_MESSAGE_HISTORY] = {};
+        std::size_t _completedMessageCount = 0;
+
+        std::function<std::vector<std::uint8_t>()> _streamSource;
+        DataStream _stream;
+        std::atomic<bool> _subscribed{false};
+        std::atomic<std::uint16_t> _subscriptionInterval{0};
+        std::atomic<std::uint32_t> _subscriptionLease{0};
+        std::atomic<std::uint32_t> _subscriptionRenewed{0};
+        std::atomic<std::uint16_t> _subscriptionRequestID{0};
+        std::atomic<bool> _subscriptionDelta{false};
+        DeltaDecoder _streamDecoder;
+        std::vector<std::uint8_t> _streamFrame; // the last frame rebuilt by _streamDecoder
+        std::uint16_t _keyframeRequestID = 0;
+
+        // link statistics, both served to the other side and subscribed to from it
+        DataStream _statsStream;
+        std::function<void(const LinkStats &)> _statsCallback;
+        std::atomic<bool> _statsSubscribed{false};
+        std::atomic<std::uint16_t> _statsInterval{0};
+        std::atomic<std::uint32_t> _statsLease{0};
+        std::atomic<std::uint32_t> _statsRenewed{0};
+        std::atomic<std::uint16_t> _statsRequestID{0};
+        std::vector<std::uint8_t> _decompressed; // the last compressed message received, decompressed
+
+        bool _batching = false;
+        std::uint32_t _batchDeadline = DEFAULT_BATCH_DEADLINE;
+        PacketBuffer _batch;            // short messages waiting to go out together, see BatchView
+        std::size_t _batchCount = 0;    // messages in _batch
+        std::uint32_t _batchStarted = 0; // when the first message joined _batch
+
+        bool _eventMode = false;
+        SpscRing<PacketBuffer, RX_QUEUE_SIZE> _rxQueue; // filled by the radio interrupt, drained by poll()
+        SpscRing<PacketBuffer, TX_QUEUE_SIZE> _txQueue; // filled by sendMessage(), drained by poll()
+
+        // the TX scheduler, see TrafficClass. Only the radio owner touches these
+        SpscRing<PacketBuffer, TX_CONTROL_QUEUE_SIZE> _controlQueue;
+        PacketBuffer _telemetry; // the latest telemetry frame waiting for the radio
+        bool _telemetryQueued = false;
+        bool _servicingTX = false;
+        TxStats _txStats;
+
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+        RF95Transport _rf95Transport;
+#endif
+        Transport *_transport;
 
-        const int _csPin = 10;
-        const int _resetPin = 2;
-        const int _interruptPin = 3;
-        const float _frequency = 1575.42;
-        const int _power = 23;
+        const int _csPin = DEFAULT_RFM95_CS;
+        const int _interruptPin = DEFAULT_RFM95_INT;
 
-        void _handleRXMessage(MessageParsingResult res);
+        bool _tryAcquireRadio();
+        void _acquireRadio();
+        void _releaseRadio();
+        bool _queueCommand(RadioCommand command);
+        void _serviceCommandQueue();
+        void _runQueuedCommands();
+        void _sendNow(Message msg, bool ackRequired, TrafficClass trafficClass = TRAFFIC_CONTROL);
+        bool _protect(Message &msg) const;
+        void _switchDataRateNow(int spreadingFactor, long bandwidth);
+        void _serviceLinkAdaptation();
+        bool _handleDataRateSwitch(const MessageView &view);
+        void _listen(std::uint16_t timeout);
+        void _poll();
+        void _tick();
+        static void _onPacketReceived(void *context, const std::uint8_t *data, std::uint8_t length);
+        void _queuePacket(const PacketBuffer &packet, TrafficClass trafficClass);
+        void _serviceTX();
+        bool _sendQueuedPacket();
+        bool _sendBulkFragment();
+        void _updateBulkActive();
+        void _transmit(const PacketBuffer &packet);
+        void _transmitFrame(const PacketBuffer &frame);
+        void _flushBatch();
+        void _flushBatchIfDue();
+        void _handleRXFrame(const std::uint8_t *frame, std::size_t length);
+        void _pumpTX();
+        void _handleRXMessage(const PacketView &packet);
+        void _handleAck(const PacketView &packet);
+        void _sendWindowOf(OutgoingTransfer &transfer);
+        void _sendAck(std::uint16_t id, MessageContentType contentType, const FragmentBitmap &received);
+        bool _wasCompleted(const PacketView &packet, std::uint32_t now);
+        void _onResponseActivity(std::uint16_t id);
+        std::uint32_t _initialTimeout() const;
+        std::uint32_t _backoffTimeout(std::uint32_t timeout);
+        bool _retriesExhausted(std::uint8_t retries, std::uint32_t firstSent) const;
+        void _dispatchMessage(const MessageView &view);
+        void _handleStreamRequest(const MessageView &view);
+        void _serviceStream();
+        void _renewSubscription();
+        void _requestKeyframe();
+        bool _handleLinkStatsRequest(const MessageView &view);
+        void _serviceLinkStatsStream();
+        void _renewLinkStatsSubscription();
+        void _handleLinkStats(const MessageView &view);
+        void _countSent(const PacketBuffer &frame);
+        std::uint32_t _airtimeOf(std::size_t frameSize) const;
+        std::uint32_t _messageAirtime(const Message &msg) const;
+        bool _budgetAllowsNext();
         void _markMessageAsAcked(std::uint16_t id);
     };
 } // namespace wircom
 
-#endif // __COM_INTERFACE_H__
-#endif // defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
\ No newline at end of file
+#endif // __COM_INTERFACE_H__
\ No newline at end of file
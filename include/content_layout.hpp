@@ -0,0 +1,231 @@
+#ifndef __CONTENT_LAYOUT_H__
+#define __CONTENT_LAYOUT_H__
+
+/// content_layout.hpp
+/// Codecs generated from a list of fields, so a content struct declares its wire format once, and its
+/// encoder and decoder cannot disagree. Each field knows how many bytes it takes, and the smallest and
+/// largest encoding of a layout are known at compile time. Encoding checks the whole size against the
+/// buffer once, before any field writes, and decoding checks every field against what is left of the
+/// payload before it reads, so neither can run past the end.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "content_registry.hpp"
+
+#define MAX_PREFIXED_FIELD_SIZE 255 // the most bytes a PrefixedField holds, its length is a single byte
+
+namespace wircom
+{
+    /// @brief The class and the type of a pointer to a data member.
+    template <typename>
+    struct MemberOf;
+
+    template <typename C, typename M>
+    struct MemberOf<M C::*>
+    {
+        using Class = C;
+        using Type = M;
+    };
+
+    /// IntField
+    /// An integer, enum or bool member, big-endian, in Bytes bytes. A wider value is cut to Bytes, and
+    /// a narrower one comes back zero extended, so a signed member must not be negative unless it is sent whole.
+    template <auto Member, std::size_t Bytes = sizeof(typename MemberOf<decltype(Member)>::Type)>
+    struct IntField
+    {
+        using Type = typename MemberOf<decltype(Member)>::Type;
+        static_assert(std::is_integral<Type>::value || std::is_enum<Type>::value, "an IntField holds an integer, enum or bool");
+        static_assert(Bytes >= 1 && Bytes <= 8, "an IntField is 1 to 8 bytes");
+
+        static constexpr std::size_t minSize = Bytes;
+        static constexpr std::size_t maxSize = Bytes;
+        static constexpr bool greedy = false;
+
+        template <typename T>
+        static std::size_t size(const T &) { return Bytes; }
+
+        template <typename T>
+        static void write(const T &content, std::uint8_t *&out)
+        {
+            std::uint64_t value = (std::uint64_t)(content.*Member);
+            for (std::size_t i = 0; i < Bytes; i++)
+            {
+                *out++ = (value >> (8 * (Bytes - 1 - i))) & 0xFF;
+            }
+        }
+
+        template <typename T>
+        static bool read(const std::uint8_t *&data, const std::uint8_t *end, T &content)
+        {
+            if ((std::size_t)(end - data) < Bytes)
+            {
+                return false;
+            }
+
+            std::uint64_t value = 0;
+            for (std::size_t i = 0; i < Bytes; i++)
+            {
+                value = (value << 8) | *data++;
+            }
+            content.*Member = static_cast<Type>(value);
+            return true;
+        }
+    };
+
+    /// PrefixedField
+    /// A std::string or byte vector member after a one byte length. Only its first MAX_PREFIXED_FIELD_SIZE bytes are sent.
+    template <auto Member>
+    struct PrefixedField
+    {
+        static constexpr std::size_t minSize = 1;
+        static constexpr std::size_t maxSize = 1 + MAX_PREFIXED_FIELD_SIZE;
+        static constexpr bool greedy = false;
+
+        template <typename T>
+        static std::size_t length(const T &content)
+        {
+            std::size_t size = (content.*Member).size();
+            return size < MAX_PREFIXED_FIELD_SIZE ? size : MAX_PREFIXED_FIELD_SIZE;
+        }
+
+        template <typename T>
+        static std::size_t size(const T &content) { return 1 + length(content); }
+
+        template <typename T>
+        static void write(const T &content, std::uint8_t *&out)
+        {
+            std::size_t size = length(content);
+            *out++ = size;
+            if (size > 0)
+            {
+                std::memcpy(out, (content.*Member).data(), size);
+            }
+            out += size;
+        }
+
+        template <typename T>
+        static bool read(const std::uint8_t *&data, const std::uint8_t *end, T &content)
+        {
+            if (data == end || (std::size_t)(end - data - 1) < *data)
+            {
+                return false;
+            }
+
+            std::size_t size = *data++;
+            (content.*Member).assign(data, data + size);
+            data += size;
+            return true;
+        }
+    };
+
+    /// RemainderField
+    /// A std::string or byte vector member that takes the rest of the payload, so it must come last.
+    template <auto Member>
+    struct RemainderField
+    {
+        static constexpr std::size_t minSize = 0;
+        static constexpr std::size_t maxSize = SIZE_MAX;
+        static constexpr bool greedy = true;
+
+        template <typename T>
+        static std::size_t size(const T &content) { return (content.*Member).size(); }
+
+        template <typename T>
+        static void write(const T &content, std::uint8_t *&out)
+        {
+            std::size_t size = (content.*Member).size();
+            if (size > 0)
+            {
+                std::memcpy(out, (content.*Member).data(), size);
+            }
+            out += size;
+        }
+
+        template <typename T>
+        static bool read(const std::uint8_t *&data, const std::uint8_t *end, T &content)
+        {
+            (content.*Member).assign(data, end);
+            data = end;
+            return true;
+        }
+    };
+
+    /// ContentLayout
+    /// The fields of a T, in the order they are sent. Bytes after the last field are ignored when
+    /// decoding, so a later version can append fields.
+    template <typename T, typename... Fields>
+    struct ContentLayout
+    {
+        static_assert(sizeof...(Fields) > 0, "a layout has at least one field");
+        static_assert((Fields::greedy + ...) == (std::tuple_element<sizeof...(Fields) - 1, std::tuple<Fields...>>::type::greedy ? 1 : 0),
+                      "only the last field can take the rest of the payload");
+
+        static constexpr std::size_t minSize = (Fields::minSize + ...);
+        static constexpr std::size_t maxSize = (Fields::greedy || ...) ? SIZE_MAX : (Fields::maxSize + ...);
+        static constexpr bool fixedSize = minSize == maxSize;
+
+        /// @brief The size of content, encoded.
+        static std::size_t size(const T &content) { return (Fields::size(content) + ...); }
+
+        /// @brief Encodes content into a caller-provided buffer, e.g. the payload of a PacketBuffer.
+        /// @return The number of bytes written, 0 if they do not fit in capacity, in which case nothing is written.
+        static std::size_t encode(const T &content, std::uint8_t *out, std::size_t capacity)
+        {
+            std::size_t size = ContentLayout::size(content);
+            if (size > capacity)
+            {
+                return 0;
+            }
+
+            (Fields::write(content, out), ...);
+            return size;
+        }
+
+        /// @return false if the data ends before the last field.
+        static bool decode(const std::uint8_t *data, std::size_t size, T &content)
+        {
+            const std::uint8_t *end = data + size;
+            return (Fields::read(data, end, content) && ...);
+        }
+    };
+
+    /// LayoutCodec
+    /// A ContentCodec generated from a layout, so registering a struct takes a single declaration:
+    ///     template <>
+    ///     struct ContentCodec<Position> : LayoutCodec<Position, MSG_CON_USER, IntField<&Position::x, 2>, IntField<&Position::y, 2>> {};
+    /// A codec that checks more than the layout can derives from it and wraps decode().
+    template <typename T, MessageContentType Type, typename... Fields>
+    struct LayoutCodec
+    {
+        using Layout = ContentLayout<T, Fields...>;
+        static constexpr MessageContentType contentType = Type;
+
+        /// @brief Encodes content into a buffer of exactly its size, allocated once, which a Message can take over.
+        static std::vector<std::uint8_t> encode(const T &content)
+        {
+            std::vector<std::uint8_t> out(Layout::size(content));
+            Layout::encode(content, out.data(), out.size());
+            return out;
+        }
+
+        /// @brief Encodes content straight into a caller-provided buffer, see ContentLayout::encode().
+        static std::size_t encode(const T &content, std::uint8_t *out, std::size_t capacity)
+        {
+            return Layout::encode(content, out, capacity);
+        }
+
+        static ContentResult<T> decode(const PayloadView &payload)
+        {
+            ContentResult<T> result{};
+            result.success = Layout::decode(payload.data, payload.size, result.content);
+            return result;
+        }
+    };
+} // namespace wircom
+
+#endif // __CONTENT_LAYOUT_H__
@@ -0,0 +1,46 @@
+#ifndef __CONTENT_REGISTRY_H__
+#define __CONTENT_REGISTRY_H__
+
+/// content_registry.hpp
+/// Ties content structs to the content type that carries them and to their wire format. A struct is
+/// registered by specializing ContentCodec for it, so everything is resolved at compile time:
+/// MessageBuilder::createContentMessage() and ComInterface::addContentCallback() pick the content type
+/// and the codec from the type of the struct, and a receiver is left with the dispatch table lookup
+/// it does for every message anyway.
+
+#include <cstdint>
+#include <vector>
+
+#include "message.hpp"
+
+namespace wircom
+{
+    template <typename T>
+    class ContentResult
+    {
+    public:
+        bool success;
+        T content;
+    };
+
+    /// ContentCodec
+    /// Specialize it for a content struct T, with
+    ///     static constexpr MessageContentType contentType; // the content type of messages carrying a T
+    ///     static std::vector<std::uint8_t> encode(const T &content);
+    ///     static ContentResult<T> decode(const PayloadView &payload);
+    /// Several structs may share a content type, e.g. a request and its response. A struct that is not
+    /// registered does not compile. Applications take their content types from MSG_CON_USER on.
+    template <typename T>
+    struct ContentCodec;
+
+    /// @brief The content type of messages carrying a T, checked at compile time.
+    template <typename T>
+    constexpr MessageContentType contentTypeOf()
+    {
+        static_assert(ContentCodec<T>::contentType >= 0 && ContentCodec<T>::contentType < MESSAGE_CONTENT_TYPE_COUNT,
+                      "a content type must fit the byte of the typed header");
+        return ContentCodec<T>::contentType;
+    }
+} // namespace wircom
+
+#endif // __CONTENT_REGISTRY_H__
@@ -0,0 +1,27 @@
+#ifndef __CRC_H__
+#define __CRC_H__
+
+/// crc.hpp
+/// CRCs for checked packets (CRC-16) and checked long messages (CRC-32), see MessageFlag.
+/// Both are computed slicing-by-8: eight bytes per step through eight lookup tables, which
+/// are generated at compile time, so there is nothing to initialize and nothing allocated.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace wircom
+{
+    class Crc
+    {
+    public:
+        /// @brief CRC-16/X-25 (reflected polynomial 0x8408, init and final XOR 0xFFFF).
+        /// @param crc The CRC of the bytes before data, to continue a running CRC, or 0 to start one.
+        static std::uint16_t crc16(const std::uint8_t *data, std::size_t size, std::uint16_t crc = 0);
+
+        /// @brief CRC-32/ISO-HDLC, the zlib and Ethernet CRC (reflected polynomial 0xEDB88320).
+        /// @param crc The CRC of the bytes before data, to continue a running CRC, or 0 to start one.
+        static std::uint32_t crc32(const std::uint8_t *data, std::size_t size, std::uint32_t crc = 0);
+    };
+} // namespace wircom
+
+#endif // __CRC_H__
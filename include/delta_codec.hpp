@@ -0,0 +1,78 @@
+#ifndef __DELTA_CODEC_H__
+#define __DELTA_CODEC_H__
+
+/// delta_codec.hpp
+/// Delta encoding of consecutive data transfer frames, e.g. daqser frames, where most signals
+/// change slowly. Every few frames the whole frame goes out as a keyframe. In between, only the
+/// XOR against the last keyframe is sent, as a bitmap of the bytes that changed followed by those
+/// bytes. Deltas refer to the keyframe and not to the previous frame, so a lost delta costs one
+/// frame and only a lost keyframe needs a resync, see DeltaDecoder::decode().
+
+#include <cstdint>
+#include <vector>
+
+#include "message.hpp"
+
+#ifndef DELTA_KEYFRAME_INTERVAL
+#define DELTA_KEYFRAME_INTERVAL 20 // frames from one keyframe to the next
+#endif
+
+#define DELTA_HEADER_SIZE 2 // frame kind and keyframe ID
+
+// ENCODED FRAME STRUCTURE
+// 0: Frame Kind -- DELTA_KEYFRAME or DELTA_FRAME
+// 1: Keyframe ID, of this keyframe or of the keyframe a delta refers to
+// (if keyframe)
+// 2-: Frame
+// (if delta)
+// 2-: Bitmap of the bytes that differ from the keyframe, one bit per byte, MSB first
+// then: The XOR of each byte that differs
+
+namespace wircom
+{
+    enum DeltaFrameKind
+    {
+        DELTA_KEYFRAME = 1,
+        DELTA_FRAME = 2,
+    };
+
+    class DeltaEncoder
+    {
+    public:
+        explicit DeltaEncoder(std::size_t keyframeInterval = DELTA_KEYFRAME_INTERVAL) : _keyframeInterval(keyframeInterval) {}
+
+        /// @brief Encodes the next frame, as a keyframe when one is due, the frame changed size,
+        /// or a delta would not be smaller than the frame.
+        std::vector<std::uint8_t> encode(const std::vector<std::uint8_t> &frame);
+
+        /// @brief Makes the next frame a keyframe, e.g. because the receiver lost the last one.
+        void requestKeyframe() { _keyframeDue = true; }
+
+    private:
+        std::vector<std::uint8_t> _keyframe;
+        std::uint8_t _keyframeID = 0;
+        std::size_t _sinceKeyframe = 0;
+        std::size_t _keyframeInterval;
+        bool _keyframeDue = true;
+    };
+
+    class DeltaDecoder
+    {
+    public:
+        /// @brief Rebuilds the full frame from an encoded one.
+        /// @param encoded The encoded frame.
+        /// @param frame Where to write the full frame.
+        /// @return false if the frame is malformed or refers to a keyframe that never arrived,
+        /// in which case the sender should be asked for a new keyframe.
+        bool decode(PayloadView encoded, std::vector<std::uint8_t> &frame);
+
+        bool hasKeyframe() const { return _hasKeyframe; }
+
+    private:
+        std::vector<std::uint8_t> _keyframe;
+        std::uint8_t _keyframeID = 0;
+        bool _hasKeyframe = false;
+    };
+} // namespace wircom
+
+#endif // __DELTA_CODEC_H__
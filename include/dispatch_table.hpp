@@ -0,0 +1,59 @@
+#ifndef __DISPATCH_TABLE_H__
+#define __DISPATCH_TABLE_H__
+
+/// dispatch_table.hpp
+/// Routes received messages to their callbacks. Every content type something is registered for
+/// gets an entry per message type, found through a table indexed by the content type, so finding
+/// the subscribers of a message is two array indexes, and dispatching it never copies the table or allocates.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "message.hpp"
+
+#define MESSAGE_TYPE_COUNT 2 // the message type is one bit of the flag
+
+namespace wircom
+{
+    typedef std::function<void(const Message &)> MessageCallback;
+    typedef std::function<void(const MessageView &)> MessageViewCallback;
+
+    class DispatchTable
+    {
+    public:
+        void add(MessageType messageType, MessageContentType contentType, MessageCallback callback);
+        void addView(MessageType messageType, MessageContentType contentType, MessageViewCallback callback);
+
+        /// @brief Adds a callback for every message of a type, whatever its content type, including
+        /// content types registered later on.
+        void addAny(MessageType messageType, MessageCallback callback);
+
+        /// @brief Calls every callback registered for the message's type and content type, then those for any
+        /// content type. View callbacks get the view as is, Message callbacks share one owning copy, made only if there are any.
+        /// @return false if nothing was registered for the message.
+        bool dispatch(const MessageView &view) const;
+
+        /// @brief The callbacks a message of this type and content type goes to, those for any content type included.
+        std::size_t subscriberCount(MessageType messageType, MessageContentType contentType) const;
+
+    private:
+        struct Entry
+        {
+            std::vector<MessageViewCallback> viewCallbacks;
+            std::vector<MessageCallback> messageCallbacks;
+        };
+
+        // for each content type, 1 + the index in _entries of its request entry, followed by its response entry,
+        // or 0 while nothing is registered for it
+        std::uint16_t _slots[MESSAGE_CONTENT_TYPE_COUNT] = {};
+        std::vector<Entry> _entries;
+        std::vector<MessageCallback> _any[MESSAGE_TYPE_COUNT];
+
+        Entry &_entry(MessageType messageType, MessageContentType contentType);
+        const Entry *_find(MessageType messageType, MessageContentType contentType) const;
+    };
+} // namespace wircom
+
+#endif // __DISPATCH_TABLE_H__
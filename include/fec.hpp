@@ -0,0 +1,148 @@
+#ifndef __FEC_H__
+#define __FEC_H__
+
+/// fec.hpp
+/// Forward error correction for long messages. The data fragments are split into blocks of K,
+/// and every block is followed by M XOR parity fragments: parity fragment p covers the data
+/// fragments of its block whose index in the block is p modulo M. A block survives any loss
+/// that leaves at most one fragment missing per parity fragment, e.g. a burst of up to M
+/// consecutive data fragments, without waiting for a retransmission.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "message.hpp"
+
+#define FEC_HEADER_SIZE 4
+// data carried by each fragment, leaving room for a CRC and the content type byte of a typed header
+#define FEC_FRAGMENT_SIZE (MAX_LONG_MSG_PAYLOAD_SIZE - CONTENT_TYPE_EXTENSION_SIZE - FEC_HEADER_SIZE - PACKET_CRC_SIZE)
+#define FEC_MAX_PACKET_COUNT 255 // packet counts are a single byte
+
+// FEC FRAGMENT STRUCTURE, the payload of every fragment of a message with the FEC flag
+// 0: Data Fragment Count
+// 1: Data Fragments per Block (K)
+// 2: Parity Fragments per Block (M)
+// 3: Size of the Last Data Fragment
+// 4-: The data, or for a parity fragment the XOR of the data it covers, zero padded
+
+namespace wircom
+{
+    /// FecLayout
+    /// Where the data and parity fragments of a message with FEC go. Blocks are sent in order,
+    /// each one as its data fragments followed by its parity fragments.
+    struct FecLayout
+    {
+        std::uint8_t dataCount = 0;
+        std::uint8_t blockData = 0;
+        std::uint8_t blockParity = 0;
+        std::uint8_t lastSize = 0;
+
+        /// @brief The layout for a payload of size bytes, which may come out invalid if it needs too many packets.
+        static FecLayout forSize(std::size_t size, std::uint8_t blockData, std::uint8_t blockParity)
+        {
+            FecLayout layout;
+            std::size_t dataCount = (size + FEC_FRAGMENT_SIZE - 1) / FEC_FRAGMENT_SIZE;
+            if (dataCount == 0 || dataCount > FEC_MAX_PACKET_COUNT)
+            {
+                return layout;
+            }
+
+            layout.dataCount = dataCount;
+            layout.blockData = blockData;
+            layout.blockParity = blockParity;
+            layout.lastSize = size - (dataCount - 1) * FEC_FRAGMENT_SIZE;
+            return layout;
+        }
+
+        /// @brief Reads the layout from the FEC header of a fragment's payload.
+        static FecLayout fromHeader(PayloadView payload)
+        {
+            FecLayout layout;
+            if (payload.size >= FEC_HEADER_SIZE)
+            {
+                layout.dataCount = payload[0];
+                layout.blockData = payload[1];
+                layout.blockParity = payload[2];
+                layout.lastSize = payload[3];
+            }
+            return layout;
+        }
+
+        void writeHeader(std::uint8_t *out) const
+        {
+            out[0] = this->dataCount;
+            out[1] = this->blockData;
+            out[2] = this->blockParity;
+            out[3] = this->lastSize;
+        }
+
+        bool valid() const
+        {
+            return this->dataCount > 0 && this->blockData > 0 && this->blockParity > 0 && this->blockParity <= this->blockData &&
+                   this->lastSize > 0 && this->lastSize <= FEC_FRAGMENT_SIZE && this->packetCount() <= FEC_MAX_PACKET_COUNT;
+        }
+
+        bool operator==(const FecLayout &other) const
+        {
+            return this->dataCount == other.dataCount && this->blockData == other.blockData &&
+                   this->blockParity == other.blockParity && this->lastSize == other.lastSize;
+        }
+
+        std::size_t blockCount() const { return (this->dataCount + this->blockData - 1) / this->blockData; }
+        std::size_t packetCount() const { return this->dataCount + this->blockCount() * this->blockParity; }
+        std::size_t dataSize() const { return (this->dataCount - 1) * FEC_FRAGMENT_SIZE + this->lastSize; }
+
+        /// @brief The data fragments in a block, only the last block can be short.
+        std::size_t dataInBlock(std::size_t block) const
+        {
+            std::size_t first = block * this->blockData;
+            return (this->dataCount - first < this->blockData) ? this->dataCount - first : this->blockData;
+        }
+
+        std::size_t blockOf(std::size_t packetNumber) const { return packetNumber / (this->blockData + this->blockParity); }
+
+        /// @brief Whether a packet is a parity fragment, and its index among the data or the parity of its block.
+        bool isParity(std::size_t packetNumber, std::size_t &index) const
+        {
+            std::size_t block = this->blockOf(packetNumber);
+            std::size_t inBlock = packetNumber % (this->blockData + this->blockParity);
+            std::size_t data = this->dataInBlock(block);
+            index = (inBlock < data) ? inBlock : inBlock - data;
+            return inBlock >= data;
+        }
+
+        std::size_t dataPacket(std::size_t block, std::size_t index) const
+        {
+            return block * (this->blockData + this->blockParity) + index;
+        }
+
+        std::size_t parityPacket(std::size_t block, std::size_t parity) const
+        {
+            return block * (this->blockData + this->blockParity) + this->dataInBlock(block) + parity;
+        }
+
+        /// @brief Where a fragment is kept, in fragments: the data in order first, so that it ends up contiguous,
+        /// then the parity.
+        std::size_t storageIndex(std::size_t packetNumber) const
+        {
+            std::size_t index;
+            std::size_t block = this->blockOf(packetNumber);
+            if (this->isParity(packetNumber, index))
+            {
+                return this->dataCount + block * this->blockParity + index;
+            }
+            return block * this->blockData + index;
+        }
+
+        /// @brief The payload size of a fragment, without the FEC header.
+        std::size_t fragmentSize(std::size_t packetNumber) const
+        {
+            std::size_t index;
+            bool parity = this->isParity(packetNumber, index);
+            bool lastData = !parity && this->blockOf(packetNumber) * this->blockData + index == this->dataCount - 1u;
+            return lastData ? this->lastSize : FEC_FRAGMENT_SIZE;
+        }
+    };
+} // namespace wircom
+
+#endif // __FEC_H__
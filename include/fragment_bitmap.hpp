@@ -0,0 +1,122 @@
+#ifndef __FRAGMENT_BITMAP_H__
+#define __FRAGMENT_BITMAP_H__
+
+/// fragment_bitmap.hpp
+/// A bitmap with one bit per fragment of a long message. Used to track which fragments
+/// have been received or acknowledged, and sent over the air as-is in selective acks.
+
+#include <cstdint>
+#include <vector>
+
+namespace wircom
+{
+    class FragmentBitmap
+    {
+    public:
+        FragmentBitmap() {}
+        explicit FragmentBitmap(std::size_t count) : _count(count), _bits((count + 7) / 8, 0) {}
+
+        /// @brief Rebuilds a bitmap from its wire representation, as produced by data().
+        static FragmentBitmap fromBytes(std::size_t count, const std::uint8_t *bytes, std::size_t length)
+        {
+            FragmentBitmap bitmap(count);
+            for (std::size_t i = 0; i < count && i / 8 < length; i++)
+            {
+                if (bytes[i / 8] & (1 << (i % 8)))
+                {
+                    bitmap.set(i);
+                }
+            }
+            return bitmap;
+        }
+
+        void set(std::size_t index)
+        {
+            if (index >= this->_count || this->test(index))
+            {
+                return;
+            }
+
+            this->_bits[index / 8] |= (1 << (index % 8));
+            this->_setCount++;
+        }
+
+        bool test(std::size_t index) const
+        {
+            return index < this->_count && (this->_bits[index / 8] & (1 << (index % 8))) != 0;
+        }
+
+        /// @brief Sets every bit that is set in other.
+        /// @return The number of bits that were newly set.
+        std::size_t merge(const FragmentBitmap &other)
+        {
+            std::size_t before = this->_setCount;
+            for (std::size_t i = 0; i < other._count; i++)
+            {
+                if (other.test(i))
+                {
+                    this->set(i);
+                }
+            }
+            return this->_setCount - before;
+        }
+
+        /// @brief Sets every bit below base, and every bit from base on that is set in bytes, where
+        /// bit base + i is bit (i % 8) of byte (i / 8). This is how the acks of messages too large
+        /// to ack in one bitmap report them, see ComInterface::_sendAck().
+        /// @return The number of bits that were newly set.
+        std::size_t mergeRange(std::size_t base, const std::uint8_t *bytes, std::size_t length)
+        {
+            std::size_t before = this->_setCount;
+            for (std::size_t i = this->nextClear(0); i < base && i < this->_count; i = this->nextClear(i + 1))
+            {
+                this->set(i);
+            }
+
+            for (std::size_t i = 0; i < length * 8 && base + i < this->_count; i++)
+            {
+                if (bytes[i / 8] & (1 << (i % 8)))
+                {
+                    this->set(base + i);
+                }
+            }
+            return this->_setCount - before;
+        }
+
+        /// @brief The first clear bit at or after from, or size() if there is none.
+        std::size_t nextClear(std::size_t from) const
+        {
+            std::size_t i = from;
+            while (i < this->_count)
+            {
+                if (i % 8 == 0 && this->_bits[i / 8] == 0xFF)
+                {
+                    // skip whole bytes of set bits
+                    i += 8;
+                    continue;
+                }
+
+                if (!this->test(i))
+                {
+                    return i;
+                }
+                i++;
+            }
+            return this->_count;
+        }
+
+        std::size_t size() const { return this->_count; }
+        std::size_t setCount() const { return this->_setCount; }
+        bool all() const { return this->_setCount == this->_count; }
+
+        const std::uint8_t *data() const { return this->_bits.data(); }
+        std::size_t byteSize() const { return this->_bits.size(); }
+
+    private:
+        std::size_t _count = 0;
+        std::size_t _setCount = 0;
+        std::vector<std::uint8_t> _bits;
+    };
+} // namespace wircom
+
+#endif // __FRAGMENT_BITMAP_H__
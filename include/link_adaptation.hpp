@@ -0,0 +1,151 @@
+#ifndef __LINK_ADAPTATION_H__
+#define __LINK_ADAPTATION_H__
+
+/// link_adaptation.hpp
+/// Picks the data rate from what the link looks like: the SNR and RSSI of received packets, and how
+/// many of the packets we send need a retransmission. Close to the pits the SNR has margin to spare,
+/// and a faster spreading factor or a wider bandwidth gets more through; at the far end of the track
+/// only a slow, robust rate gets through at all. LinkAdaptation only decides, ComInterface negotiates
+/// the switch with the other side, see ComInterface::enableLinkAdaptation().
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace wircom
+{
+    struct DataRate
+    {
+        int spreadingFactor;
+        long bandwidth; // in Hz
+
+        bool operator==(const DataRate &other) const { return spreadingFactor == other.spreadingFactor && bandwidth == other.bandwidth; }
+        bool operator!=(const DataRate &other) const { return !(*this == other); }
+    };
+
+    struct LinkAdaptationConfig
+    {
+        /// The rates to choose from, from the most robust to the fastest. Both sides must use the same list.
+        /// The first is the fallback, which both sides go back to when the link goes quiet.
+        std::vector<DataRate> rates = {{10, 125000}, {9, 125000}, {8, 125000}, {7, 125000}, {7, 250000}, {7, 500000}};
+        bool initiator = true;               // whether this side decides and proposes switches, exactly one side should
+        float upMargin = 8.0f;               // SNR above a rate's demodulation floor before switching up to it, in dB
+        float downMargin = 3.0f;             // SNR above the current rate's floor below which to switch down, in dB
+        float maxLossRate = 0.3f;            // share of packets needing a retransmission above which to switch down
+        std::uint8_t minSamples = 4;         // received packets needed at a rate before deciding anything
+        std::uint32_t holdTime = 2000;       // time at a rate before switching up again, in ms
+        std::uint32_t switchTimeout = 3000;  // how long a switch waits to hear the other side at the new rate before reverting, in ms
+        std::uint32_t silenceTimeout = 6000; // how long the link may be quiet at any but the fallback rate before both sides fall back, in ms
+    };
+
+    enum LinkState
+    {
+        LINK_STEADY,   // both sides are on the current rate
+        LINK_PROPOSED, // the initiator asked to switch, and waits for the answer at the old rate
+        LINK_SWITCHED, // switched, until the other side is heard at the new rate, or the switch times out
+    };
+
+    /// LinkAdaptation
+    /// The state of the adaptive data rate, fed by ComInterface. Signal samples are kept as the SNR the
+    /// packet would have had at 125 kHz, so that samples taken at different bandwidths compare.
+    class LinkAdaptation
+    {
+    public:
+        LinkAdaptation() {}
+        /// @brief Starts out at rate, the index of the current data rate in config.rates.
+        LinkAdaptation(const LinkAdaptationConfig &config, std::size_t rate, std::uint32_t now);
+
+        /// @brief The SNR, in dB, a rate needs to be demodulated at 125 kHz: the SX127x floor of its
+        /// spreading factor, raised by the extra noise a wider bandwidth lets in.
+        static float requiredSNR(const DataRate &rate);
+
+        /// @brief Feeds the signal of a received packet, which also counts as hearing from the other side.
+        /// @param rssi In dBm, 0 if the radio does not measure it, in which case only the time is kept.
+        /// @param snr In dB.
+        void onReceived(int rssi, float snr, std::uint32_t now);
+
+        /// @brief Feeds packets that made it to the other side, e.g. answered requests and acked fragments.
+        void onDelivered(std::size_t count);
+
+        /// @brief Feeds packets that had to be sent again.
+        void onLost(std::size_t count);
+
+        /// @brief The rate to switch to, the current one to stay.
+        std::size_t target(std::uint32_t now) const;
+
+        /// @brief Starts a switch proposed by this side, see LINK_PROPOSED.
+        void propose(std::size_t rate, std::uint16_t requestID, std::uint32_t now);
+
+        /// @brief Moves to the proposed or requested rate, and waits to hear the other side on it.
+        void switchTo(std::size_t rate, std::uint32_t now);
+
+        /// @brief The other side was heard at the new rate, the switch is done.
+        void confirm(std::uint32_t now);
+
+        /// @brief Goes back to the rate before the switch, and leaves the rate that failed alone for a while.
+        void revert(std::uint32_t now);
+
+        /// @brief Goes back to the fallback rate, after the link went quiet.
+        void fallBack(std::uint32_t now);
+
+        /// @brief Whether the link has been quiet for silenceTimeout at a rate other than the fallback.
+        bool silent(std::uint32_t now) const;
+
+        /// @brief Whether a switch waited for longer than switchTimeout.
+        bool switchTimedOut(std::uint32_t now) const;
+
+        /// @brief The index in LinkAdaptationConfig::rates of a rate, or rates.size() if it is not in the list.
+        std::size_t indexOf(const DataRate &rate) const;
+
+        const LinkAdaptationConfig &config() const { return this->_config; }
+        bool enabled() const { return this->_enabled; }
+        LinkState state() const { return this->_state; }
+        std::size_t current() const { return this->_current; }
+        std::size_t previous() const { return this->_previous; }
+        std::size_t proposed() const { return this->_proposed; }
+        const DataRate &rate() const { return this->_config.rates[this->_current]; }
+        const DataRate &rate(std::size_t index) const { return this->_config.rates[index]; }
+        std::uint16_t requestID() const { return this->_requestID; }
+        void setRequestID(std::uint16_t id) { this->_requestID = id; }
+        std::uint32_t lastHeard() const { return this->_lastHeard; }
+
+        /// @brief The smoothed SNR of received packets, at 125 kHz, in dB.
+        float snr() const { return this->_snr; }
+
+        /// @brief The smoothed share of packets that needed a retransmission, since the last switch.
+        float lossRate() const { return this->_lossRate; }
+
+        /// @brief Switches that went through, and switches that were reverted or fell back.
+        std::uint32_t switches() const { return this->_switches; }
+        std::uint32_t reverts() const { return this->_reverts; }
+
+    private:
+        LinkAdaptationConfig _config;
+        bool _enabled = false;
+        LinkState _state = LINK_STEADY;
+        std::size_t _current = 0;
+        std::size_t _previous = 0;
+        std::size_t _proposed = 0;
+        std::uint16_t _requestID = 0;   // of the proposal or commit waiting for an answer
+        std::uint32_t _switchStarted = 0;
+        std::uint32_t _lastSwitch = 0;
+        std::uint32_t _lastHeard = 0;
+
+        float _snr = 0.0f;
+        bool _hasSignal = false;
+        std::size_t _samples = 0; // signal samples at the current rate
+        float _lossRate = 0.0f;
+        std::size_t _outcomes = 0; // delivered and lost packets at the current rate
+
+        // a rate that failed to switch to is not tried again until the link has had time to change
+        std::size_t _ceiling = 0;
+        std::uint32_t _ceilingUntil = 0;
+
+        std::uint32_t _switches = 0;
+        std::uint32_t _reverts = 0;
+
+        void _settle(std::size_t rate, std::uint32_t now);
+    };
+} // namespace wircom
+
+#endif // __LINK_ADAPTATION_H__
@@ -0,0 +1,139 @@
+#ifndef __LINK_STATS_H__
+#define __LINK_STATS_H__
+
+/// link_stats.hpp
+/// Counters and histograms of what the link and the protocol on top of it are doing, kept by
+/// ComInterface in fixed memory. They are cheap enough to update for every packet, and small
+/// enough to send, so the car can stream its own statistics to the pit, see ComInterface::subscribeLinkStats().
+/// Both go as MSG_CON_LINK_STATS messages, through the ContentCodecs at the end.
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "content_layout.hpp"
+
+#define HISTOGRAM_BUCKETS 24 // bucket 0 holds 0, bucket i holds 2^(i-1) up to 2^i - 1, the last one everything above
+#define LINK_STATS_VERSION 1 // the first byte of encoded statistics
+
+namespace wircom
+{
+    /// Histogram
+    /// Values in buckets of powers of two, so that a fixed number of buckets covers anything from 1 to
+    /// millions at a relative error of at most 2x, e.g. round trips at SF7 and at SF12 alike.
+    class Histogram
+    {
+    public:
+        void add(std::uint32_t value)
+        {
+            this->_buckets[bucketOf(value)]++;
+            this->_count++;
+            this->_sum += value;
+            if (value > this->_max)
+            {
+                this->_max = value;
+            }
+        }
+
+        std::uint32_t count() const { return this->_count; }
+        std::uint64_t sum() const { return this->_sum; }
+        std::uint32_t max() const { return this->_max; }
+        std::uint32_t mean() const { return this->_count > 0 ? (std::uint32_t)(this->_sum / this->_count) : 0; }
+        std::uint32_t bucket(std::size_t index) const { return this->_buckets[index]; }
+
+        /// @brief An upper bound on a fraction of the values, e.g. 0.99 for the 99th percentile: the top of
+        /// the bucket the value falls in, or the largest value, whichever is smaller. 0 if empty.
+        std::uint32_t percentile(float fraction) const;
+
+        /// @brief The bucket a value goes in.
+        static std::size_t bucketOf(std::uint32_t value)
+        {
+            if (value == 0)
+            {
+                return 0;
+            }
+
+            std::size_t bits = 32 - __builtin_clz(value);
+            return bits < HISTOGRAM_BUCKETS ? bits : HISTOGRAM_BUCKETS - 1;
+        }
+
+        /// @brief The largest value that goes in a bucket.
+        static std::uint32_t bucketLimit(std::size_t index)
+        {
+            return index + 1 < HISTOGRAM_BUCKETS ? (1u << index) - 1 : UINT32_MAX;
+        }
+
+    private:
+        std::uint32_t _buckets[HISTOGRAM_BUCKETS] = {};
+        std::uint32_t _count = 0;
+        std::uint64_t _sum = 0;
+        std::uint32_t _max = 0;
+
+        friend struct LinkStats;
+    };
+
+    /// LinkStats
+    /// A snapshot of the statistics of one side of the link, see ComInterface::linkStats().
+    struct LinkStats
+    {
+        std::uint32_t timestamp = 0; // when the snapshot was taken, by the clock of the side it describes, in ms
+
+        std::uint32_t packetsSent = 0;      // frames handed to the radio, a batch counts once
+        std::uint32_t packetsReceived = 0;  // frames received, whether they could be decoded or not
+        std::uint32_t bytesSent = 0;
+        std::uint32_t bytesReceived = 0;
+        std::uint32_t decodeFailures = 0;   // frames that are not wircom packets, or are malformed
+        std::uint32_t checksumFailures = 0; // packets and reassembled messages whose CRC did not match
+        std::uint32_t duplicates = 0;       // fragments received again, e.g. because their ack was lost
+        std::uint32_t retries = 0;          // requests and windows of long messages sent again
+        std::uint32_t timeouts = 0;         // requests and long messages given up on
+        std::uint32_t rxOverflows = 0;      // packets dropped because poll() was not called often enough
+        std::uint32_t messagesReceived = 0; // messages dispatched, reassembled ones count once
+
+        Histogram responseLatency;      // from sending a request the first time to the first packet of its response, in ms
+        Histogram fragmentInterarrival; // between two fragments of the same long message, in ms
+        Histogram reassemblyTime;       // from the first to the last fragment of a long message, in ms
+        Histogram retriesPerRequest;    // retries of each request that was answered or timed out
+        Histogram airtimePerPacket;     // time on air of each frame sent, in µs, its sum is the total airtime
+
+        /// @brief Encodes the statistics compactly, as varints and only the buckets that are not empty.
+        /// A full snapshot of a busy link usually fits a single packet.
+        std::vector<std::uint8_t> encode() const;
+
+        /// @brief Decodes what encode() produced. Fields added by a later version of this library are skipped.
+        /// @return false if the data is truncated or of an unknown version.
+        static bool decode(const std::uint8_t *data, std::size_t size, LinkStats &stats);
+    };
+
+    /// LinkStatsRequest
+    /// Subscribes to the link statistics of the other side, renews the subscription, or stops it.
+    struct LinkStatsRequest
+    {
+        std::uint16_t interval = 0; // the time between snapshots, in ms, 0 for a single one
+        std::uint32_t lease = 0;    // how long the other side keeps pushing without a renewal, in ms, 0 to stop
+    };
+
+    // 0-1: Interval, 2-5: Lease, big-endian
+    template <>
+    struct ContentCodec<LinkStatsRequest> : LayoutCodec<LinkStatsRequest, MSG_CON_LINK_STATS, IntField<&LinkStatsRequest::interval>, IntField<&LinkStatsRequest::lease>>
+    {
+    };
+
+    // varints rather than a layout, see LinkStats::encode()
+    template <>
+    struct ContentCodec<LinkStats>
+    {
+        static constexpr MessageContentType contentType = MSG_CON_LINK_STATS;
+
+        static std::vector<std::uint8_t> encode(const LinkStats &stats) { return stats.encode(); }
+
+        static ContentResult<LinkStats> decode(const PayloadView &payload)
+        {
+            ContentResult<LinkStats> result;
+            result.success = LinkStats::decode(payload.data, payload.size, result.content);
+            return result;
+        }
+    };
+} // namespace wircom
+
+#endif // __LINK_STATS_H__
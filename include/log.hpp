@@ -0,0 +1,108 @@
+#ifndef __LOG_H__
+#define __LOG_H__
+
+/// log.hpp
+/// Leveled, compile-time filtered logging for wircom.
+/// Set WIRCOM_LOG_LEVEL (e.g. -D WIRCOM_LOG_LEVEL=WIRCOM_LOG_LEVEL_NONE) to choose the most
+/// verbose level that is compiled in. Statements above that level expand to nothing, so their
+/// arguments are never evaluated and cost nothing on the hot path.
+/// Output goes to Serial on Arduino boards, and to std::cout natively, unless a different sink is
+/// installed with Log::setSink().
+
+#include <sstream>
+#include <string>
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#else
+#include <iostream>
+#endif
+
+#define WIRCOM_LOG_LEVEL_NONE 0
+#define WIRCOM_LOG_LEVEL_ERROR 1
+#define WIRCOM_LOG_LEVEL_WARN 2
+#define WIRCOM_LOG_LEVEL_INFO 3
+#define WIRCOM_LOG_LEVEL_DEBUG 4
+
+#ifndef WIRCOM_LOG_LEVEL
+#define WIRCOM_LOG_LEVEL WIRCOM_LOG_LEVEL_WARN
+#endif
+
+namespace wircom
+{
+    enum LogLevel
+    {
+        LOG_NONE = WIRCOM_LOG_LEVEL_NONE,
+        LOG_ERROR = WIRCOM_LOG_LEVEL_ERROR,
+        LOG_WARN = WIRCOM_LOG_LEVEL_WARN,
+        LOG_INFO = WIRCOM_LOG_LEVEL_INFO,
+        LOG_DEBUG = WIRCOM_LOG_LEVEL_DEBUG,
+    };
+
+    /// A log sink receives every message that survives the compile-time filter.
+    typedef void (*LogSink)(LogLevel level, const char *message);
+
+    class Log
+    {
+    public:
+        /// @brief Installs a sink for log messages, or restores the default sink, Serial or std::cout.
+        /// @param sink The sink to install, or nullptr for the default.
+        static void setSink(LogSink sink)
+        {
+            _sink = sink;
+        }
+
+        static void write(LogLevel level, const std::string &message)
+        {
+            if (_sink != nullptr)
+            {
+                _sink(level, message.c_str());
+                return;
+            }
+
+#if defined(ARDUINO)
+            // std::cout goes nowhere on the board, the USB serial console is where a dead radio gets noticed
+            Serial.println(message.c_str());
+#else
+            std::cout << message << std::endl;
+#endif
+        }
+
+    private:
+        inline static LogSink _sink = nullptr;
+    };
+} // namespace wircom
+
+#define WIRCOM_LOG(level, expr)                              \
+    do                                                       \
+    {                                                        \
+        std::ostringstream _wircomLogStream;                 \
+        _wircomLogStream << expr;                            \
+        ::wircom::Log::write(level, _wircomLogStream.str()); \
+    } while (0)
+
+#if WIRCOM_LOG_LEVEL >= WIRCOM_LOG_LEVEL_ERROR
+#define WIRCOM_LOG_ERROR(expr) WIRCOM_LOG(::wircom::LOG_ERROR, expr)
+#else
+#define WIRCOM_LOG_ERROR(expr) do {} while (0)
+#endif
+
+#if WIRCOM_LOG_LEVEL >= WIRCOM_LOG_LEVEL_WARN
+#define WIRCOM_LOG_WARN(expr) WIRCOM_LOG(::wircom::LOG_WARN, expr)
+#else
+#define WIRCOM_LOG_WARN(expr) do {} while (0)
+#endif
+
+#if WIRCOM_LOG_LEVEL >= WIRCOM_LOG_LEVEL_INFO
+#define WIRCOM_LOG_INFO(expr) WIRCOM_LOG(::wircom::LOG_INFO, expr)
+#else
+#define WIRCOM_LOG_INFO(expr) do {} while (0)
+#endif
+
+#if WIRCOM_LOG_LEVEL >= WIRCOM_LOG_LEVEL_DEBUG
+#define WIRCOM_LOG_DEBUG(expr) WIRCOM_LOG(::wircom::LOG_DEBUG, expr)
+#else
+#define WIRCOM_LOG_DEBUG(expr) do {} while (0)
+#endif
+
+#endif // __LOG_H__
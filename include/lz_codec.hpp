@@ -0,0 +1,48 @@
+#ifndef __LZ_CODEC_H__
+#define __LZ_CODEC_H__
+
+/// lz_codec.hpp
+/// A small LZSS codec for message payloads, e.g. drive files, which are schema text that repeats
+/// itself a lot. Matches are found through a single-entry hash table kept on the stack, and the
+/// window is bounded, so neither side allocates and both run in linear time.
+
+#include <cstddef>
+#include <cstdint>
+
+#ifndef LZ_HASH_BITS
+#define LZ_HASH_BITS 10 // the compressor's hash table has 2^LZ_HASH_BITS entries, on the stack
+#endif
+
+#define LZ_HEADER_SIZE 4    // the uncompressed size, big-endian
+#define LZ_WINDOW_SIZE 4096 // how far back a match can start, 12 bits of offset
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH 18 // 4 bits of length
+
+// COMPRESSED STRUCTURE
+// 0-3: Uncompressed Size
+// then groups of up to 8 items, each group led by a byte with one bit per item, MSB first:
+//  0: a literal byte
+//  1: a match, 2 bytes: 12 bits of offset - 1, then 4 bits of length - LZ_MIN_MATCH
+
+namespace wircom
+{
+    class LzCodec
+    {
+    public:
+        /// @brief The largest compressed size of size bytes, for incompressible input.
+        static constexpr std::size_t maxCompressedSize(std::size_t size) { return LZ_HEADER_SIZE + size + (size + 7) / 8; }
+
+        /// @brief Compresses input into output.
+        /// @return The compressed size, or 0 if it did not fit into capacity bytes.
+        static std::size_t compress(const std::uint8_t *input, std::size_t size, std::uint8_t *output, std::size_t capacity);
+
+        /// @brief The uncompressed size of compressed data, from its header. 0 if there is no header.
+        static std::size_t decompressedSize(const std::uint8_t *input, std::size_t size);
+
+        /// @brief Decompresses input into output, which must hold at least decompressedSize() bytes.
+        /// @return false if input is malformed or output is too small.
+        static bool decompress(const std::uint8_t *input, std::size_t size, std::uint8_t *output, std::size_t capacity);
+    };
+} // namespace wircom
+
+#endif // __LZ_CODEC_H__
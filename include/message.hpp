@@ -1,17 +1,25 @@
 #ifndef __MESSAGE_H__
 #define __MESSAGE_H__
 
+#include <atomic>
 #include <cstdint>
+#include <functional>
 #include <string>
 #include <iostream>
 #include <vector>
 #include <bitset>
+#include <utility>
 
 #if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
 #include <RH_RF95.h> 
 #endif
 
 #define MSG_IDENTIFIER "NFR"
+#define BATCH_IDENTIFIER "NFB"    // a frame carrying several short messages, see BatchView
+#define EXTENDED_IDENTIFIER "NFX" // a fragment of a long message with more packets than a byte can count
+#define TYPED_IDENTIFIER "NFT"    // a packet of a message whose content type does not fit the flag, see MessageFlag
+#define EXTENDED_HEADER_VERSION 1
+#define EXTENDED_TYPED_HEADER_VERSION 2 // the extended header, with the content type byte of the typed header
 #define BIT_FLAG(x) (1 << x)
 
 #if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
@@ -22,16 +30,66 @@
 
 #define SHORT_MSG_HEADER_SIZE 7
 #define LONG_MSG_HEADER_SIZE 9 // for long messages
+#define EXTENDED_MSG_HEADER_SIZE 12 // for long messages of more than MAX_LONG_MSG_PACKET_COUNT packets
 #define MAX_SHORT_MSG_PAYLOAD_SIZE (MAX_PACKET_SIZE - SHORT_MSG_HEADER_SIZE)
 #define MAX_LONG_MSG_PAYLOAD_SIZE (MAX_PACKET_SIZE - LONG_MSG_HEADER_SIZE)
+#define MAX_EXTENDED_MSG_PAYLOAD_SIZE (MAX_PACKET_SIZE - EXTENDED_MSG_HEADER_SIZE)
+#define CONTENT_TYPE_EXTENSION_SIZE 1 // the content type byte a typed header adds to any of the above
+
+#define MAX_LONG_MSG_PACKET_COUNT 255   // packets the long header can count
+#define MAX_MESSAGE_PACKET_COUNT 65535 // packets the extended header can count, about 15 MB
+
+#define FLAG_CONTENT_TYPE_COUNT 4      // content types that fit bits 2-3 of the flag
+#define MESSAGE_CONTENT_TYPE_COUNT 256 // content types a typed header can carry
+
+#define MSG_FLAG_OFFSET 5
+#define PACKET_CRC_SIZE 2  // the CRC-16 after the payload of a checked packet
+#define MESSAGE_CRC_SIZE 4 // the CRC-32 at the end of a checked long message, before it is split up
+#define BATCH_RECORD_HEADER_SIZE (SHORT_MSG_HEADER_SIZE - 3) // a short message header without the identifier
 
 // HEADER STRUCTURE
 // 0-2: Identifier
 // 3-4: Message ID
 // 5: Message Flag
 // (if long message)
-// 6-7: Packet Number
-// 8-9: Packet Count
+// 6: Packet Number
+// 7: Packet Count
+// then
+// +0: Payload Length
+// +1-: Payload
+// (if checked)
+// after the payload: CRC-16 of everything but the identifier, big-endian
+
+// TYPED HEADER STRUCTURE, for messages of content types from FLAG_CONTENT_TYPE_COUNT on
+// 0-2: Typed Identifier
+// 3-4: Message ID
+// 5: Message Flag, its content type bits are 0
+// 6: Content Type
+// then as in the header structure, from the packet number of a long message on
+
+// EXTENDED HEADER STRUCTURE, for long messages of more than MAX_LONG_MSG_PACKET_COUNT packets
+// 0-2: Extended Identifier
+// 3-4: Message ID
+// 5: Message Flag
+// 6: Header Version
+// (if version EXTENDED_TYPED_HEADER_VERSION)
+// 7: Content Type, as in the typed header, and everything after it moves up a byte
+// 7-8: Packet Number, big-endian
+// 9-10: Packet Count, big-endian
+// 11: Payload Length
+// 12-: Payload
+// (if checked)
+// after the payload: CRC-16 of everything but the identifier, big-endian
+
+// BATCH STRUCTURE
+// 0-2: Batch Identifier
+// then, for every message in the batch, a short message without its identifier:
+// 0-1: Message ID
+// 2: Message Flag
+// 3: Payload Length
+// 4-: Payload
+// (if checked) then the message's CRC-16, as in a single packet
+// messages with a typed header are never batched
 
 namespace wircom
 {
@@ -48,11 +106,17 @@ namespace wircom
         MSG_CON_DRIVE = 1,            // .drive file
         MSG_CON_SWITCH_DATA_RATE = 2, // switch data rate
         MSG_CON_DATA_TRANSFER = 3,    // data transfer
+
+        // content types from here on do not fit the flag, and are sent with the typed header
+        MSG_CON_LINK_STATS = 4, // link statistics, see ComInterface::subscribeLinkStats()
+        // up to MSG_CON_USER are reserved for wircom, e.g. time sync or log download
+        MSG_CON_USER = 128, // the first of the content types left to applications, up to MESSAGE_CONTENT_TYPE_COUNT - 1
     };
 
     struct MessageFlag
     {
         std::uint8_t raw;
+        std::uint8_t extendedType; // the content type if it does not fit bits 2-3, otherwise 0, see TYPED HEADER STRUCTURE
 
         // FLAG Bits
         // 0: Message Type -- 0: Request, 1: Response
@@ -62,31 +126,28 @@ namespace wircom
         //  1: Drive
         //  2: Switch Data Rate
         //  3: Data Transfer
-        // 4-7: Reserved
+        // 4: Ack -- on a fragment of a long message, asks the receiver for a selective ack;
+        //           on a short message, marks it as that selective ack
+        // 5: Compressed -- the payload is LZ compressed, see lz_codec.hpp
+        // 6: FEC -- a long message with parity fragments, see fec.hpp
+        // 7: Checked -- the packet ends with a CRC-16, and a long message ends with a CRC-32, see crc.hpp
+        // Any other content type leaves bits 2-3 at 0 and goes in extendedType, which the typed header carries.
 
-        MessageFlag() : raw(0) {}
+        MessageFlag() : raw(0), extendedType(0) {}
 
         MessageFlag(MessageType type, MessageContentType content)
         {
             raw = 0;
             raw |= (type << 0);
+            extendedType = 0;
 
-            switch (content)
+            if (content < FLAG_CONTENT_TYPE_COUNT)
             {
-            case MSG_CON_META:
-                raw |= (0 << 2);
-                break;
-            case MSG_CON_DRIVE:
-                raw |= (1 << 2);
-                break;
-            case MSG_CON_SWITCH_DATA_RATE:
-                raw |= (2 << 2);
-                break;
-            case MSG_CON_DATA_TRANSFER:
-                raw |= (3 << 2);
-                break;
-            default:
-                break;
+                raw |= (content << 2);
+            }
+            else
+            {
+                extendedType = content;
             }
         }
 
@@ -97,7 +158,13 @@ namespace wircom
 
         MessageContentType getMessageContentType() const
         {
-            return MessageContentType((raw >> 2) & 0x3);
+            return extendedType != 0 ? MessageContentType(extendedType) : MessageContentType((raw >> 2) & 0x3);
+        }
+
+        /// @brief Whether the content type does not fit the flag, so the message is sent with the typed header.
+        bool isTyped() const
+        {
+            return extendedType != 0;
         }
 
         // equal operator for MessageFlag/uint8_t
@@ -109,7 +176,7 @@ namespace wircom
         // equal operator for MessageFlag/MessageFlag
         bool operator==(const MessageFlag &other) const
         {
-            return raw == other.raw;
+            return raw == other.raw && extendedType == other.extendedType;
         }
 
         void markAsLongMessage()
@@ -121,13 +188,134 @@ namespace wircom
         {
             return (raw & BIT_FLAG(1)) != 0;
         }
+
+        void markAsAck()
+        {
+            raw |= BIT_FLAG(4);
+        }
+
+        void clearAck()
+        {
+            raw &= ~BIT_FLAG(4);
+        }
+
+        bool isAck() const
+        {
+            return (raw & BIT_FLAG(4)) != 0;
+        }
+
+        void markAsCompressed()
+        {
+            raw |= BIT_FLAG(5);
+        }
+
+        void clearCompressed()
+        {
+            raw &= ~BIT_FLAG(5);
+        }
+
+        bool isCompressed() const
+        {
+            return (raw & BIT_FLAG(5)) != 0;
+        }
+
+        void markAsFEC()
+        {
+            raw |= BIT_FLAG(6);
+        }
+
+        bool isFEC() const
+        {
+            return (raw & BIT_FLAG(6)) != 0;
+        }
+
+        void markAsChecked()
+        {
+            raw |= BIT_FLAG(7);
+        }
+
+        bool isChecked() const
+        {
+            return (raw & BIT_FLAG(7)) != 0;
+        }
+    };
+
+    /// PayloadView
+    /// A non-owning, span-style view over a contiguous run of payload bytes.
+    /// The bytes are owned by whoever produced the view (usually the radio buffer),
+    /// so a view must not outlive the call it was handed to.
+    struct PayloadView
+    {
+        const std::uint8_t *data = nullptr;
+        std::size_t size = 0;
+
+        PayloadView() {}
+        PayloadView(const std::uint8_t *data, std::size_t size) : data(data), size(size) {}
+        PayloadView(const std::vector<std::uint8_t> &vec) : data(vec.data()), size(vec.size()) {}
+
+        const std::uint8_t *begin() const { return data; }
+        const std::uint8_t *end() const { return data + size; }
+        bool empty() const { return size == 0; }
+        const std::uint8_t &operator[](std::size_t index) const { return data[index]; }
+
+        std::vector<std::uint8_t> toVector() const
+        {
+            return std::vector<std::uint8_t>(this->begin(), this->end());
+        }
+    };
+
+    /// PacketView
+    /// A non-owning view over a single received packet. The header is validated and
+    /// parsed in place, and the payload is exposed as a view into the packet buffer,
+    /// so parsing never touches the heap.
+    struct PacketView
+    {
+        bool success = false;
+        bool corrupt = false; // the packet is well formed, but its CRC does not match
+        std::uint16_t messageID = 0;
+        MessageFlag flag;
+        std::uint16_t packetNumber = 0;
+        std::uint16_t packetCount = 1;
+        bool extended = false; // the packet has the extended header
+        bool typed = false;    // the packet carries its content type in a byte of its own, see flag.extendedType
+        PayloadView payload;
+
+        /// @brief Validates and parses a packet in place.
+        /// @param packet The raw packet bytes, which must outlive the returned view.
+        /// @param length The number of bytes in packet.
+        /// @return The parsed view. success is false if the packet is malformed or corrupt.
+        static PacketView parse(const std::uint8_t *packet, std::size_t length);
+
+        MessageType messageType() const { return flag.getMessageType(); }
+        MessageContentType contentType() const { return flag.getMessageContentType(); }
+    };
+
+    /// BatchView
+    /// Walks the short messages packed into one batch frame, in place. A batch of one
+    /// message is sent as a plain packet instead, so receivers only see batches of two or more.
+    class BatchView
+    {
+    public:
+        BatchView(const std::uint8_t *frame, std::size_t length) : _frame(frame), _length(length), _offset(3) {}
+
+        /// @brief Whether frame is a batch rather than a single packet.
+        static bool isBatch(const std::uint8_t *frame, std::size_t length);
+
+        /// @brief Parses the next message in the batch.
+        /// @return false once the batch is exhausted, or at the first malformed or corrupt record.
+        bool next(PacketView &packet);
+
+    private:
+        const std::uint8_t *_frame;
+        std::size_t _length;
+        std::size_t _offset;
     };
 
     struct MessageParsingResult
     {
         bool success;
-        std::uint8_t packetNumber;
-        std::uint8_t packetCount;
+        std::uint16_t packetNumber;
+        std::uint16_t packetCount;
         std::uint16_t messageID;
         MessageType messageType;
         MessageContentType contentType;
@@ -139,48 +327,185 @@ namespace wircom
         }
 
         MessageParsingResult(bool success, std::uint16_t id, MessageType messageType, MessageContentType contentType, std::vector<std::uint8_t> data) 
-            : success(success), messageID(id), messageType(messageType), contentType(contentType), payload(data), packetNumber(1), packetCount(1) {}
-        MessageParsingResult(bool success, std::uint16_t id, std::uint8_t packetNumber, std::uint8_t packetCount, MessageType messageType, MessageContentType contentType, std::vector<std::uint8_t> data) 
-            : success(success), messageID(id), packetNumber(packetNumber), packetCount(packetCount), messageType(messageType), contentType(contentType), payload(data) {}
+            : success(success), messageID(id), messageType(messageType), contentType(contentType), payload(std::move(data)), packetNumber(1), packetCount(1) {}
+        MessageParsingResult(bool success, std::uint16_t id, std::uint16_t packetNumber, std::uint16_t packetCount, MessageType messageType, MessageContentType contentType, std::vector<std::uint8_t> data) 
+            : success(success), messageID(id), packetNumber(packetNumber), packetCount(packetCount), messageType(messageType), contentType(contentType), payload(std::move(data)) {}
+    };
+
+    /// PacketBuffer
+    /// A caller-owned, fixed-size buffer holding a single encoded packet.
+    /// Used by Message::encodeInto() so that encoding never touches the heap.
+    struct PacketBuffer
+    {
+        std::uint8_t data[MAX_PACKET_SIZE];
+        std::size_t size = 0;
     };
 
+    /// MessageSource
+    /// Reads size bytes of a message's data, starting at offset, into out, for messages too large to
+    /// hold in memory, e.g. a drive file read straight off the SD card. It is called as packets are
+    /// encoded, on the thread that owns the radio, and again for the same bytes when fragments are
+    /// resent or parity is computed, so it must be able to read any range at any time.
+    /// Returns false if the bytes could not be read.
+    using MessageSource = std::function<bool(std::size_t offset, std::uint8_t *out, std::size_t size)>;
+
     class Message
     {
     public:
         MessageFlag flag;
-        std::vector<std::uint8_t> data;
+        std::vector<std::uint8_t> data; // empty if the message has a source
         std::uint16_t messageID;
-        inline static std::uint16_t messageIDCounter;
+        inline static std::atomic<std::uint16_t> messageIDCounter{0}; // messages can be built on any thread
 
         Message() : flag(), data(), messageID(0) {}
-        Message(const Message &other) : flag(other.flag), data(other.data), messageID(other.messageID) {}
-        Message(MessageType type, MessageContentType content, const std::vector<std::uint8_t> &data) : flag(MessageFlag(type, content)), data(data)
+        Message(const Message &other) = default;
+        Message(Message &&other) = default;
+        Message &operator=(const Message &other) = default;
+        Message &operator=(Message &&other) = default;
+        // the data is taken by value, so an encoded payload is moved in rather than copied
+        Message(MessageType type, MessageContentType content, std::vector<std::uint8_t> data) : flag(MessageFlag(type, content)), data(std::move(data))
         {
-            if (data.size() > MAX_SHORT_MSG_PAYLOAD_SIZE)
+            if (this->data.size() > Message::maxPayloadSize(this->flag))
             {
                 this->flag.markAsLongMessage();
             }
             messageID = Message::_getNextMessageID();
         }
-        Message(std::uint16_t id, MessageType type, MessageContentType content, const std::vector<std::uint8_t> &data) : flag(MessageFlag(type, content)), data(data), messageID(id) {
-            if (data.size() > MAX_SHORT_MSG_PAYLOAD_SIZE)
+        Message(std::uint16_t id, MessageType type, MessageContentType content, std::vector<std::uint8_t> data) : flag(MessageFlag(type, content)), data(std::move(data)), messageID(id) {
+            if (this->data.size() > Message::maxPayloadSize(this->flag))
             {
                 this->flag.markAsLongMessage();
             }
         }
 
+        /// @brief A message whose data is read from source as its packets are encoded, instead of being held in data.
+        /// @param size The number of bytes source provides.
+        Message(std::uint16_t id, MessageType type, MessageContentType content, std::size_t size, MessageSource source)
+            : flag(MessageFlag(type, content)), messageID(id), _source(std::move(source)), _sourceSize(size)
+        {
+            if (size > Message::maxPayloadSize(this->flag))
+            {
+                this->flag.markAsLongMessage();
+            }
+        }
+
+        /// @brief The size of the message's data, whether it is held in data or read from a source.
+        std::size_t dataSize() const { return _source ? _sourceSize : data.size(); }
+        bool hasSource() const { return (bool)_source; }
+
         static MessageParsingResult decode(const std::vector<std::uint8_t> &packet);
         static MessageParsingResult decode(const std::vector<std::vector<std::uint8_t>> &packets);
         std::vector<std::vector<std::uint8_t>> encode() const;
+
+        /// @brief The number of packets this message is split into when encoded. Messages of more than
+        /// MAX_LONG_MSG_PACKET_COUNT packets are sent with the extended header, and can have up to
+        /// MAX_MESSAGE_PACKET_COUNT; a larger message cannot be sent.
+        std::size_t packetCount() const;
+
+        /// @brief Encodes a single packet of this message into a caller-provided buffer.
+        /// @param packetNumber The index of the packet to encode, in [0, packetCount()).
+        /// @param out The buffer to write the packet into.
+        /// @return false if packetNumber is out of range, or the message's source could not be read.
+        bool encodePacket(std::size_t packetNumber, PacketBuffer &out) const;
+
+        /// @brief Encodes the message into caller-provided packet buffers, without any heap allocations.
+        /// Starting at firstPacket, packets are written until the message or the buffers run out, or the source fails,
+        /// so a small ring of buffers can be refilled by calling this repeatedly with an advancing firstPacket.
+        /// @param packets The buffers to write the packets into.
+        /// @param capacity The number of buffers in packets.
+        /// @param firstPacket The index of the first packet to encode.
+        /// @return The number of packets written.
+        std::size_t encodeInto(PacketBuffer *packets, std::size_t capacity, std::size_t firstPacket = 0) const;
+
+        /// @brief Sends a long message with forward error correction: after every dataFragments fragments
+        /// come parityFragments XOR parity fragments, so the receiver can rebuild lost fragments without
+        /// a retransmission. See fec.hpp.
+        /// @return false if the message is not long, or would need more than FEC_MAX_PACKET_COUNT packets.
+        bool enableFEC(std::uint8_t dataFragments, std::uint8_t parityFragments);
+
+        std::uint8_t fecDataFragments() const { return _fecData; }
+        std::uint8_t fecParityFragments() const { return _fecParity; }
+
+        /// @brief Protects the message with CRCs: every packet ends with a CRC-16, and a long message carries
+        /// a CRC-32 of its data in its last bytes. A short message that no longer fits a packet becomes long.
+        /// Call once the data is final, and before enableFEC(). The CRC-32 of a message with a source is
+        /// computed by reading it through once.
+        /// @return false if FEC is already enabled, or the source could not be read.
+        bool enableChecksum();
+
+        /// @brief The most payload a packet with this flag, and header, carries. A typed flag costs a byte.
+        static std::size_t maxPayloadSize(const MessageFlag &flag, bool extended = false);
+
+        /// @brief Sets the ack bit of an encoded packet, e.g. on the last fragment of a window,
+        /// and updates its CRC if it is checked.
+        static void markPacketAsAck(PacketBuffer &packet);
+
         bool operator==(const Message &other) const;
 
     private:
-        std::vector<std::uint8_t> _buildPacket(const std::vector<std::uint8_t> &data, std::uint8_t packetNumber = 0, std::uint8_t packetCount = 0) const;
+        std::uint8_t _fecData = 0;
+        std::uint8_t _fecParity = 0;
+        std::uint32_t _crc = 0; // CRC-32 of data, for checked long messages
+        MessageSource _source;
+        std::size_t _sourceSize = 0;
+
+        std::size_t _bodySize() const;
+        bool _extended() const;
+        bool _readData(std::size_t offset, std::size_t size, std::uint8_t *out) const;
+        bool _copyBody(std::size_t offset, std::size_t size, std::uint8_t *out) const;
+        std::size_t _writePacket(const std::uint8_t *payload, std::size_t payloadSize, std::uint16_t packetNumber, std::uint16_t packetCount, std::uint8_t *out) const;
         static std::uint16_t _getNextMessageID()
         {
             return messageIDCounter++;
         }
     };
+
+    /// PacketCursor
+    /// Encodes the packets of a message one at a time, into one reusable buffer, so that a message
+    /// is never held in encoded form all at once and its first packet can go out straight away.
+    /// The message must outlive the cursor.
+    class PacketCursor
+    {
+    public:
+        explicit PacketCursor(const Message &message, std::size_t firstPacket = 0)
+            : _message(message), _count(message.packetCount()), _next(firstPacket) {}
+
+        /// @brief Encodes the next packet into packet().
+        /// @return false once every packet has been encoded, or if the message's source failed, see failed().
+        bool next();
+
+        PacketBuffer &packet() { return _packet; }
+        std::size_t index() const { return _next - 1; } // the number of the packet in packet()
+        std::size_t count() const { return _count; }
+        bool failed() const { return _failed; }
+
+    private:
+        const Message &_message;
+        std::size_t _count;
+        std::size_t _next;
+        bool _failed = false;
+        PacketBuffer _packet;
+    };
+
+    /// MessageView
+    /// A non-owning view of a complete received message, handed to view callbacks so
+    /// that the payload can be consumed straight out of the receive buffer.
+    /// Only valid for the duration of the callback it is passed to.
+    struct MessageView
+    {
+        std::uint16_t messageID;
+        MessageFlag flag;
+        PayloadView payload;
+
+        MessageType messageType() const { return flag.getMessageType(); }
+        MessageContentType contentType() const { return flag.getMessageContentType(); }
+
+        /// @brief Copies the view into an owning Message.
+        Message toMessage() const
+        {
+            return Message(messageID, flag.getMessageType(), flag.getMessageContentType(), payload.toVector());
+        }
+    };
 } // namespace wircom
 
 #endif // __MESSAGE_H__
\ No newline at end of file
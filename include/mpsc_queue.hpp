@@ -0,0 +1,116 @@
+#ifndef __MPSC_QUEUE_H__
+#define __MPSC_QUEUE_H__
+
+/// mpsc_queue.hpp
+/// A fixed-size, lock-free queue for many producers and one consumer, e.g. application
+/// threads handing messages to the thread that owns the radio. Each slot carries a sequence
+/// number, so producers only contend on a single compare-and-swap to claim a slot, and the
+/// consumer never waits on a producer that has not finished writing (D. Vyukov's bounded queue).
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace wircom
+{
+    template <typename T, std::size_t N>
+    class MpscQueue
+    {
+        static_assert(N > 0 && (N & (N - 1)) == 0, "MpscQueue size must be a power of two");
+
+    public:
+        MpscQueue()
+        {
+            for (std::size_t i = 0; i < N; i++)
+            {
+                this->_slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MpscQueue(const MpscQueue &) = delete;
+        MpscQueue &operator=(const MpscQueue &) = delete;
+
+        /// @brief Producer, from any thread: adds a copy of an item.
+        /// @return false if the queue is full.
+        bool push(const T &item)
+        {
+            return this->push(T(item));
+        }
+
+        /// @brief Producer, from any thread: moves an item in. If the queue is full, the item is left as
+        /// it was, so pushing it again in a loop is fine.
+        /// @return false if the queue is full.
+        bool push(T &&item)
+        {
+            std::size_t position = this->_head.load(std::memory_order_relaxed);
+            Slot *slot;
+            while (true)
+            {
+                slot = &this->_slots[position % N];
+                std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                std::ptrdiff_t difference = (std::ptrdiff_t)sequence - (std::ptrdiff_t)position;
+                if (difference == 0)
+                {
+                    // the slot is free, try to claim it
+                    if (this->_head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                    {
+                        break;
+                    }
+                }
+                else if (difference < 0)
+                {
+                    // the consumer has not freed this slot yet
+                    return false;
+                }
+                else
+                {
+                    // another producer claimed it first
+                    position = this->_head.load(std::memory_order_relaxed);
+                }
+            }
+
+            slot->value = std::move(item);
+            slot->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+
+        /// @brief Consumer: takes the oldest fully written item.
+        /// @return false if the queue is empty.
+        bool pop(T &item)
+        {
+            std::size_t position = this->_tail.load(std::memory_order_relaxed);
+            Slot &slot = this->_slots[position % N];
+            if (slot.sequence.load(std::memory_order_acquire) != position + 1)
+            {
+                return false;
+            }
+
+            item = std::move(slot.value);
+            slot.sequence.store(position + N, std::memory_order_release);
+            this->_tail.store(position + 1, std::memory_order_relaxed);
+            return true;
+        }
+
+        /// @brief Whether an item is ready for the consumer. Only a hint while producers are running.
+        bool empty() const
+        {
+            std::size_t position = this->_tail.load(std::memory_order_relaxed);
+            return this->_slots[position % N].sequence.load(std::memory_order_acquire) != position + 1;
+        }
+
+        static constexpr std::size_t capacity() { return N; }
+
+    private:
+        struct Slot
+        {
+            std::atomic<std::size_t> sequence;
+            T value;
+        };
+
+        Slot _slots[N];
+        std::atomic<std::size_t> _head{0}; // next position to claim, shared by the producers
+        std::atomic<std::size_t> _tail{0}; // next position to read, only advanced by the consumer
+    };
+} // namespace wircom
+
+#endif // __MPSC_QUEUE_H__
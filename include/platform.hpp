@@ -0,0 +1,61 @@
+#ifndef __PLATFORM_H__
+#define __PLATFORM_H__
+
+/// platform.hpp
+/// Shims over the few platform services wircom needs (time and yielding), so that the
+/// protocol logic builds both on the Teensy and natively.
+
+#include <cstdint>
+#include <functional>
+
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+#include <Arduino.h>
+#include <RadioHead.h>
+#define WIRCOM_YIELD() YIELD
+#else
+#include <chrono>
+#include <thread>
+#define WIRCOM_YIELD() std::this_thread::yield()
+#endif
+
+namespace wircom
+{
+    /// Clock
+    /// The millisecond time source used by wircom. Defaults to millis() on the Teensy and a
+    /// steady clock natively, but can be replaced, e.g. by a simulated network's virtual time.
+    class Clock
+    {
+    public:
+        static std::uint32_t millis()
+        {
+            if (_source)
+            {
+                return _source();
+            }
+
+            return _platformMillis();
+        }
+
+        /// @brief Replaces the time source, or restores the platform clock.
+        /// @param source The new time source, or nullptr for the platform clock.
+        static void setSource(std::function<std::uint32_t()> source)
+        {
+            _source = source;
+        }
+
+    private:
+        inline static std::function<std::uint32_t()> _source;
+
+        static std::uint32_t _platformMillis()
+        {
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+            return ::millis();
+#else
+            static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+#endif
+        }
+    };
+} // namespace wircom
+
+#endif // __PLATFORM_H__
@@ -0,0 +1,159 @@
+#ifndef __REASSEMBLY_H__
+#define __REASSEMBLY_H__
+
+/// reassembly.hpp
+/// Reassembly of long messages into a fixed pool of preallocated slots. Each fragment is
+/// copied straight to its final offset in its slot, and a per-slot bitmap tracks which
+/// fragments have arrived, so storing a fragment, rejecting a duplicate and detecting
+/// completion are constant work, and memory use is fixed when the buffer is created.
+/// Partial messages are dropped once no fragment has arrived for the reassembly timeout,
+/// and the least recently active one is evicted when a new message needs its room.
+/// Messages sent with FEC are rebuilt from their parity as soon as a block allows it.
+
+#include <cstdint>
+#include <vector>
+
+#include "fec.hpp"
+#include "fragment_bitmap.hpp"
+#include "message.hpp"
+
+#ifndef REASSEMBLY_SLOTS
+#define REASSEMBLY_SLOTS 2 // long messages that can be reassembled at the same time
+#endif
+
+// largest long message a slot can hold, in fragments, up to MAX_MESSAGE_PACKET_COUNT. By default, anything the long
+// header can count, so any message of up to 255 packets is received without setup, larger ones need a larger pool
+#ifndef REASSEMBLY_SLOT_FRAGMENTS
+#define REASSEMBLY_SLOT_FRAGMENTS MAX_LONG_MSG_PACKET_COUNT
+#endif
+
+#ifndef REASSEMBLY_TIMEOUT
+#define REASSEMBLY_TIMEOUT 10000 // ms without a new fragment before a partial message is dropped
+#endif
+
+namespace wircom
+{
+    struct ReassemblySlot
+    {
+        bool inUse = false;
+        std::uint16_t messageID = 0;
+        MessageFlag flag;
+        std::uint16_t packetCount = 0;
+        std::size_t receivedCount = 0;
+        std::size_t size = 0; // total payload size, known once the last fragment arrives
+        bool ackRequested = false;
+        std::uint32_t firstActivity = 0; // when the first fragment arrived
+        std::uint32_t lastActivity = 0; // when the last new fragment arrived
+        std::uint8_t *received = nullptr; // one bit per fragment, owned by the ReassemblyBuffer
+        FecLayout fec;                // for messages with the FEC flag
+        std::size_t dataReceived = 0; // data fragments of an FEC message, received or rebuilt
+
+        bool hasFragment(std::size_t packetNumber) const
+        {
+            return (received[packetNumber / 8] & (1 << (packetNumber % 8))) != 0;
+        }
+
+        bool isComplete() const
+        {
+            return inUse && (flag.isFEC() ? dataReceived == fec.dataCount : receivedCount == packetCount);
+        }
+
+        /// @brief The fragments that have arrived, or been rebuilt, as they are reported in selective acks.
+        FragmentBitmap receivedFragments() const
+        {
+            return FragmentBitmap::fromBytes(packetCount, received, (packetCount + 7) / 8);
+        }
+
+        /// @brief The bytes this message claims from the byte budget, its size once complete.
+        std::size_t reservedBytes() const
+        {
+            return (std::size_t)packetCount * MAX_LONG_MSG_PAYLOAD_SIZE;
+        }
+    };
+
+    struct ReassemblyStats
+    {
+        std::uint32_t completed = 0; // messages reassembled
+        std::uint32_t expired = 0;   // incomplete messages dropped after the reassembly timeout
+        std::uint32_t evicted = 0;   // incomplete messages dropped to make room for a newer one
+        std::uint32_t rejected = 0;  // fragments that could not be stored
+        std::uint32_t recovered = 0; // fragments rebuilt from FEC parity
+    };
+
+    enum ReassemblyStatus
+    {
+        REASSEMBLY_STORED,    // the fragment was stored, more are needed
+        REASSEMBLY_DUPLICATE, // the fragment was already there
+        REASSEMBLY_COMPLETE,  // the fragment completed the message
+        REASSEMBLY_REJECTED,  // no slot was free, the message is too large, or the fragment is malformed
+    };
+
+    class ReassemblyBuffer
+    {
+    public:
+        ReassemblyBuffer(std::size_t slotCount = REASSEMBLY_SLOTS, std::size_t slotFragments = REASSEMBLY_SLOT_FRAGMENTS);
+
+        // the slots point into the buffer's storage
+        ReassemblyBuffer(const ReassemblyBuffer &) = delete;
+        ReassemblyBuffer &operator=(const ReassemblyBuffer &) = delete;
+
+        /// @brief Stores a fragment of a long message in its slot. A new message claims a free slot,
+        /// evicting the least recently active partial messages if no slot is free or the byte budget is used up.
+        /// @param packet The fragment, its payload is copied out before this returns.
+        /// @param now The current time, in ms.
+        /// @param slot Set to the slot the fragment belongs to, or nullptr if it was rejected.
+        ReassemblyStatus add(const PacketView &packet, std::uint32_t now, ReassemblySlot *&slot);
+
+        /// @brief Reallocates the pool, e.g. with room for a multi-megabyte transfer on a receiver with the memory
+        /// for it. Drops every partial message, and resets the byte budget to the whole pool.
+        void resize(std::size_t slotCount, std::size_t slotFragments);
+
+        /// @brief Drops the partial messages that have not received a fragment within the timeout.
+        /// @return The number of messages dropped.
+        std::size_t expire(std::uint32_t now);
+
+        /// @brief Finds the slot for a message, or nullptr if it is not being reassembled.
+        ReassemblySlot *find(std::uint16_t messageID);
+
+        /// @brief The reassembled payload of a complete slot, valid until the slot is released.
+        PayloadView payload(const ReassemblySlot &slot) const;
+
+        /// @brief Frees a slot for the next message.
+        void release(ReassemblySlot &slot);
+
+        /// @brief Sets how long a partial message may go without a new fragment, in ms. 0 never expires them.
+        void setTimeout(std::uint32_t timeout) { _timeout = timeout; }
+        std::uint32_t timeout() const { return _timeout; }
+
+        /// @brief Caps the bytes all partial messages together may claim, on top of the slot count.
+        /// Defaults to the whole pool.
+        void setByteBudget(std::size_t bytes) { _byteBudget = bytes; }
+
+        const ReassemblyStats &stats() const { return _stats; }
+
+        std::size_t slotCount() const { return _slots.size(); }
+        std::size_t slotCapacity() const { return _slotFragments * MAX_LONG_MSG_PAYLOAD_SIZE; }
+        std::size_t slotsInUse() const;
+        std::size_t bytesInUse() const;
+
+    private:
+        std::vector<ReassemblySlot> _slots;
+        std::vector<std::uint8_t> _storage;  // slot i owns [i * slotCapacity(), (i + 1) * slotCapacity())
+        std::vector<std::uint8_t> _received; // the bitmaps of the slots, slotFragments bits each
+        std::size_t _slotFragments;
+        std::uint32_t _timeout = REASSEMBLY_TIMEOUT;
+        std::size_t _byteBudget;
+        ReassemblyStats _stats;
+
+        ReassemblySlot *_claimSlot(std::size_t bytes);
+        bool _storeFEC(ReassemblySlot &slot, const PacketView &packet);
+        void _recoverBlock(ReassemblySlot &slot, std::size_t block);
+        void _markReceived(ReassemblySlot &slot, std::size_t packetNumber);
+        ReassemblySlot *_leastRecentlyActive();
+
+        std::uint8_t *_slotData(const ReassemblySlot &slot);
+        const std::uint8_t *_slotData(const ReassemblySlot &slot) const;
+    };
+} // namespace wircom
+
+#endif // __REASSEMBLY_H__
@@ -0,0 +1,52 @@
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+#ifndef __RF95_TRANSPORT_H__
+#define __RF95_TRANSPORT_H__
+
+/// rf95_transport.hpp
+/// Transport backend for the RFM95 LoRa module, through the RadioHead RH_RF95 driver.
+/// With a receive handler installed, the DIO0 interrupt is routed through this class: RadioHead
+/// still services the radio, and every packet it reads is passed on straight from the interrupt.
+
+#include <SPI.h>
+#include <RH_RF95.h>
+
+#include "transport.hpp"
+
+namespace wircom
+{
+    class RF95Transport : public Transport
+    {
+    public:
+        RF95Transport(RH_RF95 &driver, int resetPin, int interruptPin, float frequency, int power)
+            : _driver(driver), _resetPin(resetPin), _interruptPin(interruptPin), _frequency(frequency), _power(power) {}
+
+        bool init() override;
+        bool send(const std::uint8_t *data, std::uint8_t length) override;
+        bool waitPacketSent() override;
+        bool transmitting() override;
+        bool available() override;
+        bool recv(std::uint8_t *buffer, std::uint8_t *length) override;
+        void setDataRate(int spreadingFactor, long bandwidth) override;
+        int lastRssi() override;
+        int lastSNR() override;
+        bool setReceiveHandler(ReceiveHandler handler, void *context) override;
+
+    private:
+        // like RadioHead's own interrupt routing, one radio can own the interrupt
+        inline static RF95Transport *_interruptOwner = nullptr;
+
+        RH_RF95 &_driver;
+        ReceiveHandler _receiveHandler = nullptr;
+        void *_receiveContext = nullptr;
+        const int _resetPin = 2;
+        const int _interruptPin = 3;
+        const float _frequency = 1575.42;
+        const int _power = 23;
+
+        void _attachInterrupt();
+        static void _onInterrupt();
+    };
+} // namespace wircom
+
+#endif // __RF95_TRANSPORT_H__
+#endif // defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
@@ -0,0 +1,109 @@
+#ifndef __RTT_ESTIMATOR_H__
+#define __RTT_ESTIMATOR_H__
+
+/// rtt_estimator.hpp
+/// Round trip time estimation for the retransmission timeout, following RFC 6298:
+/// a smoothed RTT and RTT variance are updated from every unambiguous sample, and the
+/// timeout doubles on every expiry until the next valid sample arrives (Karn's algorithm).
+/// Answers to retransmitted messages never become samples, but can drop the backoff, see addAmbiguousSample().
+
+#include <cstdint>
+
+#define MIN_RETRANSMIT_TIMEOUT 100
+#define MAX_RETRANSMIT_TIMEOUT 60000
+
+namespace wircom
+{
+    class RttEstimator
+    {
+    public:
+        explicit RttEstimator(std::uint32_t initialTimeout) : _initialTimeout(initialTimeout) {}
+
+        /// @brief Feeds a round trip time, in ms. Only pass samples from messages that were never
+        /// retransmitted, otherwise it is unknown which transmission the answer belongs to.
+        void addSample(std::uint32_t rtt)
+        {
+            if (!this->_hasSamples)
+            {
+                this->_srtt = rtt;
+                this->_rttvar = rtt / 2.0f;
+                this->_hasSamples = true;
+            }
+            else
+            {
+                float error = (this->_srtt > rtt) ? this->_srtt - rtt : rtt - this->_srtt;
+                this->_rttvar = 0.75f * this->_rttvar + 0.25f * error;
+                this->_srtt = 0.875f * this->_srtt + 0.125f * rtt;
+            }
+
+            this->_backoff = 0;
+        }
+
+        /// @brief Feeds the answer to a retransmitted message. The time since the last transmission
+        /// is a lower bound on the round trip. If it fits within the unbacked-off timeout, the timeout
+        /// fired because of loss and not because the estimate is too short, so the backoff is dropped;
+        /// on LoRa, loss is not congestion. Otherwise the backoff stays until a valid sample arrives.
+        void addAmbiguousSample(std::uint32_t lowerBound)
+        {
+            if (this->_hasSamples && lowerBound <= this->_baseTimeout())
+            {
+                this->_backoff = 0;
+            }
+        }
+
+        /// @brief Doubles the timeout after it expired. Sticks until the next valid sample.
+        void backoff()
+        {
+            if (this->_backoff < 16)
+            {
+                this->_backoff++;
+            }
+        }
+
+        /// @brief Rescales the estimate, e.g. by old / new bit rate after switching data rates.
+        void scale(float factor)
+        {
+            if (!this->_hasSamples)
+            {
+                // the initial timeout is a conservative guess, not a measurement
+                return;
+            }
+
+            this->_srtt *= factor;
+            this->_rttvar *= factor;
+        }
+
+        /// @brief The current retransmission timeout, in ms, including any backoff.
+        std::uint32_t timeout() const
+        {
+            float timeout = this->_baseTimeout() * (1u << this->_backoff);
+            if (timeout < MIN_RETRANSMIT_TIMEOUT)
+            {
+                return MIN_RETRANSMIT_TIMEOUT;
+            }
+            if (timeout > MAX_RETRANSMIT_TIMEOUT)
+            {
+                return MAX_RETRANSMIT_TIMEOUT;
+            }
+            return (std::uint32_t)timeout;
+        }
+
+        bool hasSamples() const { return this->_hasSamples; }
+        float srtt() const { return this->_srtt; }
+        float rttvar() const { return this->_rttvar; }
+
+    private:
+        float _baseTimeout() const
+        {
+            return this->_hasSamples ? this->_srtt + 4.0f * this->_rttvar : this->_initialTimeout;
+        }
+
+        std::uint32_t _initialTimeout;
+        float _srtt = 0.0f;
+        float _rttvar = 0.0f;
+        bool _hasSamples = false;
+        std::uint8_t _backoff = 0;
+    };
+} // namespace wircom
+
+#endif // __RTT_ESTIMATOR_H__
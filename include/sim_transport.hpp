@@ -0,0 +1,157 @@
+#ifndef __SIM_TRANSPORT_H__
+#define __SIM_TRANSPORT_H__
+
+/// sim_transport.hpp
+/// An in-process, simulated LoRa channel, so that ComInterface instances can talk to each
+/// other natively. Time on the network is virtual and only moves when advance() is called,
+/// which keeps tests and benchmarks deterministic. The network and its transports can be
+/// used from several threads, every operation on them is serialized by one lock.
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "message.hpp"
+#include "transport.hpp"
+
+namespace wircom
+{
+    class SimulatedTransport;
+
+    struct SimulatedChannelConfig
+    {
+        std::uint32_t latency = 0;        // one-way latency added to every packet, in ms
+        std::uint32_t bitRate = 0;        // link bit rate in bits/s, 0 derives it from the sender's spreading factor and bandwidth
+        std::uint32_t packetOverhead = 0; // time on air added to every packet for the preamble and radio header, in ms
+        bool loraTiming = false;          // time on air from the LoRa formula instead of the bit rate, see timeOnAir()
+        float lossRate = 0.0f;            // probability that a packet is dropped
+        float duplicateRate = 0.0f;       // probability that a packet is delivered twice
+        float corruptRate = 0.0f;         // probability that a delivered packet has a bit flipped, past the radio's own CRC
+        float reorderRate = 0.0f;         // probability that a packet is held back, so later packets overtake it
+        std::uint32_t reorderDelay = 50;  // how long a reordered packet is held back, in ms
+        float snr = 20.0f;                // signal to noise ratio at the receivers at 125 kHz, in dB. Packets fade out
+                                          // within 1.5 dB of their data rate's demodulation floor, see LinkAdaptation::requiredSNR()
+        std::uint32_t seed = 1;           // seed for the loss, duplication, corruption and reordering decisions
+    };
+
+    struct SimulatedChannelStats
+    {
+        std::uint32_t packetsSent = 0;
+        std::uint32_t packetsDelivered = 0;
+        std::uint32_t packetsLost = 0;
+        std::uint32_t packetsDuplicated = 0;
+        std::uint32_t packetsCorrupted = 0;
+        std::uint32_t packetsReordered = 0;
+        std::uint32_t packetsFaded = 0; // lost because the SNR was too low for their data rate, also counted in packetsLost
+        std::uint32_t bytesSent = 0;
+        std::uint32_t airtime = 0; // total time spent transmitting, in ms
+    };
+
+    /// SimulatedNetwork
+    /// The shared medium. Every packet sent by one endpoint is broadcast to all other endpoints
+    /// that are tuned to the same data rate, subject to the configured impairments.
+    class SimulatedNetwork
+    {
+    public:
+        SimulatedChannelConfig config;
+        SimulatedChannelStats stats;
+
+        /// Optional hook to drop specific packets, on top of the random loss. Return true to drop.
+        /// Called with the network lock held.
+        std::function<bool(const std::uint8_t *data, std::uint8_t length)> dropFilter;
+
+        SimulatedNetwork() : SimulatedNetwork(SimulatedChannelConfig()) {}
+        explicit SimulatedNetwork(SimulatedChannelConfig config) : config(config), _rng(config.seed) {}
+
+        SimulatedNetwork(const SimulatedNetwork &) = delete;
+        SimulatedNetwork &operator=(const SimulatedNetwork &) = delete;
+
+        std::uint32_t now() const { return _now.load(); }
+
+        /// @brief Moves virtual time forward, and raises the receive interrupt of every radio
+        /// with a receive handler for the packets that arrived in the meantime.
+        void advance(std::uint32_t ms);
+
+        /// @brief Makes this network's virtual time the wircom Clock.
+        /// Call Clock::setSource(nullptr) to go back to the platform clock.
+        void useAsClock();
+
+    private:
+        friend class SimulatedTransport;
+
+        std::vector<SimulatedTransport *> _endpoints;
+        std::atomic<std::uint32_t> _now{0};
+        std::mt19937 _rng;
+        std::recursive_mutex _mutex; // recursive, as raising interrupts reads packets through the transports
+
+        void _transmit(SimulatedTransport &sender, const std::uint8_t *data, std::uint8_t length);
+        void _raiseInterrupts();
+        bool _chance(float probability);
+    };
+
+    /// SimulatedTransport
+    /// One radio attached to a SimulatedNetwork. Transmissions are serialized at the link bit rate,
+    /// so a burst of packets takes as long to arrive as it would on air. send() never blocks, but
+    /// waitPacketSent() moves the network's virtual time to the end of the transmission, like the
+    /// real driver blocks its caller.
+    class SimulatedTransport : public Transport
+    {
+    public:
+        explicit SimulatedTransport(SimulatedNetwork &network);
+        ~SimulatedTransport();
+
+        SimulatedTransport(const SimulatedTransport &) = delete;
+        SimulatedTransport &operator=(const SimulatedTransport &) = delete;
+
+        bool init() override;
+        bool send(const std::uint8_t *data, std::uint8_t length) override;
+        bool waitPacketSent() override;
+        bool transmitting() override;
+        bool available() override;
+        bool recv(std::uint8_t *buffer, std::uint8_t *length) override;
+        void setDataRate(int spreadingFactor, long bandwidth) override;
+        int lastRssi() override { return _lastRssi; }
+        int lastSNR() override { return _lastSNR; }
+        bool setReceiveHandler(ReceiveHandler handler, void *context) override;
+
+        /// @brief The bit rate this radio currently transmits at, in bits/s.
+        std::uint32_t bitRate() const;
+
+        /// @brief How long a packet of the given length occupies the channel, in ms.
+        std::uint32_t airtime(std::size_t length) const;
+
+    private:
+        friend class SimulatedNetwork;
+
+        struct InFlightPacket
+        {
+            std::uint32_t deliverAt;
+            std::uint32_t sequence;
+            int spreadingFactor;
+            long bandwidth;
+            int rssi;
+            int snr;
+            std::uint8_t length;
+            std::uint8_t data[MAX_PACKET_SIZE];
+        };
+
+        SimulatedNetwork &_network;
+        std::vector<InFlightPacket> _inbox;
+        std::uint32_t _txBusyUntil = 0;
+        std::uint32_t _nextSequence = 0;
+        int _spreadingFactor = 7;
+        long _bandwidth = 125000;
+        int _lastRssi = 0;
+        int _lastSNR = 0;
+        ReceiveHandler _receiveHandler = nullptr;
+        void *_receiveContext = nullptr;
+
+        int _nextDeliverable() const;
+        void _dropUndecodable();
+    };
+} // namespace wircom
+
+#endif // __SIM_TRANSPORT_H__
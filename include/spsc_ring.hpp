@@ -0,0 +1,92 @@
+#ifndef __SPSC_RING_H__
+#define __SPSC_RING_H__
+
+/// spsc_ring.hpp
+/// A fixed-size, lock-free ring buffer for one producer and one consumer, e.g. a radio
+/// interrupt handing received packets to the main loop. Slots are written and read in place
+/// (prepare()/publish() and front()/pop()), so packets are never copied through the ring.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace wircom
+{
+    template <typename T, std::size_t N>
+    class SpscRing
+    {
+        static_assert(N > 0 && (N & (N - 1)) == 0, "SpscRing size must be a power of two");
+
+    public:
+        SpscRing() = default;
+
+        SpscRing(const SpscRing &) = delete;
+        SpscRing &operator=(const SpscRing &) = delete;
+
+        /// @brief Producer: the slot to write the next item into, or nullptr if the ring is full.
+        /// The item only becomes visible to the consumer on publish().
+        T *prepare()
+        {
+            std::size_t head = this->_head.load(std::memory_order_relaxed);
+            if (head - this->_tail.load(std::memory_order_acquire) == N)
+            {
+                this->_overflows.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            return &this->_slots[head % N];
+        }
+
+        /// @brief Producer: hands the slot returned by prepare() to the consumer.
+        void publish()
+        {
+            this->_head.store(this->_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        bool push(const T &item)
+        {
+            T *slot = this->prepare();
+            if (slot == nullptr)
+            {
+                return false;
+            }
+
+            *slot = item;
+            this->publish();
+            return true;
+        }
+
+        /// @brief Consumer: the oldest item, or nullptr if the ring is empty. Stays valid until pop().
+        T *front()
+        {
+            std::size_t tail = this->_tail.load(std::memory_order_relaxed);
+            if (tail == this->_head.load(std::memory_order_acquire))
+            {
+                return nullptr;
+            }
+
+            return &this->_slots[tail % N];
+        }
+
+        /// @brief Consumer: releases the item returned by front() back to the producer.
+        void pop()
+        {
+            this->_tail.store(this->_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        std::size_t size() const { return this->_head.load(std::memory_order_acquire) - this->_tail.load(std::memory_order_acquire); }
+        bool empty() const { return this->size() == 0; }
+        static constexpr std::size_t capacity() { return N; }
+
+        /// @brief How many items the producer could not add because the ring was full.
+        std::uint32_t overflows() const { return this->_overflows.load(std::memory_order_relaxed); }
+
+    private:
+        T _slots[N];
+        std::atomic<std::size_t> _head{0}; // next slot to write, only advanced by the producer
+        std::atomic<std::size_t> _tail{0}; // next slot to read, only advanced by the consumer
+        std::atomic<std::uint32_t> _overflows{0};
+    };
+} // namespace wircom
+
+#endif // __SPSC_RING_H__
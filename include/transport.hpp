@@ -0,0 +1,63 @@
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+/// transport.hpp
+/// The interface between ComInterface and the radio it talks through.
+/// The RFM95 driver is one backend (rf95_transport.hpp), the in-process simulated
+/// channel is another (sim_transport.hpp). The calls mirror the RadioHead driver API.
+
+#include <cstdint>
+
+namespace wircom
+{
+    /// Receives a packet from the transport's interrupt handler, see Transport::setReceiveHandler().
+    /// Runs in interrupt context, so it must not block, allocate or log.
+    typedef void (*ReceiveHandler)(void *context, const std::uint8_t *data, std::uint8_t length);
+
+    class Transport
+    {
+    public:
+        virtual ~Transport() {}
+
+        /// @brief Brings up the radio.
+        /// @return false if the radio could not be initialized.
+        virtual bool init() = 0;
+
+        /// @brief Queues a single packet for transmission.
+        /// @return false if the packet could not be queued.
+        virtual bool send(const std::uint8_t *data, std::uint8_t length) = 0;
+
+        /// @brief Blocks until the last packet passed to send() has left the radio.
+        virtual bool waitPacketSent() = 0;
+
+        /// @brief Whether the last packet passed to send() is still on air, so that callers can
+        /// queue packets instead of blocking in waitPacketSent().
+        virtual bool transmitting() = 0;
+
+        /// @brief Whether a received packet is waiting to be read with recv().
+        virtual bool available() = 0;
+
+        /// @brief Reads the next received packet.
+        /// @param buffer Where to copy the packet.
+        /// @param length In: the size of buffer. Out: the size of the packet.
+        /// @return false if no packet was available.
+        virtual bool recv(std::uint8_t *buffer, std::uint8_t *length) = 0;
+
+        /// @brief Switches the modem to a different spreading factor and bandwidth (in Hz).
+        virtual void setDataRate(int spreadingFactor, long bandwidth) = 0;
+
+        /// @brief The signal strength of the last received packet, in dBm, or 0 if the radio does not measure it.
+        virtual int lastRssi() { return 0; }
+
+        /// @brief The signal to noise ratio of the last received packet, in dB.
+        virtual int lastSNR() { return 0; }
+
+        /// @brief Hands every received packet to handler as soon as it arrives, from the radio interrupt,
+        /// instead of leaving it to be picked up with available() and recv().
+        /// @param handler The handler, or nullptr to go back to polling.
+        /// @return false if this transport can only be polled.
+        virtual bool setReceiveHandler(ReceiveHandler, void *) { return false; }
+    };
+} // namespace wircom
+
+#endif // __TRANSPORT_H__
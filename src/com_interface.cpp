@@ -1,58 +1,49 @@
-#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
-
 #include "com_interface.hpp"
-#include <SPI.h>
-#include <RH_RF95.h>
+#include "airtime.hpp"
+#include "builder.hpp"
+#include "crc.hpp"
+#include "log.hpp"
+#include "lz_codec.hpp"
+#include "platform.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <unordered_map>
 
 using namespace wircom;
 
-void ComInterface::initialize()
+// a checked long message ends with the CRC-32 of everything before it, which is cut off if it matches
+static bool _stripMessageCRC(PayloadView &payload)
 {
-    // manually reset the LoRa module
-    pinMode(this->_resetPin, OUTPUT);
-    digitalWrite(this->_resetPin, HIGH);
-
-    pinMode(this->_resetPin, OUTPUT);
-    digitalWrite(this->_resetPin, LOW);
-    delay(10);
-    digitalWrite(this->_resetPin, HIGH);
-    delay(10);
-
-    // initialize the LoRa radio
-    if (!this->rf95.init())
+    if (payload.size < MESSAGE_CRC_SIZE)
     {
-        Serial.println("LoRa radio init failed");
-        return;
+        return false;
     }
 
-    // set the LoRa radio frequency
-    if (!this->rf95.setFrequency(this->_frequency))
+    std::size_t size = payload.size - MESSAGE_CRC_SIZE;
+    const std::uint8_t *expected = payload.data + size;
+    std::uint32_t crc = ((std::uint32_t)expected[0] << 24) | (expected[1] << 16) | (expected[2] << 8) | expected[3];
+    if (Crc::crc32(payload.data, size) != crc)
     {
-        Serial.println("setFrequency failed");
-        return;
+        return false;
     }
 
-    // set the transmit power
-    this->rf95.setTxPower(this->_power, false);
+    payload.size = size;
+    return true;
 }
 
-ComInterface ComInterface::addRXCallback(MessageType messageType, MessageContentType contentType, std::function<void(Message)> callback)
+void ComInterface::initialize()
 {
-    std::unordered_map<MessageContentType, std::vector<std::function<void(Message)>>> &callbacks =
-        (messageType == MessageType::MSG_REQUEST) ? this->_requestMessageCallbacks : this->_responseMessageCallbacks;
-
-    if (callbacks.find(contentType) == callbacks.end())
-    {
-        callbacks[contentType] = std::vector<std::function<void(Message)>>();
-    }
-
-    callbacks[contentType].push_back(callback);
+    this->ready = this->_transport->init();
+}
 
+ComInterface &ComInterface::addRXCallback(MessageType messageType, MessageContentType contentType, MessageCallback callback)
+{
+    this->_dispatchTable.add(messageType, contentType, std::move(callback));
     return *this;
 }
 
-ComInterface ComInterface::addRXCallback(MessageType messageType, std::vector<MessageContentType> contentTypes, std::function<void(Message)> callback)
+ComInterface &ComInterface::addRXCallback(MessageType messageType, const std::vector<MessageContentType> &contentTypes, MessageCallback callback)
 {
     for (MessageContentType type : contentTypes)
     {
@@ -62,234 +53,1662 @@ ComInterface ComInterface::addRXCallback(MessageType messageType, std::vector<Me
     return *this;
 }
 
-ComInterface ComInterface::addRXCallbackToAny(MessageType messageType, std::function<void(Message)> callback)
+ComInterface &ComInterface::addRXCallbackToAny(MessageType messageType, MessageCallback callback)
 {
-    std::vector<MessageContentType> types = {
-        MessageContentType::MSG_CON_META,
-        MessageContentType::MSG_CON_DRIVE,
-        MessageContentType::MSG_CON_SWITCH_DATA_RATE,
-        MessageContentType::MSG_CON_DATA_TRANSFER,
-    };
+    this->_dispatchTable.addAny(messageType, std::move(callback));
+    return *this;
+}
 
-    return this->addRXCallback(messageType, types, callback);
+ComInterface &ComInterface::addRXViewCallback(MessageType messageType, MessageContentType contentType, MessageViewCallback callback)
+{
+    this->_dispatchTable.addView(messageType, contentType, std::move(callback));
+    return *this;
 }
 
 void ComInterface::switchDataRate(int spreadingFactor, int bandwidth)
 {
-    this->rf95.setSpreadingFactor(spreadingFactor);
-    this->rf95.setSignalBandwidth(bandwidth);
+    // queued behind any messages that are still to go out at the old data rate
+    RadioCommand command;
+    command.switchDataRate = true;
+    command.spreadingFactor = spreadingFactor;
+    command.bandwidth = bandwidth;
+    this->_queueCommand(std::move(command));
 }
 
-void ComInterface::listen(std::uint16_t timeout)
+void ComInterface::_switchDataRateNow(int spreadingFactor, long bandwidth)
 {
-    // std::cout << "Listening for messages..." << std::endl;
-
-    unsigned long start = millis();
-
-    // wait until the radio is done transmitting
-    while (this->_radioState == RADIO_STATE_TRANSMITTING && millis() - start < timeout)
+    // control packets and telemetry queued before the switch, and whatever is waiting in a batch, go out
+    // at the old rate. Fragments of long messages carry on at the new one
+    while (this->_sendQueuedPacket())
     {
-        // std::cout << "Radio is transmitting, waiting..." << std::endl;
-        YIELD;
     }
+    this->_flushBatch();
 
-    this->_radioState = RADIO_STATE_RECEIVING;
-    // std::cout << "starting timeout at " << start << std::endl;
-    while (millis() - start < timeout)
+    if (this->_eventMode)
     {
-        // wait for a bit
-        // we could be running on a different thread
-        // just in case another thread is trying to send a message
-        // yield to allow the other thread to run
-        // std::cout << "Checking..." << std::endl;
-        if (this->_radioState == RADIO_STATE_TRANSMITTING)
+        // the modem takes the new rate at once, even for packets it still has queued
+        while (!this->_txQueue.empty())
         {
-            // std::cout << "Radio is transmitting, waiting..." << std::endl;
-            YIELD;
-            continue;
+            this->_transport->waitPacketSent();
+            this->_pumpTX();
         }
+        this->_transport->waitPacketSent();
+    }
 
-        // check if we have a message
-        if (this->rf95.available())
-        {
-            break;
-        }
-        YIELD;
+    // round trips scale with the time on air, which goes with 2^SF / (SF * BW)
+    float oldRate = (float)this->_spreadingFactor * this->_bandwidth / (1u << this->_spreadingFactor);
+    float newRate = (float)spreadingFactor * bandwidth / (1u << spreadingFactor);
+    this->_rtt.scale(oldRate / newRate);
+
+    this->_spreadingFactor = spreadingFactor;
+    this->_bandwidth = bandwidth;
+    this->_transport->setDataRate(spreadingFactor, bandwidth);
+}
+
+void ComInterface::setAirtimeBudget(float dutyCycle, std::uint32_t window, AirtimePolicy policy)
+{
+    this->_acquireRadio();
+    this->_airtimeBudget.configure(dutyCycle, window, Clock::millis());
+    this->_airtimePolicy = policy;
+    this->_releaseRadio();
+}
+
+LoRaModulation ComInterface::modulation() const
+{
+    LoRaModulation modulation;
+    modulation.spreadingFactor = this->_spreadingFactor;
+    modulation.bandwidth = this->_bandwidth;
+    return modulation;
+}
+
+std::uint32_t ComInterface::messageAirtime(std::size_t payloadSize) const
+{
+    // under an ID of its own, so that asking does not use up the IDs of real messages
+    return this->_messageAirtime(Message(0, MSG_RESPONSE, MSG_CON_DATA_TRANSFER, std::vector<std::uint8_t>(payloadSize)));
+}
+
+std::uint32_t ComInterface::_messageAirtime(const Message &msg) const
+{
+    // a stand-in of the same size and kind, protected and encoded like _sendNow() would, so every header, CRC and
+    // parity fragment is counted, and the message's own data is neither copied nor read, e.g. from a file
+    Message sample(0, msg.flag.getMessageType(), msg.flag.getMessageContentType(), msg.dataSize(),
+                   [](std::size_t, std::uint8_t *out, std::size_t size)
+                   {
+                       std::memset(out, 0, size);
+                       return true;
+                   });
+    if (msg.flag.isFEC())
+    {
+        sample.enableFEC(msg.fecDataFragments(), msg.fecParityFragments());
     }
-    // std::cout << "Finished listening" << std::endl;
-    this->_radioState = RADIO_STATE_IDLE;
+    else if (msg.flag.isChecked())
+    {
+        sample.enableChecksum();
+    }
+    this->_protect(sample);
 
-    if (this->rf95.available() == false)
-        return; // nothing
+    std::uint32_t airtime = 0;
+    PacketBuffer packet;
+    for (std::size_t i = 0; i < sample.packetCount() && sample.encodePacket(i, packet); i++)
+    {
+        airtime += this->_airtimeOf(packet.size);
+    }
+    return airtime;
+}
 
-    // std::cout << "Available message..." << std::endl;
-    uint8_t buf[RH_RF95_MAX_MESSAGE_LEN];
-    uint8_t len = sizeof(buf);
+float ComInterface::maxFrameRate(std::size_t payloadSize) const
+{
+    return this->_airtimeBudget.dutyCycle() * 1000000.0f / this->messageAirtime(payloadSize);
+}
+
+std::uint32_t ComInterface::_airtimeOf(std::size_t frameSize) const
+{
+    return timeOnAir(this->modulation(), frameSize + RADIO_HEADER_SIZE);
+}
+
+void ComInterface::enableLinkAdaptation(const LinkAdaptationConfig &config)
+{
+    this->_acquireRadio();
+    std::uint32_t now = Clock::millis();
+    this->_linkAdaptation = LinkAdaptation(config, 0, now);
+    std::size_t current = this->_linkAdaptation.indexOf(DataRate{this->_spreadingFactor.load(), this->_bandwidth.load()});
+    if (current < config.rates.size())
+    {
+        this->_linkAdaptation = LinkAdaptation(config, current, now);
+    }
+    else
+    {
+        // the other side does the same, so both start out on the fallback rate
+        this->_switchDataRateNow(config.rates[0].spreadingFactor, config.rates[0].bandwidth);
+    }
+    this->_releaseRadio();
+}
+
+void ComInterface::_serviceLinkAdaptation()
+{
+    LinkAdaptation &adaptation = this->_linkAdaptation;
+    if (!adaptation.enabled())
+    {
+        return;
+    }
 
-    if (this->rf95.recv(buf, &len))
+    std::uint32_t now = Clock::millis();
+    if (adaptation.switchTimedOut(now))
     {
-        std::vector<std::uint8_t> data(buf, buf + len);
-        MessageParsingResult res = Message::decode(data);
-        if (!res.success)
+        bool switched = adaptation.state() == LINK_SWITCHED;
+        if (adaptation.config().initiator)
         {
-            return;
+            this->_acksRequired.erase(adaptation.requestID());
+        }
+        adaptation.revert(now);
+        WIRCOM_LOG_INFO("Data rate switch not confirmed, staying at SF" << adaptation.rate().spreadingFactor << " "
+                                                                        << adaptation.rate().bandwidth << " Hz");
+        if (switched)
+        {
+            this->_switchDataRateNow(adaptation.rate().spreadingFactor, adaptation.rate().bandwidth);
         }
+        return;
+    }
 
-        this->_handleRXMessage(res);
+    if (adaptation.silent(now))
+    {
+        adaptation.fallBack(now);
+        WIRCOM_LOG_WARN("Nothing heard for " << adaptation.config().silenceTimeout << " ms, falling back to SF"
+                                             << adaptation.rate().spreadingFactor << " " << adaptation.rate().bandwidth << " Hz");
+        this->_switchDataRateNow(adaptation.rate().spreadingFactor, adaptation.rate().bandwidth);
+        return;
     }
-}
 
-void ComInterface::sendMessage(Message msg, bool ackRequired)
-{
-    RadioState startingState = this->_radioState;
-    this->_radioState = RADIO_STATE_TRANSMITTING;
+    if (!adaptation.config().initiator || adaptation.state() != LINK_STEADY)
+    {
+        return;
+    }
 
-    std::vector<std::vector<std::uint8_t>> packets = msg.encode();
-    for (int i = 0; i < packets.size(); i++)
+    std::size_t target = adaptation.target(now);
+    if (target != adaptation.current())
     {
-        this->rf95.send(packets[i].data(), packets[i].size());
-        this->rf95.waitPacketSent();
+        const DataRate &rate = adaptation.rate(target);
+        WIRCOM_LOG_INFO("Proposing to switch to SF" << rate.spreadingFactor << " " << rate.bandwidth << " Hz at "
+                                                    << adaptation.snr() << " dB SNR, " << adaptation.lossRate() << " loss");
+        Message request = MessageBuilder::createDataRateSwitchRequest(SWITCH_PROPOSE, rate.spreadingFactor, rate.bandwidth);
+        adaptation.propose(target, request.messageID, now);
+        this->_sendNow(std::move(request), true);
+        return;
     }
 
-    // add the message to the list of messages that require an ack, if the message type requires one
-    if (ackRequired && msg.flag.getMessageType() == MessageType::MSG_REQUEST)
+    // a quiet link would fall back, so both sides hear from each other at least every half silenceTimeout
+    if (adaptation.current() > 0 && now - adaptation.lastHeard() > adaptation.config().silenceTimeout / 2 &&
+        this->_acksRequired.find(adaptation.requestID()) == this->_acksRequired.end())
     {
-        std::cout << "Sending message with ID " << msg.messageID << std::endl;
-        std::cout << "Expecting an ack..." << std::endl;
-        this->_acksRequired[msg.messageID] = SentMessage{msg, millis(), 0};
+        Message probe = MessageBuilder::createDataRateSwitchRequest(SWITCH_COMMIT, adaptation.rate().spreadingFactor, adaptation.rate().bandwidth);
+        adaptation.setRequestID(probe.messageID);
+        this->_sendNow(std::move(probe), true);
     }
-    this->_radioState = startingState;
 }
 
-void ComInterface::tick()
+bool ComInterface::_handleDataRateSwitch(const MessageView &view)
 {
-    std::vector<std::uint16_t> toRemove;
-    for (auto &sentMessage : this->_acksRequired)
+    LinkAdaptation &adaptation = this->_linkAdaptation;
+    std::uint32_t now = Clock::millis();
+    if (view.messageType() == MessageType::MSG_RESPONSE)
     {
-        SentMessage &msg = sentMessage.second;
-        std::uint16_t id = sentMessage.first;
-        if (millis() - msg.timeSent > SEND_TIMEOUT)
+        if (view.messageID != adaptation.requestID())
         {
-            if (msg.retries < MAX_RETRIES)
-            {
-                std::cout << "Resending message with ID " << msg.message.messageID
-                          << " (retry " << (int)msg.retries << ")" << std::endl;
-                // resend the message
-                this->sendMessage(msg.message, false);
-                msg.timeSent = millis();
-                msg.retries++;
-            }
-            else
+            return false;
+        }
+
+        this->_acksRequired.erase(view.messageID);
+        bool okay = !view.payload.empty() && view.payload[0] != 0;
+        if (adaptation.state() == LINK_PROPOSED)
+        {
+            if (!okay)
             {
-                // we've reached the max number of retries
-                // remove the message from the list
-                std::cout << "Message with ID " << msg.message.messageID << " has timed out" << std::endl;
-                toRemove.push_back(msg.message.messageID);
+                adaptation.revert(now);
+                return true;
             }
+
+            // the other side has moved, follow it and confirm from the new rate
+            std::size_t target = adaptation.proposed();
+            adaptation.switchTo(target, now);
+            this->_switchDataRateNow(adaptation.rate().spreadingFactor, adaptation.rate().bandwidth);
+            Message commit = MessageBuilder::createDataRateSwitchRequest(SWITCH_COMMIT, adaptation.rate().spreadingFactor, adaptation.rate().bandwidth);
+            adaptation.setRequestID(commit.messageID);
+            this->_sendNow(std::move(commit), true);
+        }
+        else if (adaptation.state() == LINK_SWITCHED && okay)
+        {
+            adaptation.confirm(now);
+            WIRCOM_LOG_INFO("Switched to SF" << adaptation.rate().spreadingFactor << " " << adaptation.rate().bandwidth << " Hz");
         }
+        return true;
     }
 
-    for (std::uint16_t id : toRemove)
+    ContentResult<DataRateSwitchContent> request = MessageParser::parseContent<DataRateSwitchContent>(view.payload);
+    if (!request.success)
     {
-        this->_acksRequired.erase(id);
+        // a switch the application negotiates itself
+        return false;
+    }
+
+    DataRate rate{request.content.spreadingFactor, request.content.bandwidth};
+    std::size_t index = adaptation.indexOf(rate);
+    if (request.content.phase == SWITCH_COMMIT)
+    {
+        // only heard if both sides are on the rate
+        bool okay = index == adaptation.current();
+        this->_sendNow(MessageBuilder::createSwitchDataRateMessageResponse(view.messageID, okay), false);
+        if (okay)
+        {
+            adaptation.confirm(now);
+        }
+        return true;
+    }
+
+    // both sides proposing at once would leave them each waiting for the other
+    bool okay = index < adaptation.config().rates.size() && adaptation.state() == LINK_STEADY && !adaptation.config().initiator;
+    this->_sendNow(MessageBuilder::createSwitchDataRateMessageResponse(view.messageID, okay), false);
+    if (okay && index != adaptation.current())
+    {
+        // the answer goes out at the old rate first, see _switchDataRateNow()
+        adaptation.switchTo(index, now);
+        this->_switchDataRateNow(rate.spreadingFactor, rate.bandwidth);
     }
+    return true;
 }
 
-void ComInterface::_handleRXMessage(MessageParsingResult res)
+bool ComInterface::enableEventMode()
 {
-    // std::cout << "res.packetCount " << res.packetCount << std::endl;
-    if (res.packetCount == 1)
+    if (!this->_transport->setReceiveHandler(&ComInterface::_onPacketReceived, this))
     {
-        // std::cout << "Received single packet message of type " << res.contentType << std::endl;
-        // std::cout << "Message length: " << res.payload.size() << std::endl;
-        // this is a normal message, we don't need to collect any more packets
-        std::unordered_map<MessageContentType, std::vector<std::function<void(Message)>>> callbacks =
-            (res.messageType == MessageType::MSG_REQUEST) ? this->_requestMessageCallbacks : this->_responseMessageCallbacks;
+        WIRCOM_LOG_WARN("Transport can only be polled, staying in polling mode");
+        return false;
+    }
 
-        if (callbacks.find(res.contentType) != callbacks.end())
+    this->_eventMode = true;
+    return true;
+}
+
+void ComInterface::poll()
+{
+    this->_acquireRadio();
+    this->_poll();
+    this->_releaseRadio();
+}
+
+void ComInterface::_poll()
+{
+    if (!this->_eventMode)
+    {
+        while (this->_transport->available())
         {
-            Message msg = Message(res.messageID, res.messageType, res.contentType, res.payload);
-            for (auto &callback : callbacks[res.contentType])
-            {
-                callback(msg);
-            }
+            this->_listen(0);
         }
+        return;
+    }
+
+    // the interrupt has already copied the packets out of the radio, all that is left is dispatch
+    PacketBuffer *frame;
+    while ((frame = this->_rxQueue.front()) != nullptr)
+    {
+        this->_handleRXFrame(frame->data, frame->size);
+        this->_rxQueue.pop();
+    }
+
+    this->_serviceTX();
+    this->_pumpTX();
+}
 
-        if (res.messageType == MessageType::MSG_RESPONSE)
+void ComInterface::_onPacketReceived(void *context, const std::uint8_t *data, std::uint8_t length)
+{
+    // interrupt context: no logging and no allocation, a full queue is counted by the ring
+    ComInterface *self = static_cast<ComInterface *>(context);
+    PacketBuffer *frame = self->_rxQueue.prepare();
+    if (frame == nullptr)
+    {
+        return;
+    }
+
+    std::memcpy(frame->data, data, length);
+    frame->size = length;
+    self->_rxQueue.publish();
+}
+
+void ComInterface::setBatching(std::uint32_t flushDeadline)
+{
+    this->_acquireRadio();
+    this->_flushBatch();
+    this->_batching = flushDeadline > 0;
+    this->_batchDeadline = flushDeadline;
+    this->_releaseRadio();
+}
+
+void ComInterface::_queuePacket(const PacketBuffer &packet, TrafficClass trafficClass)
+{
+    if (trafficClass == TRAFFIC_TELEMETRY)
+    {
+        if (this->_telemetryQueued)
         {
-            // this is a completed message, mark it as acked
-            this->_acksRequired.erase(res.messageID);
+            // the client only cares about the latest frame
+            this->_txStats.staleDropped++;
         }
 
+        this->_telemetry = packet;
+        this->_telemetryQueued = true;
         return;
     }
 
-    std::cout
-        << "Received packet " << res.packetNumber
-        << " of " << res.packetCount
-        << " for message type " << res.contentType
-        << " for message ID " << res.messageID << std::endl;
+    if (!this->_controlQueue.push(packet))
+    {
+        // the oldest goes out from here, which holds up whoever is queueing this much
+        this->_transmit(*this->_controlQueue.front());
+        this->_controlQueue.pop();
+        this->_txStats.sent[TRAFFIC_CONTROL]++;
+        this->_controlQueue.push(packet);
+    }
+}
 
-    if (this->_messageBuffer.find(res.messageID) == this->_messageBuffer.end())
+void ComInterface::_serviceTX()
+{
+    // packets queued while we are sending, e.g. by the stream or by other threads, are picked up by the loop below
+    if (this->_servicingTX)
     {
-        this->_messageBuffer[res.messageID] = std::vector<MessageParsingResult>();
+        return;
     }
+    this->_servicingTX = true;
 
-    // check if we already have this packet
-    for (auto &msg : this->_messageBuffer[res.messageID])
+    // in event mode the radio is only handed a packet once it is idle, so that what is queued meanwhile can still overtake
+    while (!this->_eventMode || (this->_txQueue.empty() && !this->_transport->transmitting()))
     {
-        if (msg.packetNumber == res.packetNumber)
+        if (!this->_budgetAllowsNext())
         {
-            // we already have this packet
-            return;
+            // tick() tries again, by then the budget may have refilled
+            break;
+        }
+
+        if (this->_sendQueuedPacket())
+        {
+            continue;
+        }
+
+        if (!this->_sendBulkFragment())
+        {
+            break;
         }
+
+        // a fragment is long on air, telemetry that came due meanwhile and messages from other threads go next
+        this->_serviceStream();
+        this->_runQueuedCommands();
     }
 
-    this->_messageBuffer[res.messageID].push_back(res);
+    this->_servicingTX = false;
+}
 
-    // go and update the timers on the request, if it exists
-    if (this->_acksRequired.find(res.messageID) != this->_acksRequired.end())
+bool ComInterface::_budgetAllowsNext()
+{
+    if (!this->_airtimeBudget.enabled())
     {
-        std::cout << "Resetting timeout for message with ID " << res.messageID << std::endl;
-        this->_acksRequired[res.messageID].timeSent = millis();
+        return true;
     }
 
-    // check if we have all the packets
-    if (this->_messageBuffer[res.messageID].size() == this->_messageBuffer[res.messageID][0].packetCount)
+    // whatever _sendQueuedPacket() sends next, or else a fragment, most of which are full
+    PacketBuffer *packet = this->_controlQueue.front();
+    std::size_t size = (packet != nullptr) ? packet->size : this->_telemetryQueued ? this->_telemetry.size : MAX_PACKET_SIZE;
+    return this->_airtimeBudget.allows(this->_airtimeOf(size), Clock::millis());
+}
+
+bool ComInterface::_sendQueuedPacket()
+{
+    PacketBuffer *packet = this->_controlQueue.front();
+    if (packet != nullptr)
+    {
+        this->_transmit(*packet);
+        this->_controlQueue.pop();
+        this->_txStats.sent[TRAFFIC_CONTROL]++;
+        return true;
+    }
+
+    if (this->_telemetryQueued)
     {
-        std::vector<MessageParsingResult> packets = this->_messageBuffer[res.messageID];
-        // std::cout << "Received all packets for message type " << res.contentType << std::endl;
-        // std::cout << "Collected " << packets.size() << " packets" << std::endl;
-        std::vector<std::uint8_t> fullMessage;
-        // we need to order the packets by their sequence number
-        std::sort(packets.begin(), packets.end(), [](MessageParsingResult a, MessageParsingResult b)
-                  { return a.packetNumber < b.packetNumber; });
+        this->_telemetryQueued = false;
+        this->_transmit(this->_telemetry);
+        this->_txStats.sent[TRAFFIC_TELEMETRY]++;
+        return true;
+    }
+
+    return false;
+}
 
-        for (auto &msg : packets)
+bool ComInterface::_sendBulkFragment()
+{
+    PacketBuffer packet;
+    for (auto &entry : this->_outgoingTransfers)
+    {
+        OutgoingTransfer &transfer = entry.second;
+        if (transfer.windowSent == transfer.window.size())
         {
-            fullMessage.insert(fullMessage.end(), msg.payload.begin(), msg.payload.end());
+            continue;
         }
 
-        std::unordered_map<MessageContentType, std::vector<std::function<void(Message)>>> callbacks =
-            (res.messageType == MessageType::MSG_REQUEST) ? this->_requestMessageCallbacks : this->_responseMessageCallbacks;
-
-        if (callbacks.find(res.contentType) != callbacks.end())
+        std::size_t fragment = transfer.window[transfer.windowSent++];
+        bool last = transfer.windowSent == transfer.window.size();
+        if (!transfer.message.encodePacket(fragment, packet))
         {
-            Message msg = Message(res.messageID, res.messageType, res.contentType, fullMessage);
-            for (auto &callback : callbacks[res.contentType])
+            // left unacked, so it is tried again with the next window, until the retries run out
+            WIRCOM_LOG_WARN("Could not read fragment " << fragment << " of message with ID " << entry.first);
+        }
+        else
+        {
+            if (last)
             {
-                callback(msg);
+                // the last fragment of the window asks the receiver for a selective ack
+                Message::markPacketAsAck(packet);
             }
+
+            this->_transmit(packet);
+            this->_txStats.sent[TRAFFIC_BULK]++;
         }
 
-        if (res.messageType == MessageType::MSG_RESPONSE)
+        if (last)
         {
-            // this is a completed message, mark it as acked
-            this->_acksRequired.erase(res.messageID);
+            transfer.timeSent = Clock::millis();
         }
+        return true;
+    }
+
+    if (this->_unackedTransfers.empty())
+    {
+        return false;
+    }
+
+    UnackedTransfer &transfer = this->_unackedTransfers.front();
+    if (transfer.message.encodePacket(transfer.nextToSend, packet))
+    {
+        this->_transmit(packet);
+        this->_txStats.sent[TRAFFIC_BULK]++;
+        transfer.nextToSend++;
+    }
+    else
+    {
+        WIRCOM_LOG_WARN("Stopped sending message with ID " << transfer.message.messageID << " at packet "
+                                                           << transfer.nextToSend << ", its source could not be read");
+        transfer.nextToSend = transfer.message.packetCount();
+    }
+
+    if (transfer.nextToSend == transfer.message.packetCount())
+    {
+        this->_unackedTransfers.pop_front();
+        this->_updateBulkActive();
+    }
+    return true;
+}
+
+void ComInterface::_updateBulkActive()
+{
+    this->_bulkActive.store(this->_outgoingTransfers.size() + this->_unackedTransfers.size());
+}
+
+void ComInterface::_transmit(const PacketBuffer &packet)
+{
+    MessageFlag flag;
+    flag.raw = packet.data[MSG_FLAG_OFFSET];
+    // a batch record has no room for the content type byte of a typed header
+    bool batchable = this->_batching && !flag.isLongMessage() && std::memcmp(packet.data, MSG_IDENTIFIER, 3) == 0;
+    std::size_t recordSize = packet.size - 3;
+    if (!batchable || this->_batch.size + recordSize > MAX_PACKET_SIZE)
+    {
+        this->_flushBatch();
+    }
+
+    if (!batchable)
+    {
+        this->_transmitFrame(packet);
+        return;
+    }
+
+    if (this->_batchCount == 0)
+    {
+        std::memcpy(this->_batch.data, BATCH_IDENTIFIER, 3);
+        this->_batch.size = 3;
+        this->_batchStarted = Clock::millis();
+    }
+
+    // a record is the packet without its identifier
+    std::memcpy(this->_batch.data + this->_batch.size, packet.data + 3, recordSize);
+    this->_batch.size += recordSize;
+    this->_batchCount++;
+
+    if (MAX_PACKET_SIZE - this->_batch.size < BATCH_RECORD_HEADER_SIZE)
+    {
+        // not even an empty message fits anymore
+        this->_flushBatch();
+    }
+}
+
+void ComInterface::_flushBatch()
+{
+    if (this->_batchCount == 0)
+    {
+        return;
+    }
+
+    if (this->_batchCount == 1)
+    {
+        // a batch of one is exactly the original packet under the batch identifier
+        std::memcpy(this->_batch.data, MSG_IDENTIFIER, 3);
+    }
+
+    WIRCOM_LOG_DEBUG("Sending a batch of " << this->_batchCount << " messages in " << this->_batch.size << " bytes");
+    this->_batchCount = 0;
+    this->_transmitFrame(this->_batch);
+    this->_batch.size = 0;
+}
+
+void ComInterface::_flushBatchIfDue()
+{
+    if (this->_batchCount > 0 && Clock::millis() - this->_batchStarted >= this->_batchDeadline)
+    {
+        this->_flushBatch();
+    }
+}
+
+void ComInterface::_transmitFrame(const PacketBuffer &packet)
+{
+    this->_countSent(packet);
+    if (!this->_eventMode)
+    {
+        this->_transport->send(packet.data, packet.size);
+        this->_transport->waitPacketSent();
+        return;
+    }
+
+    // only block when the caller is more than a queue ahead of the radio
+    while (this->_txQueue.size() == this->_txQueue.capacity())
+    {
+        this->_transport->waitPacketSent();
+        this->_pumpTX();
+    }
+
+    this->_txQueue.push(packet);
+    this->_pumpTX();
+}
 
-        this->_messageBuffer.erase(res.messageID);
+void ComInterface::_countSent(const PacketBuffer &frame)
+{
+    // a data rate switch waits for the frames queued before it, so they go on air at the current rate
+    std::uint32_t airtime = this->_airtimeOf(frame.size);
+    this->_linkStats.packetsSent++;
+    this->_linkStats.bytesSent += frame.size;
+    this->_linkStats.airtimePerPacket.add(airtime);
+    this->_airtimeBudget.spend(airtime, Clock::millis());
+}
+
+void ComInterface::_pumpTX()
+{
+    PacketBuffer *frame;
+    while (!this->_transport->transmitting() && (frame = this->_txQueue.front()) != nullptr)
+    {
+        this->_transport->send(frame->data, frame->size);
+        this->_txQueue.pop();
     }
 }
 
-#endif
\ No newline at end of file
+void ComInterface::listen(std::uint16_t timeout)
+{
+    this->_acquireRadio();
+    this->_listen(timeout);
+    this->_releaseRadio();
+}
+
+void ComInterface::_listen(std::uint16_t timeout)
+{
+    // std::cout << "Listening for messages..." << std::endl;
+
+    std::uint32_t start = Clock::millis();
+
+    if (this->_eventMode)
+    {
+        while (this->_rxQueue.empty() && Clock::millis() - start < timeout)
+        {
+            this->_runQueuedCommands();
+            this->_pumpTX();
+            WIRCOM_YIELD();
+        }
+
+        this->_poll();
+        return;
+    }
+
+    // std::cout << "starting timeout at " << start << std::endl;
+    while (Clock::millis() - start < timeout)
+    {
+        // we own the radio while listening, so messages that other threads
+        // want to send are sent from here, between checks for a new packet
+        this->_runQueuedCommands();
+
+        // check if we have a message
+        if (this->_transport->available())
+        {
+            break;
+        }
+        WIRCOM_YIELD();
+    }
+    // std::cout << "Finished listening" << std::endl;
+
+    if (this->_transport->available() == false)
+        return; // nothing
+
+    // std::cout << "Available message..." << std::endl;
+    uint8_t buf[MAX_PACKET_SIZE];
+    uint8_t len = sizeof(buf);
+
+    if (this->_transport->recv(buf, &len))
+    {
+        this->_handleRXFrame(buf, len);
+    }
+}
+
+void ComInterface::_handleRXFrame(const std::uint8_t *frame, std::size_t length)
+{
+    this->_linkStats.packetsReceived++;
+    this->_linkStats.bytesReceived += length;
+    if (this->_linkAdaptation.enabled())
+    {
+        // in event mode the radio has moved on to the latest packet the interrupt queued, which is close enough
+        this->_linkAdaptation.onReceived(this->_transport->lastRssi(), this->_transport->lastSNR(), Clock::millis());
+    }
+
+    // packets are parsed in place, the payload stays in the frame
+    if (!BatchView::isBatch(frame, length))
+    {
+        PacketView packet = PacketView::parse(frame, length);
+        if (packet.success)
+        {
+            this->_handleRXMessage(packet);
+        }
+        else if (packet.corrupt)
+        {
+            WIRCOM_LOG_WARN("Dropping packet for message ID " << packet.messageID << ", its CRC does not match");
+            this->_linkStats.checksumFailures++;
+        }
+        else
+        {
+            this->_linkStats.decodeFailures++;
+        }
+        return;
+    }
+
+    BatchView batch(frame, length);
+    PacketView packet;
+    while (batch.next(packet))
+    {
+        this->_handleRXMessage(packet);
+    }
+
+    if (packet.corrupt)
+    {
+        WIRCOM_LOG_WARN("Dropping the rest of a batch, the CRC of message ID " << packet.messageID << " does not match");
+        this->_linkStats.checksumFailures++;
+    }
+}
+
+bool ComInterface::sendMessage(Message msg, bool ackRequired)
+{
+    // long messages share the link a fragment at a time, so past a few the caller has to wait its turn
+    bool bulk = msg.flag.isLongMessage();
+    if (this->_airtimePolicy == AIRTIME_REFUSE && this->_airtimeBudget.enabled())
+    {
+        std::uint32_t airtime = this->_messageAirtime(msg);
+        if (!this->_airtimeBudget.allows(airtime, Clock::millis()))
+        {
+            this->_airtimeRefusals++;
+            WIRCOM_LOG_DEBUG("Refusing message with ID " << msg.messageID << ", its " << airtime << " us on air do not fit the budget");
+            return false;
+        }
+    }
+
+    if (bulk && this->_bulkQueued.fetch_add(1) + this->_bulkActive.load() >= BULK_QUEUE_SIZE)
+    {
+        this->_bulkQueued--;
+        this->_bulkRefusals++;
+        WIRCOM_LOG_DEBUG("Refusing long message with ID " << msg.messageID << ", " << BULK_QUEUE_SIZE << " are already on their way");
+        return false;
+    }
+
+    RadioCommand command;
+    command.message = std::move(msg);
+    command.ackRequired = ackRequired;
+    command.bulk = bulk;
+    if (!this->_queueCommand(std::move(command)))
+    {
+        if (bulk)
+        {
+            this->_bulkQueued--;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool ComInterface::_queueCommand(RadioCommand command)
+{
+    std::uint32_t start = Clock::millis();
+    while (!this->_commandQueue.push(std::move(command)))
+    {
+        // the radio owner is behind, help it along if it is idle, or give it time
+        if (Clock::millis() - start > COMMAND_QUEUE_TIMEOUT)
+        {
+            WIRCOM_LOG_WARN("Send queue is full, dropping message with ID " << command.message.messageID);
+            return false;
+        }
+
+        this->_serviceCommandQueue();
+        WIRCOM_YIELD();
+    }
+
+    this->_serviceCommandQueue();
+    return true;
+}
+
+void ComInterface::_serviceCommandQueue()
+{
+    // if another thread owns the radio, it runs the queue before letting go of it. The fences
+    // pair up with the one in _releaseRadio(): either that thread sees our command after
+    // releasing, or we see the radio released and take it ourselves
+    while (true)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (this->_commandQueue.empty() || !this->_tryAcquireRadio())
+        {
+            return;
+        }
+
+        this->_runQueuedCommands();
+        this->_radioOwned.store(false);
+    }
+}
+
+void ComInterface::_runQueuedCommands()
+{
+    RadioCommand command;
+    while (this->_commandQueue.pop(command))
+    {
+        if (command.switchDataRate)
+        {
+            this->_switchDataRateNow(command.spreadingFactor, command.bandwidth);
+        }
+        else
+        {
+            this->_sendNow(std::move(command.message), command.ackRequired);
+            if (command.bulk)
+            {
+                // counted in _bulkActive by now
+                this->_bulkQueued--;
+            }
+        }
+    }
+
+    this->_serviceTX();
+    this->_flushBatchIfDue();
+}
+
+bool ComInterface::_tryAcquireRadio()
+{
+    return !this->_radioOwned.exchange(true);
+}
+
+void ComInterface::_acquireRadio()
+{
+    while (!this->_tryAcquireRadio())
+    {
+        WIRCOM_YIELD();
+    }
+}
+
+void ComInterface::_releaseRadio()
+{
+    // messages queued while we owned the radio, including from our own callbacks, go out first
+    this->_runQueuedCommands();
+    this->_radioOwned.store(false);
+    this->_serviceCommandQueue();
+}
+
+void ComInterface::_sendNow(Message msg, bool ackRequired, TrafficClass trafficClass)
+{
+    // the message is protected in place, it is this call's own copy, and usually moved in from the queue
+    if (!this->_protect(msg))
+    {
+        WIRCOM_LOG_WARN("Dropping message with ID " << msg.messageID << ", its source could not be read");
+        return;
+    }
+
+    std::uint16_t id = msg.messageID;
+    std::size_t numPackets = msg.packetCount();
+    if (numPackets > MAX_MESSAGE_PACKET_COUNT)
+    {
+        WIRCOM_LOG_WARN("Dropping message with ID " << id << ", it needs " << numPackets << " packets");
+        return;
+    }
+
+    // long messages are queued as bulk and go out a fragment at a time, see _serviceTX()
+    bool awaitsResponse = ackRequired && msg.flag.getMessageType() == MessageType::MSG_REQUEST;
+    if (ackRequired && numPackets > 1)
+    {
+        // a window at a time, and only the fragments that get lost are resent
+        OutgoingTransfer &transfer = this->_outgoingTransfers[id];
+        transfer = OutgoingTransfer{awaitsResponse ? msg : std::move(msg), FragmentBitmap(numPackets), 0, Clock::millis(), 0, Clock::millis(), this->_initialTimeout(), {}, 0};
+        this->_sendWindowOf(transfer);
+        this->_updateBulkActive();
+    }
+    else if (numPackets > 1)
+    {
+        this->_unackedTransfers.push_back(UnackedTransfer{std::move(msg), 0});
+        this->_updateBulkActive();
+        return;
+    }
+    else
+    {
+        PacketBuffer packet;
+        if (!msg.encodePacket(0, packet))
+        {
+            WIRCOM_LOG_WARN("Dropping message with ID " << id << ", its source could not be read");
+            return;
+        }
+        this->_queuePacket(packet, trafficClass);
+    }
+
+    // add the message to the list of messages that require an ack, if the message type requires one
+    if (awaitsResponse)
+    {
+        WIRCOM_LOG_DEBUG("Sending message with ID " << id << ", expecting an ack");
+        std::uint32_t now = Clock::millis();
+        this->_acksRequired[id] = SentMessage{std::move(msg), now, 0, now, this->_initialTimeout()};
+    }
+}
+
+bool ComInterface::_protect(Message &msg) const
+{
+    MessageContentType contentType = msg.flag.getMessageContentType();
+    if (this->_integrityCheck && !msg.flag.isChecked() && !msg.flag.isFEC() && !msg.enableChecksum())
+    {
+        return false;
+    }
+
+    // a checked short message may have become long
+    if (this->_fecParity[contentType] > 0 && msg.flag.isLongMessage() && !msg.flag.isFEC())
+    {
+        msg.enableFEC(this->_fecData[contentType], this->_fecParity[contentType]);
+    }
+    return true;
+}
+
+void ComInterface::tick()
+{
+    this->_acquireRadio();
+    this->_tick();
+    this->_releaseRadio();
+}
+
+void ComInterface::_tick()
+{
+    this->_serviceStream();
+    this->_renewSubscription();
+    this->_serviceLinkStatsStream();
+    this->_renewLinkStatsSubscription();
+    this->_flushBatchIfDue();
+
+    // drop long messages whose sender has gone quiet, e.g. a car that drove out of range
+    this->_reassembly.expire(Clock::millis());
+    this->_serviceLinkAdaptation();
+
+    std::vector<std::uint16_t> toRemove;
+    for (auto &sentMessage : this->_acksRequired)
+    {
+        SentMessage &msg = sentMessage.second;
+        if (Clock::millis() - msg.timeSent > msg.timeout)
+        {
+            if (!this->_retriesExhausted(msg.retries, msg.firstSent) && !this->_budgetAllowsNext())
+            {
+                // a retry would only wait behind what the budget already holds back, the timer starts over instead
+                msg.timeSent = Clock::millis();
+            }
+            else if (!this->_retriesExhausted(msg.retries, msg.firstSent))
+            {
+                WIRCOM_LOG_INFO("Resending message with ID " << msg.message.messageID
+                                                             << " (retry " << (int)msg.retries << ", timeout " << msg.timeout << " ms)");
+                // resend the message
+                this->_linkAdaptation.onLost(1);
+                this->_linkStats.retries++;
+                this->_sendNow(msg.message, false);
+                msg.timeSent = Clock::millis();
+                msg.retries++;
+                msg.timeout = this->_backoffTimeout(msg.timeout);
+            }
+            else
+            {
+                // we've reached the max number of retries
+                // remove the message from the list
+                WIRCOM_LOG_WARN("Message with ID " << msg.message.messageID << " has timed out");
+                this->_linkStats.timeouts++;
+                this->_linkStats.retriesPerRequest.add(msg.retries);
+                toRemove.push_back(msg.message.messageID);
+            }
+        }
+    }
+
+    for (std::uint16_t id : toRemove)
+    {
+        this->_acksRequired.erase(id);
+    }
+
+    // resend the unacked fragments of long messages whose selective ack never came
+    toRemove.clear();
+    for (auto &entry : this->_outgoingTransfers)
+    {
+        OutgoingTransfer &transfer = entry.second;
+        if (transfer.windowSent < transfer.window.size() || Clock::millis() - transfer.timeSent <= transfer.timeout)
+        {
+            // the window is still going out, or its ack can still come
+            continue;
+        }
+
+        if (this->_retriesExhausted(transfer.retries, transfer.firstSent))
+        {
+            WIRCOM_LOG_WARN("Long message with ID " << entry.first << " has timed out with "
+                                                    << transfer.acked.setCount() << " of " << transfer.acked.size() << " fragments acked");
+            this->_linkStats.timeouts++;
+            toRemove.push_back(entry.first);
+            continue;
+        }
+
+        // the ack of the window is lost, if nothing else
+        this->_linkAdaptation.onLost(1);
+        this->_linkStats.retries++;
+        transfer.retries++;
+        transfer.timeout = this->_backoffTimeout(transfer.timeout);
+        WIRCOM_LOG_INFO("Resending unacked fragments of message with ID " << entry.first
+                                                                          << " (retry " << (int)transfer.retries << ")");
+        this->_sendWindowOf(transfer);
+    }
+
+    for (std::uint16_t id : toRemove)
+    {
+        this->_outgoingTransfers.erase(id);
+    }
+    this->_updateBulkActive();
+
+    this->_serviceTX();
+}
+
+void ComInterface::_handleRXMessage(const PacketView &packet)
+{
+    if (packet.flag.isAck() && !packet.flag.isLongMessage())
+    {
+        // a selective ack for one of our long messages, not something to dispatch
+        this->_handleAck(packet);
+        return;
+    }
+
+    if (packet.messageType() == MessageType::MSG_RESPONSE)
+    {
+        this->_onResponseActivity(packet.messageID);
+    }
+
+    if (packet.packetCount == 1)
+    {
+        WIRCOM_LOG_DEBUG("Received single packet message of type " << packet.contentType()
+                                                                   << " with length " << packet.payload.size);
+        // this is a normal message, we don't need to collect any more packets
+        this->_dispatchMessage(MessageView{packet.messageID, packet.flag, packet.payload});
+        return;
+    }
+
+    WIRCOM_LOG_DEBUG("Received packet " << (int)packet.packetNumber
+                                        << " of " << (int)packet.packetCount
+                                        << " for message type " << packet.contentType()
+                                        << " for message ID " << packet.messageID);
+
+    std::uint32_t now = Clock::millis();
+    if (this->_fragmentReceived && this->_lastFragmentID == packet.messageID)
+    {
+        this->_linkStats.fragmentInterarrival.add(now - this->_lastFragmentAt);
+    }
+    this->_fragmentReceived = true;
+    this->_lastFragmentID = packet.messageID;
+    this->_lastFragmentAt = now;
+
+    if (this->_wasCompleted(packet, now))
+    {
+        // the sender missed our final ack, and is retransmitting a message we already have
+        this->_linkStats.duplicates++;
+        if (packet.flag.isAck())
+        {
+            FragmentBitmap received(packet.packetCount);
+            for (std::size_t i = 0; i < packet.packetCount; i++)
+            {
+                received.set(i);
+            }
+            this->_sendAck(packet.messageID, packet.contentType(), received);
+        }
+        return;
+    }
+
+    ReassemblySlot *slot = nullptr;
+    ReassemblyStatus status = this->_reassembly.add(packet, now, slot);
+    if (status == REASSEMBLY_DUPLICATE)
+    {
+        this->_linkStats.duplicates++;
+    }
+    else if (status == REASSEMBLY_REJECTED)
+    {
+        WIRCOM_LOG_WARN("Dropping packet " << (int)packet.packetNumber << " of " << (int)packet.packetCount
+                                           << " for message ID " << packet.messageID << ", no reassembly slot can take it");
+        return;
+    }
+
+    bool complete = status == REASSEMBLY_COMPLETE;
+    if (packet.flag.isAck() || (complete && slot->ackRequested))
+    {
+        this->_sendAck(packet.messageID, packet.contentType(), slot->receivedFragments());
+    }
+
+    // check if we have all the packets
+    if (complete)
+    {
+        WIRCOM_LOG_DEBUG("Received all " << slot->receivedCount << " packets for message ID " << packet.messageID);
+        this->_linkStats.reassemblyTime.add(now - slot->firstActivity);
+
+        // the fragments were placed in order as they arrived, so the slot already holds the whole payload
+        PayloadView payload = this->_reassembly.payload(*slot);
+        if (slot->flag.isChecked() && !_stripMessageCRC(payload))
+        {
+            // the sender considers it delivered, so it is up to a request's retry to ask again
+            WIRCOM_LOG_WARN("Dropping message with ID " << packet.messageID << ", its CRC-32 does not match");
+            this->_linkStats.checksumFailures++;
+            this->_reassembly.release(*slot);
+            return;
+        }
+
+        this->_completedMessages[this->_completedMessageCount++ % COMPLETED_MESSAGE_HISTORY] =
+            CompletedMessage{packet.messageID, packet.packetCount, packet.flag.getMessageType(), packet.contentType(), now};
+        this->_dispatchMessage(MessageView{slot->messageID, slot->flag, payload});
+        this->_reassembly.release(*slot);
+    }
+}
+
+void ComInterface::_handleAck(const PacketView &packet)
+{
+    auto it = this->_outgoingTransfers.find(packet.messageID);
+    if (it == this->_outgoingTransfers.end() || packet.payload.empty())
+    {
+        return;
+    }
+
+    OutgoingTransfer &transfer = it->second;
+    const PayloadView &ack = packet.payload;
+    bool ranged = ack[0] == 0;
+    std::size_t count = !ranged ? ack[0] : (ack.size >= RANGE_ACK_HEADER_SIZE) ? (ack[1] << 8) | ack[2] : 0;
+    if (count != transfer.acked.size())
+    {
+        // an ack for a different message that happened to reuse this ID
+        return;
+    }
+
+    // an ack that arrives while the window is still going out answers an earlier one, e.g. a duplicate or a late ack,
+    // its fragments count, but it says nothing about the fragments of this window that are not on air yet
+    bool windowOnAir = transfer.windowSent == transfer.window.size();
+    if (windowOnAir && transfer.retries == 0)
+    {
+        // this window went out once, so the ack unambiguously answers it
+        this->_rtt.addSample(Clock::millis() - transfer.timeSent);
+        transfer.timeout = this->_initialTimeout();
+    }
+
+    std::size_t newlyAcked = ranged ? transfer.acked.mergeRange((ack[3] << 8) | ack[4], ack.data + RANGE_ACK_HEADER_SIZE, ack.size - RANGE_ACK_HEADER_SIZE)
+                                    : transfer.acked.merge(FragmentBitmap::fromBytes(count, ack.data + 1, ack.size - 1));
+    if (newlyAcked > 0)
+    {
+        // the receiver is making progress, so the link is alive
+        transfer.retries = 0;
+    }
+
+    if (windowOnAir)
+    {
+        // the ack answers the window, a repeat of it would find the next window still going out
+        std::size_t lost = 0;
+        for (std::size_t fragment : transfer.window)
+        {
+            lost += !transfer.acked.test(fragment);
+        }
+        this->_linkAdaptation.onDelivered(transfer.window.size() - lost);
+        this->_linkAdaptation.onLost(lost);
+    }
+
+    if (transfer.acked.all())
+    {
+        WIRCOM_LOG_DEBUG("Long message with ID " << packet.messageID << " fully acked");
+        this->_outgoingTransfers.erase(it);
+        this->_updateBulkActive();
+        return;
+    }
+
+    if (windowOnAir)
+    {
+        this->_sendWindowOf(transfer);
+    }
+}
+
+void ComInterface::_sendWindowOf(OutgoingTransfer &transfer)
+{
+    std::size_t window = this->_sendWindow;
+    if (transfer.message.flag.isFEC())
+    {
+        // whole blocks, so that the parity is in before the receiver reports what is missing
+        std::size_t block = transfer.message.fecDataFragments() + transfer.message.fecParityFragments();
+        window = (window + block - 1) / block * block;
+    }
+
+    // fragments that were sent before the last ack but never acked are lost, they go first
+    std::vector<std::size_t> &toSend = transfer.window;
+    toSend.clear();
+    for (std::size_t i = transfer.acked.nextClear(0); i < transfer.nextToSend && toSend.size() < window; i = transfer.acked.nextClear(i + 1))
+    {
+        toSend.push_back(i);
+    }
+
+    // then fill the rest of the window with fragments that were never sent
+    while (toSend.size() < window && transfer.nextToSend < transfer.acked.size())
+    {
+        toSend.push_back(transfer.nextToSend++);
+    }
+
+    // the fragments are encoded as they go on air, by _sendBulkFragment()
+    transfer.windowSent = 0;
+    transfer.timeSent = Clock::millis();
+}
+
+void ComInterface::_sendAck(std::uint16_t id, MessageContentType contentType, const FragmentBitmap &received)
+{
+    // ACK PAYLOAD
+    // 0: Packet Count
+    // 1-n: Bitmap of received fragments, fragment i is bit (i % 8) of byte (i / 8)
+    // or, for messages of more than MAX_LONG_MSG_PACKET_COUNT packets, whose bitmap may not fit a packet:
+    // 0: 0, which is never a packet count
+    // 1-2: Packet Count
+    // 3-4: Base, a multiple of 8, every fragment before it has arrived
+    // 5-n: Bitmap of the fragments from base on, up to RANGE_ACK_BITMAP_SIZE bytes, fragment base + i is bit (i % 8) of byte (i / 8)
+    std::vector<std::uint8_t> payload;
+    if (received.size() <= MAX_LONG_MSG_PACKET_COUNT)
+    {
+        payload.reserve(1 + received.byteSize());
+        payload.push_back(received.size());
+        payload.insert(payload.end(), received.data(), received.data() + received.byteSize());
+    }
+    else
+    {
+        std::size_t first = received.nextClear(0) / 8;
+        std::size_t length = std::min<std::size_t>(received.byteSize() - first, RANGE_ACK_BITMAP_SIZE);
+        payload.reserve(RANGE_ACK_HEADER_SIZE + length);
+        payload.push_back(0);
+        payload.push_back((received.size() >> 8) & 0xFF);
+        payload.push_back(received.size() & 0xFF);
+        payload.push_back(((first * 8) >> 8) & 0xFF);
+        payload.push_back((first * 8) & 0xFF);
+        payload.insert(payload.end(), received.data() + first, received.data() + first + length);
+    }
+
+    Message ack(id, MessageType::MSG_RESPONSE, contentType, payload);
+    ack.flag.markAsAck();
+    if (this->_integrityCheck)
+    {
+        // a corrupt bitmap would ack fragments that never arrived
+        ack.enableChecksum();
+    }
+
+    PacketBuffer packet;
+    ack.encodePacket(0, packet);
+    this->_queuePacket(packet, TRAFFIC_CONTROL);
+}
+
+bool ComInterface::_wasCompleted(const PacketView &packet, std::uint32_t now)
+{
+    std::size_t count = (this->_completedMessageCount < COMPLETED_MESSAGE_HISTORY) ? this->_completedMessageCount : COMPLETED_MESSAGE_HISTORY;
+    for (std::size_t i = 0; i < count; i++)
+    {
+        CompletedMessage &completed = this->_completedMessages[i];
+        if (completed.messageID == packet.messageID && completed.packetCount == packet.packetCount &&
+            completed.messageType == packet.flag.getMessageType() && completed.contentType == packet.contentType() &&
+            now - completed.lastSeen <= this->_reassembly.timeout())
+        {
+            // a sender that keeps retrying keeps being recognized
+            completed.lastSeen = now;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ComInterface::_dispatchMessage(const MessageView &view)
+{
+    this->_linkStats.messagesReceived++;
+    if (this->_linkAdaptation.enabled() && view.contentType() == MessageContentType::MSG_CON_SWITCH_DATA_RATE && this->_handleDataRateSwitch(view))
+    {
+        return;
+    }
+
+    // every side serves its link statistics, whether it streams data or not
+    if (this->_handleLinkStatsRequest(view))
+    {
+        return;
+    }
+    this->_handleLinkStats(view);
+
+    if (this->_streamSource && view.messageType() == MessageType::MSG_REQUEST &&
+        view.contentType() == MessageContentType::MSG_CON_DATA_TRANSFER && !view.payload.empty())
+    {
+        this->_handleStreamRequest(view);
+        return;
+    }
+
+    MessageView delivered = view;
+    if (view.flag.isCompressed())
+    {
+        std::size_t size = LzCodec::decompressedSize(view.payload.data, view.payload.size);
+        if (size > MAX_DECOMPRESSED_SIZE)
+        {
+            WIRCOM_LOG_WARN("Dropping message with ID " << view.messageID << ", it decompresses to " << size << " bytes");
+            return;
+        }
+
+        this->_decompressed.resize(size);
+        if (!LzCodec::decompress(view.payload.data, view.payload.size, this->_decompressed.data(), size))
+        {
+            WIRCOM_LOG_WARN("Dropping message with ID " << view.messageID << ", it does not decompress");
+            return;
+        }
+
+        delivered.payload = PayloadView(this->_decompressed);
+        delivered.flag.clearCompressed();
+    }
+
+    if (this->_subscriptionDelta && view.messageType() == MessageType::MSG_RESPONSE &&
+        view.contentType() == MessageContentType::MSG_CON_DATA_TRANSFER)
+    {
+        if (this->_streamDecoder.decode(delivered.payload, this->_streamFrame))
+        {
+            delivered.payload = PayloadView(this->_streamFrame);
+        }
+        else
+        {
+            WIRCOM_LOG_INFO("Cannot rebuild data stream frame " << view.messageID << ", asking for a keyframe");
+            this->_requestKeyframe();
+            // the frame is lost, but it still answers the request it carries
+            this->_acksRequired.erase(view.messageID);
+            return;
+        }
+    }
+
+    this->_dispatchTable.dispatch(delivered);
+
+    if (view.messageType() == MessageType::MSG_RESPONSE)
+    {
+        // this is a completed message, mark it as acked
+        this->_acksRequired.erase(view.messageID);
+    }
+}
+
+bool ComInterface::subscribe(std::uint16_t interval, std::uint32_t lease, bool delta)
+{
+    Message request = MessageBuilder::createDataStreamRequest(interval, lease, delta);
+    this->_subscriptionInterval = interval;
+    this->_subscriptionLease = lease;
+    this->_subscriptionRenewed = Clock::millis();
+    this->_subscriptionRequestID = request.messageID;
+    this->_subscriptionDelta = delta;
+    this->_subscribed = true;
+    return this->sendMessage(request);
+}
+
+bool ComInterface::unsubscribe()
+{
+    this->_subscribed = false;
+    // no ack needed, if the stop gets lost the lease runs out
+    return this->sendMessage(MessageBuilder::createDataStreamStop(), false);
+}
+
+void ComInterface::_handleStreamRequest(const MessageView &view)
+{
+    ContentResult<DataStreamContent> request = MessageParser::parseDataStreamContent(view.payload.toVector());
+    if (!request.success)
+    {
+        WIRCOM_LOG_WARN("Ignoring malformed data stream request with ID " << view.messageID);
+        return;
+    }
+
+    if (request.content.command == STREAM_STOP)
+    {
+        WIRCOM_LOG_INFO("Data stream stopped by the client");
+        this->_stream.active = false;
+        return;
+    }
+
+    if (request.content.command == STREAM_KEYFRAME)
+    {
+        if (this->_stream.active)
+        {
+            this->_stream.encoder.requestKeyframe();
+            this->_stream.answerPending = true;
+            this->_stream.requestID = view.messageID;
+            this->_serviceStream();
+        }
+        return;
+    }
+
+    std::uint32_t now = Clock::millis();
+    if (!this->_stream.active)
+    {
+        WIRCOM_LOG_INFO("Data stream started, a frame every " << request.content.interval << " ms");
+        this->_stream.nextFrame = now;
+    }
+
+    if (!this->_stream.active || request.content.delta != this->_stream.delta)
+    {
+        // a new client has no reference to decode deltas against
+        this->_stream.encoder.requestKeyframe();
+    }
+    this->_stream.delta = request.content.delta;
+
+    // a renewal from a client that already gets frames is answered by the next frame, like a subscribe
+    this->_stream.interval = request.content.interval;
+    this->_stream.leaseExpires = now + request.content.lease;
+    this->_stream.answerPending = true;
+    this->_stream.requestID = view.messageID;
+    this->_stream.active = true;
+
+    this->_serviceStream();
+}
+
+void ComInterface::_serviceStream()
+{
+    if (!this->_stream.active)
+    {
+        return;
+    }
+
+    std::uint32_t now = Clock::millis();
+    if ((std::int32_t)(now - this->_stream.leaseExpires) >= 0)
+    {
+        WIRCOM_LOG_INFO("Data stream lease expired without a renewal");
+        this->_stream.active = false;
+        return;
+    }
+
+    if (!this->_stream.answerPending && (std::int32_t)(now - this->_stream.nextFrame) < 0)
+    {
+        return;
+    }
+
+    std::vector<std::uint8_t> frame = this->_streamSource();
+    if (frame.empty())
+    {
+        // nothing new to send, ask again on the next tick
+        return;
+    }
+
+    if (this->_stream.delta)
+    {
+        frame = this->_stream.encoder.encode(frame);
+    }
+
+    // a frame that answers a request and is still waiting for the radio is about to be replaced, the new one answers instead
+    bool answer = this->_stream.answerPending || (this->_telemetryQueued && this->_stream.answerQueued);
+    Message msg = answer ? Message(this->_stream.requestID, MSG_RESPONSE, MSG_CON_DATA_TRANSFER, frame)
+                         : Message(MSG_RESPONSE, MSG_CON_DATA_TRANSFER, frame);
+    this->_stream.answerPending = false;
+    this->_stream.answerQueued = answer;
+
+    // frames missed while the radio was busy are skipped, the client only cares about the latest one
+    this->_stream.nextFrame += this->_stream.interval;
+    if ((std::int32_t)(now - this->_stream.nextFrame) > 0)
+    {
+        this->_stream.nextFrame = now + this->_stream.interval;
+    }
+
+    // a lost frame is superseded by the next one, so frames are never retransmitted, nor sent once stale
+    this->_sendNow(std::move(msg), false, TRAFFIC_TELEMETRY);
+}
+
+void ComInterface::_renewSubscription()
+{
+    if (!this->_subscribed)
+    {
+        return;
+    }
+
+    std::uint32_t now = Clock::millis();
+    if (now - this->_subscriptionRenewed < this->_subscriptionLease / 2)
+    {
+        return;
+    }
+
+    // the last renewal is still being retried, no point in piling another one on top
+    if (this->_acksRequired.find(this->_subscriptionRequestID) != this->_acksRequired.end())
+    {
+        return;
+    }
+
+    Message request = MessageBuilder::createDataStreamRequest(this->_subscriptionInterval, this->_subscriptionLease, this->_subscriptionDelta);
+    this->_subscriptionRequestID = request.messageID;
+    this->_subscriptionRenewed = now;
+    this->_sendNow(std::move(request), true);
+}
+
+void ComInterface::_requestKeyframe()
+{
+    // one request at a time, the retries take care of a lost one
+    if (this->_acksRequired.find(this->_keyframeRequestID) != this->_acksRequired.end())
+    {
+        return;
+    }
+
+    Message request = MessageBuilder::createKeyframeRequest();
+    this->_keyframeRequestID = request.messageID;
+    this->_sendNow(std::move(request), true);
+}
+
+LinkStats ComInterface::linkStats() const
+{
+    LinkStats stats = this->_linkStats;
+    stats.timestamp = Clock::millis();
+    stats.rxOverflows = this->_rxQueue.overflows();
+    return stats;
+}
+
+bool ComInterface::subscribeLinkStats(std::function<void(const LinkStats &)> callback, std::uint16_t interval, std::uint32_t lease)
+{
+    Message request = MessageBuilder::createLinkStatsRequest(interval, lease);
+    this->_statsCallback = std::move(callback);
+    this->_statsInterval = interval;
+    this->_statsLease = lease;
+    this->_statsRenewed = Clock::millis();
+    this->_statsRequestID = request.messageID;
+    // a single snapshot needs no renewals
+    this->_statsSubscribed = interval > 0;
+    return this->sendMessage(request);
+}
+
+bool ComInterface::unsubscribeLinkStats()
+{
+    this->_statsSubscribed = false;
+    // no ack needed, if the stop gets lost the lease runs out
+    return this->sendMessage(MessageBuilder::createLinkStatsRequest(0, 0), false);
+}
+
+bool ComInterface::_handleLinkStatsRequest(const MessageView &view)
+{
+    if (view.messageType() != MessageType::MSG_REQUEST || view.contentType() != MessageContentType::MSG_CON_LINK_STATS)
+    {
+        return false;
+    }
+
+    ContentResult<LinkStatsRequest> request = ContentCodec<LinkStatsRequest>::decode(view.payload);
+    if (!request.success)
+    {
+        WIRCOM_LOG_WARN("Ignoring malformed link statistics request with ID " << view.messageID);
+        return true;
+    }
+
+    std::uint32_t now = Clock::millis();
+    if (request.content.lease == 0)
+    {
+        WIRCOM_LOG_INFO("Link statistics stopped by the client");
+        this->_statsStream.active = false;
+        return true;
+    }
+
+    // like a data stream, every request, including a renewal, is answered right away
+    this->_statsStream.interval = request.content.interval;
+    this->_statsStream.leaseExpires = now + request.content.lease;
+    this->_statsStream.nextFrame = now;
+    this->_statsStream.requestID = view.messageID;
+    this->_statsStream.active = true;
+    this->_serviceLinkStatsStream();
+    return true;
+}
+
+void ComInterface::_serviceLinkStatsStream()
+{
+    if (!this->_statsStream.active)
+    {
+        return;
+    }
+
+    std::uint32_t now = Clock::millis();
+    if ((std::int32_t)(now - this->_statsStream.leaseExpires) >= 0)
+    {
+        WIRCOM_LOG_INFO("Link statistics lease expired without a renewal");
+        this->_statsStream.active = false;
+        return;
+    }
+
+    if ((std::int32_t)(now - this->_statsStream.nextFrame) < 0)
+    {
+        return;
+    }
+
+    if (this->_statsStream.interval == 0)
+    {
+        // a single snapshot was asked for
+        this->_statsStream.active = false;
+    }
+
+    this->_statsStream.nextFrame += this->_statsStream.interval;
+    if ((std::int32_t)(now - this->_statsStream.nextFrame) > 0)
+    {
+        this->_statsStream.nextFrame = now + this->_statsStream.interval;
+    }
+
+    // the next snapshot has everything a lost one had, so they are never retransmitted
+    this->_sendNow(MessageBuilder::createLinkStatsResponse(this->_statsStream.requestID, this->linkStats()), false);
+}
+
+void ComInterface::_renewLinkStatsSubscription()
+{
+    if (!this->_statsSubscribed)
+    {
+        return;
+    }
+
+    std::uint32_t now = Clock::millis();
+    if (now - this->_statsRenewed < this->_statsLease / 2 ||
+        this->_acksRequired.find(this->_statsRequestID) != this->_acksRequired.end())
+    {
+        return;
+    }
+
+    Message request = MessageBuilder::createLinkStatsRequest(this->_statsInterval, this->_statsLease);
+    this->_statsRequestID = request.messageID;
+    this->_statsRenewed = now;
+    this->_sendNow(std::move(request), true);
+}
+
+void ComInterface::_handleLinkStats(const MessageView &view)
+{
+    if (!this->_statsCallback || view.messageType() != MessageType::MSG_RESPONSE ||
+        view.contentType() != MessageContentType::MSG_CON_LINK_STATS)
+    {
+        return;
+    }
+
+    ContentResult<LinkStats> stats = ContentCodec<LinkStats>::decode(view.payload);
+    if (!stats.success)
+    {
+        WIRCOM_LOG_WARN("Link statistics with ID " << view.messageID << " do not decode");
+        return;
+    }
+
+    this->_statsCallback(stats.content);
+}
+
+void ComInterface::_onResponseActivity(std::uint16_t id)
+{
+    auto it = this->_acksRequired.find(id);
+    if (it == this->_acksRequired.end())
+    {
+        return;
+    }
+
+    SentMessage &msg = it->second;
+    std::uint32_t now = Clock::millis();
+    if (!msg.rttSampled)
+    {
+        this->_linkAdaptation.onDelivered(1);
+        this->_linkStats.responseLatency.add(now - msg.firstSent);
+        this->_linkStats.retriesPerRequest.add(msg.retries);
+        // Karn's algorithm, a retransmitted request makes the round trip ambiguous
+        if (msg.retries == 0)
+        {
+            this->_rtt.addSample(now - msg.timeSent);
+        }
+        else
+        {
+            this->_rtt.addAmbiguousSample(now - msg.timeSent);
+        }
+        msg.rttSampled = true;
+    }
+
+    // the response is coming in, hold off on retrying the request
+    WIRCOM_LOG_DEBUG("Resetting timeout for message with ID " << id);
+    msg.timeSent = now;
+}
+
+std::uint32_t ComInterface::_initialTimeout() const
+{
+    return this->_adaptiveTimeout ? this->_rtt.timeout() : SEND_TIMEOUT;
+}
+
+std::uint32_t ComInterface::_backoffTimeout(std::uint32_t timeout)
+{
+    if (!this->_adaptiveTimeout)
+    {
+        return SEND_TIMEOUT;
+    }
+
+    // the estimate stays backed off until a fresh sample comes in
+    this->_rtt.backoff();
+
+    // double, plus up to a quarter of jitter so both ends don't retry in lockstep
+    std::uint32_t doubled = (timeout > MAX_RETRANSMIT_TIMEOUT / 2) ? MAX_RETRANSMIT_TIMEOUT : timeout * 2;
+    std::uint32_t jitter = this->_jitter() % (doubled / 4 + 1);
+    return (doubled + jitter > MAX_RETRANSMIT_TIMEOUT) ? MAX_RETRANSMIT_TIMEOUT : doubled + jitter;
+}
+
+bool ComInterface::_retriesExhausted(std::uint8_t retries, std::uint32_t firstSent) const
+{
+    if (this->_retryBudget > 0)
+    {
+        return Clock::millis() - firstSent >= this->_retryBudget;
+    }
+
+    return retries >= this->_maxRetries;
+}
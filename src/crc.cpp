@@ -0,0 +1,74 @@
+#include "crc.hpp"
+
+using namespace wircom;
+
+// table[0][n] is the CRC of byte n, and table[k][n] the CRC of byte n followed by k zero bytes,
+// so the eight bytes of a step can be looked up independently and XORed together
+template <typename T, T Polynomial>
+struct CrcTables
+{
+    T table[8][256];
+
+    constexpr CrcTables() : table()
+    {
+        for (unsigned n = 0; n < 256; n++)
+        {
+            T crc = n;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc & 1) ? (T)((crc >> 1) ^ Polynomial) : (T)(crc >> 1);
+            }
+            table[0][n] = crc;
+        }
+
+        for (unsigned n = 0; n < 256; n++)
+        {
+            for (int k = 1; k < 8; k++)
+            {
+                table[k][n] = (T)((table[k - 1][n] >> 8) ^ table[0][table[k - 1][n] & 0xFF]);
+            }
+        }
+    }
+};
+
+static constexpr CrcTables<std::uint16_t, 0x8408> _crc16Tables;
+static constexpr CrcTables<std::uint32_t, 0xEDB88320> _crc32Tables;
+
+std::uint16_t Crc::crc16(const std::uint8_t *data, std::size_t size, std::uint16_t crc)
+{
+    const auto &t = _crc16Tables.table;
+    std::uint32_t value = crc ^ 0xFFFF;
+    for (; size >= 8; size -= 8, data += 8)
+    {
+        value ^= data[0] | (data[1] << 8);
+        value = t[7][value & 0xFF] ^ t[6][value >> 8] ^ t[5][data[2]] ^ t[4][data[3]] ^
+                t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    }
+
+    for (; size > 0; size--, data++)
+    {
+        value = (value >> 8) ^ t[0][(value ^ *data) & 0xFF];
+    }
+
+    return (std::uint16_t)(value ^ 0xFFFF);
+}
+
+std::uint32_t Crc::crc32(const std::uint8_t *data, std::size_t size, std::uint32_t crc)
+{
+    const auto &t = _crc32Tables.table;
+    std::uint32_t value = ~crc;
+    for (; size >= 8; size -= 8, data += 8)
+    {
+        // assembled byte by byte, so that it does not matter how the platform orders words
+        value ^= data[0] | (data[1] << 8) | (data[2] << 16) | ((std::uint32_t)data[3] << 24);
+        value = t[7][value & 0xFF] ^ t[6][(value >> 8) & 0xFF] ^ t[5][(value >> 16) & 0xFF] ^ t[4][value >> 24] ^
+                t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+    }
+
+    for (; size > 0; size--, data++)
+    {
+        value = (value >> 8) ^ t[0][(value ^ *data) & 0xFF];
+    }
+
+    return ~value;
+}
@@ -0,0 +1,96 @@
+#include "delta_codec.hpp"
+
+using namespace wircom;
+
+std::vector<std::uint8_t> DeltaEncoder::encode(const std::vector<std::uint8_t> &frame)
+{
+    std::vector<std::uint8_t> encoded;
+    bool keyframe = this->_keyframeDue || frame.size() != this->_keyframe.size() ||
+                    this->_sinceKeyframe + 1 >= this->_keyframeInterval;
+
+    if (!keyframe)
+    {
+        std::size_t bitmapSize = (frame.size() + 7) / 8;
+        encoded.reserve(DELTA_HEADER_SIZE + bitmapSize + frame.size());
+        encoded.push_back(DELTA_FRAME);
+        encoded.push_back(this->_keyframeID);
+        encoded.resize(DELTA_HEADER_SIZE + bitmapSize, 0);
+
+        for (std::size_t i = 0; i < frame.size(); i++)
+        {
+            std::uint8_t difference = frame[i] ^ this->_keyframe[i];
+            if (difference != 0)
+            {
+                encoded[DELTA_HEADER_SIZE + i / 8] |= 0x80 >> (i % 8);
+                encoded.push_back(difference);
+            }
+        }
+
+        if (encoded.size() < DELTA_HEADER_SIZE + frame.size())
+        {
+            this->_sinceKeyframe++;
+            return encoded;
+        }
+
+        // too much changed, a keyframe is no bigger and resets the reference
+        encoded.clear();
+    }
+
+    this->_keyframe = frame;
+    this->_keyframeID++;
+    this->_sinceKeyframe = 0;
+    this->_keyframeDue = false;
+
+    encoded.reserve(DELTA_HEADER_SIZE + frame.size());
+    encoded.push_back(DELTA_KEYFRAME);
+    encoded.push_back(this->_keyframeID);
+    encoded.insert(encoded.end(), frame.begin(), frame.end());
+    return encoded;
+}
+
+bool DeltaDecoder::decode(PayloadView encoded, std::vector<std::uint8_t> &frame)
+{
+    if (encoded.size < DELTA_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    if (encoded[0] == DELTA_KEYFRAME)
+    {
+        this->_keyframe.assign(encoded.begin() + DELTA_HEADER_SIZE, encoded.end());
+        this->_keyframeID = encoded[1];
+        this->_hasKeyframe = true;
+        frame = this->_keyframe;
+        return true;
+    }
+
+    if (encoded[0] != DELTA_FRAME || !this->_hasKeyframe || encoded[1] != this->_keyframeID)
+    {
+        return false;
+    }
+
+    std::size_t bitmapSize = (this->_keyframe.size() + 7) / 8;
+    if (encoded.size < DELTA_HEADER_SIZE + bitmapSize)
+    {
+        return false;
+    }
+
+    frame = this->_keyframe;
+    const std::uint8_t *bitmap = encoded.data + DELTA_HEADER_SIZE;
+    std::size_t next = DELTA_HEADER_SIZE + bitmapSize;
+    for (std::size_t i = 0; i < frame.size(); i++)
+    {
+        if ((bitmap[i / 8] & (0x80 >> (i % 8))) == 0)
+        {
+            continue;
+        }
+
+        if (next >= encoded.size)
+        {
+            return false;
+        }
+        frame[i] ^= encoded[next++];
+    }
+
+    return next == encoded.size;
+}
@@ -0,0 +1,77 @@
+#include "dispatch_table.hpp"
+
+using namespace wircom;
+
+void DispatchTable::add(MessageType messageType, MessageContentType contentType, MessageCallback callback)
+{
+    this->_entry(messageType, contentType).messageCallbacks.push_back(std::move(callback));
+}
+
+void DispatchTable::addView(MessageType messageType, MessageContentType contentType, MessageViewCallback callback)
+{
+    this->_entry(messageType, contentType).viewCallbacks.push_back(std::move(callback));
+}
+
+void DispatchTable::addAny(MessageType messageType, MessageCallback callback)
+{
+    this->_any[messageType % MESSAGE_TYPE_COUNT].push_back(std::move(callback));
+}
+
+bool DispatchTable::dispatch(const MessageView &view) const
+{
+    const Entry *entry = this->_find(view.messageType(), view.contentType());
+    const std::vector<MessageCallback> &any = this->_any[view.messageType() % MESSAGE_TYPE_COUNT];
+    if (entry != nullptr)
+    {
+        for (const MessageViewCallback &callback : entry->viewCallbacks)
+        {
+            callback(view);
+        }
+    }
+
+    bool copied = entry != nullptr && !entry->messageCallbacks.empty();
+    if (copied || !any.empty())
+    {
+        // only materialize an owning copy if someone asked for one, and share it
+        Message msg = view.toMessage();
+        if (copied)
+        {
+            for (const MessageCallback &callback : entry->messageCallbacks)
+            {
+                callback(msg);
+            }
+        }
+
+        for (const MessageCallback &callback : any)
+        {
+            callback(msg);
+        }
+    }
+
+    return copied || !any.empty() || (entry != nullptr && !entry->viewCallbacks.empty());
+}
+
+std::size_t DispatchTable::subscriberCount(MessageType messageType, MessageContentType contentType) const
+{
+    const Entry *entry = this->_find(messageType, contentType);
+    std::size_t count = this->_any[messageType % MESSAGE_TYPE_COUNT].size();
+    return entry != nullptr ? count + entry->viewCallbacks.size() + entry->messageCallbacks.size() : count;
+}
+
+DispatchTable::Entry &DispatchTable::_entry(MessageType messageType, MessageContentType contentType)
+{
+    std::uint16_t &slot = this->_slots[(std::size_t)contentType % MESSAGE_CONTENT_TYPE_COUNT];
+    if (slot == 0)
+    {
+        this->_entries.resize(this->_entries.size() + MESSAGE_TYPE_COUNT);
+        slot = this->_entries.size() - MESSAGE_TYPE_COUNT + 1;
+    }
+
+    return this->_entries[slot - 1 + messageType % MESSAGE_TYPE_COUNT];
+}
+
+const DispatchTable::Entry *DispatchTable::_find(MessageType messageType, MessageContentType contentType) const
+{
+    std::uint16_t slot = this->_slots[(std::size_t)contentType % MESSAGE_CONTENT_TYPE_COUNT];
+    return slot != 0 ? &this->_entries[slot - 1 + messageType % MESSAGE_TYPE_COUNT] : nullptr;
+}
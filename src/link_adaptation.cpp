@@ -0,0 +1,205 @@
+#include "link_adaptation.hpp"
+#include <cmath>
+
+using namespace wircom;
+
+// the SX127x reports SNR up to about +10 dB, a stronger signal only shows in the RSSI
+#define SNR_SATURATION 5.0f
+#define NOISE_FIGURE 6.0f // of the receiver, in dB
+
+// the weight of a new sample in the smoothed SNR and loss rate
+#define SNR_GAIN 0.25f
+#define LOSS_GAIN 0.125f
+
+static float _bandwidthPenalty(long bandwidth)
+{
+    // noise power grows with the bandwidth, so the same signal has less SNR in a wider channel
+    return 10.0f * std::log10((float)bandwidth / 125000.0f);
+}
+
+LinkAdaptation::LinkAdaptation(const LinkAdaptationConfig &config, std::size_t rate, std::uint32_t now)
+    : _config(config), _enabled(true), _current(rate), _previous(rate), _lastSwitch(now), _lastHeard(now)
+{
+}
+
+float LinkAdaptation::requiredSNR(const DataRate &rate)
+{
+    // -7.5 dB at SF7, 2.5 dB less for every step up to SF12
+    return -7.5f - 2.5f * (rate.spreadingFactor - 7) + _bandwidthPenalty(rate.bandwidth);
+}
+
+void LinkAdaptation::onReceived(int rssi, float snr, std::uint32_t now)
+{
+    this->_lastHeard = now;
+    if (rssi == 0)
+    {
+        return;
+    }
+
+    long bandwidth = this->rate().bandwidth;
+    if (snr > SNR_SATURATION)
+    {
+        float noiseFloor = -174.0f + 10.0f * std::log10((float)bandwidth) + NOISE_FIGURE;
+        snr = std::fmax(snr, rssi - noiseFloor);
+    }
+    snr += _bandwidthPenalty(bandwidth);
+
+    this->_snr = this->_hasSignal ? this->_snr + SNR_GAIN * (snr - this->_snr) : snr;
+    this->_hasSignal = true;
+    this->_samples++;
+}
+
+void LinkAdaptation::onDelivered(std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++)
+    {
+        this->_lossRate -= LOSS_GAIN * this->_lossRate;
+    }
+    this->_outcomes += count;
+}
+
+void LinkAdaptation::onLost(std::size_t count)
+{
+    for (std::size_t i = 0; i < count; i++)
+    {
+        this->_lossRate += LOSS_GAIN * (1.0f - this->_lossRate);
+    }
+    this->_outcomes += count;
+}
+
+std::size_t LinkAdaptation::target(std::uint32_t now) const
+{
+    if (!this->_enabled || !this->_config.initiator || this->_state != LINK_STEADY)
+    {
+        return this->_current;
+    }
+
+    // retransmissions say the rate is too fast even before the signal does, e.g. when packets stop arriving
+    if (this->_current > 0 && this->_outcomes >= this->_config.minSamples && this->_lossRate > this->_config.maxLossRate)
+    {
+        return this->_current - 1;
+    }
+
+    if (this->_samples < this->_config.minSamples)
+    {
+        return this->_current;
+    }
+
+    std::size_t best = this->_current;
+    while (best > 0 && this->_snr < requiredSNR(this->rate(best)) + this->_config.downMargin)
+    {
+        best--;
+    }
+
+    if (best < this->_current)
+    {
+        return best;
+    }
+
+    // up one margin and down another, so that a signal on the edge does not flip the rate back and forth
+    if (now - this->_lastSwitch < this->_config.holdTime || this->_lossRate > this->_config.maxLossRate / 2)
+    {
+        return this->_current;
+    }
+
+    bool capped = (std::int32_t)(now - this->_ceilingUntil) < 0;
+    for (std::size_t i = this->_current + 1; i < this->_config.rates.size() && !(capped && i >= this->_ceiling); i++)
+    {
+        if (this->_snr >= requiredSNR(this->rate(i)) + this->_config.upMargin)
+        {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+void LinkAdaptation::propose(std::size_t rate, std::uint16_t requestID, std::uint32_t now)
+{
+    this->_state = LINK_PROPOSED;
+    this->_proposed = rate;
+    this->_requestID = requestID;
+    this->_switchStarted = now;
+}
+
+void LinkAdaptation::switchTo(std::size_t rate, std::uint32_t now)
+{
+    if (this->_state != LINK_PROPOSED)
+    {
+        // requested by the other side, the timeout starts now
+        this->_switchStarted = now;
+    }
+
+    this->_previous = this->_current;
+    this->_current = rate;
+    this->_state = LINK_SWITCHED;
+    this->_samples = 0;
+}
+
+void LinkAdaptation::confirm(std::uint32_t now)
+{
+    if (this->_state != LINK_SWITCHED)
+    {
+        return;
+    }
+
+    this->_switches++;
+    this->_settle(this->_current, now);
+}
+
+void LinkAdaptation::revert(std::uint32_t now)
+{
+    this->_ceiling = (this->_state == LINK_PROPOSED) ? this->_proposed : this->_current;
+    this->_ceilingUntil = now + 4 * this->_config.holdTime;
+    this->_reverts++;
+    this->_settle(this->_state == LINK_SWITCHED ? this->_previous : this->_current, now);
+}
+
+void LinkAdaptation::fallBack(std::uint32_t now)
+{
+    this->_ceiling = this->_current;
+    this->_ceilingUntil = now + 4 * this->_config.holdTime;
+    this->_reverts++;
+    this->_settle(0, now);
+
+    // the link was lost at the faster rate, give it a fresh start at the slow one
+    this->_lastHeard = now;
+}
+
+bool LinkAdaptation::silent(std::uint32_t now) const
+{
+    return this->_enabled && this->_state == LINK_STEADY && this->_current > 0 && now - this->_lastHeard > this->_config.silenceTimeout;
+}
+
+bool LinkAdaptation::switchTimedOut(std::uint32_t now) const
+{
+    return this->_enabled && this->_state != LINK_STEADY && now - this->_switchStarted > this->_config.switchTimeout;
+}
+
+std::size_t LinkAdaptation::indexOf(const DataRate &rate) const
+{
+    for (std::size_t i = 0; i < this->_config.rates.size(); i++)
+    {
+        if (this->_config.rates[i] == rate)
+        {
+            return i;
+        }
+    }
+
+    return this->_config.rates.size();
+}
+
+void LinkAdaptation::_settle(std::size_t rate, std::uint32_t now)
+{
+    if (rate != this->_current)
+    {
+        this->_samples = 0;
+    }
+
+    this->_current = rate;
+    this->_previous = rate;
+    this->_state = LINK_STEADY;
+    this->_lastSwitch = now;
+    this->_lossRate = 0.0f;
+    this->_outcomes = 0;
+}
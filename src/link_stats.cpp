@@ -0,0 +1,176 @@
+#include "link_stats.hpp"
+
+using namespace wircom;
+
+// ENCODED LINK STATS
+// 0: Version, LINK_STATS_VERSION
+// then, as LEB128 varints: the timestamp and the counters, in the order they are declared
+// then for each histogram, in the order they are declared:
+//   count, and unless it is 0: sum, max, the number of buckets that are not empty, and for each of
+//   them its index as one byte and its count
+// a later version only ever appends fields, so a decoder stops at what it knows
+
+static void _putVarint(std::vector<std::uint8_t> &out, std::uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out.push_back((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+static bool _getVarint(const std::uint8_t *&data, const std::uint8_t *end, std::uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && data < end; shift += 7)
+    {
+        std::uint8_t byte = *data++;
+        value |= (std::uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool _getVarint(const std::uint8_t *&data, const std::uint8_t *end, std::uint32_t &value)
+{
+    std::uint64_t wide;
+    if (!_getVarint(data, end, wide) || wide > UINT32_MAX)
+    {
+        return false;
+    }
+
+    value = (std::uint32_t)wide;
+    return true;
+}
+
+std::uint32_t Histogram::percentile(float fraction) const
+{
+    if (this->_count == 0)
+    {
+        return 0;
+    }
+
+    // the rank of the value, counted from 1
+    std::uint64_t rank = (std::uint64_t)(fraction * this->_count + 0.999999f);
+    rank = rank < 1 ? 1 : rank;
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += this->_buckets[i];
+        if (seen >= rank)
+        {
+            return bucketLimit(i) < this->_max ? bucketLimit(i) : this->_max;
+        }
+    }
+
+    return this->_max;
+}
+
+std::vector<std::uint8_t> LinkStats::encode() const
+{
+    std::vector<std::uint8_t> out;
+    out.push_back(LINK_STATS_VERSION);
+
+    const std::uint32_t counters[] = {this->timestamp, this->packetsSent, this->packetsReceived, this->bytesSent,
+                                      this->bytesReceived, this->decodeFailures, this->checksumFailures, this->duplicates,
+                                      this->retries, this->timeouts, this->rxOverflows, this->messagesReceived};
+    for (std::uint32_t counter : counters)
+    {
+        _putVarint(out, counter);
+    }
+
+    const Histogram *histograms[] = {&this->responseLatency, &this->fragmentInterarrival, &this->reassemblyTime,
+                                     &this->retriesPerRequest, &this->airtimePerPacket};
+    for (const Histogram *histogram : histograms)
+    {
+        _putVarint(out, histogram->_count);
+        if (histogram->_count == 0)
+        {
+            continue;
+        }
+
+        _putVarint(out, histogram->_sum);
+        _putVarint(out, histogram->_max);
+        std::size_t used = 0;
+        for (std::uint32_t bucket : histogram->_buckets)
+        {
+            used += bucket != 0;
+        }
+
+        _putVarint(out, used);
+        for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            if (histogram->_buckets[i] != 0)
+            {
+                out.push_back(i);
+                _putVarint(out, histogram->_buckets[i]);
+            }
+        }
+    }
+
+    return out;
+}
+
+bool LinkStats::decode(const std::uint8_t *data, std::size_t size, LinkStats &stats)
+{
+    const std::uint8_t *end = data + size;
+    if (size == 0 || *data++ != LINK_STATS_VERSION)
+    {
+        return false;
+    }
+
+    LinkStats decoded;
+    std::uint32_t *counters[] = {&decoded.timestamp, &decoded.packetsSent, &decoded.packetsReceived, &decoded.bytesSent,
+                                 &decoded.bytesReceived, &decoded.decodeFailures, &decoded.checksumFailures, &decoded.duplicates,
+                                 &decoded.retries, &decoded.timeouts, &decoded.rxOverflows, &decoded.messagesReceived};
+    for (std::uint32_t *counter : counters)
+    {
+        if (!_getVarint(data, end, *counter))
+        {
+            return false;
+        }
+    }
+
+    Histogram *histograms[] = {&decoded.responseLatency, &decoded.fragmentInterarrival, &decoded.reassemblyTime,
+                               &decoded.retriesPerRequest, &decoded.airtimePerPacket};
+    for (Histogram *histogram : histograms)
+    {
+        if (!_getVarint(data, end, histogram->_count))
+        {
+            return false;
+        }
+        if (histogram->_count == 0)
+        {
+            continue;
+        }
+
+        std::uint32_t used;
+        if (!_getVarint(data, end, histogram->_sum) || !_getVarint(data, end, histogram->_max) ||
+            !_getVarint(data, end, used) || used > HISTOGRAM_BUCKETS)
+        {
+            return false;
+        }
+
+        for (std::uint32_t i = 0; i < used; i++)
+        {
+            if (data == end || *data >= HISTOGRAM_BUCKETS)
+            {
+                return false;
+            }
+
+            std::size_t index = *data++;
+            if (!_getVarint(data, end, histogram->_buckets[index]))
+            {
+                return false;
+            }
+        }
+    }
+
+    stats = decoded;
+    return true;
+}
@@ -0,0 +1,169 @@
+#include "lz_codec.hpp"
+
+using namespace wircom;
+
+#define LZ_HASH_SIZE (1u << LZ_HASH_BITS)
+#define LZ_NO_POSITION 0xFFFFFFFFu
+
+static inline std::uint32_t _hash(const std::uint8_t *data)
+{
+    std::uint32_t value = (data[0] << 16) | (data[1] << 8) | data[2];
+    return (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+std::size_t LzCodec::compress(const std::uint8_t *input, std::size_t size, std::uint8_t *output, std::size_t capacity)
+{
+    if (capacity < LZ_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    output[0] = (size >> 24) & 0xFF;
+    output[1] = (size >> 16) & 0xFF;
+    output[2] = (size >> 8) & 0xFF;
+    output[3] = size & 0xFF;
+
+    std::uint32_t head[LZ_HASH_SIZE];
+    for (std::uint32_t &position : head)
+    {
+        position = LZ_NO_POSITION;
+    }
+
+    std::size_t out = LZ_HEADER_SIZE;
+    std::size_t flagPosition = 0;
+    std::size_t item = 0; // items in the current group
+    std::size_t i = 0;
+    while (i < size)
+    {
+        if (item == 0)
+        {
+            if (out >= capacity)
+            {
+                return 0;
+            }
+            flagPosition = out++;
+            output[flagPosition] = 0;
+        }
+
+        std::size_t matchLength = 0;
+        std::size_t matchOffset = 0;
+        if (i + LZ_MIN_MATCH <= size)
+        {
+            std::uint32_t hash = _hash(input + i);
+            std::uint32_t candidate = head[hash];
+            head[hash] = i;
+
+            if (candidate != LZ_NO_POSITION && i - candidate <= LZ_WINDOW_SIZE)
+            {
+                std::size_t limit = (size - i < LZ_MAX_MATCH) ? size - i : LZ_MAX_MATCH;
+                while (matchLength < limit && input[candidate + matchLength] == input[i + matchLength])
+                {
+                    matchLength++;
+                }
+                matchOffset = i - candidate;
+            }
+        }
+
+        if (matchLength >= LZ_MIN_MATCH)
+        {
+            if (capacity - out < 2)
+            {
+                return 0;
+            }
+
+            std::uint16_t token = ((matchOffset - 1) << 4) | (matchLength - LZ_MIN_MATCH);
+            output[flagPosition] |= 0x80 >> item;
+            output[out++] = token >> 8;
+            output[out++] = token & 0xFF;
+
+            // remember the positions inside the match too, so later repeats of them are found
+            for (std::size_t j = i + 1; j < i + matchLength && j + LZ_MIN_MATCH <= size; j++)
+            {
+                head[_hash(input + j)] = j;
+            }
+            i += matchLength;
+        }
+        else
+        {
+            if (out >= capacity)
+            {
+                return 0;
+            }
+            output[out++] = input[i++];
+        }
+
+        item = (item + 1) % 8;
+    }
+
+    return out;
+}
+
+std::size_t LzCodec::decompressedSize(const std::uint8_t *input, std::size_t size)
+{
+    if (size < LZ_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    return ((std::size_t)input[0] << 24) | ((std::size_t)input[1] << 16) | (input[2] << 8) | input[3];
+}
+
+bool LzCodec::decompress(const std::uint8_t *input, std::size_t size, std::uint8_t *output, std::size_t capacity)
+{
+    std::size_t total = decompressedSize(input, size);
+    if (size < LZ_HEADER_SIZE || total > capacity)
+    {
+        return false;
+    }
+
+    std::size_t in = LZ_HEADER_SIZE;
+    std::size_t out = 0;
+    std::uint8_t flags = 0;
+    std::size_t item = 0;
+    while (out < total)
+    {
+        if (item == 0)
+        {
+            if (in >= size)
+            {
+                return false;
+            }
+            flags = input[in++];
+        }
+
+        if (flags & (0x80 >> item))
+        {
+            if (size - in < 2)
+            {
+                return false;
+            }
+
+            std::uint16_t token = (input[in] << 8) | input[in + 1];
+            in += 2;
+            std::size_t offset = (token >> 4) + 1;
+            std::size_t length = (token & 0x0F) + LZ_MIN_MATCH;
+            if (offset > out || total - out < length)
+            {
+                return false;
+            }
+
+            // byte by byte, a match may overlap the bytes it produces
+            for (std::size_t j = 0; j < length; j++, out++)
+            {
+                output[out] = output[out - offset];
+            }
+        }
+        else
+        {
+            if (in >= size)
+            {
+                return false;
+            }
+            output[out++] = input[in++];
+        }
+
+        item = (item + 1) % 8;
+    }
+
+    return in == size;
+}
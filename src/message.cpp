@@ -1,83 +1,186 @@
 // message.hpp
 
+#include <algorithm>
 #include <cstdint>
 #include <string>
 #include <iostream>
 #include <vector>
 #include <bitset>
+#include <cstring>
 
+#include "crc.hpp"
+#include "fec.hpp"
 #include "message.hpp"
+#include "log.hpp"
 
 using namespace wircom;
 
-MessageParsingResult Message::decode(const std::vector<std::uint8_t> &packet)
+static inline bool _checkPacketCRC(const std::uint8_t *bytes, std::size_t size)
+{
+    // bytes is everything the CRC covers, followed by the CRC
+    std::uint16_t crc = Crc::crc16(bytes, size - PACKET_CRC_SIZE);
+    return bytes[size - 2] == (crc >> 8) && bytes[size - 1] == (crc & 0xFF);
+}
+
+PacketView PacketView::parse(const std::uint8_t *packet, std::size_t length)
 {
-    if (packet.size() < SHORT_MSG_HEADER_SIZE)
+    PacketView view;
+    if (length < SHORT_MSG_HEADER_SIZE)
     {
-        std::cout << "Message Parsing Error: Packet size is too small" << std::endl;
-        return MessageParsingResult::error();
+        return view;
     }
 
     // check if the packet is a message packet
-    for (int i = 0; i < 3; i++)
+    bool extended = std::memcmp(packet, EXTENDED_IDENTIFIER, 3) == 0;
+    bool typed = std::memcmp(packet, TYPED_IDENTIFIER, 3) == 0;
+    if (!extended && !typed && std::memcmp(packet, MSG_IDENTIFIER, 3) != 0)
     {
-        if (packet[i] != MSG_IDENTIFIER[i])
-        {
-            std::cout << "Message Parsing Error: Invalid message identifier" << std::endl;
-            return MessageParsingResult::error();
-        }
+        return view;
     }
 
-    MessageFlag flag;
-    std::uint16_t messageID = (packet[3] << 8) | packet[4];
-    flag.raw = packet[5];
+    view.messageID = (packet[3] << 8) | packet[4];
+    view.flag.raw = packet[5];
 
-    // print the flag bits
-    std::cout << "Flag bits: " << std::bitset<8>(flag.raw) << std::endl;
-    std::cout << "Message Type: " << flag.getMessageType() << std::endl;
-    std::cout << "Content Type: " << flag.getMessageContentType() << std::endl;
-    int payloadStart = SHORT_MSG_HEADER_SIZE - 1; // assume short message
+    std::size_t payloadStart = SHORT_MSG_HEADER_SIZE - 1; // assume short message
+    if (extended)
+    {
+        // a newer header version may move things around, so it is not guessed at
+        typed = packet[6] == EXTENDED_TYPED_HEADER_VERSION;
+        if (packet[6] != EXTENDED_HEADER_VERSION && !typed)
+        {
+            return view;
+        }
 
-    if (flag.isLongMessage())
+        payloadStart = EXTENDED_MSG_HEADER_SIZE - 1 + (typed ? CONTENT_TYPE_EXTENSION_SIZE : 0);
+        if (length <= payloadStart || !view.flag.isLongMessage())
+        {
+            return view;
+        }
+
+        view.extended = true;
+        view.packetNumber = (packet[payloadStart - 4] << 8) | packet[payloadStart - 3];
+        view.packetCount = (packet[payloadStart - 2] << 8) | packet[payloadStart - 1];
+        if (view.packetCount == 0 || view.packetNumber >= view.packetCount)
+        {
+            return view;
+        }
+    }
+    else
     {
-        std::cout << "Long message detected" << std::endl;
-        payloadStart = LONG_MSG_HEADER_SIZE - 1;
+        payloadStart += (typed ? CONTENT_TYPE_EXTENSION_SIZE : 0) + (view.flag.isLongMessage() ? 2 : 0);
+        if (length <= payloadStart)
+        {
+            return view;
+        }
+
+        if (view.flag.isLongMessage())
+        {
+            view.packetNumber = packet[payloadStart - 2];
+            view.packetCount = packet[payloadStart - 1];
+            if (view.packetCount == 0 || view.packetNumber >= view.packetCount)
+            {
+                return view;
+            }
+        }
     }
 
-    if (packet.size() <= payloadStart)
+    if (typed)
     {
-        std::cout << "Message Parsing Error: Packet size is too small" << std::endl;
-        return MessageParsingResult::error();
+        // the content type byte always follows the flag, or the version of an extended header.
+        // A type that fits the flag is never sent this way, so each message has one encoding
+        std::uint8_t contentType = packet[extended ? 7 : 6];
+        if (contentType < FLAG_CONTENT_TYPE_COUNT || (view.flag.raw & (0x3 << 2)) != 0)
+        {
+            return view;
+        }
+
+        view.typed = true;
+        view.flag.extendedType = contentType;
     }
 
     std::uint8_t dataSize = packet[payloadStart];
+    if (view.flag.isChecked())
+    {
+        std::size_t checkedSize = dataSize + PACKET_CRC_SIZE;
+        if (length - payloadStart - 1 != checkedSize)
+        {
+            return view;
+        }
 
-    if (dataSize == 0)
+        if (!_checkPacketCRC(packet + 3, length - 3))
+        {
+            view.corrupt = true;
+            return view;
+        }
+    }
+    else if (dataSize != 0 && length - payloadStart - 1 != dataSize)
     {
-        // this has no payload
-        std::cout << "Message Parsing: No payload" << std::endl;
-        return MessageParsingResult(true, messageID, flag.getMessageType(), flag.getMessageContentType(), std::vector<std::uint8_t>());
+        return view;
     }
 
-    std::vector<std::uint8_t> payload;
-    for (int i = payloadStart + 1; i < packet.size(); i++)
+    view.payload = PayloadView(packet + payloadStart + 1, dataSize);
+    view.success = true;
+    return view;
+}
+
+bool BatchView::isBatch(const std::uint8_t *frame, std::size_t length)
+{
+    return length >= 3 && std::memcmp(frame, BATCH_IDENTIFIER, 3) == 0;
+}
+
+bool BatchView::next(PacketView &packet)
+{
+    packet = PacketView();
+    if (this->_length - this->_offset < BATCH_RECORD_HEADER_SIZE)
+    {
+        return false;
+    }
+
+    const std::uint8_t *record = this->_frame + this->_offset;
+    packet.messageID = (record[0] << 8) | record[1];
+    packet.flag.raw = record[2];
+    std::uint8_t dataSize = record[3];
+    std::size_t recordSize = BATCH_RECORD_HEADER_SIZE + dataSize + (packet.flag.isChecked() ? PACKET_CRC_SIZE : 0);
+    if (packet.flag.isLongMessage() || this->_length - this->_offset < recordSize)
+    {
+        // only short messages are batched
+        this->_offset = this->_length;
+        return false;
+    }
+
+    if (packet.flag.isChecked() && !_checkPacketCRC(record, recordSize))
     {
-        payload.push_back(packet[i]);
+        // the length of the next record cannot be trusted either
+        packet.corrupt = true;
+        this->_offset = this->_length;
+        return false;
     }
 
-    if (payload.size() != dataSize)
+    packet.payload = PayloadView(record + BATCH_RECORD_HEADER_SIZE, dataSize);
+    packet.success = true;
+    this->_offset += recordSize;
+    return true;
+}
+
+MessageParsingResult Message::decode(const std::vector<std::uint8_t> &packet)
+{
+    PacketView view = PacketView::parse(packet.data(), packet.size());
+    if (!view.success)
     {
-        std::cout << "Message Parsing Error: Data size does not match the packet size" << std::endl;
-        std::cout << "Data size: " << payload.size() << " Expected size: " << (unsigned int)dataSize << std::endl;
+        WIRCOM_LOG_WARN("Message Parsing Error: Malformed packet");
         return MessageParsingResult::error();
     }
 
-    if (flag.isLongMessage())
+    WIRCOM_LOG_DEBUG("Flag bits: " << std::bitset<8>(view.flag.raw)
+                                   << " Message Type: " << view.messageType()
+                                   << " Content Type: " << view.contentType());
+
+    if (view.flag.isLongMessage() && !view.payload.empty())
     {
-        return MessageParsingResult(true, messageID, packet[payloadStart - 2], packet[payloadStart - 1], flag.getMessageType(), flag.getMessageContentType(), payload);
+        return MessageParsingResult(true, view.messageID, view.packetNumber, view.packetCount, view.messageType(), view.contentType(), view.payload.toVector());
     }
 
-    return MessageParsingResult(true, messageID, flag.getMessageType(), flag.getMessageContentType(), payload);
+    return MessageParsingResult(true, view.messageID, view.messageType(), view.contentType(), view.payload.toVector());
 }
 
 MessageParsingResult Message::decode(const std::vector<std::vector<std::uint8_t>> &packets)
@@ -113,101 +216,310 @@ bool Message::operator==(const Message &other) const
 
 std::vector<std::vector<std::uint8_t>> Message::encode() const
 {
-    // split the data into packets
+    WIRCOM_LOG_DEBUG("Encoding::" << (flag.isLongMessage() ? "Long" : "Short") << " message " << messageID);
+
+    PacketCursor cursor(*this);
     std::vector<std::vector<std::uint8_t>> packets;
-    std::vector<std::uint8_t> slice = data;
+    packets.reserve(cursor.count());
+    while (cursor.next())
+    {
+        packets.emplace_back(cursor.packet().data, cursor.packet().data + cursor.packet().size);
+    }
 
-    if (slice.size() == 0)
+    return packets;
+}
+
+bool Message::enableChecksum()
+{
+    if (this->flag.isFEC())
     {
-        // no data to send
-        std::vector<std::uint8_t> packet = this->_buildPacket(slice);
-        packets.push_back(packet);
-        return packets;
+        return false;
     }
 
-    std::uint8_t numPackets = 1;
-    if (flag.isLongMessage())
+    std::uint32_t crc = 0;
+    if (this->_source)
     {
-        std::cout << "Encoding::Long message detected" << std::endl;
-        // this a long message, it needs to be split into multiple packets
-        float fNumPackets = (float)slice.size() / MAX_LONG_MSG_PAYLOAD_SIZE;
-        if (fNumPackets > (std::uint8_t)fNumPackets)
+        std::uint8_t chunk[MAX_LONG_MSG_PAYLOAD_SIZE];
+        for (std::size_t offset = 0; offset < this->_sourceSize; offset += sizeof(chunk))
         {
-            numPackets = (std::uint8_t)fNumPackets + 1;
+            std::size_t size = std::min(sizeof(chunk), this->_sourceSize - offset);
+            if (!this->_source(offset, chunk, size))
+            {
+                return false;
+            }
+            crc = Crc::crc32(chunk, size, crc);
         }
-        else
+    }
+    else
+    {
+        crc = Crc::crc32(this->data.data(), this->data.size());
+    }
+
+    this->flag.markAsChecked();
+    if (!this->flag.isLongMessage() && this->dataSize() > Message::maxPayloadSize(this->flag))
+    {
+        this->flag.markAsLongMessage();
+    }
+
+    this->_crc = crc;
+    return true;
+}
+
+bool Message::enableFEC(std::uint8_t dataFragments, std::uint8_t parityFragments)
+{
+    FecLayout layout = FecLayout::forSize(this->_bodySize(), dataFragments, parityFragments);
+    if (!this->flag.isLongMessage() || !layout.valid())
+    {
+        return false;
+    }
+
+    this->_fecData = dataFragments;
+    this->_fecParity = parityFragments;
+    this->flag.markAsFEC();
+    return true;
+}
+
+std::size_t Message::packetCount() const
+{
+    if (flag.isFEC())
+    {
+        return FecLayout::forSize(this->_bodySize(), _fecData, _fecParity).packetCount();
+    }
+
+    std::size_t size = this->_bodySize();
+    if (size == 0)
+    {
+        // no data to send, but we still send the header
+        return 1;
+    }
+
+    std::size_t maxPayloadSize = Message::maxPayloadSize(flag, this->_extended());
+    return (size + maxPayloadSize - 1) / maxPayloadSize;
+}
+
+bool Message::encodePacket(std::size_t packetNumber, PacketBuffer &out) const
+{
+    std::size_t numPackets = this->packetCount();
+    if (packetNumber >= numPackets || numPackets > MAX_MESSAGE_PACKET_COUNT)
+    {
+        return false;
+    }
+
+    if (flag.isFEC())
+    {
+        FecLayout layout = FecLayout::forSize(this->_bodySize(), _fecData, _fecParity);
+        std::uint8_t payload[MAX_LONG_MSG_PAYLOAD_SIZE];
+        layout.writeHeader(payload);
+        std::uint8_t *body = payload + FEC_HEADER_SIZE;
+
+        std::size_t index;
+        std::size_t block = layout.blockOf(packetNumber);
+        if (!layout.isParity(packetNumber, index))
+        {
+            std::size_t offset = (block * layout.blockData + index) * FEC_FRAGMENT_SIZE;
+            std::size_t size = layout.fragmentSize(packetNumber);
+            if (!this->_copyBody(offset, size, body))
+            {
+                return false;
+            }
+            out.size = this->_writePacket(payload, FEC_HEADER_SIZE + size, packetNumber, numPackets, out.data);
+            return true;
+        }
+
+        // the XOR of every data fragment in the block with this residue, the short last one zero padded
+        std::memset(body, 0, FEC_FRAGMENT_SIZE);
+        std::uint8_t fragmentData[FEC_FRAGMENT_SIZE];
+        for (std::size_t i = index; i < layout.dataInBlock(block); i += layout.blockParity)
+        {
+            std::size_t fragment = block * layout.blockData + i;
+            std::size_t size = (fragment == layout.dataCount - 1u) ? layout.lastSize : FEC_FRAGMENT_SIZE;
+            if (!this->_copyBody(fragment * FEC_FRAGMENT_SIZE, size, fragmentData))
+            {
+                return false;
+            }
+            for (std::size_t j = 0; j < size; j++)
+            {
+                body[j] ^= fragmentData[j];
+            }
+        }
+
+        out.size = this->_writePacket(payload, FEC_HEADER_SIZE + FEC_FRAGMENT_SIZE, packetNumber, numPackets, out.data);
+        return true;
+    }
+
+    std::size_t maxPayloadSize = Message::maxPayloadSize(flag, this->_extended());
+    std::size_t size = this->_bodySize();
+    std::size_t offset = packetNumber * maxPayloadSize;
+    std::size_t payloadSize = (size - offset > maxPayloadSize) ? maxPayloadSize : size - offset;
+    if (this->_source || offset + payloadSize > data.size())
+    {
+        // the packet is read from the source, or carries some of the message's CRC-32, which is not in data
+        std::uint8_t payload[MAX_LONG_MSG_PAYLOAD_SIZE];
+        if (!this->_copyBody(offset, payloadSize, payload))
+        {
+            return false;
+        }
+        out.size = this->_writePacket(payload, payloadSize, packetNumber, numPackets, out.data);
+        return true;
+    }
+
+    out.size = this->_writePacket(data.data() + offset, payloadSize, packetNumber, numPackets, out.data);
+    return true;
+}
+
+std::size_t Message::encodeInto(PacketBuffer *packets, std::size_t capacity, std::size_t firstPacket) const
+{
+    std::size_t numPackets = this->packetCount();
+    std::size_t written = 0;
+    for (std::size_t i = firstPacket; i < numPackets && written < capacity; i++)
+    {
+        if (!this->encodePacket(i, packets[written]))
         {
-            numPackets = (std::uint8_t)fNumPackets;
+            break;
         }
+        written++;
+    }
+
+    return written;
+}
+
+std::size_t Message::maxPayloadSize(const MessageFlag &flag, bool extended)
+{
+    std::size_t size = (extended) ? MAX_EXTENDED_MSG_PAYLOAD_SIZE : (flag.isLongMessage()) ? MAX_LONG_MSG_PAYLOAD_SIZE : MAX_SHORT_MSG_PAYLOAD_SIZE;
+    size -= flag.isTyped() ? CONTENT_TYPE_EXTENSION_SIZE : 0;
+    return flag.isChecked() ? size - PACKET_CRC_SIZE : size;
+}
+
+void Message::markPacketAsAck(PacketBuffer &packet)
+{
+    MessageFlag flag;
+    flag.raw = packet.data[MSG_FLAG_OFFSET];
+    flag.markAsAck();
+    packet.data[MSG_FLAG_OFFSET] = flag.raw;
+
+    if (flag.isChecked())
+    {
+        std::uint16_t crc = Crc::crc16(packet.data + 3, packet.size - 3 - PACKET_CRC_SIZE);
+        packet.data[packet.size - 2] = (crc >> 8) & 0xFF;
+        packet.data[packet.size - 1] = crc & 0xFF;
     }
-    std::uint8_t packetIndex = 0;
-    int maxPayloadSize = (flag.isLongMessage()) ? MAX_LONG_MSG_PAYLOAD_SIZE : MAX_SHORT_MSG_PAYLOAD_SIZE;
+}
 
-    // std::cout << "Number of packets: " << numPackets << std::endl;
+std::size_t Message::_bodySize() const
+{
+    // a checked long message is sent as its data followed by the CRC-32 of the data
+    return (flag.isChecked() && flag.isLongMessage()) ? this->dataSize() + MESSAGE_CRC_SIZE : this->dataSize();
+}
 
-    while (slice.size() > 0)
+bool Message::_extended() const
+{
+    // only when the long header cannot count the packets, so older receivers still get everything else
+    if (!flag.isLongMessage() || flag.isFEC())
     {
-        // std::cout << "Data size: " << slice.size() << std::endl;
-        // slice the data
-        int offset = (slice.size() > maxPayloadSize) ? maxPayloadSize : slice.size();
-        // std::cout << "Offset: " << offset << std::endl;
-        std::vector<std::uint8_t> packetData = std::vector<std::uint8_t>(slice.begin(), slice.begin() + offset);
-        std::vector<std::uint8_t> packet = this->_buildPacket(packetData, packetIndex, numPackets);
+        return false;
+    }
 
-        slice = std::vector<std::uint8_t>(slice.begin() + offset, slice.end());
+    std::size_t maxPayloadSize = Message::maxPayloadSize(flag);
+    return (this->_bodySize() + maxPayloadSize - 1) / maxPayloadSize > MAX_LONG_MSG_PACKET_COUNT;
+}
 
-        packets.push_back(packet);
-        packetIndex++;
+bool Message::_readData(std::size_t offset, std::size_t size, std::uint8_t *out) const
+{
+    if (this->_source)
+    {
+        return this->_source(offset, out, size);
     }
 
-    return packets;
+    std::memcpy(out, data.data() + offset, size);
+    return true;
+}
+
+bool Message::_copyBody(std::size_t offset, std::size_t size, std::uint8_t *out) const
+{
+    std::size_t dataSize = this->dataSize();
+    std::size_t fromData = (offset < dataSize) ? std::min(size, dataSize - offset) : 0;
+    if (fromData > 0 && !this->_readData(offset, fromData, out))
+    {
+        return false;
+    }
+
+    for (std::size_t i = fromData; i < size; i++)
+    {
+        // the CRC-32, big-endian
+        std::size_t byte = offset + i - dataSize;
+        out[i] = (this->_crc >> (8 * (MESSAGE_CRC_SIZE - 1 - byte))) & 0xFF;
+    }
+    return true;
 }
 
-std::vector<std::uint8_t> Message::_buildPacket(const std::vector<std::uint8_t> &data, std::uint8_t packetNumber, std::uint8_t packetCount) const
+std::size_t Message::_writePacket(const std::uint8_t *payload, std::size_t payloadSize, std::uint16_t packetNumber, std::uint16_t packetCount, std::uint8_t *out) const
 {
-    std::vector<std::uint8_t> packet;
-    for (char c : MSG_IDENTIFIER)
+    bool extended = packetCount > MAX_LONG_MSG_PACKET_COUNT;
+    const char *identifier = extended ? EXTENDED_IDENTIFIER : flag.isTyped() ? TYPED_IDENTIFIER : MSG_IDENTIFIER;
+    std::size_t size = 0;
+    for (int i = 0; i < 3; i++)
     {
-        if (c != '\0')
-            packet.push_back(c);
+        out[size++] = identifier[i];
     }
 
     // add the message ID
-    packet.push_back((messageID >> 8) & 0xFF);
-    packet.push_back(messageID & 0xFF);
-    packet.push_back(flag.raw);
+    out[size++] = (messageID >> 8) & 0xFF;
+    out[size++] = messageID & 0xFF;
+    out[size++] = flag.raw;
+
+    if (extended)
+    {
+        out[size++] = flag.isTyped() ? EXTENDED_TYPED_HEADER_VERSION : EXTENDED_HEADER_VERSION;
+    }
 
-    // print the flag bits
-    // std::cout << "Building packet: " << std::endl;
-    // std::cout << "  Flag bits: " << std::bitset<8>(flag.raw) << std::endl;
+    if (flag.isTyped())
+    {
+        out[size++] = flag.extendedType;
+    }
 
-    // make sure the packet size is less than MAX_PACKET_SIZE
-    if (data.size() > MAX_SHORT_MSG_PAYLOAD_SIZE && !flag.isLongMessage())
+    if (extended)
     {
-        // std::cout << "Data size is too large for a single packet" << std::endl;
-        packet.push_back(0);
-        return packet;
+        out[size++] = (packetNumber >> 8) & 0xFF;
+        out[size++] = packetNumber & 0xFF;
+        out[size++] = (packetCount >> 8) & 0xFF;
+        out[size++] = packetCount & 0xFF;
     }
-    else if (data.size() > MAX_LONG_MSG_PAYLOAD_SIZE && flag.isLongMessage())
+    else if (flag.isLongMessage())
+    {
+        out[size++] = packetNumber;
+        out[size++] = packetCount;
+    }
+
+    out[size++] = payloadSize;
+    if (payloadSize > 0)
     {
-        // std::cout << "Data size is too large for a single packet" << std::endl;
-        packet.push_back(0);
-        return packet;
+        std::memcpy(out + size, payload, payloadSize);
     }
+    size += payloadSize;
 
-    if (packetCount > 1)
+    if (flag.isChecked())
     {
-        std::cout << "  Packet number: " << packetNumber << " Packet count: " << packetCount << std::endl;
-        packet.push_back(packetNumber);
-        packet.push_back(packetCount);
+        std::uint16_t crc = Crc::crc16(out + 3, size - 3);
+        out[size++] = (crc >> 8) & 0xFF;
+        out[size++] = crc & 0xFF;
     }
 
-    packet.push_back(data.size());
+    return size;
+}
+
+bool PacketCursor::next()
+{
+    if (this->_failed || this->_next >= this->_count)
+    {
+        return false;
+    }
 
-    for (std::uint8_t byte : data)
+    if (!this->_message.encodePacket(this->_next, this->_packet))
     {
-        packet.push_back(byte);
+        this->_failed = true;
+        return false;
     }
 
-    return packet;
+    this->_next++;
+    return true;
 }
@@ -0,0 +1,368 @@
+#include <cstring>
+
+#include "log.hpp"
+#include "reassembly.hpp"
+
+using namespace wircom;
+
+ReassemblyBuffer::ReassemblyBuffer(std::size_t slotCount, std::size_t slotFragments)
+{
+    this->resize(slotCount, slotFragments);
+}
+
+void ReassemblyBuffer::resize(std::size_t slotCount, std::size_t slotFragments)
+{
+    std::size_t bitmapSize = (slotFragments + 7) / 8;
+    this->_slots = std::vector<ReassemblySlot>(slotCount);
+    this->_storage.assign(slotCount * slotFragments * MAX_LONG_MSG_PAYLOAD_SIZE, 0);
+    this->_storage.shrink_to_fit();
+    this->_received.assign(slotCount * bitmapSize, 0);
+    this->_slotFragments = slotFragments;
+    this->_byteBudget = this->_storage.size();
+    for (std::size_t i = 0; i < slotCount; i++)
+    {
+        this->_slots[i].received = this->_received.data() + i * bitmapSize;
+    }
+}
+
+ReassemblyStatus ReassemblyBuffer::add(const PacketView &packet, std::uint32_t now, ReassemblySlot *&slot)
+{
+    slot = this->find(packet.messageID);
+    if (slot != nullptr && (slot->packetCount != packet.packetCount || slot->flag.isChecked() != packet.flag.isChecked()))
+    {
+        // a fragment of a different message that reuses the ID, keep the one we have
+        slot = nullptr;
+        this->_stats.rejected++;
+        return REASSEMBLY_REJECTED;
+    }
+
+    FecLayout fec;
+    if (packet.flag.isFEC())
+    {
+        fec = FecLayout::fromHeader(packet.payload);
+        if (!fec.valid() || fec.packetCount() != packet.packetCount || (slot != nullptr && !(slot->fec == fec)))
+        {
+            slot = nullptr;
+            this->_stats.rejected++;
+            return REASSEMBLY_REJECTED;
+        }
+    }
+
+    if (slot == nullptr)
+    {
+        std::size_t bytes = (std::size_t)packet.packetCount * MAX_LONG_MSG_PAYLOAD_SIZE;
+        if (packet.packetCount > this->_slotFragments || bytes > this->_byteBudget)
+        {
+            this->_stats.rejected++;
+            return REASSEMBLY_REJECTED;
+        }
+
+        slot = this->_claimSlot(bytes);
+        if (slot == nullptr)
+        {
+            this->_stats.rejected++;
+            return REASSEMBLY_REJECTED;
+        }
+
+        std::uint8_t *received = slot->received;
+        *slot = ReassemblySlot();
+        slot->received = received;
+        std::memset(received, 0, (packet.packetCount + 7) / 8);
+        slot->inUse = true;
+        slot->messageID = packet.messageID;
+        slot->flag = packet.flag;
+        slot->flag.clearAck();
+        slot->packetCount = packet.packetCount;
+        slot->firstActivity = now;
+        slot->lastActivity = now;
+        slot->fec = fec;
+        if (packet.flag.isFEC())
+        {
+            slot->size = fec.dataSize();
+        }
+    }
+
+    if (packet.flag.isAck())
+    {
+        slot->ackRequested = true;
+    }
+
+    if (slot->hasFragment(packet.packetNumber))
+    {
+        return REASSEMBLY_DUPLICATE;
+    }
+
+    if (packet.flag.isFEC())
+    {
+        if (!this->_storeFEC(*slot, packet))
+        {
+            this->_stats.rejected++;
+            return REASSEMBLY_REJECTED;
+        }
+
+        slot->lastActivity = now;
+        if (slot->isComplete())
+        {
+            // nothing else is needed, so every fragment counts as received
+            for (std::size_t i = 0; i < slot->packetCount; i++)
+            {
+                this->_markReceived(*slot, i);
+            }
+            this->_stats.completed++;
+            return REASSEMBLY_COMPLETE;
+        }
+        return REASSEMBLY_STORED;
+    }
+
+    // every fragment but the last is full, so each one has a fixed place in the message
+    bool last = packet.packetNumber == packet.packetCount - 1;
+    std::size_t fragmentSize = Message::maxPayloadSize(packet.flag, packet.extended);
+    if ((!last && packet.payload.size != fragmentSize) || packet.payload.size > fragmentSize)
+    {
+        this->_stats.rejected++;
+        return REASSEMBLY_REJECTED;
+    }
+
+    std::size_t offset = (std::size_t)packet.packetNumber * fragmentSize;
+    if (!packet.payload.empty())
+    {
+        std::memcpy(this->_slotData(*slot) + offset, packet.payload.data, packet.payload.size);
+    }
+
+    if (last)
+    {
+        slot->size = offset + packet.payload.size;
+    }
+
+    slot->received[packet.packetNumber / 8] |= (1 << (packet.packetNumber % 8));
+    slot->receivedCount++;
+    slot->lastActivity = now;
+
+    if (slot->isComplete())
+    {
+        this->_stats.completed++;
+        return REASSEMBLY_COMPLETE;
+    }
+
+    return REASSEMBLY_STORED;
+}
+
+bool ReassemblyBuffer::_storeFEC(ReassemblySlot &slot, const PacketView &packet)
+{
+    std::size_t size = slot.fec.fragmentSize(packet.packetNumber);
+    if (packet.payload.size != FEC_HEADER_SIZE + size)
+    {
+        return false;
+    }
+
+    // the short last fragment is zero padded, like the sender padded it for the parity
+    std::uint8_t *fragment = this->_slotData(slot) + slot.fec.storageIndex(packet.packetNumber) * FEC_FRAGMENT_SIZE;
+    std::memcpy(fragment, packet.payload.data + FEC_HEADER_SIZE, size);
+    std::memset(fragment + size, 0, FEC_FRAGMENT_SIZE - size);
+
+    this->_markReceived(slot, packet.packetNumber);
+    this->_recoverBlock(slot, slot.fec.blockOf(packet.packetNumber));
+    return true;
+}
+
+void ReassemblyBuffer::_recoverBlock(ReassemblySlot &slot, std::size_t block)
+{
+    const FecLayout &fec = slot.fec;
+    std::uint8_t *data = this->_slotData(slot);
+    for (std::size_t parity = 0; parity < fec.blockParity; parity++)
+    {
+        // the fragments tied together by this parity fragment, the parity itself last
+        std::size_t missing = 0;
+        std::size_t missingPacket = 0;
+        std::size_t members = 0;
+        for (std::size_t i = parity; i < fec.dataInBlock(block); i += fec.blockParity)
+        {
+            std::size_t packet = fec.dataPacket(block, i);
+            members++;
+            if (!slot.hasFragment(packet))
+            {
+                missing++;
+                missingPacket = packet;
+            }
+        }
+
+        std::size_t parityPacket = fec.parityPacket(block, parity);
+        if (members == 0 || missing > 1 || (missing == 1 && !slot.hasFragment(parityPacket)))
+        {
+            continue;
+        }
+
+        if (missing == 0)
+        {
+            // the data is all there, so the parity is of no more use
+            this->_markReceived(slot, parityPacket);
+            continue;
+        }
+
+        std::uint8_t *rebuilt = data + fec.storageIndex(missingPacket) * FEC_FRAGMENT_SIZE;
+        std::memcpy(rebuilt, data + fec.storageIndex(parityPacket) * FEC_FRAGMENT_SIZE, FEC_FRAGMENT_SIZE);
+        for (std::size_t i = parity; i < fec.dataInBlock(block); i += fec.blockParity)
+        {
+            std::size_t packet = fec.dataPacket(block, i);
+            if (packet == missingPacket)
+            {
+                continue;
+            }
+
+            const std::uint8_t *fragment = data + fec.storageIndex(packet) * FEC_FRAGMENT_SIZE;
+            for (std::size_t j = 0; j < FEC_FRAGMENT_SIZE; j++)
+            {
+                rebuilt[j] ^= fragment[j];
+            }
+        }
+
+        this->_markReceived(slot, missingPacket);
+        this->_stats.recovered++;
+    }
+}
+
+void ReassemblyBuffer::_markReceived(ReassemblySlot &slot, std::size_t packetNumber)
+{
+    if (slot.hasFragment(packetNumber))
+    {
+        return;
+    }
+
+    std::size_t index;
+    slot.received[packetNumber / 8] |= (1 << (packetNumber % 8));
+    slot.receivedCount++;
+    if (slot.flag.isFEC() && !slot.fec.isParity(packetNumber, index))
+    {
+        slot.dataReceived++;
+    }
+}
+
+std::size_t ReassemblyBuffer::expire(std::uint32_t now)
+{
+    if (this->_timeout == 0)
+    {
+        return 0;
+    }
+
+    std::size_t expired = 0;
+    for (ReassemblySlot &slot : this->_slots)
+    {
+        if (slot.inUse && now - slot.lastActivity > this->_timeout)
+        {
+            WIRCOM_LOG_INFO("Dropping message with ID " << slot.messageID << ", only " << slot.receivedCount
+                                                        << " of " << (int)slot.packetCount << " packets arrived in time");
+            this->release(slot);
+            expired++;
+        }
+    }
+
+    this->_stats.expired += expired;
+    return expired;
+}
+
+ReassemblySlot *ReassemblyBuffer::find(std::uint16_t messageID)
+{
+    for (ReassemblySlot &slot : this->_slots)
+    {
+        if (slot.inUse && slot.messageID == messageID)
+        {
+            return &slot;
+        }
+    }
+
+    return nullptr;
+}
+
+PayloadView ReassemblyBuffer::payload(const ReassemblySlot &slot) const
+{
+    return PayloadView(this->_slotData(slot), slot.size);
+}
+
+void ReassemblyBuffer::release(ReassemblySlot &slot)
+{
+    slot.inUse = false;
+}
+
+std::size_t ReassemblyBuffer::slotsInUse() const
+{
+    std::size_t count = 0;
+    for (const ReassemblySlot &slot : this->_slots)
+    {
+        count += slot.inUse;
+    }
+
+    return count;
+}
+
+std::size_t ReassemblyBuffer::bytesInUse() const
+{
+    std::size_t bytes = 0;
+    for (const ReassemblySlot &slot : this->_slots)
+    {
+        if (slot.inUse)
+        {
+            bytes += slot.reservedBytes();
+        }
+    }
+
+    return bytes;
+}
+
+ReassemblySlot *ReassemblyBuffer::_claimSlot(std::size_t bytes)
+{
+    ReassemblySlot *slot = nullptr;
+    for (ReassemblySlot &candidate : this->_slots)
+    {
+        if (!candidate.inUse)
+        {
+            slot = &candidate;
+            break;
+        }
+    }
+
+    // make room by dropping the partial messages that have gone quiet the longest
+    while (slot == nullptr || this->bytesInUse() + bytes > this->_byteBudget)
+    {
+        ReassemblySlot *victim = this->_leastRecentlyActive();
+        if (victim == nullptr)
+        {
+            return nullptr;
+        }
+
+        WIRCOM_LOG_INFO("Evicting message with ID " << victim->messageID << " with " << victim->receivedCount
+                                                    << " of " << (int)victim->packetCount << " packets to make room");
+        this->release(*victim);
+        this->_stats.evicted++;
+
+        if (slot == nullptr)
+        {
+            slot = victim;
+        }
+    }
+
+    return slot;
+}
+
+ReassemblySlot *ReassemblyBuffer::_leastRecentlyActive()
+{
+    ReassemblySlot *oldest = nullptr;
+    for (ReassemblySlot &slot : this->_slots)
+    {
+        if (slot.inUse && (oldest == nullptr || (std::int32_t)(slot.lastActivity - oldest->lastActivity) < 0))
+        {
+            oldest = &slot;
+        }
+    }
+
+    return oldest;
+}
+
+std::uint8_t *ReassemblyBuffer::_slotData(const ReassemblySlot &slot)
+{
+    return this->_storage.data() + (&slot - this->_slots.data()) * this->slotCapacity();
+}
+
+const std::uint8_t *ReassemblyBuffer::_slotData(const ReassemblySlot &slot) const
+{
+    return this->_storage.data() + (&slot - this->_slots.data()) * this->slotCapacity();
+}
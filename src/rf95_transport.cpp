@@ -0,0 +1,138 @@
+#if defined(ARDUINO_TEENSY40) || defined(ARDUINO_TEENSY41)
+
+#include "rf95_transport.hpp"
+#include "log.hpp"
+
+using namespace wircom;
+
+namespace
+{
+    // handleInterrupt() is protected, this reaches it on an existing driver instance
+    struct RF95InterruptAccess : public RH_RF95
+    {
+        static void handle(RH_RF95 &driver)
+        {
+            (driver.*(&RF95InterruptAccess::handleInterrupt))();
+        }
+    };
+} // namespace
+
+bool RF95Transport::init()
+{
+    // manually reset the LoRa module
+    pinMode(this->_resetPin, OUTPUT);
+    digitalWrite(this->_resetPin, HIGH);
+
+    pinMode(this->_resetPin, OUTPUT);
+    digitalWrite(this->_resetPin, LOW);
+    delay(10);
+    digitalWrite(this->_resetPin, HIGH);
+    delay(10);
+
+    // initialize the LoRa radio
+    if (!this->_driver.init())
+    {
+        WIRCOM_LOG_ERROR("LoRa radio init failed");
+        return false;
+    }
+
+    // set the LoRa radio frequency
+    if (!this->_driver.setFrequency(this->_frequency))
+    {
+        WIRCOM_LOG_ERROR("setFrequency failed");
+        return false;
+    }
+
+    // set the transmit power
+    this->_driver.setTxPower(this->_power, false);
+
+    // init() hooked RadioHead's own handler to the interrupt pin, take it back
+    if (this->_receiveHandler != nullptr)
+    {
+        this->_attachInterrupt();
+    }
+    return true;
+}
+
+bool RF95Transport::send(const std::uint8_t *data, std::uint8_t length)
+{
+    return this->_driver.send(data, length);
+}
+
+bool RF95Transport::waitPacketSent()
+{
+    return this->_driver.waitPacketSent();
+}
+
+bool RF95Transport::transmitting()
+{
+    return this->_driver.mode() == RHGenericDriver::RHModeTx;
+}
+
+bool RF95Transport::available()
+{
+    return this->_driver.available();
+}
+
+bool RF95Transport::recv(std::uint8_t *buffer, std::uint8_t *length)
+{
+    return this->_driver.recv(buffer, length);
+}
+
+void RF95Transport::setDataRate(int spreadingFactor, long bandwidth)
+{
+    this->_driver.setSpreadingFactor(spreadingFactor);
+    this->_driver.setSignalBandwidth(bandwidth);
+}
+
+int RF95Transport::lastRssi()
+{
+    return this->_driver.lastRssi();
+}
+
+int RF95Transport::lastSNR()
+{
+    return this->_driver.lastSNR();
+}
+
+bool RF95Transport::setReceiveHandler(ReceiveHandler handler, void *context)
+{
+    noInterrupts();
+    this->_receiveHandler = handler;
+    this->_receiveContext = context;
+    interrupts();
+
+    this->_attachInterrupt();
+    return true;
+}
+
+void RF95Transport::_attachInterrupt()
+{
+    _interruptOwner = this;
+    attachInterrupt(digitalPinToInterrupt(this->_interruptPin), _onInterrupt, RISING);
+}
+
+void RF95Transport::_onInterrupt()
+{
+    RF95Transport *self = _interruptOwner;
+    if (self == nullptr)
+    {
+        return;
+    }
+
+    // let RadioHead read the packet out of the radio FIFO, or finish a transmission
+    RF95InterruptAccess::handle(self->_driver);
+
+    // available() also puts the radio back into receive mode after a transmission
+    if (self->_receiveHandler != nullptr && self->_driver.available())
+    {
+        std::uint8_t buffer[RH_RF95_MAX_MESSAGE_LEN];
+        std::uint8_t length = sizeof(buffer);
+        if (self->_driver.recv(buffer, &length))
+        {
+            self->_receiveHandler(self->_receiveContext, buffer, length);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <cstring>
+
+#include "sim_transport.hpp"
+#include "airtime.hpp"
+#include "link_adaptation.hpp"
+#include "platform.hpp"
+#include <cmath>
+
+using namespace wircom;
+
+void SimulatedNetwork::useAsClock()
+{
+    Clock::setSource([this]()
+                     { return this->now(); });
+}
+
+void SimulatedNetwork::advance(std::uint32_t ms)
+{
+    std::lock_guard<std::recursive_mutex> lock(this->_mutex);
+    this->_now += ms;
+    this->_raiseInterrupts();
+}
+
+void SimulatedNetwork::_raiseInterrupts()
+{
+    std::uint8_t buffer[MAX_PACKET_SIZE];
+    for (SimulatedTransport *endpoint : this->_endpoints)
+    {
+        if (endpoint->_receiveHandler == nullptr)
+        {
+            continue;
+        }
+
+        std::uint8_t length = sizeof(buffer);
+        while (endpoint->recv(buffer, &length))
+        {
+            endpoint->_receiveHandler(endpoint->_receiveContext, buffer, length);
+            length = sizeof(buffer);
+        }
+    }
+}
+
+bool SimulatedNetwork::_chance(float probability)
+{
+    if (probability <= 0.0f)
+    {
+        return false;
+    }
+
+    return std::uniform_real_distribution<float>(0.0f, 1.0f)(this->_rng) < probability;
+}
+
+void SimulatedNetwork::_transmit(SimulatedTransport &sender, const std::uint8_t *data, std::uint8_t length)
+{
+    std::lock_guard<std::recursive_mutex> lock(this->_mutex);
+    // the radio is half duplex, back to back packets queue up behind each other
+    std::uint32_t start = std::max(this->_now.load(), sender._txBusyUntil);
+    std::uint32_t airtime = sender.airtime(length);
+    sender._txBusyUntil = start + airtime;
+
+    this->stats.packetsSent++;
+    this->stats.bytesSent += length;
+    this->stats.airtime += airtime;
+
+    // every receiver sees the same SNR, measured over the sender's bandwidth. Within 1.5 dB of the demodulation
+    // floor of the sender's data rate, more and more packets fade out
+    float bandwidthPenalty = 10.0f * std::log10((float)sender._bandwidth / 125000.0f);
+    float snr = this->config.snr - bandwidthPenalty;
+    int rssi = (int)std::lround(-174.0f + 10.0f * std::log10((float)sender._bandwidth) + 6.0f + snr);
+    float margin = this->config.snr - LinkAdaptation::requiredSNR(DataRate{sender._spreadingFactor, sender._bandwidth});
+    float fadeRate = std::min(1.0f, std::max(0.0f, (1.5f - margin) / 3.0f));
+
+    for (SimulatedTransport *receiver : this->_endpoints)
+    {
+        if (receiver == &sender)
+        {
+            continue;
+        }
+
+        if (this->_chance(fadeRate))
+        {
+            this->stats.packetsFaded++;
+            this->stats.packetsLost++;
+            continue;
+        }
+
+        if (this->_chance(this->config.lossRate) || (this->dropFilter && this->dropFilter(data, length)))
+        {
+            this->stats.packetsLost++;
+            continue;
+        }
+
+        int copies = 1;
+        if (this->_chance(this->config.duplicateRate))
+        {
+            this->stats.packetsDuplicated++;
+            copies = 2;
+        }
+
+        for (int i = 0; i < copies; i++)
+        {
+            SimulatedTransport::InFlightPacket packet;
+            packet.deliverAt = start + airtime + this->config.latency;
+            packet.sequence = receiver->_nextSequence++;
+            packet.spreadingFactor = sender._spreadingFactor;
+            packet.bandwidth = sender._bandwidth;
+            packet.rssi = rssi;
+            packet.snr = (int)std::lround(snr);
+            packet.length = length;
+            std::memcpy(packet.data, data, length);
+
+            if (length > 0 && this->_chance(this->config.corruptRate))
+            {
+                this->stats.packetsCorrupted++;
+                std::uint32_t bit = std::uniform_int_distribution<std::uint32_t>(0, length * 8 - 1)(this->_rng);
+                packet.data[bit / 8] ^= 1 << (bit % 8);
+            }
+
+            if (this->_chance(this->config.reorderRate))
+            {
+                this->stats.packetsReordered++;
+                packet.deliverAt += this->config.reorderDelay;
+            }
+
+            receiver->_inbox.push_back(packet);
+        }
+    }
+}
+
+SimulatedTransport::SimulatedTransport(SimulatedNetwork &network) : _network(network)
+{
+    std::lock_guard<std::recursive_mutex> lock(this->_network._mutex);
+    this->_network._endpoints.push_back(this);
+}
+
+SimulatedTransport::~SimulatedTransport()
+{
+    std::lock_guard<std::recursive_mutex> lock(this->_network._mutex);
+    std::vector<SimulatedTransport *> &endpoints = this->_network._endpoints;
+    endpoints.erase(std::remove(endpoints.begin(), endpoints.end(), this), endpoints.end());
+}
+
+bool SimulatedTransport::init()
+{
+    return true;
+}
+
+bool SimulatedTransport::send(const std::uint8_t *data, std::uint8_t length)
+{
+    if (length > MAX_PACKET_SIZE)
+    {
+        return false;
+    }
+
+    this->_network._transmit(*this, data, length);
+    return true;
+}
+
+bool SimulatedTransport::waitPacketSent()
+{
+    std::lock_guard<std::recursive_mutex> lock(this->_network._mutex);
+    // the caller is blocked for as long as the packet is on air
+    std::uint32_t now = this->_network.now();
+    if (this->_txBusyUntil > now)
+    {
+        this->_network.advance(this->_txBusyUntil - now);
+    }
+    return true;
+}
+
+bool SimulatedTransport::transmitting()
+{
+    std::lock_guard<std::recursive_mutex> lock(this->_network._mutex);
+    return this->_txBusyUntil > this->_network.now();
+}
+
+bool SimulatedTransport::available()
+{
+    std::lock_guard<std::recursive_mutex> lock(this->_network._mutex);
+    this->_dropUndecodable();
+    return this->_nextDeliverable() >= 0;
+}
+
+bool SimulatedTransport::recv(std::uint8_t *buffer, std::uint8_t *length)
+{
+    std::lock_guard<std::recursive_mutex> lock(this->_network._mutex);
+    this->_dropUndecodable();
+    int index = this->_nextDeliverable();
+    if (index < 0)
+    {
+        return false;
+    }
+
+    InFlightPacket &packet = this->_inbox[index];
+    std::uint8_t copied = std::min(packet.length, *length);
+    std::memcpy(buffer, packet.data, copied);
+    *length = copied;
+    this->_lastRssi = packet.rssi;
+    this->_lastSNR = packet.snr;
+
+    this->_inbox.erase(this->_inbox.begin() + index);
+    this->_network.stats.packetsDelivered++;
+    return true;
+}
+
+void SimulatedTransport::setDataRate(int spreadingFactor, long bandwidth)
+{
+    std::lock_guard<std::recursive_mutex> lock(this->_network._mutex);
+    this->_spreadingFactor = spreadingFactor;
+    this->_bandwidth = bandwidth;
+}
+
+bool SimulatedTransport::setReceiveHandler(ReceiveHandler handler, void *context)
+{
+    std::lock_guard<std::recursive_mutex> lock(this->_network._mutex);
+    this->_receiveHandler = handler;
+    this->_receiveContext = context;
+    return true;
+}
+
+std::uint32_t SimulatedTransport::bitRate() const
+{
+    if (this->_network.config.bitRate != 0)
+    {
+        return this->_network.config.bitRate;
+    }
+
+    // LoRa raw bit rate, SF * BW / 2^SF, with the default 4/5 coding rate
+    return (std::uint32_t)((std::uint64_t)this->_spreadingFactor * this->_bandwidth * 4 / (5 * (1u << this->_spreadingFactor)));
+}
+
+std::uint32_t SimulatedTransport::airtime(std::size_t length) const
+{
+    if (this->_network.config.loraTiming)
+    {
+        LoRaModulation modulation;
+        modulation.spreadingFactor = this->_spreadingFactor;
+        modulation.bandwidth = this->_bandwidth;
+        return this->_network.config.packetOverhead + (timeOnAir(modulation, length + RADIO_HEADER_SIZE) + 999) / 1000;
+    }
+
+    std::uint32_t bitRate = this->bitRate();
+    return this->_network.config.packetOverhead + (std::uint32_t)((length * 8 * 1000 + bitRate - 1) / bitRate);
+}
+
+int SimulatedTransport::_nextDeliverable() const
+{
+    int next = -1;
+    std::uint32_t now = this->_network.now();
+    for (std::size_t i = 0; i < this->_inbox.size(); i++)
+    {
+        const InFlightPacket &packet = this->_inbox[i];
+        if (packet.deliverAt > now)
+        {
+            continue;
+        }
+
+        if (next < 0 || packet.deliverAt < this->_inbox[next].deliverAt ||
+            (packet.deliverAt == this->_inbox[next].deliverAt && packet.sequence < this->_inbox[next].sequence))
+        {
+            next = (int)i;
+        }
+    }
+
+    return next;
+}
+
+void SimulatedTransport::_dropUndecodable()
+{
+    // a packet that arrived while we were tuned to a different data rate is never demodulated
+    std::uint32_t now = this->_network.now();
+    std::size_t before = this->_inbox.size();
+    this->_inbox.erase(std::remove_if(this->_inbox.begin(), this->_inbox.end(), [&](const InFlightPacket &packet)
+                                      { return packet.deliverAt <= now &&
+                                               (packet.spreadingFactor != this->_spreadingFactor || packet.bandwidth != this->_bandwidth); }),
+                       this->_inbox.end());
+    this->_network.stats.packetsLost += before - this->_inbox.size();
+}
@@ -2,12 +2,62 @@
 
 #include <unity.h>
 #include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <atomic>
+#include <new>
+#include <set>
+#include <unordered_map>
+#include <thread>
 
 #include "message.hpp"
+#include "airtime.hpp"
 #include "builder.hpp"
+#include "log.hpp"
+#include "com_interface.hpp"
+#include "crc.hpp"
+#include "delta_codec.hpp"
+#include "dispatch_table.hpp"
+#include "lz_codec.hpp"
+#include "sim_transport.hpp"
+#include "platform.hpp"
 
 using namespace wircom;
 
+// count heap allocations, so tests can check that the hot paths never allocate, atomic as some tests run threads
+static std::atomic<std::size_t> g_allocationCount{0};
+static std::atomic<std::size_t> g_allocatedBytes{0};
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+// free() does match the replaced operator new, but GCC cannot tell once it inlines the pair
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(std::size_t size)
+{
+    g_allocationCount++;
+    g_allocatedBytes += size;
+    void *ptr = std::malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
 void setUp(void)
 {
 }
@@ -230,17 +280,3132 @@ void test_long_message(void)
 }
 
 
-int main(int argc, char **argv)
+void test_encode_into(void)
 {
-    UNITY_BEGIN();
-    std::cout << "*** RUNNING TESTS ***" << std::endl;
-    // run tests
-    RUN_TEST(test_message_flag);
-    RUN_TEST(test_meta_message);
-    RUN_TEST(test_meta_message_request);
-    RUN_TEST(test_drive_message);
-    RUN_TEST(test_drive_message_request);
-    RUN_TEST(test_long_message);
+    std::string content = "";
+    for (int i = 0; i < 250; i++)
+    {
+        content += "abc_";
+    }
+
+    Message msg = MessageBuilder::createDriveMessageResponse(1, content);
+    std::vector<std::vector<std::uint8_t>> expected = msg.encode();
+    TEST_ASSERT_EQUAL(expected.size(), msg.packetCount());
+
+    PacketBuffer packets[8];
+    std::size_t allocationsBefore = g_allocationCount;
+    std::size_t written = msg.encodeInto(packets, 8);
+    TEST_ASSERT_EQUAL(0, g_allocationCount - allocationsBefore);
+    TEST_ASSERT_EQUAL(expected.size(), written);
+
+    for (std::size_t i = 0; i < written; i++)
+    {
+        TEST_ASSERT_EQUAL(expected[i].size(), packets[i].size);
+        TEST_ASSERT_EQUAL_MEMORY(expected[i].data(), packets[i].data, packets[i].size);
+    }
+
+    // an empty message still produces a header-only packet
+    Message request = MessageBuilder::createDriveMessageRequest();
+    TEST_ASSERT_EQUAL(1, request.encodeInto(packets, 8));
+    TEST_ASSERT_EQUAL(SHORT_MSG_HEADER_SIZE, packets[0].size);
+}
+
+void test_encode_into_ring(void)
+{
+    std::string content = "";
+    for (int i = 0; i < 250; i++)
+    {
+        content += "abc_";
+    }
+
+    Message msg = MessageBuilder::createDriveMessageResponse(1, content);
+    std::vector<std::vector<std::uint8_t>> expected = msg.encode();
+
+    // refill a two-slot ring until the message is drained
+    PacketBuffer ring[2];
+    std::size_t next = 0;
+    while (next < msg.packetCount())
+    {
+        std::size_t written = msg.encodeInto(ring, 2, next);
+        TEST_ASSERT_TRUE(written > 0);
+        for (std::size_t i = 0; i < written; i++)
+        {
+            TEST_ASSERT_EQUAL(expected[next + i].size(), ring[i].size);
+            TEST_ASSERT_EQUAL_MEMORY(expected[next + i].data(), ring[i].data, ring[i].size);
+        }
+        next += written;
+    }
+
+    TEST_ASSERT_EQUAL(expected.size(), next);
+    TEST_ASSERT_EQUAL(0, msg.encodeInto(ring, 2, next));
+}
+
+void test_packet_view(void)
+{
+    std::string content = "";
+    for (int i = 0; i < 250; i++)
+    {
+        content += "abc_";
+    }
+
+    Message msg = MessageBuilder::createDriveMessageResponse(7, content);
+    PacketBuffer packets[8];
+    std::size_t numPackets = msg.encodeInto(packets, 8);
+
+    std::size_t allocationsBefore = g_allocationCount;
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < numPackets; i++)
+    {
+        PacketView view = PacketView::parse(packets[i].data, packets[i].size);
+        TEST_ASSERT_TRUE(view.success);
+        TEST_ASSERT_EQUAL(7, view.messageID);
+        TEST_ASSERT_EQUAL(MessageType::MSG_RESPONSE, view.messageType());
+        TEST_ASSERT_EQUAL(MessageContentType::MSG_CON_DRIVE, view.contentType());
+        TEST_ASSERT_EQUAL(i, view.packetNumber);
+        TEST_ASSERT_EQUAL(numPackets, view.packetCount);
+
+        // the payload points straight into the packet buffer
+        TEST_ASSERT_TRUE(view.payload.data > packets[i].data && view.payload.end() == packets[i].data + packets[i].size);
+        TEST_ASSERT_EQUAL_MEMORY(content.data() + offset, view.payload.data, view.payload.size);
+        offset += view.payload.size;
+    }
+    TEST_ASSERT_EQUAL(0, g_allocationCount - allocationsBefore);
+    TEST_ASSERT_EQUAL(content.size(), offset);
+}
+
+void test_packet_view_rejects_malformed(void)
+{
+    Message msg = MessageBuilder::createMetaMessageResponse(3, "Test", 1, 0, 1);
+    PacketBuffer packet;
+    msg.encodePacket(0, packet);
+    TEST_ASSERT_TRUE(PacketView::parse(packet.data, packet.size).success);
+
+    // too short
+    TEST_ASSERT_FALSE(PacketView::parse(packet.data, SHORT_MSG_HEADER_SIZE - 1).success);
+
+    // truncated payload
+    TEST_ASSERT_FALSE(PacketView::parse(packet.data, packet.size - 1).success);
+
+    // bad identifier
+    PacketBuffer corrupt = packet;
+    corrupt.data[1] = 'X';
+    TEST_ASSERT_FALSE(PacketView::parse(corrupt.data, corrupt.size).success);
+
+    // packet number out of range on a long message
+    std::string content(600, 'x');
+    Message longMsg = MessageBuilder::createDriveMessageResponse(4, content);
+    longMsg.encodePacket(0, corrupt);
+    corrupt.data[LONG_MSG_HEADER_SIZE - 3] = corrupt.data[LONG_MSG_HEADER_SIZE - 2];
+    TEST_ASSERT_FALSE(PacketView::parse(corrupt.data, corrupt.size).success);
+}
+
+void test_reassembly_buffer(void)
+{
+    std::string content(1000, 'x');
+    for (std::size_t i = 0; i < content.size(); i++)
+    {
+        content[i] = 'a' + i % 26;
+    }
+    Message msg = MessageBuilder::createDriveMessageResponse(7, content);
+    std::vector<std::vector<std::uint8_t>> packets = msg.encode();
+
+    // by default, a slot holds any message the long header can count
+    TEST_ASSERT_EQUAL(MAX_LONG_MSG_PACKET_COUNT * MAX_LONG_MSG_PAYLOAD_SIZE, ReassemblyBuffer().slotCapacity());
+
+    ReassemblyBuffer buffer(2, 8);
+    ReassemblySlot *slot = nullptr;
+
+    // out of order, with a duplicate
+    for (std::size_t i = packets.size(); i-- > 1;)
+    {
+        TEST_ASSERT_EQUAL(REASSEMBLY_STORED, buffer.add(PacketView::parse(packets[i].data(), packets[i].size()), 0, slot));
+    }
+    TEST_ASSERT_EQUAL(REASSEMBLY_DUPLICATE, buffer.add(PacketView::parse(packets[1].data(), packets[1].size()), 0, slot));
+    TEST_ASSERT_EQUAL(packets.size() - 1, slot->receivedCount);
+    TEST_ASSERT_EQUAL(REASSEMBLY_COMPLETE, buffer.add(PacketView::parse(packets[0].data(), packets[0].size()), 0, slot));
+
+    PayloadView payload = buffer.payload(*slot);
+    TEST_ASSERT_TRUE(payload.toVector() == msg.data);
+    buffer.release(*slot);
+    TEST_ASSERT_EQUAL(0, buffer.slotsInUse());
+
+    // messages larger than a slot are rejected
+    Message tooLong = MessageBuilder::createDriveMessageResponse(8, std::string(9 * MAX_LONG_MSG_PAYLOAD_SIZE, 'x'));
+    PacketBuffer packet;
+    tooLong.encodePacket(0, packet);
+    TEST_ASSERT_EQUAL(REASSEMBLY_REJECTED, buffer.add(PacketView::parse(packet.data, packet.size), 0, slot));
+    TEST_ASSERT_NULL(slot);
+
+    // once every slot is taken, the least recently active partial message makes room
+    for (std::uint16_t id = 10; id < 13; id++)
+    {
+        Message partial = MessageBuilder::createDriveMessageResponse(id, content);
+        partial.encodePacket(id == 10 ? 0 : 1, packet);
+        TEST_ASSERT_EQUAL(REASSEMBLY_STORED, buffer.add(PacketView::parse(packet.data, packet.size), id, slot));
+        if (id == 11)
+        {
+            // message 10 hears from its sender again, so 11 is now the quietest
+            Message refresh = MessageBuilder::createDriveMessageResponse(10, content);
+            refresh.encodePacket(1, packet);
+            buffer.add(PacketView::parse(packet.data, packet.size), 20, slot);
+        }
+    }
+    TEST_ASSERT_EQUAL(2, buffer.slotsInUse());
+    TEST_ASSERT_EQUAL(1, buffer.stats().evicted);
+    TEST_ASSERT_NOT_NULL(buffer.find(10));
+    TEST_ASSERT_NULL(buffer.find(11));
+    TEST_ASSERT_NOT_NULL(buffer.find(12));
+
+    // the byte budget evicts too, even with a slot free
+    buffer.setByteBudget(6 * MAX_LONG_MSG_PAYLOAD_SIZE);
+    Message small = MessageBuilder::createDriveMessageResponse(13, std::string(2 * MAX_LONG_MSG_PAYLOAD_SIZE, 'x'));
+    small.encodePacket(0, packet);
+    buffer.release(*buffer.find(12));
+    TEST_ASSERT_EQUAL(REASSEMBLY_STORED, buffer.add(PacketView::parse(packet.data, packet.size), 30, slot));
+    TEST_ASSERT_EQUAL(2, buffer.stats().evicted);
+    TEST_ASSERT_NULL(buffer.find(10));
+
+    // and partial messages that go quiet expire
+    buffer.setTimeout(100);
+    TEST_ASSERT_EQUAL(0, buffer.expire(130));
+    TEST_ASSERT_EQUAL(1, buffer.expire(131));
+    TEST_ASSERT_EQUAL(0, buffer.slotsInUse());
+    TEST_ASSERT_EQUAL(1, buffer.stats().expired);
+}
+
+// a daqser-like frame of 48 big-endian 32-bit signals, where signal k changes every k + 1 frames
+static std::vector<std::uint8_t> _telemetryFrame(std::uint32_t n)
+{
+    std::vector<std::uint8_t> frame;
+    for (std::uint32_t k = 0; k < 48; k++)
+    {
+        std::uint32_t value = 1000 * k + n / (k + 1);
+        frame.push_back((value >> 24) & 0xFF);
+        frame.push_back((value >> 16) & 0xFF);
+        frame.push_back((value >> 8) & 0xFF);
+        frame.push_back(value & 0xFF);
+    }
+    return frame;
+}
+
+void test_delta_codec(void)
+{
+    DeltaEncoder encoder(10);
+    DeltaDecoder decoder;
+    std::vector<std::uint8_t> frame;
+
+    for (std::uint32_t n = 0; n < 30; n++)
+    {
+        std::vector<std::uint8_t> encoded = encoder.encode(_telemetryFrame(n));
+        TEST_ASSERT_EQUAL(n % 10 == 0 ? DELTA_KEYFRAME : DELTA_FRAME, encoded[0]);
+        if (encoded[0] == DELTA_FRAME)
+        {
+            TEST_ASSERT_LESS_THAN(_telemetryFrame(n).size() / 2, encoded.size());
+        }
+
+        TEST_ASSERT_TRUE(decoder.decode(PayloadView(encoded), frame));
+        TEST_ASSERT_TRUE(frame == _telemetryFrame(n));
+    }
+
+    // a frame of a different size, or one that changed completely, goes out as a keyframe
+    TEST_ASSERT_EQUAL(DELTA_KEYFRAME, encoder.encode(std::vector<std::uint8_t>(10, 1))[0]);
+    TEST_ASSERT_EQUAL(DELTA_KEYFRAME, encoder.encode(std::vector<std::uint8_t>(10, 2))[0]);
+
+    // a receiver that missed the keyframe cannot rebuild the deltas until it asks for a new one
+    std::vector<std::uint8_t> lostKeyframe = encoder.encode(std::vector<std::uint8_t>(10, 3));
+    std::vector<std::uint8_t> delta = encoder.encode(std::vector<std::uint8_t>{3, 3, 3, 3, 3, 3, 3, 3, 3, 4});
+    TEST_ASSERT_EQUAL(DELTA_FRAME, delta[0]);
+    TEST_ASSERT_FALSE(MessageParser::parseDataFrame(delta, decoder).success);
+
+    encoder.requestKeyframe();
+    std::vector<std::uint8_t> keyframe = encoder.encode(std::vector<std::uint8_t>(10, 5));
+    TEST_ASSERT_EQUAL(DELTA_KEYFRAME, keyframe[0]);
+    ContentResult<DataTransferContent> result = MessageParser::parseDataFrame(keyframe, decoder);
+    TEST_ASSERT_TRUE(result.success);
+    TEST_ASSERT_TRUE(result.content.data == std::vector<std::uint8_t>(10, 5));
+
+    // truncated deltas are rejected
+    delta = encoder.encode(std::vector<std::uint8_t>{5, 5, 5, 5, 5, 5, 5, 5, 5, 6});
+    delta.pop_back();
+    TEST_ASSERT_FALSE(decoder.decode(PayloadView(delta), frame));
+}
+
+// a stand-in for a daqser .drive schema, there are none checked into this repository
+static std::string _driveSchema(int signals)
+{
+    std::string schema = "{\n  \"name\": \"daq-schema\",\n  \"version\": \"1.0.0\",\n  \"signals\": [\n";
+    const char *units[] = {"V", "A", "degC", "rpm", "kPa", "bool"};
+    for (int i = 0; i < signals; i++)
+    {
+        schema += "    { \"name\": \"signal_" + std::to_string(i) + "\", \"can_id\": " + std::to_string(0x100 + i / 4) +
+                  ", \"start_bit\": " + std::to_string((i % 4) * 16) + ", \"length\": 16, \"factor\": 0.1, \"offset\": 0, \"unit\": \"" +
+                  units[i % 6] + "\" },\n";
+    }
+    return schema + "  ]\n}\n";
+}
+
+void test_lz_codec(void)
+{
+    std::minstd_rand random(7);
+    std::vector<std::uint8_t> noise(1000);
+    for (std::uint8_t &byte : noise)
+    {
+        byte = random() & 0xFF;
+    }
+
+    std::string schema = _driveSchema(100);
+    std::vector<std::vector<std::uint8_t>> inputs = {
+        {},
+        {'a'},
+        std::vector<std::uint8_t>(1000, 'x'), // one long run of overlapping matches
+        std::vector<std::uint8_t>(schema.begin(), schema.end()),
+        noise,
+    };
+
+    for (const std::vector<std::uint8_t> &input : inputs)
+    {
+        std::vector<std::uint8_t> compressed(LzCodec::maxCompressedSize(input.size()));
+        std::size_t size = LzCodec::compress(input.data(), input.size(), compressed.data(), compressed.size());
+        TEST_ASSERT_NOT_EQUAL(0, size);
+        TEST_ASSERT_EQUAL(input.size(), LzCodec::decompressedSize(compressed.data(), size));
+
+        std::vector<std::uint8_t> output(input.size());
+        TEST_ASSERT_TRUE(LzCodec::decompress(compressed.data(), size, output.data(), output.size()));
+        TEST_ASSERT_TRUE(output == input);
+    }
+
+    // schema text shrinks a lot, noise does not fit into less than its own size
+    std::vector<std::uint8_t> compressed(LzCodec::maxCompressedSize(schema.size()));
+    std::size_t size = LzCodec::compress((const std::uint8_t *)schema.data(), schema.size(), compressed.data(), compressed.size());
+    TEST_ASSERT_LESS_THAN(schema.size() / 3, size);
+    std::vector<std::uint8_t> tooSmall(noise.size());
+    TEST_ASSERT_EQUAL(0, LzCodec::compress(noise.data(), noise.size(), tooSmall.data(), tooSmall.size()));
+
+    // truncated input and a short output buffer are rejected
+    std::vector<std::uint8_t> output(schema.size());
+    TEST_ASSERT_FALSE(LzCodec::decompress(compressed.data(), size - 1, output.data(), output.size()));
+    TEST_ASSERT_FALSE(LzCodec::decompress(compressed.data(), size, output.data(), output.size() - 1));
+
+    // a compressed drive message is flagged, and only when it gets smaller
+    Message msg = MessageBuilder::createDriveMessageResponse(1, schema, true);
+    TEST_ASSERT_TRUE(msg.flag.isCompressed());
+    TEST_ASSERT_EQUAL(MessageContentType::MSG_CON_DRIVE, msg.flag.getMessageContentType());
+    TEST_ASSERT_FALSE(MessageBuilder::createDriveMessageResponse(1, "abc", true).flag.isCompressed());
+}
+
+void test_fec(void)
+{
+    std::string content;
+    for (int i = 0; i < 4400; i++)
+    {
+        content += (char)('a' + i % 23);
+    }
+
+    Message msg = MessageBuilder::createDriveMessageResponse(7, content);
+    TEST_ASSERT_TRUE(msg.enableFEC(8, 2));
+    TEST_ASSERT_TRUE(msg.flag.isFEC());
+    // 19 data fragments in blocks of 8, 8 and 3, each followed by 2 parity fragments
+    TEST_ASSERT_EQUAL(25, msg.packetCount());
+    TEST_ASSERT_FALSE(MessageBuilder::createMetaMessageRequest().enableFEC(8, 2));
+
+    std::vector<std::vector<std::uint8_t>> packets = msg.encode();
+
+    // a burst of two in the first block, one in the second, and the short last fragment
+    std::set<std::size_t> lost = {3, 4, 12, 22};
+    ReassemblyBuffer buffer;
+    ReassemblySlot *slot = nullptr;
+    std::size_t completedAt = 0;
+    for (std::size_t i = 0; i < packets.size() && completedAt == 0; i++)
+    {
+        if (lost.count(i) == 0 && buffer.add(PacketView::parse(packets[i].data(), packets[i].size()), 0, slot) == REASSEMBLY_COMPLETE)
+        {
+            completedAt = i;
+        }
+    }
+
+    // done at the first parity fragment of the last block, the one after it is not needed
+    TEST_ASSERT_EQUAL(23, completedAt);
+    TEST_ASSERT_EQUAL(4, buffer.stats().recovered);
+    PayloadView payload = buffer.payload(*slot);
+    TEST_ASSERT_TRUE(std::string(payload.begin(), payload.end()) == content);
+    // the rebuilt fragments are reported as received, so the sender does not resend them
+    TEST_ASSERT_EQUAL(25, slot->receivedFragments().setCount());
+    buffer.release(*slot);
+
+    // two losses under the same parity fragment need a retransmission
+    lost = {0, 2};
+    for (std::size_t i = 0; i < packets.size(); i++)
+    {
+        if (lost.count(i) == 0)
+        {
+            TEST_ASSERT_NOT_EQUAL(REASSEMBLY_COMPLETE, buffer.add(PacketView::parse(packets[i].data(), packets[i].size()), 0, slot));
+        }
+    }
+    TEST_ASSERT_FALSE(slot->hasFragment(0));
+    TEST_ASSERT_EQUAL(REASSEMBLY_COMPLETE, buffer.add(PacketView::parse(packets[2].data(), packets[2].size()), 0, slot));
+    payload = buffer.payload(*slot);
+    TEST_ASSERT_TRUE(std::string(payload.begin(), payload.end()) == content);
+}
+
+void test_message_source(void)
+{
+    std::vector<std::uint8_t> content(3000);
+    for (std::size_t i = 0; i < content.size(); i++)
+    {
+        content[i] = (i * 131) & 0xFF;
+    }
+    std::size_t reads = 0;
+    MessageSource source = [&](std::size_t offset, std::uint8_t *out, std::size_t size)
+    {
+        reads++;
+        if (offset + size > content.size())
+        {
+            return false;
+        }
+        std::memcpy(out, content.data() + offset, size);
+        return true;
+    };
+
+    // a message read from a source goes out exactly like one held in memory, checked or protected by FEC
+    for (int protection = 0; protection < 3; protection++)
+    {
+        Message held(5, MSG_RESPONSE, MSG_CON_DRIVE, content);
+        Message streamed = MessageBuilder::createDriveMessageResponse(5, content.size(), source);
+        TEST_ASSERT_TRUE(streamed.hasSource());
+        TEST_ASSERT_EQUAL(content.size(), streamed.dataSize());
+        TEST_ASSERT_TRUE(streamed.data.empty());
+        for (Message *msg : {&held, &streamed})
+        {
+            if (protection == 1)
+            {
+                TEST_ASSERT_TRUE(msg->enableChecksum());
+            }
+            else if (protection == 2)
+            {
+                TEST_ASSERT_TRUE(msg->enableFEC(4, 1));
+            }
+        }
+
+        reads = 0;
+        std::vector<std::vector<std::uint8_t>> expected = held.encode();
+        PacketCursor cursor(streamed);
+        TEST_ASSERT_EQUAL(expected.size(), cursor.count());
+        while (cursor.next())
+        {
+            const std::vector<std::uint8_t> &packet = expected[cursor.index()];
+            TEST_ASSERT_EQUAL(packet.size(), cursor.packet().size);
+            TEST_ASSERT_EQUAL_MEMORY(packet.data(), cursor.packet().data, packet.size());
+        }
+        TEST_ASSERT_FALSE(cursor.failed());
+        TEST_ASSERT_EQUAL(expected.size(), cursor.index() + 1);
+        TEST_ASSERT_GREATER_OR_EQUAL(expected.size(), reads);
+    }
+
+    // a source that cannot be read stops the packets at the first one it should have filled
+    content.resize(1000);
+    Message broken = MessageBuilder::createDriveMessageResponse(6, 3000, source);
+    PacketBuffer packet;
+    TEST_ASSERT_TRUE(broken.encodePacket(3, packet));
+    TEST_ASSERT_FALSE(broken.encodePacket(4, packet));
+    PacketCursor cursor(broken);
+    std::size_t encoded = 0;
+    while (cursor.next())
+    {
+        encoded++;
+    }
+    TEST_ASSERT_TRUE(cursor.failed());
+    TEST_ASSERT_EQUAL(4, encoded);
+    TEST_ASSERT_FALSE(broken.enableChecksum());
+    TEST_ASSERT_FALSE(broken.flag.isChecked());
+}
+
+void test_extended_message(void)
+{
+    // 255 packets still fit the long header, so existing receivers can read them
+    std::string content(255 * MAX_LONG_MSG_PAYLOAD_SIZE, 'x');
+    for (std::size_t i = 0; i < content.size(); i++)
+    {
+        content[i] = (char)('a' + i % 23);
+    }
+    Message msg = MessageBuilder::createDriveMessageResponse(9, content);
+    TEST_ASSERT_EQUAL(255, msg.packetCount());
+    PacketBuffer packet;
+    TEST_ASSERT_TRUE(msg.encodePacket(254, packet));
+    TEST_ASSERT_EQUAL_MEMORY(MSG_IDENTIFIER, packet.data, 3);
+
+    // one byte more needs a 256th packet, and the extended header to number it
+    content += "!";
+    msg = MessageBuilder::createDriveMessageResponse(9, content);
+    std::size_t count = (content.size() + MAX_EXTENDED_MSG_PAYLOAD_SIZE - 1) / MAX_EXTENDED_MSG_PAYLOAD_SIZE;
+    TEST_ASSERT_EQUAL(count, msg.packetCount());
+    TEST_ASSERT_TRUE(msg.encodePacket(count - 1, packet));
+    TEST_ASSERT_EQUAL_MEMORY(EXTENDED_IDENTIFIER, packet.data, 3);
+    TEST_ASSERT_EQUAL(EXTENDED_HEADER_VERSION, packet.data[6]);
+    PacketView view = PacketView::parse(packet.data, packet.size);
+    TEST_ASSERT_TRUE(view.success && view.extended);
+    TEST_ASSERT_EQUAL(count - 1, view.packetNumber);
+    TEST_ASSERT_EQUAL(count, view.packetCount);
+    TEST_ASSERT_FALSE(msg.encodePacket(count, packet));
+
+    // a version this build does not know is not guessed at
+    TEST_ASSERT_TRUE(msg.encodePacket(0, packet));
+    packet.data[6] = EXTENDED_HEADER_VERSION + 1;
+    TEST_ASSERT_FALSE(PacketView::parse(packet.data, packet.size).success);
+
+    // reassembled like any other long message, in a slot large enough for it
+    std::vector<std::vector<std::uint8_t>> packets = msg.encode();
+    TEST_ASSERT_EQUAL(count, packets.size());
+    ReassemblyBuffer small;
+    ReassemblySlot *slot = nullptr;
+    TEST_ASSERT_EQUAL(REASSEMBLY_REJECTED, small.add(PacketView::parse(packets[0].data(), packets[0].size()), 0, slot));
+    ReassemblyBuffer buffer(1, 300);
+    for (std::size_t i = packets.size(); i-- > 0;)
+    {
+        TEST_ASSERT_EQUAL(i == 0 ? REASSEMBLY_COMPLETE : REASSEMBLY_STORED, buffer.add(PacketView::parse(packets[i].data(), packets[i].size()), 0, slot));
+    }
+    PayloadView payload = buffer.payload(*slot);
+    TEST_ASSERT_TRUE(std::string(payload.begin(), payload.end()) == content);
+
+    // more packets than even the extended header can count are not sent at all
+    Message huge(1, MSG_RESPONSE, MSG_CON_DRIVE, std::vector<std::uint8_t>((std::size_t)MAX_MESSAGE_PACKET_COUNT * MAX_EXTENDED_MSG_PAYLOAD_SIZE + 1));
+    TEST_ASSERT_FALSE(huge.encodePacket(0, packet));
+
+    // the acks of such messages start at the first missing fragment
+    FragmentBitmap acked(1000);
+    const std::uint8_t bytes[] = {0x05, 0xFF};
+    TEST_ASSERT_EQUAL(16 + 2 + 8, acked.mergeRange(16, bytes, sizeof(bytes)));
+    TEST_ASSERT_TRUE(acked.test(15) && acked.test(16) && !acked.test(17) && acked.test(18) && acked.test(31));
+    TEST_ASSERT_EQUAL(17, acked.nextClear(0));
+    TEST_ASSERT_EQUAL(19, acked.nextClear(18));
+    TEST_ASSERT_EQUAL(32, acked.nextClear(24));
+}
+
+// an application content type, registered the way an application would
+struct TestSignal
+{
+    std::uint16_t signal;
+    std::int32_t value;
+};
+
+namespace wircom
+{
+    template <>
+    struct ContentCodec<TestSignal> : LayoutCodec<TestSignal, MessageContentType(MSG_CON_USER + 1), IntField<&TestSignal::signal>, IntField<&TestSignal::value>>
+    {
+    };
+}
+
+void test_typed_message(void)
+{
+    // a content type past the flag's two bits rides in a byte of its own after the flag
+    Message msg = MessageBuilder::createContentMessage(MSG_REQUEST, TestSignal{0x1234, -5});
+    TEST_ASSERT_TRUE(msg.flag.isTyped());
+    TEST_ASSERT_EQUAL(MSG_CON_USER + 1, msg.flag.getMessageContentType());
+    TEST_ASSERT_EQUAL(0, msg.flag.raw & (0x3 << 2));
+    PacketBuffer packet;
+    TEST_ASSERT_TRUE(msg.encodePacket(0, packet));
+    TEST_ASSERT_EQUAL_MEMORY(TYPED_IDENTIFIER, packet.data, 3);
+    TEST_ASSERT_EQUAL(MSG_CON_USER + 1, packet.data[6]);
+    TEST_ASSERT_EQUAL(SHORT_MSG_HEADER_SIZE + CONTENT_TYPE_EXTENSION_SIZE + 6, packet.size);
+
+    PacketView view = PacketView::parse(packet.data, packet.size);
+    TEST_ASSERT_TRUE(view.success && view.typed);
+    TEST_ASSERT_EQUAL(MSG_CON_USER + 1, view.contentType());
+    ContentResult<TestSignal> signal = ContentCodec<TestSignal>::decode(view.payload);
+    TEST_ASSERT_TRUE(signal.success);
+    TEST_ASSERT_EQUAL(0x1234, signal.content.signal);
+    TEST_ASSERT_EQUAL(-5, signal.content.value);
+    TEST_ASSERT_TRUE(view.flag == msg.flag);
+    TEST_ASSERT_FALSE(view.flag == MessageFlag(MSG_REQUEST, MSG_CON_META));
+
+    // the built-in content types keep the header older receivers know
+    TEST_ASSERT_FALSE(MessageFlag(MSG_REQUEST, MSG_CON_DATA_TRANSFER).isTyped());
+    TEST_ASSERT_EQUAL(MAX_SHORT_MSG_PAYLOAD_SIZE - 1, Message::maxPayloadSize(msg.flag));
+
+    // a type that fits the flag, or content type bits next to the byte, would make a second encoding
+    packet.data[6] = MSG_CON_DRIVE;
+    TEST_ASSERT_FALSE(PacketView::parse(packet.data, packet.size).success);
+    packet.data[6] = MSG_CON_LINK_STATS;
+    packet.data[MSG_FLAG_OFFSET] |= MSG_CON_DRIVE << 2;
+    TEST_ASSERT_FALSE(PacketView::parse(packet.data, packet.size).success);
+
+    // checked, long, and with FEC, like any other message
+    std::vector<std::uint8_t> data(3000);
+    for (std::size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = i * 7;
+    }
+    Message stats(3, MSG_RESPONSE, MSG_CON_LINK_STATS, data);
+    TEST_ASSERT_TRUE(stats.enableChecksum());
+    TEST_ASSERT_TRUE(stats.enableFEC(4, 1));
+    std::vector<std::vector<std::uint8_t>> packets = stats.encode();
+    TEST_ASSERT_EQUAL(stats.packetCount(), packets.size());
+    ReassemblyBuffer buffer;
+    ReassemblySlot *slot = nullptr;
+    for (std::size_t i = 1; i < packets.size(); i++)
+    {
+        // the first fragment is lost, and rebuilt from parity
+        view = PacketView::parse(packets[i].data(), packets[i].size());
+        TEST_ASSERT_TRUE(view.success && view.typed);
+        TEST_ASSERT_TRUE(packets[i].size() <= MAX_PACKET_SIZE);
+        if (buffer.add(view, 0, slot) == REASSEMBLY_COMPLETE)
+        {
+            break;
+        }
+    }
+    TEST_ASSERT_NOT_NULL(slot);
+    TEST_ASSERT_TRUE(slot->isComplete());
+    TEST_ASSERT_EQUAL(MSG_CON_LINK_STATS, slot->flag.getMessageContentType());
+    PayloadView payload = buffer.payload(*slot);
+    TEST_ASSERT_EQUAL(data.size() + MESSAGE_CRC_SIZE, payload.size);
+    TEST_ASSERT_EQUAL_MEMORY(data.data(), payload.data, data.size());
+
+    // and past 255 packets, with the typed version of the extended header
+    Message huge(4, MSG_RESPONSE, MSG_CON_LINK_STATS, std::vector<std::uint8_t>(256 * MAX_LONG_MSG_PAYLOAD_SIZE, 'x'));
+    std::size_t count = huge.packetCount();
+    TEST_ASSERT_EQUAL((huge.data.size() + MAX_EXTENDED_MSG_PAYLOAD_SIZE - 2) / (MAX_EXTENDED_MSG_PAYLOAD_SIZE - 1), count);
+    TEST_ASSERT_TRUE(huge.encodePacket(count - 1, packet));
+    TEST_ASSERT_EQUAL_MEMORY(EXTENDED_IDENTIFIER, packet.data, 3);
+    TEST_ASSERT_EQUAL(EXTENDED_TYPED_HEADER_VERSION, packet.data[6]);
+    TEST_ASSERT_EQUAL(MSG_CON_LINK_STATS, packet.data[7]);
+    view = PacketView::parse(packet.data, packet.size);
+    TEST_ASSERT_TRUE(view.success && view.extended && view.typed);
+    TEST_ASSERT_EQUAL(count - 1, view.packetNumber);
+    TEST_ASSERT_EQUAL(count, view.packetCount);
+    TEST_ASSERT_EQUAL(MSG_CON_LINK_STATS, view.contentType());
+}
+
+void test_content_layout(void)
+{
+    // sizes are known at compile time, and fixed layouts say so
+    static_assert(ContentCodec<MetaContent>::Layout::minSize == 4, "");
+    static_assert(ContentCodec<MetaContent>::Layout::maxSize == 4 + MAX_PREFIXED_FIELD_SIZE, "");
+    static_assert(ContentCodec<DataRateSwitchContent>::Layout::fixedSize && ContentCodec<DataRateSwitchContent>::Layout::minSize == 6, "");
+    static_assert(ContentCodec<LinkStatsRequest>::Layout::fixedSize && ContentCodec<LinkStatsRequest>::Layout::maxSize == 6, "");
+    static_assert(ContentCodec<DriveContent>::Layout::maxSize == SIZE_MAX, "");
+
+    // the generated codecs keep the wire format of the hand-written builders
+    Message meta = MessageBuilder::createMetaMessageResponse(1, "Test", 1, 2, 3);
+    const std::uint8_t metaBytes[] = {4, 'T', 'e', 's', 't', 1, 2, 3};
+    TEST_ASSERT_EQUAL(sizeof(metaBytes), meta.data.size());
+    TEST_ASSERT_EQUAL_MEMORY(metaBytes, meta.data.data(), sizeof(metaBytes));
+    Message rate = MessageBuilder::createDataRateSwitchRequest(SWITCH_COMMIT, 9, 250000);
+    const std::uint8_t rateBytes[] = {SWITCH_COMMIT, 9, 0x00, 0x03, 0xD0, 0x90};
+    TEST_ASSERT_EQUAL(sizeof(rateBytes), rate.data.size());
+    TEST_ASSERT_EQUAL_MEMORY(rateBytes, rate.data.data(), sizeof(rateBytes));
+
+    // every truncation fails, rather than reading past the end, e.g. a schema name longer than the payload
+    for (std::size_t i = 0; i < sizeof(metaBytes); i++)
+    {
+        TEST_ASSERT_FALSE(MessageParser::parseContent<MetaContent>(PayloadView(metaBytes, i)).success);
+    }
+    const std::uint8_t overlong[] = {200, 'a', 'b', 1, 2, 3};
+    TEST_ASSERT_FALSE(MessageParser::parseMetaContent(std::vector<std::uint8_t>(overlong, overlong + sizeof(overlong))).success);
+    ContentResult<MetaContent> parsed = MessageParser::parseMetaContent(meta.data);
+    TEST_ASSERT_TRUE(parsed.success);
+    TEST_ASSERT_TRUE(parsed.content.schemaName == "Test");
+    TEST_ASSERT_EQUAL(3, parsed.content.patch);
+
+    // a name too long for its length byte is cut, instead of leaving the length and the bytes out of step
+    parsed = MessageParser::parseMetaContent(MessageBuilder::createMetaMessageResponse(1, std::string(300, 'n'), 1, 2, 3).data);
+    TEST_ASSERT_TRUE(parsed.success);
+    TEST_ASSERT_EQUAL(MAX_PREFIXED_FIELD_SIZE, parsed.content.schemaName.size());
+    TEST_ASSERT_EQUAL(1, parsed.content.major);
+
+    // bytes after the last field are left for later versions
+    const std::uint8_t longer[] = {SWITCH_PROPOSE, 7, 0x00, 0x01, 0xE8, 0x48, 0xFF};
+    ContentResult<DataRateSwitchContent> switched = MessageParser::parseContent<DataRateSwitchContent>(PayloadView(longer, sizeof(longer)));
+    TEST_ASSERT_TRUE(switched.success);
+    TEST_ASSERT_EQUAL(125000, switched.content.bandwidth);
+    TEST_ASSERT_FALSE(MessageParser::parseDataRateSwitchContent({7, 7, 0, 0, 0, 0}).success);
+
+    // integers are cut to their width, and a signed one sent whole keeps its sign
+    TestSignal signal{0xBEEF, -123456};
+    std::vector<std::uint8_t> encoded = ContentCodec<TestSignal>::encode(signal);
+    TEST_ASSERT_EQUAL(6, encoded.size());
+    ContentResult<TestSignal> decoded = MessageParser::parseContent<TestSignal>(encoded);
+    TEST_ASSERT_TRUE(decoded.success);
+    TEST_ASSERT_EQUAL(0xBEEF, decoded.content.signal);
+    TEST_ASSERT_EQUAL(-123456, decoded.content.value);
+
+    // straight into a packet's buffer, without touching the heap, or not at all if it does not fit
+    PacketBuffer packet;
+    std::size_t allocationsBefore = g_allocationCount;
+    std::size_t written = ContentCodec<TestSignal>::encode(signal, packet.data, sizeof(packet.data));
+    TEST_ASSERT_EQUAL(0, g_allocationCount - allocationsBefore);
+    TEST_ASSERT_EQUAL(6, written);
+    TEST_ASSERT_EQUAL_MEMORY(encoded.data(), packet.data, 6);
+    packet.data[0] = 0x55;
+    TEST_ASSERT_EQUAL(0, ContentCodec<TestSignal>::encode(signal, packet.data, 5));
+    TEST_ASSERT_EQUAL(0x55, packet.data[0]);
+}
+
+// the CRCs computed a bit at a time, straight from their definitions
+static std::uint32_t _crcBitwise(const std::uint8_t *data, std::size_t size, std::uint32_t polynomial, std::uint32_t mask)
+{
+    std::uint32_t crc = mask;
+    for (std::size_t i = 0; i < size; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 1) ? (crc >> 1) ^ polynomial : crc >> 1;
+        }
+    }
+    return crc ^ mask;
+}
+
+void test_crc(void)
+{
+    const std::uint8_t check[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+    TEST_ASSERT_EQUAL_HEX16(0x906E, Crc::crc16(check, sizeof(check)));
+    TEST_ASSERT_EQUAL_HEX32(0xCBF43926, Crc::crc32(check, sizeof(check)));
+    TEST_ASSERT_EQUAL_HEX32(0, Crc::crc32(check, 0));
+
+    // every length around the 8 byte steps, against the bitwise definition
+    std::minstd_rand rng(17);
+    std::vector<std::uint8_t> data(300);
+    for (std::uint8_t &byte : data)
+    {
+        byte = rng() & 0xFF;
+    }
+    for (std::size_t size = 0; size < data.size(); size += (size < 40) ? 1 : 37)
+    {
+        TEST_ASSERT_EQUAL_HEX16(_crcBitwise(data.data(), size, 0x8408, 0xFFFF), Crc::crc16(data.data(), size));
+        TEST_ASSERT_EQUAL_HEX32(_crcBitwise(data.data(), size, 0xEDB88320, 0xFFFFFFFF), Crc::crc32(data.data(), size));
+    }
+
+    // a running CRC continues where the last call left off
+    TEST_ASSERT_EQUAL_HEX16(Crc::crc16(data.data(), 300), Crc::crc16(data.data() + 13, 287, Crc::crc16(data.data(), 13)));
+    TEST_ASSERT_EQUAL_HEX32(Crc::crc32(data.data(), 300), Crc::crc32(data.data() + 13, 287, Crc::crc32(data.data(), 13)));
+}
+
+void test_checked_message(void)
+{
+    // a checked short message verifies, and any flipped bit after the identifier is caught
+    Message meta = MessageBuilder::createMetaMessageResponse(3, "daq-schema", 1, 2, 3);
+    TEST_ASSERT_TRUE(meta.enableChecksum());
+    std::vector<std::uint8_t> packet = meta.encode()[0];
+    PacketView view = PacketView::parse(packet.data(), packet.size());
+    TEST_ASSERT_TRUE(view.success);
+    TEST_ASSERT_TRUE(view.flag.isChecked());
+    TEST_ASSERT_TRUE(view.payload.toVector() == meta.data);
+    for (std::size_t bit = 3 * 8; bit < packet.size() * 8; bit++)
+    {
+        std::vector<std::uint8_t> corrupted = packet;
+        corrupted[bit / 8] ^= 1 << (bit % 8);
+        TEST_ASSERT_FALSE(PacketView::parse(corrupted.data(), corrupted.size()).success);
+    }
+
+    // a short message without room for the CRC becomes long
+    Message full(MSG_RESPONSE, MSG_CON_DATA_TRANSFER, std::vector<std::uint8_t>(MAX_SHORT_MSG_PAYLOAD_SIZE, 7));
+    TEST_ASSERT_FALSE(full.flag.isLongMessage());
+    full.enableChecksum();
+    TEST_ASSERT_TRUE(full.flag.isLongMessage());
+    TEST_ASSERT_EQUAL(2, full.packetCount());
+
+    // a checked long message reassembles with its CRC-32 at the end
+    std::string content(1000, 'x');
+    for (std::size_t i = 0; i < content.size(); i++)
+    {
+        content[i] = (char)('a' + i % 23);
+    }
+    Message checked = MessageBuilder::createDriveMessageResponse(4, content);
+    std::vector<std::uint8_t> expected = checked.data;
+    TEST_ASSERT_TRUE(checked.enableChecksum());
+    std::vector<std::vector<std::uint8_t>> packets = checked.encode();
+    TEST_ASSERT_EQUAL((expected.size() + MESSAGE_CRC_SIZE + MAX_LONG_MSG_PAYLOAD_SIZE - PACKET_CRC_SIZE - 1) / (MAX_LONG_MSG_PAYLOAD_SIZE - PACKET_CRC_SIZE), packets.size());
+
+    ReassemblyBuffer buffer;
+    ReassemblySlot *slot = nullptr;
+    ReassemblyStatus status = REASSEMBLY_STORED;
+    for (std::vector<std::uint8_t> &fragment : packets)
+    {
+        status = buffer.add(PacketView::parse(fragment.data(), fragment.size()), 0, slot);
+    }
+    TEST_ASSERT_EQUAL(REASSEMBLY_COMPLETE, status);
+    PayloadView payload = buffer.payload(*slot);
+    TEST_ASSERT_EQUAL(expected.size() + MESSAGE_CRC_SIZE, payload.size);
+    TEST_ASSERT_EQUAL_HEX32(Crc::crc32(expected.data(), expected.size()),
+                            ((std::uint32_t)payload[expected.size()] << 24) | (payload[expected.size() + 1] << 16) | (payload[expected.size() + 2] << 8) | payload[expected.size() + 3]);
+    TEST_ASSERT_TRUE(std::vector<std::uint8_t>(payload.begin(), payload.end() - MESSAGE_CRC_SIZE) == expected);
+
+    // asking for an ack after encoding keeps the CRC valid
+    PacketBuffer last;
+    checked.encodePacket(packets.size() - 1, last);
+    Message::markPacketAsAck(last);
+    view = PacketView::parse(last.data, last.size);
+    TEST_ASSERT_TRUE(view.success);
+    TEST_ASSERT_TRUE(view.flag.isAck());
+
+    // the CRC-32 is part of what FEC protects, so it has to come first
+    Message protectedDrive = MessageBuilder::createDriveMessageResponse(5, content);
+    TEST_ASSERT_TRUE(protectedDrive.enableFEC(4, 1));
+    TEST_ASSERT_FALSE(protectedDrive.enableChecksum());
+}
+
+void test_dispatch_table(void)
+{
+    DispatchTable table;
+    int viewCalls = 0, messageCalls = 0, otherCalls = 0;
+    table.addView(MSG_REQUEST, MSG_CON_META, [&](const MessageView &view)
+                  { viewCalls++; });
+    table.add(MSG_REQUEST, MSG_CON_META, [&](const Message &msg)
+              { messageCalls += msg.data.size() == 4; });
+    table.add(MSG_RESPONSE, MSG_CON_META, [&](const Message &msg)
+              { otherCalls++; });
+    table.add(MSG_REQUEST, MSG_CON_DRIVE, [&](const Message &msg)
+              { otherCalls++; });
+
+    std::uint8_t payload[4] = {1, 2, 3, 4};
+    MessageView view{1, MessageFlag(MSG_REQUEST, MSG_CON_META), PayloadView(payload, sizeof(payload))};
+    TEST_ASSERT_TRUE(table.dispatch(view));
+    TEST_ASSERT_EQUAL(1, viewCalls);
+    TEST_ASSERT_EQUAL(1, messageCalls);
+    TEST_ASSERT_EQUAL(0, otherCalls);
+    TEST_ASSERT_EQUAL(2, table.subscriberCount(MSG_REQUEST, MSG_CON_META));
+
+    MessageView unsubscribed{2, MessageFlag(MSG_RESPONSE, MSG_CON_DATA_TRANSFER), PayloadView(payload, sizeof(payload))};
+    TEST_ASSERT_FALSE(table.dispatch(unsubscribed));
+
+    // content types past the flag get their entries as they are subscribed to, and any content type covers them all
+    int typedCalls = 0, anyCalls = 0;
+    MessageContentType user = MessageContentType(MSG_CON_USER + 7);
+    table.addView(MSG_REQUEST, user, [&](const MessageView &view)
+                  { typedCalls++; });
+    table.addAny(MSG_REQUEST, [&](const Message &msg)
+                 { anyCalls += msg.flag.getMessageContentType() == user; });
+    MessageView typed{3, MessageFlag(MSG_REQUEST, user), PayloadView(payload, sizeof(payload))};
+    TEST_ASSERT_TRUE(table.dispatch(typed));
+    TEST_ASSERT_EQUAL(1, typedCalls);
+    TEST_ASSERT_EQUAL(1, anyCalls);
+    TEST_ASSERT_EQUAL(2, table.subscriberCount(MSG_REQUEST, user));
+    TEST_ASSERT_EQUAL(3, table.subscriberCount(MSG_REQUEST, MSG_CON_META));
+    TEST_ASSERT_EQUAL(0, table.subscriberCount(MSG_RESPONSE, user));
+    MessageView other{4, MessageFlag(MSG_REQUEST, MSG_CON_LINK_STATS), PayloadView(payload, sizeof(payload))};
+    TEST_ASSERT_TRUE(table.dispatch(other));
+    TEST_ASSERT_EQUAL(1, typedCalls);
+    TEST_ASSERT_EQUAL(1, viewCalls);
+
+    // view subscribers alone never cost an allocation
+    DispatchTable views;
+    for (int i = 0; i < 4; i++)
+    {
+        views.addView(MSG_REQUEST, MSG_CON_META, [&](const MessageView &view)
+                      { viewCalls++; });
+    }
+    std::size_t allocationsBefore = g_allocationCount;
+    views.dispatch(view);
+    TEST_ASSERT_EQUAL(0, g_allocationCount - allocationsBefore);
+    TEST_ASSERT_EQUAL(5, viewCalls);
+}
+
+static std::size_t g_logCount = 0;
+static LogLevel g_lastLogLevel = LOG_NONE;
+
+static void _countingLogSink(LogLevel level, const char *message)
+{
+    g_logCount++;
+    g_lastLogLevel = level;
+}
+
+void test_log_sink(void)
+{
+    g_logCount = 0;
+    Log::setSink(_countingLogSink);
+
+    std::vector<std::uint8_t> garbage = {'X', 'Y', 'Z', 0, 0, 0, 0};
+    MessageParsingResult res = Message::decode(garbage);
+    TEST_ASSERT_FALSE(res.success);
+
+#if WIRCOM_LOG_LEVEL >= WIRCOM_LOG_LEVEL_WARN
+    TEST_ASSERT_EQUAL(1, g_logCount);
+    TEST_ASSERT_EQUAL(LOG_WARN, g_lastLogLevel);
+#else
+    TEST_ASSERT_EQUAL(0, g_logCount);
+#endif
+
+    // levels above WIRCOM_LOG_LEVEL are compiled out, and never evaluate their arguments
+    int evaluated = 0;
+    WIRCOM_LOG_DEBUG("debug " << ++evaluated);
+#if WIRCOM_LOG_LEVEL >= WIRCOM_LOG_LEVEL_DEBUG
+    TEST_ASSERT_EQUAL(1, evaluated);
+#else
+    TEST_ASSERT_EQUAL(0, evaluated);
+#endif
+
+    Log::setSink(nullptr);
+}
+
+// steps a simulated network forward, letting every interface drain its radio and tick, once per ms
+static void _runNetwork(SimulatedNetwork &network, std::vector<std::pair<ComInterface *, SimulatedTransport *>> nodes, std::uint32_t ms)
+{
+    for (std::uint32_t t = 0; t < ms; t++)
+    {
+        network.advance(1);
+        for (auto &node : nodes)
+        {
+            while (node.second->available())
+            {
+                node.first->listen(0);
+            }
+            node.first->tick();
+        }
+    }
+}
+
+void test_sim_request_response(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    car.initialize();
+    pit.initialize();
+    TEST_ASSERT_TRUE(car.ready && pit.ready);
+
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_META, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createMetaMessageResponse(msg.messageID, "Test", 1, 2, 3)); });
+
+    int responses = 0;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_META, [&](Message msg)
+                      {
+        ContentResult<MetaContent> meta = MessageParser::parseMetaContent(msg.data);
+        TEST_ASSERT_TRUE(meta.success);
+        TEST_ASSERT_EQUAL(2, meta.content.minor);
+        responses++; });
+
+    pit.sendMessage(MessageBuilder::createMetaMessageRequest());
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 3 * SEND_TIMEOUT);
+
+    // answered on the first try, so it is never resent
+    TEST_ASSERT_EQUAL(1, responses);
+    TEST_ASSERT_EQUAL(2, network.stats.packetsSent);
+    Clock::setSource(nullptr);
+}
+
+void test_sim_lossy_drive_transfer(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    config.lossRate = 0.1f;
+    config.duplicateRate = 0.05f;
+    config.reorderRate = 0.1f;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+
+    std::string content = "";
+    for (int i = 0; i < 250; i++)
+    {
+        content += "abc_";
+    }
+
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createDriveMessageResponse(msg.messageID, content)); });
+
+    std::string received;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { received = MessageParser::parseDriveContent(msg.data).content.driveContent; });
+
+    pit.sendMessage(MessageBuilder::createDriveMessageRequest());
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 30 * SEND_TIMEOUT);
+
+    TEST_ASSERT_TRUE(received == content);
+    TEST_ASSERT_TRUE(network.stats.packetsLost > 0);
+    Clock::setSource(nullptr);
+}
+
+void test_sim_selective_repeat(void)
+{
+    SimulatedNetwork network;
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+
+    std::string content(1000, 'x');
+    Message response = MessageBuilder::createDriveMessageResponse(42, content);
+    std::size_t numPackets = response.packetCount();
+
+    // lose the first transmission of fragment 3, and count how often each fragment goes on air
+    std::vector<int> sent(numPackets, 0);
+    int acks = 0;
+    network.dropFilter = [&](const std::uint8_t *data, std::uint8_t length)
+    {
+        PacketView view = PacketView::parse(data, length);
+        if (!view.flag.isLongMessage())
+        {
+            acks += view.flag.isAck();
+            return false;
+        }
+        return ++sent[view.packetNumber] == 1 && view.packetNumber == 3;
+    };
+
+    std::string received;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { received = MessageParser::parseDriveContent(msg.data).content.driveContent; });
+
+    car.sendMessage(response);
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 2 * SEND_TIMEOUT);
+
+    TEST_ASSERT_TRUE(received == content);
+    for (std::size_t i = 0; i < numPackets; i++)
+    {
+        TEST_ASSERT_EQUAL(i == 3 ? 2 : 1, sent[i]);
+    }
+
+    // one ack reporting the gap, and one confirming the whole message
+    TEST_ASSERT_EQUAL(2, acks);
+    Clock::setSource(nullptr);
+}
+
+void test_sim_duplicate_ack_mid_window(void)
+{
+    SimulatedNetwork network;
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    car.initialize();
+    pit.initialize();
+    TEST_ASSERT_TRUE(car.enableEventMode());
+    TEST_ASSERT_TRUE(pit.enableEventMode());
+    car.setSendWindow(4);
+
+    std::string content(3000, 'x');
+    Message response = MessageBuilder::createDriveMessageResponse(42, content);
+    std::size_t numPackets = response.packetCount();
+    TEST_ASSERT_TRUE(numPackets > 8);
+
+    // keep the ack of the first window, and play it again once the second window is on its way. In event mode
+    // the fragments go out one at a time as the radio becomes idle, so the repeat arrives in the middle of the window
+    std::vector<int> sent(numPackets, 0);
+    std::vector<std::uint8_t> firstAck;
+    bool replay = false;
+    network.dropFilter = [&](const std::uint8_t *data, std::uint8_t length)
+    {
+        PacketView view = PacketView::parse(data, length);
+        if (!view.flag.isLongMessage())
+        {
+            if (view.flag.isAck() && firstAck.empty())
+            {
+                firstAck.assign(data, data + length);
+            }
+            return false;
+        }
+        replay |= ++sent[view.packetNumber] == 1 && view.packetNumber == 5;
+        return false;
+    };
+
+    std::string received;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { received = MessageParser::parseDriveContent(msg.data).content.driveContent; });
+
+    car.sendMessage(response);
+    bool replayed = false;
+    for (int t = 0; t < 20000 && received.empty(); t++)
+    {
+        if (replay && !replayed)
+        {
+            replayed = pitRadio.send(firstAck.data(), firstAck.size());
+        }
+        network.advance(1);
+        car.poll();
+        car.tick();
+        pit.poll();
+        pit.tick();
+    }
+
+    // the repeated ack finds fragments 6 and 7 not on air yet, which does not make them lost, so nothing goes twice
+    TEST_ASSERT_TRUE(replayed);
+    TEST_ASSERT_TRUE(received == content);
+    for (std::size_t i = 0; i < numPackets; i++)
+    {
+        TEST_ASSERT_EQUAL(1, sent[i]);
+    }
+    Clock::setSource(nullptr);
+}
+
+void test_sim_reused_message_id(void)
+{
+    SimulatedNetwork network;
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+
+    // the two sides number their messages on their own, so a new long message can reuse the ID of one that just completed
+    std::vector<Message> received;
+    pit.addRXCallbackToAny(MessageType::MSG_RESPONSE, [&](const Message &msg)
+                           { received.push_back(msg); });
+    std::size_t fragmentsSent = 0;
+    network.dropFilter = [&](const std::uint8_t *data, std::uint8_t length)
+    {
+        fragmentsSent += PacketView::parse(data, length).flag.isLongMessage();
+        return false;
+    };
+
+    Message drive = MessageBuilder::createDriveMessageResponse(42, std::string(1000, 'd'));
+    car.sendMessage(drive);
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 2 * SEND_TIMEOUT);
+    TEST_ASSERT_EQUAL(1, received.size());
+
+    // a different message under the same ID is dispatched, rather than acked as a retransmission of the first
+    Message transfer(42, MSG_RESPONSE, MSG_CON_DATA_TRANSFER, std::vector<std::uint8_t>(2000, 't'));
+    fragmentsSent = 0;
+    car.sendMessage(transfer);
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 2 * SEND_TIMEOUT);
+    TEST_ASSERT_EQUAL(2, received.size());
+    TEST_ASSERT_TRUE(received[1].data == transfer.data);
+    TEST_ASSERT_EQUAL(transfer.packetCount(), fragmentsSent);
+    TEST_ASSERT_EQUAL(0, pit.linkStats().duplicates);
+
+    // and so is the same message once the history has forgotten it, past the reassembly timeout
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, REASSEMBLY_TIMEOUT);
+    car.sendMessage(drive);
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 2 * SEND_TIMEOUT);
+    TEST_ASSERT_EQUAL(3, received.size());
+    TEST_ASSERT_TRUE(received[2].data == drive.data);
+    Clock::setSource(nullptr);
+}
+
+void test_sim_reassembly_timeout(void)
+{
+    SimulatedNetwork network;
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    pit.setReassemblyLimits(2000, 16 * MAX_LONG_MSG_PAYLOAD_SIZE);
+
+    // the car drives out of range halfway through a drive file
+    network.dropFilter = [&](const std::uint8_t *data, std::uint8_t length)
+    {
+        return PacketView::parse(data, length).packetNumber >= 2;
+    };
+
+    bool received = false;
+    pit.addRXCallbackToAny(MessageType::MSG_RESPONSE, [&](Message msg)
+                           { received = true; });
+
+    car.sendMessage(MessageBuilder::createDriveMessageResponse(42, std::string(1000, 'x')), false);
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 1000);
+    TEST_ASSERT_EQUAL(1, pit.reassemblyBuffer().slotsInUse());
+
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 2000);
+    TEST_ASSERT_FALSE(received);
+    TEST_ASSERT_EQUAL(0, pit.reassemblyBuffer().slotsInUse());
+    TEST_ASSERT_EQUAL(1, pit.reassemblyBuffer().stats().expired);
+    Clock::setSource(nullptr);
+}
+
+void test_sim_event_mode(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    config.lossRate = 0.1f;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    car.initialize();
+    pit.initialize();
+    TEST_ASSERT_TRUE(car.enableEventMode());
+    TEST_ASSERT_TRUE(pit.enableEventMode());
+
+    std::string content(2000, 'x');
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createDriveMessageResponse(msg.messageID, content)); });
+
+    std::string received;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { received = MessageParser::parseDriveContent(msg.data).content.driveContent; });
+
+    // queuing a message does not wait for it to go on air
+    std::uint32_t before = network.now();
+    pit.sendMessage(MessageBuilder::createDriveMessageRequest());
+    TEST_ASSERT_EQUAL(before, network.now());
+
+    for (int t = 0; t < 10000 && received.empty(); t++)
+    {
+        network.advance(1);
+        car.poll();
+        car.tick();
+        pit.poll();
+        pit.tick();
+    }
+
+    TEST_ASSERT_TRUE(received == content);
+    TEST_ASSERT_EQUAL(0, car.rxOverflows());
+    TEST_ASSERT_EQUAL(0, pit.rxOverflows());
+    Clock::setSource(nullptr);
+}
+
+void test_sim_data_stream(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+
+    std::uint8_t sequence = 0;
+    car.setDataStreamSource([&]()
+                            { return std::vector<std::uint8_t>(32, sequence++); });
+
+    int frames = 0;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DATA_TRANSFER, [&](Message msg)
+                      { frames++; });
+
+    // the lease is shorter than the test, so the stream only keeps going if the pit renews it
+    pit.subscribe(100, 2000);
+    std::uint32_t start = network.now();
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 5000);
+    TEST_ASSERT_TRUE(car.streaming());
+    // waiting for frames to go on air also moves the simulated clock, so count from the elapsed time
+    TEST_ASSERT_INT_WITHIN(2, (network.now() - start) / 100, frames);
+
+    pit.unsubscribe();
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 100);
+    TEST_ASSERT_FALSE(car.streaming());
+    int stoppedAt = frames;
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 1000);
+    TEST_ASSERT_EQUAL(stoppedAt, frames);
+
+    // the pit goes out of range: without renewals the car stops once the lease runs out
+    pit.subscribe(100, 2000);
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 500);
+    TEST_ASSERT_TRUE(car.streaming());
+    network.dropFilter = [&](const std::uint8_t *data, std::uint8_t length)
+    {
+        return PacketView::parse(data, length).messageType() == MessageType::MSG_REQUEST;
+    };
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 2000);
+    TEST_ASSERT_FALSE(car.streaming());
+    Clock::setSource(nullptr);
+}
+
+void test_sim_delta_stream(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+
+    std::uint32_t produced = 0;
+    car.setDataStreamSource([&]()
+                            { return _telemetryFrame(produced++); });
+
+    // callbacks see full frames, so check each one against what the car produced
+    int frames = 0, mismatches = 0;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DATA_TRANSFER, [&](Message msg)
+                      { frames++;
+                        bool known = false;
+                        for (std::uint32_t n = 0; n < produced && !known; n++)
+                        {
+                            known = msg.data == _telemetryFrame(n);
+                        }
+                        mismatches += !known; });
+
+    // the second keyframe gets lost, the deltas after it cannot be rebuilt until the pit asks for a new one
+    int keyframesDropped = 0;
+    network.dropFilter = [&](const std::uint8_t *data, std::uint8_t length)
+    {
+        PacketView packet = PacketView::parse(data, length);
+        bool drop = packet.messageType() == MessageType::MSG_RESPONSE && packet.payload.size > 1 &&
+                    packet.payload[0] == DELTA_KEYFRAME && packet.payload[1] == 2;
+        keyframesDropped += drop;
+        return drop;
+    };
+
+    pit.subscribe(100, 2000, true);
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 5000);
+    pit.unsubscribe();
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 100);
+
+    TEST_ASSERT_EQUAL(1, keyframesDropped);
+    TEST_ASSERT_EQUAL(0, mismatches);
+    // the lost keyframe costs the frame itself and the delta that noticed it, then the stream resyncs
+    TEST_ASSERT_INT_WITHIN(1, (int)produced - 2, frames);
+    TEST_ASSERT_GREATER_THAN(30, frames);
+    Clock::setSource(nullptr);
+}
+
+void test_sim_compressed_drive(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    config.lossRate = 0.1f;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+
+    std::string schema = _driveSchema(100);
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createDriveMessageResponse(msg.messageID, schema, true)); });
+
+    // callbacks get the drive file as it was written
+    std::string received;
+    pit.addRXViewCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](const MessageView &view)
+                          { TEST_ASSERT_FALSE(view.flag.isCompressed());
+                            received.assign(view.payload.begin(), view.payload.end()); });
+
+    pit.sendMessage(MessageBuilder::createDriveMessageRequest());
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 20000);
+
+    TEST_ASSERT_TRUE(received == schema);
+    // 40 fragments uncompressed, with the request, acks and retransmissions on top
+    TEST_ASSERT_LESS_THAN(30, network.stats.packetsSent);
+    Clock::setSource(nullptr);
+}
+
+void test_sim_fec_drive_transfer(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    config.lossRate = 0.1f;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    car.setFEC(MessageContentType::MSG_CON_DRIVE, 4, 1);
+
+    std::string content(8 * 1024, 'x');
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createDriveMessageResponse(msg.messageID, content)); });
+
+    std::string received;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { received = MessageParser::parseDriveContent(msg.data).content.driveContent; });
+
+    pit.sendMessage(MessageBuilder::createDriveMessageRequest());
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 60000);
+
+    TEST_ASSERT_TRUE(received == content);
+    TEST_ASSERT_GREATER_THAN(0, pit.reassemblyBuffer().stats().recovered);
+    Clock::setSource(nullptr);
+}
+
+void test_sim_integrity_check(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    config.lossRate = 0.05f;
+    config.corruptRate = 0.1f;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    for (ComInterface *node : {&car, &pit})
+    {
+        node->setIntegrityCheck(true);
+        node->setBatching(DEFAULT_BATCH_DEADLINE);
+    }
+    // the CRC-32 also has to hold for fragments rebuilt from parity
+    car.setFEC(MessageContentType::MSG_CON_DRIVE, 4, 1);
+
+    std::string content(4 * 1024, 'x');
+    for (std::size_t i = 0; i < content.size(); i++)
+    {
+        content[i] = (char)('a' + i % 23);
+    }
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createDriveMessageResponse(msg.messageID, content)); });
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_META, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createMetaMessageResponse(msg.messageID, "daq-schema", 1, 2, 3)); });
+
+    // corrupt packets never reach the callbacks, they are recovered like lost ones
+    std::string received;
+    int metaResponses = 0;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { received = MessageParser::parseDriveContent(msg.data).content.driveContent; });
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_META, [&](Message msg)
+                      { ContentResult<MetaContent> meta = MessageParser::parseMetaContent(msg.data);
+                        TEST_ASSERT_TRUE(meta.success && meta.content.schemaName == "daq-schema");
+                        metaResponses++; });
+
+    pit.sendMessage(MessageBuilder::createDriveMessageRequest());
+    for (int i = 0; i < 10; i++)
+    {
+        pit.sendMessage(MessageBuilder::createMetaMessageRequest());
+    }
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 60000);
+
+    TEST_ASSERT_TRUE(received == content);
+    TEST_ASSERT_GREATER_THAN(0, pit.reassemblyBuffer().stats().recovered);
+    TEST_ASSERT_GREATER_OR_EQUAL(10, metaResponses);
+    std::uint32_t failures = car.checksumFailures() + pit.checksumFailures();
+    TEST_ASSERT_GREATER_THAN(0, failures);
+    TEST_ASSERT_LESS_OR_EQUAL(network.stats.packetsCorrupted, failures);
+    Clock::setSource(nullptr);
+}
+
+void test_sim_large_transfer(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    config.bitRate = 1000000;
+    config.lossRate = 0.05f;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    pit.setReassemblyPool(1, 1000);
+
+    // a session log of about 1000 fragments, well past what the long header can number
+    std::string content(200 * 1024, 'x');
+    std::uint32_t seed = 1;
+    for (std::size_t i = 0; i < content.size(); i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        content[i] = (char)(seed >> 16);
+    }
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createDriveMessageResponse(msg.messageID, content)); });
+
+    std::string received;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { received = MessageParser::parseDriveContent(msg.data).content.driveContent; });
+
+    pit.sendMessage(MessageBuilder::createDriveMessageRequest());
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 60000);
+
+    TEST_ASSERT_TRUE(received == content);
+    TEST_ASSERT_GREATER_THAN(0, network.stats.packetsLost);
+    Clock::setSource(nullptr);
+}
+
+void test_sim_source_transfer(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    config.bitRate = 1000000;
+    config.lossRate = 0.05f;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    car.setIntegrityCheck(true);
+    pit.setIntegrityCheck(true);
+    pit.setReassemblyPool(1, 600);
+
+    // stands in for a log file on the SD card
+    const std::size_t size = 128 * 1024;
+    auto fileByte = [](std::size_t i)
+    { return (std::uint8_t)((i * 2654435761u) >> 13); };
+    MessageSource file = [&](std::size_t offset, std::uint8_t *out, std::size_t length)
+    {
+        for (std::size_t i = 0; i < length; i++)
+        {
+            out[i] = fileByte(offset + i);
+        }
+        return true;
+    };
+
+    // sending only reads the first window's fragments, the file is never copied into memory
+    std::size_t bytesBefore = g_allocatedBytes;
+    car.sendMessage(MessageBuilder::createDriveMessageResponse(1, size, file));
+    TEST_ASSERT_LESS_THAN(size / 8, g_allocatedBytes - bytesBefore);
+    TEST_ASSERT_EQUAL(DEFAULT_SEND_WINDOW, network.stats.packetsSent);
+
+    std::vector<std::uint8_t> received;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { received = msg.data; });
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 60000);
+
+    TEST_ASSERT_EQUAL(size, received.size());
+    for (std::size_t i = 0; i < size; i++)
+    {
+        TEST_ASSERT_EQUAL_HEX8(fileByte(i), received[i]);
+    }
+    TEST_ASSERT_EQUAL(0, pit.checksumFailures());
+    Clock::setSource(nullptr);
+}
+
+struct TelemetryRun
+{
+    std::vector<std::uint32_t> idle;     // frame latencies before the drive file was requested, in ms
+    std::vector<std::uint32_t> transfer; // frame latencies while it was on its way, in ms
+    std::uint32_t driveTime = 0;         // from the request to the whole file, in ms
+    std::uint32_t staleDropped = 0;      // frames the car dropped for a newer one
+};
+
+// the car streams 32 byte frames, stamped with the time they were taken, every interval ms, and a
+// second in the pit asks for a drive file of driveSize bytes. Both run in event mode, so neither
+// holds up the other while it is sending
+static TelemetryRun _runTelemetryDuringTransfer(std::uint16_t interval, std::size_t driveSize, std::uint32_t ms)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    car.enableEventMode();
+    pit.enableEventMode();
+    auto run = [&](std::uint32_t duration)
+    {
+        for (std::uint32_t t = 0; t < duration; t++)
+        {
+            network.advance(1);
+            for (ComInterface *node : {&car, &pit})
+            {
+                node->poll();
+                node->tick();
+            }
+        }
+    };
+    car.setDataStreamSource([&]()
+                            { std::vector<std::uint8_t> frame(32, 0);
+                              std::uint32_t now = Clock::millis();
+                              std::memcpy(frame.data(), &now, sizeof(now));
+                              return frame; });
+    std::string content(driveSize, 'd');
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createDriveMessageResponse(msg.messageID, content)); });
+
+    TelemetryRun result;
+    std::uint32_t requested = 0;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DATA_TRANSFER, [&](Message msg)
+                      { std::uint32_t taken;
+                        std::memcpy(&taken, msg.data.data(), sizeof(taken));
+                        (requested == 0 || result.driveTime > 0 ? result.idle : result.transfer).push_back(Clock::millis() - taken); });
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { result.driveTime = Clock::millis() - requested; });
+
+    pit.subscribe(interval);
+    run(1000);
+    requested = Clock::millis();
+    pit.sendMessage(MessageBuilder::createDriveMessageRequest());
+    run(ms);
+    result.staleDropped = car.txStats().staleDropped;
+    Clock::setSource(nullptr);
+    return result;
+}
+
+static std::uint32_t _percentile(std::vector<std::uint32_t> values, double fraction)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+
+    std::sort(values.begin(), values.end());
+    std::size_t rank = (std::size_t)std::ceil(fraction * values.size());
+    return values[rank > 0 ? rank - 1 : 0];
+}
+
+void test_sim_telemetry_priority(void)
+{
+    // a fragment is about 370 ms on air here, the window of 8 a frame used to queue behind about 3 s
+    TelemetryRun run = _runTelemetryDuringTransfer(200, 8 * 1024, 60000);
+    TEST_ASSERT_GREATER_THAN(0, run.driveTime);
+    TEST_ASSERT_GREATER_THAN(10, run.transfer.size());
+    TEST_ASSERT_LESS_THAN(500, _percentile(run.transfer, 0.99));
+    TEST_ASSERT_LESS_THAN(100, _percentile(run.idle, 0.99));
+    // two frames come due during some fragments, and only the newer one is sent
+    TEST_ASSERT_GREATER_THAN(0, run.staleDropped);
+}
+
+void test_sim_batching(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    car.setBatching(20);
+    pit.setBatching(20);
+
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_META, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createMetaMessageResponse(msg.messageID, "schema", 1, 2, 3)); });
+
+    std::set<std::uint16_t> answered;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_META, [&](Message msg)
+                      { answered.insert(msg.messageID); });
+
+    for (int i = 0; i < 10; i++)
+    {
+        pit.sendMessage(MessageBuilder::createMetaMessageRequest());
+    }
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 500);
+
+    // 10 requests in one packet, 10 responses in another
+    TEST_ASSERT_EQUAL(10, answered.size());
+    TEST_ASSERT_EQUAL(2, network.stats.packetsSent);
+
+    // long messages are never batched, and push out the short ones waiting in front of them
+    std::string drive;
+    car.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { drive = MessageParser::parseDriveContent(msg.data).content.driveContent; });
+    pit.sendMessage(MessageBuilder::createMetaMessageRequest());
+    pit.sendMessage(MessageBuilder::createDriveMessageResponse(1, std::string(600, 'x')), false);
+    TEST_ASSERT_EQUAL(6, network.stats.packetsSent);
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 2000);
+    TEST_ASSERT_EQUAL(11, answered.size());
+    TEST_ASSERT_EQUAL(600, drive.size());
+
+    // a truncated batch stops at the broken record
+    std::uint8_t frame[] = {'N', 'F', 'B', 0, 1, 0, 2, 'h', 'i', 0, 2, 0, 5, 'x'};
+    BatchView view(frame, sizeof(frame));
+    PacketView packet;
+    TEST_ASSERT_TRUE(BatchView::isBatch(frame, sizeof(frame)));
+    TEST_ASSERT_TRUE(view.next(packet));
+    TEST_ASSERT_EQUAL(1, packet.messageID);
+    TEST_ASSERT_EQUAL(2, packet.payload.size);
+    TEST_ASSERT_FALSE(view.next(packet));
+    Clock::setSource(nullptr);
+}
+
+void test_sim_concurrent_senders(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 2;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+
+    // the order the car's fragments go on air in, the filter runs under the network lock
+    std::vector<std::pair<std::uint16_t, std::uint16_t>> onAir;
+    network.dropFilter = [&](const std::uint8_t *data, std::uint8_t length)
+    {
+        PacketView view = PacketView::parse(data, length);
+        if (view.success && !view.flag.isAck())
+        {
+            onAir.emplace_back(view.messageID, view.packetNumber);
+        }
+        return false;
+    };
+
+    // only the thread running pit.poll() touches this
+    std::set<std::pair<int, int>> received;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DATA_TRANSFER, [&](Message msg)
+                      { received.insert({msg.data[0], msg.data[1]}); });
+
+    const int producers = 8;
+    const int messagesPerProducer = 25;
+    std::atomic<int> running{producers};
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+    {
+        threads.emplace_back([&, p]()
+                             {
+            for (int i = 0; i < messagesPerProducer; i++)
+            {
+                // every other message is long, so windows of fragments race with short messages
+                std::vector<std::uint8_t> data(i % 2 ? 600 : 40, (std::uint8_t)p);
+                data[1] = (std::uint8_t)i;
+                Message msg = MessageBuilder::createDataTransferMessage(data);
+                while (!car.sendMessage(msg))
+                {
+                    // BULK_QUEUE_SIZE long messages are already on their way
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                }
+                std::this_thread::yield();
+            }
+            running--; });
+    }
+
+    for (int t = 0; t < 200000 && (running > 0 || received.size() < producers * messagesPerProducer); t++)
+    {
+        network.advance(1);
+        car.poll();
+        car.tick();
+        pit.poll();
+        pit.tick();
+    }
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    TEST_ASSERT_EQUAL(producers * messagesPerProducer, received.size());
+
+    // other messages may go out between the fragments of a long one, but each message's new fragments
+    // go in order, and whatever is sent again has been sent before
+    std::unordered_map<std::uint16_t, std::uint16_t> nextFragment;
+    for (const std::pair<std::uint16_t, std::uint16_t> &packet : onAir)
+    {
+        std::uint16_t &next = nextFragment[packet.first];
+        TEST_ASSERT_LESS_OR_EQUAL(next, packet.second);
+        if (packet.second == next)
+        {
+            next++;
+        }
+    }
+    TEST_ASSERT_GREATER_THAN(0, car.bulkRefusals());
+    Clock::setSource(nullptr);
+}
+
+struct ExchangeStats
+{
+    int requestsSent = 0;
+    int completed = 0;
+    std::uint32_t totalLatency = 0;
+};
+
+// runs sequential meta request/response exchanges at the given data rate, counting request transmissions
+static ExchangeStats _runMetaExchanges(bool adaptive, int spreadingFactor, long bandwidth, float lossRate, int exchanges)
+{
+    SimulatedChannelConfig config;
+    config.latency = 20;
+    config.lossRate = lossRate;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    car.switchDataRate(spreadingFactor, bandwidth);
+    pit.switchDataRate(spreadingFactor, bandwidth);
+    pit.setAdaptiveTimeout(adaptive);
+
+    ExchangeStats stats;
+    network.dropFilter = [&](const std::uint8_t *data, std::uint8_t length)
+    {
+        stats.requestsSent += PacketView::parse(data, length).messageType() == MessageType::MSG_REQUEST;
+        return false;
+    };
+
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_META, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createMetaMessageResponse(msg.messageID, "Test", 1, 2, 3)); });
+
+    bool answered = false;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_META, [&](Message msg)
+                      { answered = true; });
+
+    for (int i = 0; i < exchanges; i++)
+    {
+        answered = false;
+        std::uint32_t start = network.now();
+        pit.sendMessage(MessageBuilder::createMetaMessageRequest());
+        while (!answered && network.now() - start < 60000)
+        {
+            _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 1);
+        }
+
+        if (answered)
+        {
+            stats.completed++;
+            stats.totalLatency += network.now() - start;
+        }
+
+        // let late duplicates drain before the next exchange
+        _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 5000);
+    }
+
+    Clock::setSource(nullptr);
+    return stats;
+}
+
+void test_sim_adaptive_timeout(void)
+{
+    // at a slow data rate the round trip is longer than SEND_TIMEOUT, so a fixed timeout always fires early
+    ExchangeStats fixedSlow = _runMetaExchanges(false, 12, 31250, 0.0f, 10);
+    ExchangeStats adaptiveSlow = _runMetaExchanges(true, 12, 31250, 0.0f, 10);
+    TEST_ASSERT_EQUAL(10, fixedSlow.completed);
+    TEST_ASSERT_EQUAL(10, adaptiveSlow.completed);
+    TEST_ASSERT_TRUE(fixedSlow.requestsSent >= 20);
+    TEST_ASSERT_TRUE(adaptiveSlow.requestsSent <= 12);
+
+    // at a fast data rate a lost request is retried after a few round trips, not a whole second
+    ExchangeStats fixedFast = _runMetaExchanges(false, 7, 125000, 0.2f, 100);
+    ExchangeStats adaptiveFast = _runMetaExchanges(true, 7, 125000, 0.2f, 100);
+    TEST_ASSERT_EQUAL(100, fixedFast.completed);
+    TEST_ASSERT_EQUAL(100, adaptiveFast.completed);
+    TEST_ASSERT_TRUE(adaptiveFast.totalLatency < fixedFast.totalLatency * 2 / 3);
+
+    std::cout << "SF12: fixed " << fixedSlow.requestsSent << " requests, adaptive " << adaptiveSlow.requestsSent
+              << " | SF7 20% loss: fixed " << fixedFast.totalLatency / 100 << " ms, adaptive "
+              << adaptiveFast.totalLatency / 100 << " ms mean latency" << std::endl;
+}
+
+void test_retry_time_budget(void)
+{
+    SimulatedNetwork network;
+    network.useAsClock();
+
+    // nobody answers, so the request is retried until the budget runs out
+    SimulatedTransport pitRadio(network), idleRadio(network);
+    ComInterface pit(pitRadio);
+    pit.setRetryPolicy(0, 5000);
+
+    int sent = 0;
+    network.dropFilter = [&](const std::uint8_t *data, std::uint8_t length)
+    {
+        sent++;
+        return false;
+    };
+
+    pit.sendMessage(MessageBuilder::createMetaMessageRequest());
+    _runNetwork(network, {{&pit, &pitRadio}}, 4000);
+    int sentWithinBudget = sent;
+    TEST_ASSERT_TRUE(sentWithinBudget > 1);
+
+    _runNetwork(network, {{&pit, &pitRadio}}, 60000);
+    TEST_ASSERT_TRUE(sent - sentWithinBudget <= 1);
+    Clock::setSource(nullptr);
+}
+
+void test_sim_data_rate_mismatch(void)
+{
+    SimulatedNetwork network;
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+
+    int requests = 0;
+    car.addRXCallbackToAny(MessageType::MSG_REQUEST, [&](Message msg)
+                           { requests++; });
+
+    // a radio on a different spreading factor never hears the packet
+    car.switchDataRate(9, 125000);
+    pit.sendMessage(MessageBuilder::createMetaMessageRequest(), false);
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 100);
+    TEST_ASSERT_EQUAL(0, requests);
+    TEST_ASSERT_EQUAL(1, network.stats.packetsLost);
+
+    car.switchDataRate(7, 125000);
+    pit.sendMessage(MessageBuilder::createMetaMessageRequest(), false);
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 100);
+    TEST_ASSERT_EQUAL(1, requests);
+    Clock::setSource(nullptr);
+}
+
+void test_link_adaptation(void)
+{
+    // the SX127x demodulation floors, and 3 dB more noise for every doubling of the bandwidth
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, -7.5f, LinkAdaptation::requiredSNR(DataRate{7, 125000}));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, -20.0f, LinkAdaptation::requiredSNR(DataRate{12, 125000}));
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, -1.5f, LinkAdaptation::requiredSNR(DataRate{7, 500000}));
+
+    LinkAdaptationConfig config;
+    LinkAdaptation adaptation(config, 3, 0);
+    TEST_ASSERT_TRUE(adaptation.rate() == (DataRate{7, 125000}));
+
+    // close to the pits: the SNR reads saturated, the RSSI is 17 dB over the noise floor
+    for (int i = 0; i < 3; i++)
+    {
+        adaptation.onReceived(-100, 10, 100 + i);
+    }
+    TEST_ASSERT_EQUAL(3, adaptation.target(config.holdTime + 100));
+    adaptation.onReceived(-100, 10, 103);
+    TEST_ASSERT_FLOAT_WITHIN(0.5f, 17.0f, adaptation.snr());
+    TEST_ASSERT_EQUAL(3, adaptation.target(config.holdTime - 1));
+    TEST_ASSERT_EQUAL(5, adaptation.target(config.holdTime + 100));
+
+    // the switch goes through, and is not counted until the other side is heard at the new rate
+    std::uint32_t now = config.holdTime + 100;
+    adaptation.propose(5, 42, now);
+    TEST_ASSERT_EQUAL(LINK_PROPOSED, adaptation.state());
+    TEST_ASSERT_EQUAL(3, adaptation.target(now));
+    adaptation.switchTo(5, now + 10);
+    TEST_ASSERT_EQUAL(LINK_SWITCHED, adaptation.state());
+    TEST_ASSERT_FALSE(adaptation.switchTimedOut(now + config.switchTimeout));
+    adaptation.confirm(now + 20);
+    TEST_ASSERT_EQUAL(LINK_STEADY, adaptation.state());
+    TEST_ASSERT_EQUAL(5, adaptation.current());
+    TEST_ASSERT_EQUAL(1, adaptation.switches());
+
+    // at the far end of the track the signal sinks towards the floor, and the rate goes straight down, without a hold.
+    // Measured over 500 kHz, -20 dB is -14 dB at 125 kHz
+    now += 100;
+    for (int i = 0; i < 20; i++)
+    {
+        adaptation.onReceived(-125, -20, now);
+    }
+    TEST_ASSERT_EQUAL(0, adaptation.target(now));
+
+    // retransmissions step down one rate at a time, even while the signal still looks fine
+    LinkAdaptation lossy(config, 4, 0);
+    lossy.onLost(3);
+    TEST_ASSERT_EQUAL(4, lossy.target(10));
+    lossy.onLost(3);
+    TEST_ASSERT_EQUAL(3, lossy.target(10));
+
+    // a switch that is never confirmed goes back, and the rate is left alone for a while
+    LinkAdaptation failing(config, 3, 0);
+    for (int i = 0; i < 4; i++)
+    {
+        failing.onReceived(-100, 10, 0);
+    }
+    failing.propose(5, 7, config.holdTime);
+    failing.switchTo(5, config.holdTime + 10);
+    TEST_ASSERT_TRUE(failing.switchTimedOut(config.holdTime + config.switchTimeout + 1));
+    failing.revert(config.holdTime + config.switchTimeout + 1);
+    TEST_ASSERT_EQUAL(3, failing.current());
+    TEST_ASSERT_EQUAL(1, failing.reverts());
+    for (int i = 0; i < 4; i++)
+    {
+        failing.onReceived(-100, 10, 0);
+    }
+    now = 2 * config.holdTime + config.switchTimeout + 1;
+    TEST_ASSERT_EQUAL(4, failing.target(now));
+    TEST_ASSERT_EQUAL(5, failing.target(now + 4 * config.holdTime));
+
+    // nothing heard for silenceTimeout at a faster rate than the fallback
+    TEST_ASSERT_FALSE(failing.silent(config.silenceTimeout));
+    TEST_ASSERT_TRUE(failing.silent(config.silenceTimeout + 1));
+    failing.fallBack(config.silenceTimeout + 1);
+    TEST_ASSERT_EQUAL(0, failing.current());
+    TEST_ASSERT_FALSE(failing.silent(10 * config.silenceTimeout));
+}
+
+void test_data_rate_switch_message(void)
+{
+    Message request = MessageBuilder::createDataRateSwitchRequest(SWITCH_PROPOSE, 9, 500000);
+    ContentResult<DataRateSwitchContent> content = MessageParser::parseDataRateSwitchContent(request.data);
+    TEST_ASSERT_TRUE(content.success);
+    TEST_ASSERT_EQUAL(SWITCH_PROPOSE, content.content.phase);
+    TEST_ASSERT_EQUAL(9, content.content.spreadingFactor);
+    TEST_ASSERT_EQUAL(500000, content.content.bandwidth);
+
+    // the old two byte request is left to the application
+    Message legacy = MessageBuilder::createSwitchDataRateMessageRequest(125, 7);
+    TEST_ASSERT_FALSE(MessageParser::parseDataRateSwitchContent(legacy.data).success);
+}
+
+struct LapRun
+{
+    std::size_t bytes = 0;         // telemetry that reached the pit
+    std::uint32_t longestGap = 0;  // without a frame, in ms
+    std::uint32_t switches = 0;
+    std::uint32_t reverts = 0;
+};
+
+// the car streams 64 byte frames as fast as the link allows while it drives laps of lapTime ms, and the SNR
+// at the pit falls from 12 dB at the pits to -12 dB at the far end of the track, and back. The pit adapts
+// the data rate of both, or they stay at rate
+static LapRun _runLaps(bool adaptive, DataRate rate, std::uint32_t lapTime, int laps)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    car.switchDataRate(rate.spreadingFactor, rate.bandwidth);
+    pit.switchDataRate(rate.spreadingFactor, rate.bandwidth);
+    if (adaptive)
+    {
+        LinkAdaptationConfig adaptation;
+        pit.enableLinkAdaptation(adaptation);
+        adaptation.initiator = false;
+        car.enableLinkAdaptation(adaptation);
+    }
+
+    car.setDataStreamSource([&]()
+                            { return std::vector<std::uint8_t>(64, 0xAB); });
+    LapRun result;
+    std::uint32_t lastFrame = 0;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DATA_TRANSFER, [&](Message msg)
+                      { result.bytes += msg.data.size();
+                        result.longestGap = std::max(result.longestGap, network.now() - lastFrame);
+                        lastFrame = network.now(); });
+
+    pit.subscribe(0);
+    while (network.now() < lapTime * laps)
+    {
+        network.config.snr = 12.0f * std::cos(2 * M_PI * network.now() / lapTime);
+        _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 1);
+    }
+
+    result.switches = pit.linkAdaptation().switches();
+    result.reverts = pit.linkAdaptation().reverts();
+    Clock::setSource(nullptr);
+    return result;
+}
+
+void test_sim_link_adaptation(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    config.snr = 15.0f;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    LinkAdaptationConfig adaptation;
+    pit.enableLinkAdaptation(adaptation);
+    adaptation.initiator = false;
+    car.enableLinkAdaptation(adaptation);
+
+    car.setDataStreamSource([&]()
+                            { return std::vector<std::uint8_t>(32, 0xAB); });
+    int frames = 0;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DATA_TRANSFER, [&](Message msg)
+                      { frames++; });
+    // waiting for frames to go on air also moves the simulated clock, at slow rates by more than a step
+    auto run = [&](std::uint32_t ms)
+    {
+        std::uint32_t end = network.now() + ms;
+        while (network.now() < end)
+        {
+            _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 1);
+        }
+    };
+    // a frame every 100 ms, or as many as fit on air at slow rates
+    auto expectFrames = [&]()
+    {
+        frames = 0;
+        run(2000);
+        std::uint32_t interval = std::max<std::uint32_t>(100, carRadio.airtime(32 + SHORT_MSG_HEADER_SIZE));
+        TEST_ASSERT_GREATER_OR_EQUAL(2000 / interval - 2, frames);
+    };
+
+    // close to the pits both sides move up to the fastest rate, together
+    pit.subscribe(100);
+    run(10000);
+    TEST_ASSERT_EQUAL(5, pit.linkAdaptation().current());
+    TEST_ASSERT_EQUAL(5, car.linkAdaptation().current());
+    TEST_ASSERT_EQUAL(LINK_STEADY, pit.linkAdaptation().state());
+    TEST_ASSERT_EQUAL(LINK_STEADY, car.linkAdaptation().state());
+    TEST_ASSERT_EQUAL(carRadio.bitRate(), pitRadio.bitRate());
+    expectFrames();
+
+    // further out, the signal fades gradually and the rate follows it down
+    for (int snr = 15; snr >= -8; snr--)
+    {
+        network.config.snr = (float)snr;
+        run(500);
+    }
+    run(5000);
+    TEST_ASSERT_EQUAL(1, pit.linkAdaptation().current());
+    TEST_ASSERT_EQUAL(1, car.linkAdaptation().current());
+    expectFrames();
+
+    // back to the pits, where the signal comes back at once
+    network.config.snr = 15.0f;
+    run(10000);
+    TEST_ASSERT_EQUAL(5, pit.linkAdaptation().current());
+    TEST_ASSERT_EQUAL(5, car.linkAdaptation().current());
+
+    // the signal drops out under the fastest rate before it can be measured, and both fall back on their own
+    network.config.snr = -10.0f;
+    std::uint32_t reverts = car.linkAdaptation().reverts();
+    run(adaptation.silenceTimeout + 2000);
+    TEST_ASSERT_EQUAL(0, pit.linkAdaptation().current());
+    TEST_ASSERT_EQUAL(0, car.linkAdaptation().current());
+    TEST_ASSERT_EQUAL(reverts + 1, car.linkAdaptation().reverts());
+    run(5000);
+    expectFrames();
+    Clock::setSource(nullptr);
+}
+
+void test_sim_link_adaptation_lap(void)
+{
+    // tuned for the worst corner, the link never drops, but crawls past the pits
+    LapRun robust = _runLaps(false, DataRate{10, 125000}, 60000, 2);
+    LapRun adaptive = _runLaps(true, DataRate{7, 125000}, 60000, 2);
+    TEST_ASSERT_GREATER_THAN(robust.bytes * 2, adaptive.bytes);
+    TEST_ASSERT_GREATER_THAN(4, adaptive.switches);
+}
+
+void test_link_stats(void)
+{
+    // as the SX1276 calculator has it, SF12 at 125 kHz with the low data rate optimization, at 500 kHz without
+    LoRaModulation modulation;
+    TEST_ASSERT_EQUAL(41216, timeOnAir(modulation, 10));
+    modulation.spreadingFactor = 12;
+    TEST_ASSERT_EQUAL(1318912, timeOnAir(modulation, 20));
+    TEST_ASSERT_EQUAL(1646592, timeOnAir(modulation, 30));
+    modulation.bandwidth = 500000;
+    TEST_ASSERT_EQUAL(370688, timeOnAir(modulation, 30));
+
+    Histogram histogram;
+    TEST_ASSERT_EQUAL(0, histogram.percentile(0.5f));
+    TEST_ASSERT_EQUAL(0, Histogram::bucketOf(0));
+    TEST_ASSERT_EQUAL(1, Histogram::bucketOf(1));
+    TEST_ASSERT_EQUAL(3, Histogram::bucketOf(7));
+    TEST_ASSERT_EQUAL(4, Histogram::bucketOf(8));
+    TEST_ASSERT_EQUAL(HISTOGRAM_BUCKETS - 1, Histogram::bucketOf(UINT32_MAX));
+    for (std::uint32_t value = 1; value <= 100; value++)
+    {
+        histogram.add(value);
+    }
+    TEST_ASSERT_EQUAL(100, histogram.count());
+    TEST_ASSERT_EQUAL(5050, histogram.sum());
+    TEST_ASSERT_EQUAL(50, histogram.mean());
+    // within a factor of two, and never above the largest value
+    TEST_ASSERT_EQUAL(63, histogram.percentile(0.5f));
+    TEST_ASSERT_EQUAL(100, histogram.percentile(0.99f));
+
+    LinkStats stats;
+    stats.packetsSent = 1000000;
+    stats.checksumFailures = 3;
+    stats.responseLatency = histogram;
+    stats.airtimePerPacket.add(41216);
+    std::vector<std::uint8_t> encoded = stats.encode();
+    TEST_ASSERT_LESS_THAN(MAX_SHORT_MSG_PAYLOAD_SIZE, encoded.size());
+
+    ContentResult<LinkStats> decoded = MessageParser::parseLinkStatsContent(MessageBuilder::createLinkStatsResponse(1, stats).data);
+    TEST_ASSERT_TRUE(decoded.success);
+    TEST_ASSERT_EQUAL(1000000, decoded.content.packetsSent);
+    TEST_ASSERT_EQUAL(3, decoded.content.checksumFailures);
+    TEST_ASSERT_EQUAL(0, decoded.content.fragmentInterarrival.count());
+    TEST_ASSERT_EQUAL(5050, decoded.content.responseLatency.sum());
+    TEST_ASSERT_EQUAL(100, decoded.content.responseLatency.max());
+    for (std::size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        TEST_ASSERT_EQUAL(histogram.bucket(i), decoded.content.responseLatency.bucket(i));
+    }
+    TEST_ASSERT_EQUAL(41216, decoded.content.airtimePerPacket.sum());
+
+    // fields appended by a later version are skipped, a cut off snapshot is not
+    encoded.push_back(42);
+    TEST_ASSERT_TRUE(LinkStats::decode(encoded.data(), encoded.size(), stats));
+    TEST_ASSERT_FALSE(LinkStats::decode(encoded.data(), encoded.size() - 2, stats));
+    encoded[0] = LINK_STATS_VERSION + 1;
+    TEST_ASSERT_FALSE(LinkStats::decode(encoded.data(), encoded.size(), stats));
+}
+
+void test_sim_link_stats(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    config.lossRate = 0.1f;
+    config.duplicateRate = 0.05f;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+
+    std::string content(2000, 'd');
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_META, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createMetaMessageResponse(msg.messageID, "Test", 1, 2, 3)); });
+    car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { car.sendMessage(MessageBuilder::createDriveMessageResponse(msg.messageID, content)); });
+
+    int responses = 0;
+    bool driveReceived = false;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_META, [&](Message msg)
+                      { responses++; });
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                      { driveReceived = true; });
+
+    for (int i = 0; i < 20; i++)
+    {
+        pit.sendMessage(MessageBuilder::createMetaMessageRequest());
+        _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 2 * SEND_TIMEOUT);
+    }
+    pit.sendMessage(MessageBuilder::createDriveMessageRequest());
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 20 * SEND_TIMEOUT);
+    TEST_ASSERT_TRUE(driveReceived);
+
+    LinkStats carStats = car.linkStats();
+    LinkStats pitStats = pit.linkStats();
+    TEST_ASSERT_EQUAL(network.stats.packetsSent, carStats.packetsSent + pitStats.packetsSent);
+    TEST_ASSERT_EQUAL(network.stats.bytesSent, carStats.bytesSent + pitStats.bytesSent);
+    TEST_ASSERT_EQUAL(network.stats.packetsDelivered, carStats.packetsReceived + pitStats.packetsReceived);
+    TEST_ASSERT_EQUAL(network.now(), pitStats.timestamp);
+
+    // every request either came back or timed out, and the answered ones have a latency
+    TEST_ASSERT_EQUAL(21, pitStats.retriesPerRequest.count());
+    TEST_ASSERT_EQUAL(pitStats.responseLatency.count() + pitStats.timeouts, 21);
+    TEST_ASSERT_TRUE(pitStats.retries > 0);
+    TEST_ASSERT_TRUE(pitStats.responseLatency.percentile(0.5f) >= 2 * config.latency);
+
+    // one long message came in, over a lossy link, with its fragments a few tens of ms apart
+    TEST_ASSERT_EQUAL(1, pitStats.reassemblyTime.count());
+    TEST_ASSERT_TRUE(pitStats.fragmentInterarrival.count() >= 8);
+    TEST_ASSERT_TRUE(pitStats.duplicates > 0);
+    TEST_ASSERT_EQUAL(pitStats.packetsSent, pitStats.airtimePerPacket.count());
+    TEST_ASSERT_EQUAL(timeOnAir(LoRaModulation(), MAX_PACKET_SIZE + RADIO_HEADER_SIZE), carStats.airtimePerPacket.max());
+
+    // the pit follows the car's side of the link, and its data transfer callbacks never see the snapshots
+    int frames = 0;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DATA_TRANSFER, [&](Message msg)
+                      { frames++; });
+    std::vector<LinkStats> snapshots;
+    pit.subscribeLinkStats([&](const LinkStats &stats)
+                           { snapshots.push_back(stats); },
+                           500, 2000);
+    std::uint32_t start = network.now();
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 5000);
+    TEST_ASSERT_TRUE(car.streamingLinkStats());
+    TEST_ASSERT_EQUAL(0, frames);
+    // some are lost, and never sent again
+    TEST_ASSERT_INT_WITHIN(4, (network.now() - start) / 500, snapshots.size());
+    TEST_ASSERT_TRUE(snapshots.back().timestamp > snapshots.front().timestamp);
+    TEST_ASSERT_TRUE(snapshots.back().packetsSent > carStats.packetsSent);
+    TEST_ASSERT_EQUAL(carStats.airtimePerPacket.max(), snapshots.back().airtimePerPacket.max());
+
+    pit.unsubscribeLinkStats();
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 100);
+    std::size_t stoppedAt = snapshots.size();
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 2000);
+    TEST_ASSERT_FALSE(car.streamingLinkStats());
+    TEST_ASSERT_EQUAL(stoppedAt, snapshots.size());
+    Clock::setSource(nullptr);
+}
+
+void test_sim_content_types(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    // typed messages skip the batches the others share
+    car.setBatching(DEFAULT_BATCH_DEADLINE);
+    pit.setBatching(DEFAULT_BATCH_DEADLINE);
+
+    // the car answers an application's own requests, decoded for it
+    car.addContentCallback<TestSignal>(MessageType::MSG_REQUEST, [&](std::uint16_t id, const TestSignal &request)
+                                       { car.sendMessage(MessageBuilder::createContentMessage(id, MSG_RESPONSE, TestSignal{request.signal, request.value * 2})); });
+
+    std::vector<TestSignal> answers;
+    int anyResponses = 0;
+    pit.addContentCallback<TestSignal>(MessageType::MSG_RESPONSE, [&](std::uint16_t id, const TestSignal &answer)
+                                       { answers.push_back(answer); });
+    pit.addRXCallbackToAny(MessageType::MSG_RESPONSE, [&](Message msg)
+                           { anyResponses++; });
+
+    for (int i = 0; i < 4; i++)
+    {
+        pit.sendMessage(MessageBuilder::createContentMessage(MSG_REQUEST, TestSignal{(std::uint16_t)i, 100 + i}));
+        pit.sendMessage(MessageBuilder::createMetaMessageRequest());
+    }
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 3 * SEND_TIMEOUT);
+    TEST_ASSERT_EQUAL(4, answers.size());
+    for (int i = 0; i < 4; i++)
+    {
+        TEST_ASSERT_EQUAL(i, answers[i].signal);
+        TEST_ASSERT_EQUAL(2 * (100 + i), answers[i].value);
+    }
+    TEST_ASSERT_EQUAL(4, anyResponses);
+    TEST_ASSERT_EQUAL(0, car.linkStats().decodeFailures + pit.linkStats().decodeFailures);
+
+    // link statistics have a content type of their own, so their callbacks see them as well
+    std::vector<LinkStats> snapshots;
+    std::size_t decoded = 0;
+    pit.addContentCallback<LinkStats>(MessageType::MSG_RESPONSE, [&](std::uint16_t id, const LinkStats &stats)
+                                      { decoded++; });
+    pit.subscribeLinkStats([&](const LinkStats &stats)
+                           { snapshots.push_back(stats); },
+                           0);
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, SEND_TIMEOUT);
+    TEST_ASSERT_EQUAL(1, snapshots.size());
+    TEST_ASSERT_EQUAL(1, decoded);
+    TEST_ASSERT_EQUAL(5, anyResponses);
+    TEST_ASSERT_TRUE(snapshots[0].messagesReceived >= 8);
+    Clock::setSource(nullptr);
+}
+
+void test_airtime_budget(void)
+{
+    AirtimeBudget budget;
+    TEST_ASSERT_FALSE(budget.enabled());
+    TEST_ASSERT_TRUE(budget.allows(10000000, 0));
+
+    // 1% of a minute is 600 ms on air, refilled at 10 ms a second
+    budget.configure(0.01f, 60000, 0);
+    TEST_ASSERT_EQUAL(600000, budget.available(0));
+    budget.spend(500000, 0);
+    TEST_ASSERT_INT_WITHIN(10, 100000, budget.available(0));
+    TEST_ASSERT_FALSE(budget.allows(200000, 0));
+    TEST_ASSERT_INT_WITHIN(2, 10000, budget.wait(200000, 0));
+    TEST_ASSERT_TRUE(budget.allows(200000, 10002));
+    TEST_ASSERT_EQUAL(600000, budget.available(1000000));
+
+    // a packet longer than the whole bucket goes once it is full, and leaves it in debt
+    TEST_ASSERT_FALSE(budget.allows(2000000, 40000));
+    TEST_ASSERT_TRUE(budget.allows(2000000, 1000000));
+    budget.spend(2000000, 1000000);
+    TEST_ASSERT_INT_WITHIN(10, -1400000, budget.available(1000000));
+    TEST_ASSERT_FALSE(budget.allows(1000, 1100000));
+    TEST_ASSERT_TRUE(budget.allows(1000, 1141000));
+
+    // a reader that took the time just before the last spend() sees no refill, not a wrapped around, full bucket
+    TEST_ASSERT_INT_WITHIN(10, -1400000, budget.available(999999));
+
+    // the radio owner keeps the bucket nearly empty while another thread looks at it
+    budget.configure(0.01f, 60000, 0);
+    budget.spend(590000, 0);
+    std::atomic<std::uint32_t> clock{0};
+    std::atomic<bool> started{false}, done{false};
+    std::int32_t most = INT32_MIN;
+    std::thread reader([&]()
+                       {
+        while (!done)
+        {
+            std::int32_t available = budget.available(clock);
+            most = available > most ? available : most;
+            started = true;
+        } });
+    while (!started)
+    {
+        std::this_thread::yield();
+    }
+    for (std::uint32_t now = 1; now < 200000; now++)
+    {
+        clock = now;
+        budget.spend(10, now);
+    }
+    done = true;
+    reader.join();
+    // at most a ms of refill ahead of the last spend(), never the whole bucket
+    TEST_ASSERT_INT_WITHIN(20, 10000, most);
+}
+
+void test_sim_airtime_budget(void)
+{
+    SimulatedChannelConfig config;
+    config.latency = 5;
+    config.loraTiming = true;
+    SimulatedNetwork network(config);
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    car.switchDataRate(7, 500000);
+    pit.switchDataRate(7, 500000);
+
+    // the frame alone is 16.7 ms on air, the whole time on air of the car is budgeted at 10% of every second
+    const std::size_t frameSize = 16;
+    std::uint16_t idBefore = MessageBuilder::createMetaMessageRequest().messageID;
+    TEST_ASSERT_EQUAL(16704, car.messageAirtime(frameSize));
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 1000000.0f / 16704, car.maxFrameRate(frameSize));
+    TEST_ASSERT_EQUAL((std::uint16_t)(idBefore + 1), MessageBuilder::createMetaMessageRequest().messageID);
+    car.setAirtimeBudget(0.1f, 1000, AIRTIME_REFUSE);
+    TEST_ASSERT_FLOAT_WITHIN(0.01f, 100000.0f / 16704, car.maxFrameRate(frameSize));
+
+    car.setDataStreamSource([&]()
+                            { return std::vector<std::uint8_t>(frameSize, 1); });
+    int frames = 0;
+    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DATA_TRANSFER, [&](Message msg)
+                      { frames++; });
+
+    // as fast as the link allows, which is as fast as the budget allows
+    pit.subscribe(0, 2000);
+    std::uint32_t start = network.now();
+    while (network.now() - start < 30000)
+    {
+        _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 10);
+    }
+    std::uint32_t elapsed = network.now() - start;
+    LinkStats stats = car.linkStats();
+    TEST_ASSERT_TRUE(stats.airtimePerPacket.sum() <= elapsed * 100 + car.airtimeBudget().capacity());
+    TEST_ASSERT_TRUE(stats.airtimePerPacket.sum() >= elapsed * 95);
+    // plus the frames the full bucket lets out at the start
+    TEST_ASSERT_INT_WITHIN(3, car.maxFrameRate(frameSize) * elapsed / 1000 + car.airtimeBudget().capacity() / 16704, frames);
+
+    // the stream keeps the budget spent, so there is no room for a drive file
+    TEST_ASSERT_FALSE(car.sendMessage(MessageBuilder::createDriveMessageResponse(1, std::string(2000, 'd'))));
+    TEST_ASSERT_EQUAL(1, car.airtimeRefusals());
+
+    pit.unsubscribe();
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 1000);
+    TEST_ASSERT_TRUE(car.sendMessage(MessageBuilder::createMetaMessageResponse(1, "Test", 1, 2, 3)));
+    Clock::setSource(nullptr);
+}
+
+void test_airtime_refusal_counts_protection(void)
+{
+    SimulatedNetwork network;
+    network.useAsClock();
+
+    SimulatedTransport carRadio(network), pitRadio(network);
+    ComInterface car(carRadio), pit(pitRadio);
+    car.switchDataRate(7, 500000);
+    pit.switchDataRate(7, 500000);
+
+    // with FEC, a message is on air half as long again as its data packets alone
+    const std::size_t size = 8 * FEC_FRAGMENT_SIZE;
+    std::uint32_t plain = car.messageAirtime(size);
+    car.setFEC(MSG_CON_DATA_TRANSFER, 4, 2);
+    std::uint32_t coded = car.messageAirtime(size);
+    TEST_ASSERT_TRUE(coded > plain * 14 / 10);
+
+    // after one message, what is left of the bucket holds the data packets of another, but not its parity
+    car.setAirtimeBudget(0.001f, plain + coded + (coded - plain) / 2, AIRTIME_REFUSE);
+    TEST_ASSERT_TRUE(car.sendMessage(MessageBuilder::createDataTransferMessage(std::vector<std::uint8_t>(size, 1)), false));
+    _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 100);
+    std::int32_t left = car.airtimeBudget().available(Clock::millis());
+    TEST_ASSERT_TRUE(left > (std::int32_t)plain && left < (std::int32_t)coded);
+    TEST_ASSERT_FALSE(car.sendMessage(MessageBuilder::createDataTransferMessage(std::vector<std::uint8_t>(size, 2)), false));
+    TEST_ASSERT_EQUAL(1, car.airtimeRefusals());
+    Clock::setSource(nullptr);
+}
+
+#if defined(WIRCOM_BENCHMARK)
+#pragma region Benchmarks
+
+// runs fn iterations times, returning the average time per call in nanoseconds
+template <typename Fn>
+static double _benchNanoseconds(int iterations, Fn fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+    {
+        fn();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+void bench_encode(void)
+{
+    const std::size_t sizes[] = {10, 240, 1024, 60 * 1024};
+    static PacketBuffer packets[256];
+
+    std::cout << "payload B | packets | encode() ns/pkt | allocs | encodeInto() ns/pkt | allocs" << std::endl;
+    for (std::size_t size : sizes)
+    {
+        Message msg = MessageBuilder::createDataTransferMessage(std::vector<std::uint8_t>(size, 0xA5));
+        std::size_t numPackets = msg.packetCount();
+        int iterations = (int)(200000 / numPackets) + 1;
+
+        std::size_t allocationsBefore = g_allocationCount;
+        double encodeNs = _benchNanoseconds(iterations, [&]()
+                                            { volatile std::size_t n = msg.encode().size(); (void)n; });
+        std::size_t encodeAllocs = (g_allocationCount - allocationsBefore) / iterations;
+
+        allocationsBefore = g_allocationCount;
+        double encodeIntoNs = _benchNanoseconds(iterations, [&]()
+                                                { volatile std::size_t n = msg.encodeInto(packets, 256); (void)n; });
+        std::size_t encodeIntoAllocs = (g_allocationCount - allocationsBefore) / iterations;
+
+        std::cout << size << " | " << numPackets
+                  << " | " << encodeNs / numPackets << " | " << encodeAllocs
+                  << " | " << encodeIntoNs / numPackets << " | " << encodeIntoAllocs << std::endl;
+        TEST_ASSERT_EQUAL(0, encodeIntoAllocs);
+    }
+}
+
+void bench_decode(void)
+{
+    std::string content(1024, 'x');
+    Message msg = MessageBuilder::createDriveMessageResponse(1, content);
+    std::vector<std::vector<std::uint8_t>> packets = msg.encode();
+
+    // swallow the output, so this measures the cost of producing the log lines
+    // and not the terminal; on the car, serial I/O comes on top of this
+    g_logCount = 0;
+    Log::setSink(_countingLogSink);
+    int iterations = 20000;
+    double decodeNs = _benchNanoseconds(iterations, [&]()
+                                        {
+        for (const std::vector<std::uint8_t> &packet : packets)
+        {
+            volatile bool ok = Message::decode(packet).success;
+            (void)ok;
+        } });
+    Log::setSink(nullptr);
+
+    std::cout << "WIRCOM_LOG_LEVEL=" << WIRCOM_LOG_LEVEL
+              << " | decode ns/pkt " << decodeNs / packets.size()
+              << " | log lines/pkt " << (double)g_logCount / (iterations * packets.size())
+              << " (compare native_bench against native_bench_logging)" << std::endl;
+}
+
+void bench_reassembly(void)
+{
+    std::string content(32 * MAX_LONG_MSG_PAYLOAD_SIZE, 'x');
+    Message msg = MessageBuilder::createDriveMessageResponse(1, content);
+    std::vector<std::vector<std::uint8_t>> packets = msg.encode();
+
+    // worst case arrival order for a scan-and-sort reassembler
+    std::vector<PacketView> views;
+    for (std::size_t i = packets.size(); i-- > 0;)
+    {
+        views.push_back(PacketView::parse(packets[i].data(), packets[i].size()));
+    }
+
+    ReassemblyBuffer buffer;
+    std::size_t allocations = g_allocationCount;
+    int iterations = 5000;
+    double reassembleNs = _benchNanoseconds(iterations, [&]()
+                                            {
+        ReassemblySlot *slot = nullptr;
+        for (const PacketView &view : views)
+        {
+            buffer.add(view, 0, slot);
+        }
+        buffer.release(*slot); });
+    allocations = g_allocationCount - allocations;
+
+    std::cout << "reassemble ns/fragment " << reassembleNs / views.size()
+              << " | allocations/message " << (double)allocations / iterations
+              << " | slot memory B " << buffer.slotCount() * buffer.slotCapacity() << std::endl;
+}
+
+// compression ratio and speed on drive schemas, a real one can be passed in WIRCOM_SCHEMA_FILE
+void bench_lz(void)
+{
+    std::vector<std::pair<std::string, std::string>> schemas = {
+        {"generated, 50 signals", _driveSchema(50)},
+        {"generated, 400 signals", _driveSchema(400)},
+    };
+    const char *path = std::getenv("WIRCOM_SCHEMA_FILE");
+    if (path != nullptr)
+    {
+        std::ifstream file(path, std::ios::binary);
+        schemas.push_back({path, std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>())});
+    }
+
+    std::cout << "schema | bytes | compressed | ratio | fragments before/after | compress MB/s | decompress MB/s" << std::endl;
+    for (auto &schema : schemas)
+    {
+        const std::uint8_t *input = (const std::uint8_t *)schema.second.data();
+        std::size_t size = schema.second.size();
+        std::vector<std::uint8_t> compressed(LzCodec::maxCompressedSize(size));
+        std::vector<std::uint8_t> output(size);
+        std::size_t compressedSize = 0;
+
+        double compressNs = _benchNanoseconds(200, [&]()
+                                              { compressedSize = LzCodec::compress(input, size, compressed.data(), compressed.size()); });
+        double decompressNs = _benchNanoseconds(200, [&]()
+                                                { LzCodec::decompress(compressed.data(), compressedSize, output.data(), output.size()); });
+
+        std::cout << schema.first << " | " << size << " | " << compressedSize << " | " << (double)size / compressedSize
+                  << " | " << (size + MAX_LONG_MSG_PAYLOAD_SIZE - 1) / MAX_LONG_MSG_PAYLOAD_SIZE << "/"
+                  << (compressedSize + MAX_LONG_MSG_PAYLOAD_SIZE - 1) / MAX_LONG_MSG_PAYLOAD_SIZE
+                  << " | " << size * 1000.0 / compressNs << " | " << size * 1000.0 / decompressNs << std::endl;
+    }
+}
+
+// CRC throughput, against the bitwise definition and a single 256 entry table, one byte per step
+void bench_crc(void)
+{
+    std::uint32_t table[256];
+    for (std::uint32_t n = 0; n < 256; n++)
+    {
+        std::uint8_t byte = n;
+        table[n] = _crcBitwise(&byte, 1, 0xEDB88320, 0);
+    }
+    auto bytewise = [&](const std::uint8_t *data, std::size_t size)
+    {
+        std::uint32_t crc = 0xFFFFFFFF;
+        for (std::size_t i = 0; i < size; i++)
+        {
+            crc = (crc >> 8) ^ table[(crc ^ data[i]) & 0xFF];
+        }
+        return crc ^ 0xFFFFFFFF;
+    };
+
+    const std::size_t sizes[] = {16, MAX_PACKET_SIZE, 4096, 64 * 1024};
+    std::vector<std::uint8_t> data(64 * 1024);
+    for (std::size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = (i * 131) & 0xFF;
+    }
+    volatile std::uint32_t sink = 0;
+
+    std::cout << "bytes | CRC-32 bitwise MB/s | CRC-32 bytewise table MB/s | CRC-32 slicing-by-8 MB/s | CRC-16 slicing-by-8 MB/s | CRC-16 ns/call" << std::endl;
+    for (std::size_t size : sizes)
+    {
+        int iterations = (int)(4 * 1024 * 1024 / size);
+        double bitwiseNs = _benchNanoseconds(iterations / 8 + 1, [&]()
+                                             { sink = sink + _crcBitwise(data.data(), size, 0xEDB88320, 0xFFFFFFFF); });
+        double bytewiseNs = _benchNanoseconds(iterations, [&]()
+                                              { sink = sink + bytewise(data.data(), size); });
+        double crc32Ns = _benchNanoseconds(iterations, [&]()
+                                           { sink = sink + Crc::crc32(data.data(), size); });
+        double crc16Ns = _benchNanoseconds(iterations, [&]()
+                                           { sink = sink + Crc::crc16(data.data(), size); });
+
+        std::cout << size << " | " << size * 1000.0 / bitwiseNs << " | " << size * 1000.0 / bytewiseNs
+                  << " | " << size * 1000.0 / crc32Ns << " | " << size * 1000.0 / crc16Ns
+                  << " | " << crc16Ns << std::endl;
+    }
+}
+
+void bench_dispatch(void)
+{
+    const int subscriberCounts[] = {1, 4, 16};
+    std::vector<std::uint8_t> payload(40, 0x42);
+    MessageView view{1, MessageFlag(MSG_RESPONSE, MSG_CON_DATA_TRANSFER), PayloadView(payload)};
+    volatile std::size_t sink = 0;
+
+    std::cout << "subscribers | view ns/pkt | const Message& ns/pkt | by-value map+Message ns/pkt (before)" << std::endl;
+    for (int subscribers : subscriberCounts)
+    {
+        DispatchTable views, messages;
+        // what the callback maps looked like before, with the map and message copied per packet
+        std::unordered_map<MessageContentType, std::vector<std::function<void(Message)>>> legacy;
+        for (int i = 0; i < subscribers; i++)
+        {
+            views.addView(MSG_RESPONSE, MSG_CON_DATA_TRANSFER, [&](const MessageView &v)
+                          { sink += v.payload.size; });
+            messages.add(MSG_RESPONSE, MSG_CON_DATA_TRANSFER, [&](const Message &msg)
+                         { sink += msg.data.size(); });
+            legacy[MSG_CON_DATA_TRANSFER].push_back([&](Message msg)
+                                                    { sink += msg.data.size(); });
+        }
+
+        int iterations = 200000 / subscribers;
+        double viewNs = _benchNanoseconds(iterations, [&]()
+                                          { views.dispatch(view); });
+        double messageNs = _benchNanoseconds(iterations, [&]()
+                                             { messages.dispatch(view); });
+        double legacyNs = _benchNanoseconds(iterations, [&]()
+                                            {
+            std::unordered_map<MessageContentType, std::vector<std::function<void(Message)>>> callbacks = legacy;
+            Message msg = view.toMessage();
+            for (auto &callback : callbacks[MSG_CON_DATA_TRANSFER])
+            {
+                callback(msg);
+            } });
+
+        std::cout << subscribers << " | " << viewNs << " | " << messageNs << " | " << legacyNs << std::endl;
+    }
+}
+
+void bench_sim_drive_transfer(void)
+{
+    const float lossRates[] = {0.0f, 0.05f, 0.1f, 0.2f};
+    std::string content(4 * 1024, 'x');
+
+    std::cout << "loss | completed | time ms | goodput B/s | packets sent" << std::endl;
+    for (float lossRate : lossRates)
+    {
+        SimulatedChannelConfig config;
+        config.latency = 5;
+        config.lossRate = lossRate;
+        SimulatedNetwork network(config);
+        network.useAsClock();
+
+        SimulatedTransport carRadio(network), pitRadio(network);
+        ComInterface car(carRadio), pit(pitRadio);
+        car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                          { car.sendMessage(MessageBuilder::createDriveMessageResponse(msg.messageID, content)); });
+
+        std::uint32_t completedAt = 0;
+        pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                          { completedAt = network.now(); });
+
+        pit.sendMessage(MessageBuilder::createDriveMessageRequest());
+        for (int step = 0; step < 120 && completedAt == 0; step++)
+        {
+            _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 1000);
+        }
+
+        std::cout << lossRate << " | " << (completedAt != 0) << " | " << completedAt
+                  << " | " << (completedAt ? content.size() * 1000.0 / completedAt : 0.0)
+                  << " | " << network.stats.packetsSent << std::endl;
+    }
+    Clock::setSource(nullptr);
+}
+
+// frames per second over the simulated link, requesting each frame versus a server-push subscription
+void bench_sim_data_stream(void)
+{
+    const int frameSizes[] = {16, 64, 200};
+
+    std::cout << "frame bytes | request/response frames/s | stream frames/s" << std::endl;
+    for (int frameSize : frameSizes)
+    {
+        double rates[2];
+        for (int streaming = 0; streaming < 2; streaming++)
+        {
+            SimulatedChannelConfig config;
+            config.latency = 5;
+            SimulatedNetwork network(config);
+            network.useAsClock();
+
+            SimulatedTransport carRadio(network), pitRadio(network);
+            ComInterface car(carRadio), pit(pitRadio);
+            std::vector<std::uint8_t> frame(frameSize, 0xAB);
+
+            int frames = 0;
+            if (streaming)
+            {
+                car.setDataStreamSource([&]()
+                                        { return frame; });
+                pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DATA_TRANSFER, [&](Message msg)
+                                  { frames++; });
+                pit.subscribe(0);
+            }
+            else
+            {
+                car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_DATA_TRANSFER, [&](Message msg)
+                                  { car.sendMessage(Message(msg.messageID, MSG_RESPONSE, MSG_CON_DATA_TRANSFER, frame), false); });
+                pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DATA_TRANSFER, [&](Message msg)
+                                  { frames++;
+                                    pit.sendMessage(MessageBuilder::createDataTransferRequest()); });
+                pit.sendMessage(MessageBuilder::createDataTransferRequest());
+            }
+
+            _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 10000);
+            rates[streaming] = frames * 1000.0 / network.now();
+        }
+
+        std::cout << frameSize << " | " << rates[0] << " | " << rates[1] << std::endl;
+    }
+    Clock::setSource(nullptr);
+}
+
+// latency of live telemetry, 5 frames/s, while a drive file goes out on the same link at SF7 / 125 kHz
+void bench_sim_telemetry_latency(void)
+{
+    const std::size_t driveSizes[] = {4 * 1024, 16 * 1024, 48 * 1024};
+
+    std::cout << "drive KB | drive s | idle p50 ms | idle p99 ms | transfer frames | transfer p50 ms | transfer p99 ms | transfer max ms | stale frames" << std::endl;
+    for (std::size_t driveSize : driveSizes)
+    {
+        TelemetryRun run = _runTelemetryDuringTransfer(200, driveSize, 120000);
+        std::uint32_t worst = run.transfer.empty() ? 0 : *std::max_element(run.transfer.begin(), run.transfer.end());
+        std::cout << driveSize / 1024 << " | " << run.driveTime / 1000.0
+                  << " | " << _percentile(run.idle, 0.5) << " | " << _percentile(run.idle, 0.99)
+                  << " | " << run.transfer.size() << " | " << _percentile(run.transfer, 0.5)
+                  << " | " << _percentile(run.transfer, 0.99) << " | " << worst << " | " << run.staleDropped << std::endl;
+    }
+}
+
+// airtime of a burst of small request/response exchanges, with and without batching. The
+// overhead models the preamble and radio header of a LoRa packet at SF7 / 125 kHz
+void bench_sim_batching(void)
+{
+    const int bursts[] = {1, 4, 16};
+
+    std::cout << "messages per burst | batching | packets sent | airtime ms | airtime saved" << std::endl;
+    for (int burst : bursts)
+    {
+        std::uint32_t unbatchedAirtime = 0;
+        for (int batching = 0; batching < 2; batching++)
+        {
+            SimulatedChannelConfig config;
+            config.latency = 5;
+            config.packetOverhead = 13;
+            SimulatedNetwork network(config);
+            network.useAsClock();
+
+            SimulatedTransport carRadio(network), pitRadio(network);
+            ComInterface car(carRadio), pit(pitRadio);
+            car.setBatching(batching ? DEFAULT_BATCH_DEADLINE : 0);
+            pit.setBatching(batching ? DEFAULT_BATCH_DEADLINE : 0);
+
+            car.addRXCallback(MessageType::MSG_REQUEST, MessageContentType::MSG_CON_META, [&](Message msg)
+                              { car.sendMessage(MessageBuilder::createMetaMessageResponse(msg.messageID, "schema", 1, 2, 3)); });
+
+            for (int round = 0; round < 100; round++)
+            {
+                for (int i = 0; i < burst; i++)
+                {
+                    pit.sendMessage(MessageBuilder::createMetaMessageRequest());
+                }
+                _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 100);
+            }
+
+            if (!batching)
+            {
+                unbatchedAirtime = network.stats.airtime;
+            }
+            std::cout << burst << " | " << batching << " | " << network.stats.packetsSent << " | " << network.stats.airtime
+                      << " | " << (100.0 - network.stats.airtime * 100.0 / unbatchedAirtime) << "%" << std::endl;
+        }
+    }
+    Clock::setSource(nullptr);
+}
+
+// telemetry rate of a stream going as fast as the link allows, with raw and with delta encoded frames
+void bench_sim_delta_stream(void)
+{
+    const std::size_t keyframeIntervals[] = {0, 5, 20, 50};
+
+    std::cout << "keyframe interval | frames/s | bytes on air per frame | speedup" << std::endl;
+    double rawRate = 0.0;
+    for (std::size_t keyframeInterval : keyframeIntervals)
+    {
+        SimulatedChannelConfig config;
+        config.latency = 5;
+        config.packetOverhead = 13;
+        SimulatedNetwork network(config);
+        network.useAsClock();
+
+        SimulatedTransport carRadio(network), pitRadio(network);
+        ComInterface car(carRadio), pit(pitRadio);
+
+        // the interface's encoder uses DELTA_KEYFRAME_INTERVAL, so encode in the source for other intervals
+        std::uint32_t produced = 0;
+        DeltaEncoder encoder(keyframeInterval);
+        car.setDataStreamSource([&]()
+                                { std::vector<std::uint8_t> frame = _telemetryFrame(produced++);
+                                  return keyframeInterval ? encoder.encode(frame) : frame; });
+
+        int frames = 0;
+        pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DATA_TRANSFER, [&](Message msg)
+                          { frames++; });
+        pit.subscribe(0, 60000);
+
+        _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 10000);
+        double rate = frames * 1000.0 / network.now();
+        if (keyframeInterval == 0)
+        {
+            rawRate = rate;
+        }
+
+        std::cout << keyframeInterval << " | " << rate << " | " << network.stats.bytesSent / (double)network.stats.packetsSent
+                  << " | " << rate / rawRate << "x" << std::endl;
+    }
+    Clock::setSource(nullptr);
+}
+
+// a drive transfer under random loss, plain versus FEC, averaged over seeds. With acks, the selective-repeat
+// ARQ gets every transfer through, and FEC trades its parity for fewer round trips. Without acks, nothing
+// is resent, and FEC decides whether the transfer gets through at all
+void bench_sim_fec(void)
+{
+    const float lossRates[] = {0.0f, 0.05f, 0.1f, 0.2f, 0.3f};
+    const std::pair<int, int> codes[] = {{0, 0}, {8, 1}, {8, 2}, {4, 2}};
+    const int seeds = 10;
+    std::string content(8 * 1024, 'x');
+
+    std::cout << "loss | FEC K+M | acked: mean time ms | acked: mean packets sent | unacked: completed" << std::endl;
+    for (float lossRate : lossRates)
+    {
+        for (const std::pair<int, int> &code : codes)
+        {
+            int completed[2] = {0, 0};
+            double totalTime = 0.0, totalPackets = 0.0;
+            for (int acked = 0; acked < 2; acked++)
+            {
+                for (int seed = 1; seed <= seeds; seed++)
+                {
+                    SimulatedChannelConfig config;
+                    config.latency = 5;
+                    config.lossRate = lossRate;
+                    config.seed = seed;
+                    SimulatedNetwork network(config);
+                    network.useAsClock();
+
+                    SimulatedTransport carRadio(network), pitRadio(network);
+                    ComInterface car(carRadio), pit(pitRadio);
+                    car.setFEC(MessageContentType::MSG_CON_DRIVE, code.first, code.second);
+
+                    std::uint32_t completedAt = 0;
+                    pit.addRXCallback(MessageType::MSG_RESPONSE, MessageContentType::MSG_CON_DRIVE, [&](Message msg)
+                                      { completedAt = network.now(); });
+
+                    car.sendMessage(MessageBuilder::createDriveMessageResponse(1, content), acked);
+                    for (int step = 0; step < 120 && completedAt == 0; step++)
+                    {
+                        _runNetwork(network, {{&car, &carRadio}, {&pit, &pitRadio}}, 1000);
+                    }
+
+                    if (completedAt != 0)
+                    {
+                        completed[acked]++;
+                        if (acked)
+                        {
+                            totalTime += completedAt;
+                            totalPackets += network.stats.packetsSent;
+                        }
+                    }
+                }
+            }
+
+            std::cout << lossRate << " | " << code.first << "+" << code.second
+                      << " | " << (completed[1] ? totalTime / completed[1] : 0.0) << " | " << (completed[1] ? totalPackets / completed[1] : 0.0)
+                      << " | " << completed[0] << "/" << seeds << std::endl;
+        }
+    }
+    Clock::setSource(nullptr);
+}
+
+// telemetry around a lap, see _runLaps(), at fixed data rates and adapting to the link
+void bench_sim_link_adaptation(void)
+{
+    const DataRate rates[] = {{10, 125000}, {9, 125000}, {8, 125000}, {7, 125000}, {7, 500000}};
+
+    std::cout << "data rate | goodput B/s | longest gap ms | switches | reverts" << std::endl;
+    for (int adaptive = 0; adaptive < 2; adaptive++)
+    {
+        for (const DataRate &rate : rates)
+        {
+            if (adaptive && rate != DataRate{7, 125000})
+            {
+                continue;
+            }
+
+            LapRun run = _runLaps(adaptive, rate, 90000, 3);
+            std::string label = adaptive ? "adaptive" : "SF" + std::to_string(rate.spreadingFactor) + " / " + std::to_string(rate.bandwidth / 1000) + " kHz";
+            std::cout << label << " | " << run.bytes * 1000.0 / (90000 * 3) << " | " << run.longestGap << " | " << run.switches << " | " << run.reverts << std::endl;
+        }
+    }
+}
+
+void bench_airtime(void)
+{
+    // how big a frame can be for an update rate, at each data rate and duty cycle
+    const DataRate rates[] = {{12, 125000}, {11, 125000}, {10, 125000}, {9, 125000}, {8, 125000}, {7, 125000}, {7, 250000}, {7, 500000}};
+    const std::size_t sizes[] = {16, 64, 128, MAX_SHORT_MSG_PAYLOAD_SIZE, 1024};
+    const float dutyCycles[] = {0.01f, 0.1f, 0.0f};
+
+    SimulatedNetwork network;
+    SimulatedTransport radio(network);
+    ComInterface com(radio);
+    std::cout << "data rate | frame bytes | time on air ms | max Hz at 1% | max Hz at 10% | max Hz unlimited" << std::endl;
+    for (const DataRate &rate : rates)
+    {
+        com.switchDataRate(rate.spreadingFactor, rate.bandwidth);
+        for (std::size_t size : sizes)
+        {
+            std::cout << "SF" << rate.spreadingFactor << " / " << rate.bandwidth / 1000 << " kHz | " << size << " | " << com.messageAirtime(size) / 1000.0;
+            for (float dutyCycle : dutyCycles)
+            {
+                com.setAirtimeBudget(dutyCycle);
+                std::cout << " | " << com.maxFrameRate(size);
+            }
+            std::cout << std::endl;
+        }
+    }
+
+    LoRaModulation modulation;
+    volatile std::uint32_t sink = 0;
+    double ns = _benchNanoseconds(1000000, [&]()
+                                  { sink = sink + timeOnAir(modulation, sink % MAX_PACKET_SIZE); });
+    std::cout << "timeOnAir() ns/call | " << ns << std::endl;
+}
+
+void bench_link_stats(void)
+{
+    // what the statistics cost per packet, and what a snapshot costs on air
+    LinkStats stats;
+    LoRaModulation modulation;
+    std::uint32_t value = 1;
+    double addNs = _benchNanoseconds(1000000, [&]()
+                                     {
+        value = value * 1103515245 + 12345;
+        stats.responseLatency.add(value >> 20); });
+    double airtimeNs = _benchNanoseconds(1000000, [&]()
+                                         {
+        value = value * 1103515245 + 12345;
+        stats.airtimePerPacket.add(timeOnAir(modulation, value % MAX_PACKET_SIZE)); });
+    for (Histogram *histogram : {&stats.fragmentInterarrival, &stats.reassemblyTime, &stats.retriesPerRequest})
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            value = value * 1103515245 + 12345;
+            histogram->add(value >> 24);
+        }
+    }
+    stats.packetsSent = stats.packetsReceived = 1000000;
+    stats.bytesSent = stats.bytesReceived = 100000000;
+
+    std::vector<std::uint8_t> encoded;
+    double encodeNs = _benchNanoseconds(10000, [&]()
+                                        { encoded = stats.encode(); });
+    LinkStats decoded;
+    double decodeNs = _benchNanoseconds(10000, [&]()
+                                        { LinkStats::decode(encoded.data(), encoded.size(), decoded); });
+
+    std::cout << "histogram add ns | time on air + add ns | encode ns | decode ns | encoded bytes | LinkStats bytes" << std::endl;
+    std::cout << addNs << " | " << airtimeNs << " | " << encodeNs << " | " << decodeNs << " | " << encoded.size() << " | " << sizeof(LinkStats) << std::endl;
+}
+
+// the builder and the parser of meta messages as they were written by hand, before content_layout.hpp
+static Message _handwrittenMetaResponse(std::uint16_t id, std::string schemaName, int major, int minor, int patch)
+{
+    std::vector<std::uint8_t> data;
+    data.push_back(schemaName.size());
+    for (char c : schemaName)
+    {
+        data.push_back(c);
+    }
+    data.push_back(major);
+    data.push_back(minor);
+    data.push_back(patch);
+    return Message(id, MSG_RESPONSE, MSG_CON_META, data);
+}
+
+static ContentResult<MetaContent> _handwrittenParseMeta(const std::vector<std::uint8_t> &data)
+{
+    if (data.size() < 4)
+    {
+        return {false, MetaContent()};
+    }
+
+    std::string schemaName;
+    int schemaNameLength = data[0];
+    for (int i = 1; i <= schemaNameLength; i++)
+    {
+        schemaName.push_back(data[i]);
+    }
+    return {true, MetaContent{schemaName, data[schemaNameLength + 1], data[schemaNameLength + 2], data[schemaNameLength + 3]}};
+}
+
+static Message _handwrittenDataRateSwitchRequest(DataRateSwitchPhase phase, int spreadingFactor, long bandwidth)
+{
+    std::vector<std::uint8_t> payload;
+    payload.push_back(phase);
+    payload.push_back(spreadingFactor);
+    payload.push_back((bandwidth >> 24) & 0xFF);
+    payload.push_back((bandwidth >> 16) & 0xFF);
+    payload.push_back((bandwidth >> 8) & 0xFF);
+    payload.push_back(bandwidth & 0xFF);
+    return Message(MSG_REQUEST, MSG_CON_SWITCH_DATA_RATE, payload);
+}
+
+static ContentResult<DataRateSwitchContent> _handwrittenParseDataRateSwitch(const std::vector<std::uint8_t> &data)
+{
+    if (data.size() < 6 || (data[0] != SWITCH_PROPOSE && data[0] != SWITCH_COMMIT))
+    {
+        return {false, DataRateSwitchContent()};
+    }
+
+    long bandwidth = ((long)data[2] << 24) | ((long)data[3] << 16) | (data[4] << 8) | data[5];
+    return {true, DataRateSwitchContent{(DataRateSwitchPhase)data[0], data[1], bandwidth}};
+}
+
+void bench_codecs(void)
+{
+    // the generated codecs against the hand-written builders and parsers they replaced
+    const int iterations = 200000;
+    std::string name = "nfr25-telemetry-schema";
+    Message meta = MessageBuilder::createMetaMessageResponse(1, name, 1, 2, 3);
+    Message rate = MessageBuilder::createDataRateSwitchRequest(SWITCH_PROPOSE, 9, 250000);
+    TEST_ASSERT_TRUE(meta.data == _handwrittenMetaResponse(1, name, 1, 2, 3).data);
+    TEST_ASSERT_TRUE(rate.data == _handwrittenDataRateSwitchRequest(SWITCH_PROPOSE, 9, 250000).data);
+
+    std::cout << "codec | hand-written ns | allocs | generated ns | allocs" << std::endl;
+    auto row = [&](const char *label, auto handwritten, auto generated)
+    {
+        std::size_t allocationsBefore = g_allocationCount;
+        double handwrittenNs = _benchNanoseconds(iterations, handwritten);
+        double handwrittenAllocs = (double)(g_allocationCount - allocationsBefore) / iterations;
+        allocationsBefore = g_allocationCount;
+        double generatedNs = _benchNanoseconds(iterations, generated);
+        double generatedAllocs = (double)(g_allocationCount - allocationsBefore) / iterations;
+        std::cout << label << " | " << handwrittenNs << " | " << handwrittenAllocs << " | " << generatedNs << " | " << generatedAllocs << std::endl;
+    };
+
+    row("meta build", [&]()
+        { volatile std::size_t n = _handwrittenMetaResponse(1, name, 1, 2, 3).data.size(); (void)n; },
+        [&]()
+        { volatile std::size_t n = MessageBuilder::createMetaMessageResponse(1, name, 1, 2, 3).data.size(); (void)n; });
+    row("meta parse", [&]()
+        { volatile bool ok = _handwrittenParseMeta(meta.data).success; (void)ok; },
+        [&]()
+        { volatile bool ok = MessageParser::parseMetaContent(meta.data).success; (void)ok; });
+    row("rate switch build", [&]()
+        { volatile std::size_t n = _handwrittenDataRateSwitchRequest(SWITCH_PROPOSE, 9, 250000).data.size(); (void)n; },
+        [&]()
+        { volatile std::size_t n = MessageBuilder::createDataRateSwitchRequest(SWITCH_PROPOSE, 9, 250000).data.size(); (void)n; });
+    row("rate switch parse", [&]()
+        { volatile bool ok = _handwrittenParseDataRateSwitch(rate.data).success; (void)ok; },
+        [&]()
+        { volatile bool ok = MessageParser::parseDataRateSwitchContent(rate.data).success; (void)ok; });
+
+    // what the layouts can do that the builders could not: encode into a packet, and decode from a view
+    PacketBuffer packet;
+    DataRateSwitchContent content{SWITCH_PROPOSE, 9, 250000};
+    row("rate switch, into a packet / from a view", [&]()
+        { volatile std::size_t n = _handwrittenDataRateSwitchRequest(SWITCH_PROPOSE, 9, 250000).encodePacket(0, packet); (void)n; },
+        [&]()
+        { volatile std::size_t n = ContentCodec<DataRateSwitchContent>::encode(content, packet.data, sizeof(packet.data));
+          volatile bool ok = ContentCodec<DataRateSwitchContent>::decode(PayloadView(packet.data, n)).success; (void)ok; });
+}
+
+#pragma endregion
+#endif
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    std::cout << "*** RUNNING TESTS ***" << std::endl;
+    // run tests
+    RUN_TEST(test_message_flag);
+    RUN_TEST(test_meta_message);
+    RUN_TEST(test_meta_message_request);
+    RUN_TEST(test_drive_message);
+    RUN_TEST(test_drive_message_request);
+    RUN_TEST(test_long_message);
+    RUN_TEST(test_encode_into);
+    RUN_TEST(test_encode_into_ring);
+    RUN_TEST(test_packet_view);
+    RUN_TEST(test_packet_view_rejects_malformed);
+    RUN_TEST(test_reassembly_buffer);
+    RUN_TEST(test_delta_codec);
+    RUN_TEST(test_lz_codec);
+    RUN_TEST(test_fec);
+    RUN_TEST(test_message_source);
+    RUN_TEST(test_extended_message);
+    RUN_TEST(test_typed_message);
+    RUN_TEST(test_content_layout);
+    RUN_TEST(test_crc);
+    RUN_TEST(test_checked_message);
+    RUN_TEST(test_dispatch_table);
+    RUN_TEST(test_log_sink);
+    RUN_TEST(test_sim_request_response);
+    RUN_TEST(test_sim_lossy_drive_transfer);
+    RUN_TEST(test_sim_selective_repeat);
+    RUN_TEST(test_sim_duplicate_ack_mid_window);
+    RUN_TEST(test_sim_reused_message_id);
+    RUN_TEST(test_sim_reassembly_timeout);
+    RUN_TEST(test_sim_event_mode);
+    RUN_TEST(test_sim_data_stream);
+    RUN_TEST(test_sim_delta_stream);
+    RUN_TEST(test_sim_compressed_drive);
+    RUN_TEST(test_sim_fec_drive_transfer);
+    RUN_TEST(test_sim_integrity_check);
+    RUN_TEST(test_sim_large_transfer);
+    RUN_TEST(test_sim_source_transfer);
+    RUN_TEST(test_sim_telemetry_priority);
+    RUN_TEST(test_sim_batching);
+    RUN_TEST(test_sim_concurrent_senders);
+    RUN_TEST(test_sim_adaptive_timeout);
+    RUN_TEST(test_retry_time_budget);
+    RUN_TEST(test_sim_data_rate_mismatch);
+    RUN_TEST(test_link_adaptation);
+    RUN_TEST(test_data_rate_switch_message);
+    RUN_TEST(test_sim_link_adaptation);
+    RUN_TEST(test_sim_link_adaptation_lap);
+    RUN_TEST(test_link_stats);
+    RUN_TEST(test_sim_link_stats);
+    RUN_TEST(test_sim_content_types);
+    RUN_TEST(test_airtime_budget);
+    RUN_TEST(test_sim_airtime_budget);
+    RUN_TEST(test_airtime_refusal_counts_protection);
+
+#if defined(WIRCOM_BENCHMARK)
+    RUN_TEST(bench_encode);
+    RUN_TEST(bench_decode);
+    RUN_TEST(bench_reassembly);
+    RUN_TEST(bench_lz);
+    RUN_TEST(bench_crc);
+    RUN_TEST(bench_dispatch);
+    RUN_TEST(bench_sim_drive_transfer);
+    RUN_TEST(bench_sim_fec);
+    RUN_TEST(bench_sim_data_stream);
+    RUN_TEST(bench_sim_telemetry_latency);
+    RUN_TEST(bench_sim_batching);
+    RUN_TEST(bench_sim_delta_stream);
+    RUN_TEST(bench_sim_link_adaptation);
+    RUN_TEST(bench_link_stats);
+    RUN_TEST(bench_codecs);
+    RUN_TEST(bench_airtime);
+#endif
 
     std::cout << "*** FINISHED RUNNING TESTS ***" << std::endl;
     return UNITY_END();